@@ -0,0 +1,199 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstdio>
+#include <new>
+#include <vector>
+#include <atomic>
+#include <utility>
+#include <algorithm>
+
+// --------------------------------------------------------------------------
+// Memory for per-frame temporaries and pooled objects
+//
+// A frame arena hands out memory by bumping a pointer and is reset as a whole
+// once per frame, so per-frame temporaries never touch the heap. Block pools
+// keep fixed-size blocks on a free list and only grow by whole chunks, so
+// objects that come and go at a steady rate stop allocating once the pool
+// has reached its working size. Neither is synchronized; each arena or pool
+// belongs to one thread or is guarded by its owner.
+//
+// Heap use is counted by replacing the global operator new/delete (done once,
+// in main.cpp). This covers every C++ container; C allocations made by the
+// driver or by stb_image are not seen.
+
+struct MyFrameArena
+{
+	unsigned char *base;
+	size_t capacity;
+	size_t used;
+	size_t peak;		// highest use at any reset
+	size_t failures;	// requests that did not fit
+
+	MyFrameArena() : base(0), capacity(0), used(0), peak(0), failures(0)
+	{}
+};
+
+inline bool InitializeArena(MyFrameArena *arena, size_t bytes)
+{
+	arena->base = (unsigned char *)malloc(bytes);
+	arena->capacity = arena->base ? bytes : 0;
+	arena->used = 0;
+	return arena->base != 0;
+}
+
+inline void DestroyArena(MyFrameArena *arena)
+{
+	free(arena->base);
+	arena->base = 0;
+	arena->capacity = arena->used = 0;
+}
+
+// returns uninitialized memory valid until the next reset, or null if the
+// arena is full
+inline void *ArenaAlloc(MyFrameArena *arena, size_t bytes, size_t align = 16)
+{
+	size_t start = (arena->used + align - 1) & ~(align - 1);
+	if (start + bytes > arena->capacity) {
+		arena->failures++;
+		return 0;
+	}
+	arena->used = start + bytes;
+	return arena->base + start;
+}
+
+// array of count default-constructed objects, which must not need destruction
+template <typename T>
+inline T *ArenaArray(MyFrameArena *arena, size_t count)
+{
+	T *items = (T *)ArenaAlloc(arena, count * sizeof(T), alignof(T));
+	if (items)
+		for (size_t k = 0; k < count; k++) new (items + k) T();
+	return items;
+}
+
+// releases everything allocated since the last reset
+inline void ResetArena(MyFrameArena *arena)
+{
+	if (arena->used > arena->peak) arena->peak = arena->used;
+	arena->used = 0;
+}
+
+struct MyBlockPool
+{
+	size_t blockSize;
+	size_t blocksPerChunk;
+	std::vector<unsigned char *> chunks;
+	void *freeList;		// each free block starts with the next free block
+	size_t used;		// blocks handed out
+
+	MyBlockPool() : blockSize(0), blocksPerChunk(0), freeList(0), used(0)
+	{}
+};
+
+inline void InitializePool(MyBlockPool *pool, size_t blockSize, size_t blocksPerChunk = 256)
+{
+	const size_t align = alignof(std::max_align_t);
+	pool->blockSize = (std::max(blockSize, sizeof(void *)) + align - 1) & ~(align - 1);
+	pool->blocksPerChunk = blocksPerChunk;
+}
+
+inline void DestroyPool(MyBlockPool *pool)
+{
+	for (unsigned char *chunk : pool->chunks) free(chunk);
+	pool->chunks.clear();
+	pool->freeList = 0;
+	pool->used = 0;
+}
+
+// returns an uninitialized block, growing the pool by a chunk when empty
+inline void *PoolAlloc(MyBlockPool *pool)
+{
+	if (!pool->freeList) {
+		unsigned char *chunk = (unsigned char *)malloc(pool->blockSize * pool->blocksPerChunk);
+		if (!chunk) throw std::bad_alloc();
+		pool->chunks.push_back(chunk);
+		for (size_t k = pool->blocksPerChunk; k-- > 0;) {
+			void *block = chunk + k * pool->blockSize;
+			*(void **)block = pool->freeList;
+			pool->freeList = block;
+		}
+	}
+	void *block = pool->freeList;
+	pool->freeList = *(void **)block;
+	pool->used++;
+	return block;
+}
+
+inline void PoolFree(MyBlockPool *pool, void *block)
+{
+	*(void **)block = pool->freeList;
+	pool->freeList = block;
+	pool->used--;
+}
+
+template <typename T, typename... Args>
+inline T *PoolNew(MyBlockPool *pool, Args &&... args)
+{
+	return new (PoolAlloc(pool)) T(std::forward<Args>(args)...);
+}
+
+template <typename T>
+inline void PoolDelete(MyBlockPool *pool, T *object)
+{
+	object->~T();
+	PoolFree(pool, object);
+}
+
+// --------------------------------------------------------------------------
+// Heap allocation counters
+
+struct MyAllocationCounters
+{
+	std::atomic<long long> allocations;
+	std::atomic<long long> frees;
+	std::atomic<long long> bytes;
+};
+
+inline MyAllocationCounters &AllocationCounters()
+{
+	static MyAllocationCounters counters;
+	return counters;
+}
+
+// allocations made by the calling thread
+inline long long &ThreadAllocations()
+{
+	thread_local long long allocations = 0;
+	return allocations;
+}
+
+// while set, any allocation on the calling thread aborts the program
+inline bool &AllocationTrap()
+{
+	thread_local bool armed = false;
+	return armed;
+}
+
+// called by the replaced operator new
+inline void CountAllocation(size_t size)
+{
+	MyAllocationCounters &counters = AllocationCounters();
+	counters.allocations.fetch_add(1, std::memory_order_relaxed);
+	counters.bytes.fetch_add((long long)size, std::memory_order_relaxed);
+	ThreadAllocations()++;
+	if (AllocationTrap()) {
+		// stdio only, as iostreams may allocate
+		fprintf(stderr, "ERROR: unexpected heap allocation of %zu bytes during a frame\n", size);
+		abort();
+	}
+}
+
+inline void CountFree()
+{
+	AllocationCounters().frees.fetch_add(1, std::memory_order_relaxed);
+}
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <mutex>
+
+// --------------------------------------------------------------------------
+// Benchmark mode: runs a fixed number of frames for each registered variant
+// (e.g. CPU vs GPU propagation) and prints frame time statistics per variant.
+// Subsystems can add named section timings to the current variant, from any
+// thread. The names are string literals kept by pointer in fixed tables, so
+// recording never allocates, even with the allocation trap armed.
+
+const int benchmarkEntries = 64;	// per table; further names are dropped
+
+struct MyBenchEntry
+{
+	const char *name;
+	double value;		// ms, items or events
+	double ms;			// throughput only
+};
+
+struct MyBenchTable
+{
+	MyBenchEntry entries[benchmarkEntries];
+	int count;
+
+	MyBenchTable() : count(0)
+	{}
+};
+
+struct MyBenchVariant
+{
+	std::string name;
+	std::function<void()> apply;	// switches the renderer into this variant
+};
+
+struct MyBenchmark
+{
+	std::vector<MyBenchVariant> variants;
+	int framesPerVariant;
+	int warmupFrames;
+	int variant;
+	int frame;
+
+	// samples for the current variant
+	std::vector<double> frameMs;
+	MyBenchTable sections;
+	MyBenchTable throughput;
+	MyBenchTable counts;
+	std::mutex lock;	// guards sections, throughput and counts
+
+	MyBenchmark() : framesPerVariant(0), warmupFrames(30), variant(-1), frame(0)
+	{}
+};
+
+inline bool BenchmarkActive(const MyBenchmark *bench)
+{
+	return bench->framesPerVariant > 0 && bench->variant < (int)bench->variants.size();
+}
+
+inline void AddBenchmarkVariant(MyBenchmark *bench, const std::string &name, std::function<void()> apply)
+{
+	MyBenchVariant v;
+	v.name = name;
+	v.apply = apply;
+	bench->variants.push_back(v);
+}
+
+// finds or adds the entry of a name, or returns 0 when the table is full;
+// the same literal may have different addresses in different files
+inline MyBenchEntry *BenchmarkEntry(MyBenchTable *table, const char *name)
+{
+	for (int k = 0; k < table->count; k++)
+		if (table->entries[k].name == name || !strcmp(table->entries[k].name, name))
+			return &table->entries[k];
+	if (table->count == benchmarkEntries) return 0;
+	MyBenchEntry *e = &table->entries[table->count++];
+	e->name = name;
+	e->value = 0.0;
+	e->ms = 0.0;
+	return e;
+}
+
+// records time spent in a named section during the current frame
+inline void BenchmarkSection(MyBenchmark *bench, const char *name, double ms)
+{
+	if (!BenchmarkActive(bench) || bench->frame < bench->warmupFrames) return;
+	std::lock_guard<std::mutex> guard(bench->lock);
+	if (MyBenchEntry *e = BenchmarkEntry(&bench->sections, name)) e->value += ms;
+}
+
+// records a number of items processed in a given time during the current frame
+inline void BenchmarkThroughput(MyBenchmark *bench, const char *name, double items, double ms)
+{
+	if (!BenchmarkActive(bench) || bench->frame < bench->warmupFrames) return;
+	std::lock_guard<std::mutex> guard(bench->lock);
+	if (MyBenchEntry *e = BenchmarkEntry(&bench->throughput, name)) {
+		e->value += items;
+		e->ms += ms;
+	}
+}
+
+// records a number of events (e.g. allocations) during the current frame
+inline void BenchmarkCount(MyBenchmark *bench, const char *name, double count)
+{
+	if (!BenchmarkActive(bench) || bench->frame < bench->warmupFrames) return;
+	std::lock_guard<std::mutex> guard(bench->lock);
+	if (MyBenchEntry *e = BenchmarkEntry(&bench->counts, name)) e->value += count;
+}
+
+// a table's entries in order of name, as printed
+inline std::vector<const MyBenchEntry *> SortedBenchEntries(const MyBenchTable &table)
+{
+	std::vector<const MyBenchEntry *> sorted;
+	for (int k = 0; k < table.count; k++) sorted.push_back(&table.entries[k]);
+	std::sort(sorted.begin(), sorted.end(),
+		[](const MyBenchEntry *a, const MyBenchEntry *b) { return strcmp(a->name, b->name) < 0; });
+	return sorted;
+}
+
+// prints statistics for the variant that just finished
+inline void PrintBenchmarkVariant(const MyBenchmark *bench)
+{
+	std::vector<double> sorted = bench->frameMs;
+	std::sort(sorted.begin(), sorted.end());
+	double total = 0.0;
+	for (double ms : sorted) total += ms;
+	int n = (int)sorted.size();
+	if (n == 0) return;
+
+	std::cout << std::fixed << std::setprecision(3)
+		<< "BENCH " << std::left << std::setw(20) << bench->variants[bench->variant].name << std::right
+		<< " frames " << n
+		<< "  avg " << total / n << " ms"
+		<< "  median " << sorted[n / 2] << " ms"
+		<< "  min " << sorted.front() << " ms"
+		<< "  max " << sorted.back() << " ms"
+		<< "  (" << 1000.0 * n / total << " fps)" << std::endl;
+
+	for (const MyBenchEntry *s : SortedBenchEntries(bench->sections))
+		std::cout << "      " << std::left << std::setw(26) << s->name << std::right
+			<< s->value / n << " ms/frame" << std::endl;
+
+	for (const MyBenchEntry *t : SortedBenchEntries(bench->throughput))
+		std::cout << "      " << std::left << std::setw(26) << t->name << std::right
+			<< std::setprecision(0) << 1000.0 * t->value / t->ms << " items/s"
+			<< std::setprecision(3) << std::endl;
+
+	for (const MyBenchEntry *c : SortedBenchEntries(bench->counts))
+		std::cout << "      " << std::left << std::setw(26) << c->name << std::right
+			<< c->value / n << " per frame" << std::endl;
+}
+
+// call once per frame with the previous frame's duration; returns false once
+// every variant has been measured
+inline bool BenchmarkFrame(MyBenchmark *bench, double ms)
+{
+	if (bench->framesPerVariant <= 0) return true;
+
+	if (bench->variant >= 0 && bench->frame >= bench->warmupFrames)
+		bench->frameMs.push_back(ms);
+
+	// advance to the next variant
+	if (bench->variant < 0 || ++bench->frame >= bench->warmupFrames + bench->framesPerVariant) {
+		if (bench->variant >= 0) PrintBenchmarkVariant(bench);
+		bench->variant++;
+		bench->frame = 0;
+		bench->frameMs.clear();
+		bench->sections.count = 0;
+		bench->throughput.count = 0;
+		bench->counts.count = 0;
+		if (bench->variant >= (int)bench->variants.size()) return false;
+		bench->frameMs.reserve(bench->framesPerVariant);
+		if (bench->variants[bench->variant].apply) bench->variants[bench->variant].apply();
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,270 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <atomic>
+#include <iostream>
+
+// OpenGL core profile, as set up by main.cpp
+#ifndef LAB_LINUX
+#include <glad/glad.h>
+#else
+#define GLFW_INCLUDE_GLCOREARB
+#define GL_GLEXT_PROTOTYPES
+#endif
+#include <GLFW/glfw3.h>
+
+#include "jobs.h"
+#include "arena.h"
+#include "framering.h"
+
+// --------------------------------------------------------------------------
+// Asynchronous frame capture
+//
+// Screenshots (key P) and recordings (key V or --record) read the window's
+// back buffer into a ring of pixel pack buffers. glReadPixels into a pack
+// buffer returns without waiting for the GPU. The copy is fenced, and its
+// buffer is only mapped on a later frame once the fence has signalled, so
+// the render thread never stalls on a readback. The pixels are copied out
+// of the mapping into the slot's own memory and encoded to PNG or raw RGBA
+// on the job pool. A slot stays busy until its encoding is done. A frame
+// that finds the next slot busy is dropped and counted rather than waited
+// for.
+//
+// With --shm-output every frame is also streamed to an external encoder
+// through a shared-memory ring (see framering.h and frameconsumer.cpp). The
+// mapped pixels are copied straight into the ring's next free slot, which
+// the consumer reads in place.
+//
+// main.cpp includes this file after stb_image_write, the job pool and the
+// state cache (glState and BindFramebuffer), which count and issue the
+// readback calls.
+
+const int captureSlots = 4;
+
+enum CaptureFormat { CAPTURE_PNG, CAPTURE_RAW, CAPTURE_FORMATS };
+const char *captureFormatNames[CAPTURE_FORMATS] = { "png", "raw" };
+
+struct MyCaptureSlot
+{
+	GLuint  buffer;			// pixel pack buffer
+	GLsizeiptr bytes;		// its size
+	GLsync  fence;			// of the readback, 0 once mapped
+	int     width;
+	int     height;
+	long long frame;		// recording frame number, -1 if not recorded
+	long long screenshot;	// screenshot number, -1 if none
+	bool    stream;			// to the shared-memory ring
+	double  time;			// of the readback
+	std::vector<unsigned char> pixels;	// read by the encoder
+	MyJobCounter encoded;
+
+	// initialize object names to zero (OpenGL reserved value)
+	MyCaptureSlot() : buffer(0), bytes(0), fence(0), width(0), height(0), frame(-1), screenshot(-1),
+		stream(false), time(0.0)
+	{}
+};
+
+struct MyFrameCapture
+{
+	MyCaptureSlot slots[captureSlots];
+	int     next;				// slot of the next readback
+	const char *prefix;			// of the file names
+	int     format;				// CaptureFormat of recorded frames
+	bool    recording;
+	bool    lossless;			// wait for a busy slot instead of dropping the frame
+	bool    screenshotRequested;
+	long long frames;			// frames recorded
+	long long screenshots;
+	long long dropped;			// frames of a recording or stream that found no free slot
+	std::atomic<long long> written;	// files written by the encoders
+	std::atomic<long long> failed;
+
+	// shared-memory output
+	const char *sinkName;		// none by default
+	int     sinkSlots;
+	MyFrameRing sink;
+	long long streamed;			// frames placed in the ring
+
+	MyFrameCapture() : next(0), prefix("capture"), format(CAPTURE_PNG), recording(false),
+		lossless(false), screenshotRequested(false), frames(0), screenshots(0), dropped(0), written(0), failed(0),
+		sinkName(0), sinkSlots(4), streamed(0)
+	{}
+};
+
+MyFrameCapture frameCapture;
+
+// creates the pixel buffers and, if asked for, a shared-memory ring sized
+// for frames of the given size
+inline bool InitializeFrameCapture(MyFrameCapture *capture, int width, int height)
+{
+	for (int k = 0; k < captureSlots; k++)
+		glGenBuffers(1, &capture->slots[k].buffer);
+	if (capture->sinkName) {
+		if (CreateFrameRing(&capture->sink, capture->sinkName, capture->sinkSlots, uint32_t(width) * height * 4))
+			std::cout << "Streaming frames to shared memory " << capture->sink.name << " (" << capture->sinkSlots
+				<< " slots of " << width << "x" << height << ")" << std::endl;
+		else std::cout << "ERROR: Could not create shared memory /" << capture->sinkName << std::endl;
+	}
+	return !CheckGLErrors();
+}
+
+// places a mapped readback in the shared-memory ring, if it has a free slot
+inline void StreamCapture(MyFrameCapture *capture, const MyCaptureSlot *slot, const void *pixels)
+{
+	MyFrameSlotHeader *frame = BeginFrameRingWrite(&capture->sink, uint32_t(slot->bytes));
+	if (!frame) return;
+	frame->frame = capture->streamed++;
+	frame->time = slot->time;
+	frame->width = slot->width;
+	frame->height = slot->height;
+	frame->stride = slot->width * 4;
+	frame->format = FRAME_RING_RGBA8_BOTTOM_UP;
+	memcpy(FrameRingPixels(frame), pixels, slot->bytes);
+	EndFrameRingWrite(&capture->sink);
+}
+
+// writes a slot's pixels on a job thread; OpenGL rows run bottom up
+inline void EncodeCapture(MyFrameCapture *capture, MyCaptureSlot *slot)
+{
+	int stride = slot->width * 4;
+	unsigned char *pixels = slot->pixels.data();
+	for (int k = 3; k < stride * slot->height; k += 4)
+		pixels[k] = 255;
+	const unsigned char *top = pixels + (slot->height - 1) * stride;
+
+	char name[512];
+	bool ok = true;
+	if (slot->screenshot >= 0) {
+		snprintf(name, sizeof(name), "%s_screenshot_%04lld.png", capture->prefix, slot->screenshot);
+		ok = stbi_write_png(name, slot->width, slot->height, 4, top, -stride) != 0;
+		if (ok) std::cout << "Saved " << name << std::endl;
+	}
+	if (slot->frame >= 0) {
+		if (capture->format == CAPTURE_PNG) {
+			snprintf(name, sizeof(name), "%s_%06lld.png", capture->prefix, slot->frame);
+			ok = stbi_write_png(name, slot->width, slot->height, 4, top, -stride) != 0 && ok;
+		}
+		else {
+			snprintf(name, sizeof(name), "%s_%06lld.rgba", capture->prefix, slot->frame);
+			FILE *file = fopen(name, "wb");
+			bool written = file != 0;
+			for (int y = 0; file && y < slot->height; y++)
+				written = fwrite(top - y * stride, 1, stride, file) == size_t(stride) && written;
+			ok = file && fclose(file) == 0 && written && ok;
+		}
+	}
+	if (ok) capture->written++;
+	else capture->failed++;
+}
+
+// maps the readbacks whose fences have signalled and queues their encoding
+inline void CollectCaptures(MyFrameCapture *capture)
+{
+	for (int k = 0; k < captureSlots; k++) {
+		MyCaptureSlot *slot = &capture->slots[k];
+		if (!slot->fence || glClientWaitSync(slot->fence, 0, 0) == GL_TIMEOUT_EXPIRED) continue;
+		glDeleteSync(slot->fence);
+		slot->fence = 0;
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+		void *data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, slot->bytes, GL_MAP_READ_BIT);
+		if (data) {
+			if (slot->stream) StreamCapture(capture, slot, data);
+			bool encode = slot->frame >= 0 || slot->screenshot >= 0;
+			if (encode) memcpy(slot->pixels.data(), data, slot->bytes);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			if (encode) PushJob(&jobs, [capture, slot] { EncodeCapture(capture, slot); }, &slot->encoded);
+		}
+		else capture->failed++;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glState.frame.issued[GLCALL_BUFFER] += 4;
+	}
+}
+
+// collects earlier readbacks and, if this frame is wanted, starts reading
+// back the window; call after the frame is complete, before the swap
+inline void CaptureFrame(MyFrameCapture *capture, int width, int height)
+{
+	CollectCaptures(capture);
+	bool stream = capture->sink.header != 0;
+	if (!capture->recording && !capture->screenshotRequested && !stream) return;
+
+	MyCaptureSlot *slot = &capture->slots[capture->next];
+	if ((slot->fence || slot->encoded.pending > 0) && capture->lossless) {
+		// offline rendering keeps every frame, however long it takes
+		if (slot->fence) glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+		CollectCaptures(capture);
+		WaitJobs(&jobs, &slot->encoded);
+	}
+	if (slot->fence || slot->encoded.pending > 0) {
+		// a screenshot waits for the next frame instead
+		if (capture->recording || stream) capture->dropped++;
+		return;
+	}
+	capture->next = (capture->next + 1) % captureSlots;
+
+	GLsizeiptr bytes = GLsizeiptr(width) * height * 4;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+	if (slot->bytes != bytes) {
+		// only the first capture at a window size allocates
+		bool trap = AllocationTrap();
+		AllocationTrap() = false;
+		slot->pixels.resize(bytes);
+		AllocationTrap() = trap;
+		glBufferData(GL_PIXEL_PACK_BUFFER, bytes, 0, GL_STREAM_READ);
+		slot->bytes = bytes;
+	}
+	BindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glState.frame.issued[GLCALL_BUFFER] += 3;
+
+	slot->width = width;
+	slot->height = height;
+	slot->frame = capture->recording ? capture->frames++ : -1;
+	slot->screenshot = capture->screenshotRequested ? capture->screenshots++ : -1;
+	slot->stream = stream;
+	slot->time = glfwGetTime();
+	capture->screenshotRequested = false;
+}
+
+// prints what a recording captured, wrote and dropped so far
+inline void ReportCapture(const MyFrameCapture *capture)
+{
+	std::cout << "Recorded " << capture->frames << " frames as " << capture->prefix << "_*."
+		<< (capture->format == CAPTURE_PNG ? "png" : "rgba") << ": " << capture->dropped << " dropped, "
+		<< capture->written << " files written, " << capture->failed << " failed" << std::endl;
+}
+
+inline void ToggleRecording(MyFrameCapture *capture)
+{
+	capture->recording = !capture->recording;
+	if (capture->recording) std::cout << "Recording frames (" << captureFormatNames[capture->format] << ")" << std::endl;
+	else ReportCapture(capture);
+}
+
+// finishes the readbacks and encodings in flight, then deletes the buffers
+inline void DestroyFrameCapture(MyFrameCapture *capture)
+{
+	for (int k = 0; k < captureSlots; k++)
+		if (capture->slots[k].fence)
+			glClientWaitSync(capture->slots[k].fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+	CollectCaptures(capture);
+	for (int k = 0; k < captureSlots; k++) {
+		WaitJobs(&jobs, &capture->slots[k].encoded);
+		glDeleteBuffers(1, &capture->slots[k].buffer);
+	}
+	if (capture->frames > 0) ReportCapture(capture);
+	if (capture->sink.header) {
+		std::cout << "Streamed " << capture->streamed << " frames to " << capture->sink.name << ", "
+			<< capture->dropped << " dropped waiting for readback and " << capture->sink.header->dropped
+			<< " by the consumer" << std::endl;
+		CloseFrameRing(&capture->sink);
+	}
+}
+
+#endif
@@ -0,0 +1,262 @@
+#ifndef CHEBYSHEV_H
+#define CHEBYSHEV_H
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <glm/glm.hpp>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN 1
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// --------------------------------------------------------------------------
+// Chebyshev-segment ephemeris files, in the spirit of the JPL DE files
+//
+// Every body's trajectory is cut into equal segments and each coordinate of
+// a segment is fitted with a Chebyshev polynomial. The file is laid out so it
+// can be memory-mapped and used in place:
+//
+//   MyChebHeader
+//   MyChebBody[bodyCount]
+//   coefficients (double): for each body, for each segment, x[n] y[n] z[n]
+//
+// Finding the segment for a date is a division, and evaluating position and
+// velocity is a short recurrence over the coefficients.
+
+const char chebMagic[8] = { 'S', 'S', 'C', 'H', 'E', 'B', '0', '1' };
+
+struct MyChebHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t bodyCount;
+	double startJD;
+	double endJD;
+};
+
+struct MyChebBody
+{
+	char name[16];
+	int32_t centre;			// index of the body positions are relative to, -1 = Sun
+	uint32_t coefficients;	// per coordinate and segment
+	uint32_t segmentCount;
+	uint32_t reserved;
+	double segmentDays;
+	uint64_t offset;		// byte offset of the first segment from the file start
+};
+
+struct MyChebFile
+{
+	const unsigned char *data;
+	size_t size;
+	const MyChebHeader *header;
+	const MyChebBody *bodies;
+#ifdef _WIN32
+	HANDLE file, mapping;
+#endif
+
+	MyChebFile() : data(0), size(0), header(0), bodies(0)
+#ifdef _WIN32
+		, file(INVALID_HANDLE_VALUE), mapping(0)
+#endif
+	{}
+};
+
+// description of a body to fit: position in km as a function of Julian date
+struct MyChebSource
+{
+	std::string name;
+	int centre;
+	int coefficients;
+	double segmentDays;
+	std::function<glm::dvec3(double)> position;
+};
+
+// fits coefficients for one segment by sampling at the Chebyshev nodes
+inline void FitChebSegment(const MyChebSource &source, double start, double days, double *out)
+{
+	const double pi = 3.14159265358979323846;
+	int n = source.coefficients;
+	std::vector<glm::dvec3> samples(n);
+	for (int k = 0; k < n; k++) {
+		double x = cos(pi * (k + 0.5) / n);
+		samples[k] = source.position(start + 0.5 * days * (x + 1.0));
+	}
+
+	for (int j = 0; j < n; j++) {
+		glm::dvec3 c(0.0);
+		for (int k = 0; k < n; k++)
+			c += samples[k] * cos(pi * j * (k + 0.5) / n);
+		c *= (j == 0 ? 1.0 : 2.0) / n;
+		out[j] = c.x;
+		out[n + j] = c.y;
+		out[2 * n + j] = c.z;
+	}
+}
+
+// fits every source over [startJD, endJD) and writes the file, returning
+// true if successful
+inline bool WriteChebFile(const char *filename, const std::vector<MyChebSource> &sources,
+	double startJD, double endJD)
+{
+	FILE *file = fopen(filename, "wb");
+	if (!file) return false;
+
+	MyChebHeader header;
+	memcpy(header.magic, chebMagic, sizeof(header.magic));
+	header.version = 1;
+	header.bodyCount = (uint32_t)sources.size();
+	header.startJD = startJD;
+	header.endJD = endJD;
+
+	std::vector<MyChebBody> bodies(sources.size());
+	uint64_t offset = sizeof(MyChebHeader) + bodies.size() * sizeof(MyChebBody);
+	for (size_t b = 0; b < sources.size(); b++) {
+		MyChebBody &body = bodies[b];
+		memset(&body, 0, sizeof(body));
+		strncpy(body.name, sources[b].name.c_str(), sizeof(body.name) - 1);
+		body.centre = sources[b].centre;
+		body.coefficients = sources[b].coefficients;
+		body.segmentDays = sources[b].segmentDays;
+		body.segmentCount = (uint32_t)ceil((endJD - startJD) / body.segmentDays);
+		body.offset = offset;
+		offset += (uint64_t)body.segmentCount * 3 * body.coefficients * sizeof(double);
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(bodies.data(), sizeof(MyChebBody), bodies.size(), file) == bodies.size();
+
+	// segments are fitted and streamed one at a time
+	for (size_t b = 0; b < sources.size() && ok; b++) {
+		std::vector<double> coefficients(3 * bodies[b].coefficients);
+		for (uint32_t s = 0; s < bodies[b].segmentCount && ok; s++) {
+			FitChebSegment(sources[b], startJD + s * bodies[b].segmentDays, bodies[b].segmentDays, coefficients.data());
+			ok = fwrite(coefficients.data(), sizeof(double), coefficients.size(), file) == coefficients.size();
+		}
+	}
+	fclose(file);
+	return ok;
+}
+
+inline void CloseChebFile(MyChebFile *cheb)
+{
+#ifdef _WIN32
+	if (cheb->data) UnmapViewOfFile(cheb->data);
+	if (cheb->mapping) CloseHandle(cheb->mapping);
+	if (cheb->file != INVALID_HANDLE_VALUE) CloseHandle(cheb->file);
+	cheb->file = INVALID_HANDLE_VALUE;
+	cheb->mapping = 0;
+#else
+	if (cheb->data) munmap((void *)cheb->data, cheb->size);
+#endif
+	cheb->data = 0;
+	cheb->size = 0;
+	cheb->header = 0;
+	cheb->bodies = 0;
+}
+
+// maps the file read-only and validates its layout, returning true if successful
+inline bool OpenChebFile(MyChebFile *cheb, const char *filename)
+{
+#ifdef _WIN32
+	cheb->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (cheb->file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER size;
+	GetFileSizeEx(cheb->file, &size);
+	cheb->size = (size_t)size.QuadPart;
+	cheb->mapping = CreateFileMappingA(cheb->file, 0, PAGE_READONLY, 0, 0, 0);
+	if (cheb->mapping) cheb->data = (const unsigned char *)MapViewOfFile(cheb->mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat info;
+	if (fstat(fd, &info) == 0 && info.st_size > 0) {
+		cheb->size = (size_t)info.st_size;
+		void *p = mmap(0, cheb->size, PROT_READ, MAP_SHARED, fd, 0);
+		cheb->data = p == MAP_FAILED ? 0 : (const unsigned char *)p;
+	}
+	close(fd);
+#endif
+	if (!cheb->data || cheb->size < sizeof(MyChebHeader)) {
+		CloseChebFile(cheb);
+		return false;
+	}
+
+	// check the header and that every body's segments lie inside the file
+	cheb->header = (const MyChebHeader *)cheb->data;
+	cheb->bodies = (const MyChebBody *)(cheb->data + sizeof(MyChebHeader));
+	bool ok = memcmp(cheb->header->magic, chebMagic, sizeof(chebMagic)) == 0 && cheb->header->version == 1 &&
+		sizeof(MyChebHeader) + (uint64_t)cheb->header->bodyCount * sizeof(MyChebBody) <= cheb->size;
+	for (uint32_t b = 0; ok && b < cheb->header->bodyCount; b++) {
+		const MyChebBody &body = cheb->bodies[b];
+		ok = body.coefficients > 0 && body.segmentCount > 0 && body.segmentDays > 0.0 && body.offset % sizeof(double) == 0 &&
+			body.offset + (uint64_t)body.segmentCount * 3 * body.coefficients * sizeof(double) <= cheb->size;
+	}
+	if (!ok) CloseChebFile(cheb);
+	return ok;
+}
+
+// returns the index of the named body, or -1
+inline int FindChebBody(const MyChebFile *cheb, const char *name)
+{
+	for (uint32_t b = 0; cheb->header && b < cheb->header->bodyCount; b++)
+		if (strncmp(cheb->bodies[b].name, name, sizeof(cheb->bodies[b].name)) == 0) return (int)b;
+	return -1;
+}
+
+// true if the date lies in the span the body's segments were fitted over
+inline bool ChebCovers(const MyChebFile *cheb, int index, double jd)
+{
+	const MyChebBody &body = cheb->bodies[index];
+	return jd >= cheb->header->startJD && jd <= cheb->header->startJD + body.segmentCount * body.segmentDays;
+}
+
+// evaluates position (km) and optionally velocity (km/day) of a body relative
+// to its centre; callers check ChebCovers, as dates outside the file are
+// clamped to its first/last segment and would freeze the body
+inline glm::dvec3 EvaluateCheb(const MyChebFile *cheb, int index, double jd, glm::dvec3 *velocity = 0)
+{
+	const MyChebBody &body = cheb->bodies[index];
+	int n = (int)body.coefficients;
+
+	// O(1) segment lookup
+	double t = (jd - cheb->header->startJD) / body.segmentDays;
+	if (t < 0.0) t = 0.0;
+	if (t > body.segmentCount) t = body.segmentCount;
+	int segment = (int)t;
+	if (segment == (int)body.segmentCount) segment--;
+	double x = 2.0 * (t - segment) - 1.0;
+	const double *c = (const double *)(cheb->data + body.offset) + (size_t)segment * 3 * n;
+
+	// T_k(x) and T_k'(x) by recurrence, accumulated for the three coordinates
+	double t0 = 1.0, t1 = x, d0 = 0.0, d1 = 1.0;
+	glm::dvec3 p(c[0], c[n], c[2 * n]), v(0.0);
+	for (int k = 1; k < n; k++) {
+		p += t1 * glm::dvec3(c[k], c[n + k], c[2 * n + k]);
+		v += d1 * glm::dvec3(c[k], c[n + k], c[2 * n + k]);
+		double t2 = 2.0 * x * t1 - t0;
+		double d2 = 2.0 * t1 + 2.0 * x * d1 - d0;
+		t0 = t1; t1 = t2;
+		d0 = d1; d1 = d2;
+	}
+	if (velocity) *velocity = v * (2.0 / body.segmentDays);
+	return p;
+}
+
+#endif
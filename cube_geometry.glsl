@@ -0,0 +1,67 @@
+#version 410
+
+// layered cubemap rendering: each of six invocations projects the triangle
+// onto one face of the cubemap (gl_Layer, in the order +X, -X, +Y, -Y, +Z,
+// -Z) and drops it when all three vertices lie outside the same side of that
+// face's frustum, so most triangles reach only the one or two faces they
+// touch
+layout(triangles, invocations = 6) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+in vec3 vertexColour[];
+in vec3 vertexTexCoords[];
+in vec3 vertexNormal[];
+in vec3 vertexPoint[];
+
+// the inputs of fragment.glsl, as vertex.glsl writes them
+out vec3 Colour;
+out vec3 texCoords;
+out vec3 normal;
+out vec3 point;
+out float logDepthW;
+
+// per-frame uniforms, laid out as MyFrameUniforms in uniforms.h
+layout(std140) uniform Frame
+{
+	mat4 view;
+	mat4 proj;
+	vec3 camPoint;
+	float animation;
+	vec3 light;
+	float logDepth;	// 2 / log2(zFar + 1), used when compiled with LOG_DEPTH
+};
+
+// projection of each face from the camera-relative scene, laid out as
+// MyCubeUniforms in uniforms.h
+layout(std140) uniform Cube
+{
+	mat4 faceViewProj[6];
+};
+
+void main()
+{
+	vec4 clip[3];
+	for (int k = 0; k < 3; k++)
+		clip[k] = faceViewProj[gl_InvocationID] * vec4(vertexPoint[k], 1.0);
+
+	// outside the left, right, bottom, top or near plane
+	for (int a = 0; a < 3; a++) {
+		if (clip[0][a] < -clip[0].w && clip[1][a] < -clip[1].w && clip[2][a] < -clip[2].w) return;
+		if (a < 2 && clip[0][a] > clip[0].w && clip[1][a] > clip[1].w && clip[2][a] > clip[2].w) return;
+	}
+
+	for (int k = 0; k < 3; k++) {
+		gl_Layer = gl_InvocationID;
+		gl_Position = clip[k];
+		logDepthW = 1.0 + clip[k].w;
+#ifdef LOG_DEPTH
+		gl_Position.z = (log2(max(1e-6, logDepthW)) * logDepth - 1.0) * clip[k].w;
+#endif
+		Colour = vertexColour[k];
+		texCoords = vertexTexCoords[k];
+		normal = vertexNormal[k];
+		point = vertexPoint[k];
+		EmitVertex();
+	}
+	EndPrimitive();
+}
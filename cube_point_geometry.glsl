@@ -0,0 +1,53 @@
+#version 410
+
+// layered cubemap rendering of point sprites: each of six invocations
+// places the point on one face of the cubemap (gl_Layer, in the order +X,
+// -X, +Y, -Y, +Z, -Z) if its centre falls inside that face's frustum
+layout(points, invocations = 6) in;
+layout(points, max_vertices = 1) out;
+
+in vec3 vertexPoint[];
+
+out float logDepthW;
+
+// per-frame uniforms, laid out as MyFrameUniforms in uniforms.h
+layout(std140) uniform Frame
+{
+	mat4 view;
+	mat4 proj;
+	vec3 camPoint;
+	float animation;
+	vec3 light;
+	float logDepth;	// 2 / log2(zFar + 1), used when compiled with LOG_DEPTH
+};
+
+// per-draw uniforms, laid out as MyDrawUniforms in uniforms.h
+layout(std140) uniform Draw
+{
+	mat4 model;
+	vec3 pointColour;
+	float pointSize;
+};
+
+// projection of each face from the camera-relative scene, laid out as
+// MyCubeUniforms in uniforms.h
+layout(std140) uniform Cube
+{
+	mat4 faceViewProj[6];
+};
+
+void main()
+{
+	vec4 clip = faceViewProj[gl_InvocationID] * vec4(vertexPoint[0], 1.0);
+	if (clip.w <= 0.0 || any(greaterThan(abs(clip.xy), vec2(clip.w)))) return;
+
+	gl_Layer = gl_InvocationID;
+	gl_Position = clip;
+	gl_PointSize = pointSize;
+	logDepthW = 1.0 + clip.w;
+#ifdef LOG_DEPTH
+	gl_Position.z = (log2(max(1e-6, logDepthW)) * logDepth - 1.0) * clip.w;
+#endif
+	EmitVertex();
+	EndPrimitive();
+}
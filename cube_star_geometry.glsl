@@ -0,0 +1,59 @@
+#version 410
+
+// layered cubemap rendering of catalog stars: as cube_point_geometry.glsl,
+// keeping the sprite star_vertex.glsl chose for each star
+layout(points, invocations = 6) in;
+layout(points, max_vertices = 1) out;
+
+in Star
+{
+	vec3 point;
+	vec3 colour;
+	float size;
+	float logDepthW;
+} starIn[];
+
+out Star
+{
+	vec3 point;
+	vec3 colour;
+	float size;
+	float logDepthW;
+} star;
+
+// per-frame uniforms, laid out as MyFrameUniforms in uniforms.h
+layout(std140) uniform Frame
+{
+	mat4 view;
+	mat4 proj;
+	vec3 camPoint;
+	float animation;
+	vec3 light;
+	float logDepth;	// 2 / log2(zFar + 1), used when compiled with LOG_DEPTH
+};
+
+// projection of each face from the camera-relative scene, laid out as
+// MyCubeUniforms in uniforms.h
+layout(std140) uniform Cube
+{
+	mat4 faceViewProj[6];
+};
+
+void main()
+{
+	vec4 clip = faceViewProj[gl_InvocationID] * vec4(starIn[0].point, 1.0);
+	if (clip.w <= 0.0 || any(greaterThan(abs(clip.xy), vec2(clip.w)))) return;
+
+	gl_Layer = gl_InvocationID;
+	gl_Position = clip;
+	gl_PointSize = starIn[0].size;
+	star.point = starIn[0].point;
+	star.colour = starIn[0].colour;
+	star.size = starIn[0].size;
+	star.logDepthW = 1.0 + clip.w;
+#ifdef LOG_DEPTH
+	gl_Position.z = (log2(max(1e-6, star.logDepthW)) * logDepth - 1.0) * clip.w;
+#endif
+	EmitVertex();
+	EndPrimitive();
+}
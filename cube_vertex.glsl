@@ -0,0 +1,32 @@
+#version 410
+
+// layered cubemap rendering of bodies and point sets: the vertex is only
+// placed in the camera-relative scene here, and cube_geometry.glsl or
+// cube_point_geometry.glsl projects it onto each face
+layout(location = 0) in vec3 VertexPosition;
+layout(location = 1) in vec3 VertexColour;
+layout(location = 2) in vec3 VertexTexture;
+
+out vec3 vertexColour;
+out vec3 vertexTexCoords;
+out vec3 vertexNormal;
+out vec3 vertexPoint;
+
+// per-draw uniforms, laid out as MyDrawUniforms in uniforms.h
+layout(std140) uniform Draw
+{
+	mat4 model;
+	vec3 pointColour;
+	float pointSize;
+};
+
+void main()
+{
+	vec4 newPos = model * vec4(VertexPosition, 1.0);
+	vec4 c = model * vec4(0.0, 0.0, 0.0, 1.0);
+	vertexNormal = normalize(newPos.xyz - c.xyz);
+	vertexPoint = newPos.xyz;
+	vertexColour = VertexColour;
+	vertexTexCoords = VertexTexture;
+	gl_Position = newPos;
+}
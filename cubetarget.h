@@ -0,0 +1,217 @@
+#ifndef CUBETARGET_H
+#define CUBETARGET_H
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+// OpenGL core profile, as set up by main.cpp
+#ifndef LAB_LINUX
+#include <glad/glad.h>
+#else
+#define GLFW_INCLUDE_GLCOREARB
+#define GL_GLEXT_PROTOTYPES
+#endif
+#include <GLFW/glfw3.h>
+
+#include "benchmark.h"
+#include "rendertarget.h"
+
+// --------------------------------------------------------------------------
+// Full-sphere panoramas through a cubemap
+//
+// With --panorama the scene is drawn into the six faces of a cubemap around
+// the camera instead of the render target, and a full-screen pass reprojects
+// the cubemap onto the window: as an equirectangular map of the whole
+// sphere, or as a fisheye for a planetarium dome. Recording, streaming and
+// offline rendering then take the panorama like any other frame.
+//
+// The faces are drawn in one pass: the cubemap is attached as a layered
+// framebuffer, and a geometry shader with six invocations sends each
+// triangle or point to the faces whose frustum it touches (gl_Layer). Where
+// the layered programs do not build, or with --panorama-passes 6, each face
+// is drawn in a pass of its own with the ordinary programs. Every direction
+// is in view, so culling keeps the occlusion tests but not the frustum.
+//
+// main.cpp includes this file after rendertarget.h, whose timer query count
+// and post-process texture unit it shares, and after the state cache
+// wrappers, BindUniformBlocks and the shader functions.
+
+enum PanoramaProjection { PANORAMA_OFF, PANORAMA_EQUIRECT, PANORAMA_FISHEYE, PANORAMA_PROJECTIONS };
+const char *panoramaNames[PANORAMA_PROJECTIONS] = { "off", "equirect", "fisheye" };
+
+int panoramaProjection = PANORAMA_OFF;
+int panoramaFaceSize = 0;		// pixels, 0 to match the window's resolution
+float fisheyeAperture = 180.0f;	// degrees
+bool panoramaLayered = true;	// one pass for all faces where supported
+
+struct MyCubeTarget
+{
+	// OpenGL names for the cubemaps, the layered framebuffer drawing into
+	// all faces and the framebuffers of the single faces
+	GLuint  colourTexture;
+	GLuint  depthTexture;
+	GLuint  layeredFramebuffer;
+	GLuint  faceFramebuffers[6];
+	GLuint  emptyArray;
+	GLuint  queries[renderTimeQueries];
+	int     size;				// of a face
+	int     query;
+	bool    layered;			// drawing all faces in one pass
+
+	// layered scene and point programs, and the reprojection
+	MyShader scene, points, reproject;
+
+	// initialize object names to zero (OpenGL reserved value)
+	MyCubeTarget() : colourTexture(0), depthTexture(0), layeredFramebuffer(0), emptyArray(0), size(0),
+		query(0), layered(false)
+	{
+		for (int k = 0; k < 6; k++) faceFramebuffers[k] = 0;
+		for (int k = 0; k < renderTimeQueries; k++) queries[k] = 0;
+	}
+};
+
+// rotation from the camera's view space to a face's, in the order of the
+// cubemap layers (+X, -X, +Y, -Y, +Z, -Z) and with the cubemap's orientation
+// of each face
+inline glm::mat4 CubeFaceView(int face)
+{
+	const glm::vec3 directions[6] = { glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1) };
+	const glm::vec3 ups[6] = { glm::vec3(0, -1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1), glm::vec3(0, -1, 0), glm::vec3(0, -1, 0) };
+	return glm::lookAt(glm::vec3(0.0f), directions[face], ups[face]);
+}
+
+// face size matching the resolution of the projection at the window's size
+inline int PanoramaFaceSize(int width, int height)
+{
+	if (panoramaFaceSize > 0) return panoramaFaceSize;
+	if (panoramaProjection == PANORAMA_EQUIRECT) return std::max(width / 4, height / 2);
+	return int(std::min(width, height) * 90.0f / fisheyeAperture);
+}
+
+// create the cubemaps and framebuffers, and the programs drawing into them
+// and out of them, returning true if successful
+inline bool InitializeCubeTarget(MyCubeTarget *target, int size, int windowWidth, int windowHeight)
+{
+	target->size = size;
+	glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+	GLuint *cubemaps[2] = { &target->colourTexture, &target->depthTexture };
+	GLenum formats[2][3] = { { GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE }, { GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT } };
+	for (int k = 0; k < 2; k++) {
+		glGenTextures(1, cubemaps[k]);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, *cubemaps[k]);
+		for (int face = 0; face < 6; face++)
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, formats[k][0], size, size, 0,
+				formats[k][1], formats[k][2], 0);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	}
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+	bool complete = true;
+	glGenFramebuffers(1, &target->layeredFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, target->layeredFramebuffer);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, target->colourTexture, 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, target->depthTexture, 0);
+	bool layeredComplete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glGenFramebuffers(6, target->faceFramebuffers);
+	for (int face = 0; face < 6; face++) {
+		glBindFramebuffer(GL_FRAMEBUFFER, target->faceFramebuffers[face]);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face,
+			target->colourTexture, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face,
+			target->depthTexture, 0);
+		complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE && complete;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	// the layered programs read the scene's textures and uniform blocks
+	target->layered = panoramaLayered && layeredComplete &&
+		InitializeShaders(&target->scene, "cube_vertex.glsl", "fragment.glsl", "cube_geometry.glsl") &&
+		InitializeShaders(&target->points, "cube_vertex.glsl", "point_fragment.glsl", "cube_point_geometry.glsl");
+	if (target->layered) {
+		glUseProgram(target->scene.program);
+		for (int k = 0; k < 6; k++)
+			glUniform1i(glGetUniformLocation(target->scene.program, ("tex" + std::to_string(k)).c_str()), k);
+		glUseProgram(0);
+		BindUniformBlocks(&target->scene);
+		BindUniformBlocks(&target->points);
+	}
+	else if (panoramaLayered)
+		std::cout << "Layered cubemap rendering is not available, drawing the faces in six passes" << std::endl;
+
+	complete = InitializeShaders(&target->reproject, "post_vertex.glsl", "panorama_fragment.glsl") && complete;
+	glUseProgram(target->reproject.program);
+	glUniform1i(glGetUniformLocation(target->reproject.program, "faces"), postTextureUnit);
+	glUniform2f(glGetUniformLocation(target->reproject.program, "outputSize"), float(windowWidth), float(windowHeight));
+	glUniform1i(glGetUniformLocation(target->reproject.program, "fisheye"), panoramaProjection == PANORAMA_FISHEYE);
+	glUniform1f(glGetUniformLocation(target->reproject.program, "aperture"), fisheyeAperture * piVal / 180.0f);
+	glUseProgram(0);
+
+	glGenVertexArrays(1, &target->emptyArray);
+	glGenQueries(renderTimeQueries, target->queries);
+	if (!complete) std::cout << "ERROR: Cubemap render target is incomplete" << std::endl;
+	else std::cout << "Panorama (" << panoramaNames[panoramaProjection] << ") from " << size << "x" << size
+		<< " cube faces in " << (target->layered ? "one layered pass" : "six passes") << std::endl;
+
+	return complete && !CheckGLErrors();
+}
+
+// reports the GPU time of an earlier frame, then starts timing this one and
+// binds the cubemap for drawing all faces, or the first face
+inline void BeginCubeTarget(MyCubeTarget *target)
+{
+	GLuint query = target->queries[target->query];
+	GLint available = 0;
+	if (glIsQuery(query)) glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+	if (available) {
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+		BenchmarkSection(&benchmark, "cube faces and reprojection (gpu)", ns / 1.0e6);
+	}
+	glBeginQuery(GL_TIME_ELAPSED, query);
+
+	BindFramebuffer(GL_FRAMEBUFFER, target->layered ? target->layeredFramebuffer : target->faceFramebuffers[0]);
+	SetViewport(0, 0, target->size, target->size);
+}
+
+// reprojects the cubemap onto the window and stops timing
+inline void EndCubeTarget(MyCubeTarget *target, int windowWidth, int windowHeight)
+{
+	BindFramebuffer(GL_FRAMEBUFFER, 0);
+	SetViewport(0, 0, windowWidth, windowHeight);
+	SetCapability(CAP_DEPTH_TEST, false);
+	SetPolygonMode(GL_FILL);
+	UseProgram(target->reproject.program);
+	BindTexture(postTextureUnit, GL_TEXTURE_CUBE_MAP, target->colourTexture);
+	BindVertexArray(target->emptyArray);
+	DrawArrays(GL_TRIANGLES, 0, 3);
+
+	glEndQuery(GL_TIME_ELAPSED);
+	target->query = (target->query + 1) % renderTimeQueries;
+	CheckFrameGLErrors();
+}
+
+// deallocate cubemap target objects
+inline void DestroyCubeTarget(MyCubeTarget *target)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &target->layeredFramebuffer);
+	glDeleteFramebuffers(6, target->faceFramebuffers);
+	glDeleteTextures(1, &target->colourTexture);
+	glDeleteTextures(1, &target->depthTexture);
+	glDeleteVertexArrays(1, &target->emptyArray);
+	glDeleteQueries(renderTimeQueries, target->queries);
+	MyShader *shaders[3] = { &target->scene, &target->points, &target->reproject };
+	for (int k = 0; k < 3; k++)
+		if (shaders[k]->program) DestroyShaders(shaders[k]);
+	*target = MyCubeTarget();
+}
+
+#endif
@@ -0,0 +1,311 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "jobs.h"
+#include "arena.h"
+
+// --------------------------------------------------------------------------
+// Visibility culling against the view frustum
+//
+// Bodies are tested by their bounding spheres. Large point sets (asteroids,
+// satellites, particles) are sorted along a Morton curve so that neighbours
+// in the array are neighbours in space, then cut into fixed-size chunks with
+// a bounding sphere each. Only chunks that touch the frustum are drawn, as
+// ranges merged where consecutive chunks are visible.
+//
+// Bodies and chunks inside the frustum are also tested for occlusion by the
+// large spheres of the scene (the Sun, the Earth and the Moon): from the eye
+// an occluder covers a cone, and a sphere is hidden when its own cone lies
+// inside that one and all of it is farther away than the occluder's centre.
+
+const int cullChunkSize = 256;	// points per chunk
+
+struct MyFrustum
+{
+	glm::vec4 planes[6];	// inside where dot(plane.xyz, p) + plane.w >= 0
+};
+
+struct MyPointChunk
+{
+	glm::vec3 centre;
+	float radius;
+};
+
+// cone an occluding sphere covers as seen from the eye
+struct MyOccluder
+{
+	glm::vec3 direction;	// unit, from the eye to the centre
+	float distance;			// from the eye to the centre
+	float angle;			// angular radius
+};
+
+// per-frame counts of what was drawn, culled by the frustum and occluded
+struct MyCullStats
+{
+	int bodiesDrawn, bodiesCulled, bodiesOccluded;
+	int chunksDrawn, chunksCulled, chunksOccluded;
+	long long pointsDrawn, pointsCulled, pointsOccluded;
+	long long verticesSaved;	// by culling and occlusion
+	double pixelsSaved;			// estimated fill of occluded bodies and points
+
+	MyCullStats() : bodiesDrawn(0), bodiesCulled(0), bodiesOccluded(0),
+		chunksDrawn(0), chunksCulled(0), chunksOccluded(0),
+		pointsDrawn(0), pointsCulled(0), pointsOccluded(0), verticesSaved(0), pixelsSaved(0.0)
+	{}
+};
+
+// draw ranges of the visible chunks of a point set
+struct MyDrawRanges
+{
+	bool all;	// the whole set, ignoring the ranges
+	int *first;
+	int *count;
+	int ranges;
+
+	MyDrawRanges() : all(false), first(0), count(0), ranges(0)
+	{}
+};
+
+// scratch buffers for sorting a point set, kept between steps
+struct MyPointSort
+{
+	std::vector<uint32_t> keys, keyScratch;
+	std::vector<glm::vec3> pointScratch;
+};
+
+// planes of the frustum of a combined projection and view matrix
+inline MyFrustum ExtractFrustum(const glm::mat4 &viewProj)
+{
+	// rows of the matrix (glm is column major)
+	glm::vec4 r0(viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0]);
+	glm::vec4 r1(viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1]);
+	glm::vec4 r2(viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2]);
+	glm::vec4 r3(viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]);
+
+	MyFrustum frustum;
+	frustum.planes[0] = r3 + r0;	// left
+	frustum.planes[1] = r3 - r0;	// right
+	frustum.planes[2] = r3 + r1;	// bottom
+	frustum.planes[3] = r3 - r1;	// top
+	frustum.planes[4] = r3 + r2;	// near
+	frustum.planes[5] = r3 - r2;	// far
+	for (int k = 0; k < 6; k++)
+		frustum.planes[k] /= glm::length(glm::vec3(frustum.planes[k]));
+	return frustum;
+}
+
+// planes every point is inside, for a view in all directions (a cubemap)
+inline MyFrustum AllDirectionsFrustum()
+{
+	MyFrustum frustum;
+	for (int k = 0; k < 6; k++)
+		frustum.planes[k] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	return frustum;
+}
+
+inline bool SphereVisible(const MyFrustum &frustum, const glm::vec3 &centre, float radius)
+{
+	for (int k = 0; k < 6; k++)
+		if (glm::dot(glm::vec3(frustum.planes[k]), centre) + frustum.planes[k].w < -radius)
+			return false;
+	return true;
+}
+
+// cone of an occluding sphere; returns false when the eye is inside it
+inline bool MakeOccluder(const glm::vec3 &eye, const glm::vec3 &centre, float radius, MyOccluder *occluder)
+{
+	glm::vec3 d = centre - eye;
+	float distance = glm::length(d);
+	if (distance <= radius) return false;
+	occluder->direction = d / distance;
+	occluder->distance = distance;
+	occluder->angle = asin(radius / distance);
+	return true;
+}
+
+inline bool SphereOccluded(const MyOccluder *occluders, int count, const glm::vec3 &eye,
+	const glm::vec3 &centre, float radius)
+{
+	glm::vec3 d = centre - eye;
+	float distance = glm::length(d);
+	if (distance <= radius) return false;
+	glm::vec3 direction = d / distance;
+	float angle = asin(radius / distance);
+	for (int k = 0; k < count; k++) {
+		const MyOccluder &o = occluders[k];
+		// every point of the sphere must lie beyond the occluder's front
+		// surface, which is never farther than its centre
+		if (distance - radius < o.distance) continue;
+		float apart = acos(glm::clamp(glm::dot(direction, o.direction), -1.0f, 1.0f));
+		if (apart + angle <= o.angle) return true;
+	}
+	return false;
+}
+
+// approximate area in pixels a sphere covers on screen, for a projection
+// with the given focal length in pixels
+inline double ProjectedArea(const glm::vec3 &eye, const glm::vec3 &centre, float radius, float focal)
+{
+	float distance = glm::length(centre - eye);
+	if (distance <= radius) return 0.0;
+	double r = focal * radius / sqrt(distance * distance - radius * radius);
+	return 3.14159265358979 * r * r;
+}
+
+// spreads the lower 10 bits of v to every third bit
+inline uint32_t SpreadBits(uint32_t v)
+{
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+// reorders points along a Morton curve over their bounding box, with a
+// radix sort on 30 bit keys
+inline void SortPoints(MyJobPool *pool, std::vector<glm::vec3> &points, MyPointSort *sort)
+{
+	int n = (int)points.size();
+	if (n <= cullChunkSize) return;
+
+	glm::vec3 lo(1.0e30f), hi(-1.0e30f);
+	for (const glm::vec3 &p : points) {
+		lo = glm::min(lo, p);
+		hi = glm::max(hi, p);
+	}
+	glm::vec3 scale = 1023.0f / glm::max(hi - lo, glm::vec3(1.0e-20f));
+
+	sort->keys.resize(n);
+	sort->keyScratch.resize(n);
+	sort->pointScratch.resize(n);
+	uint32_t *keys = sort->keys.data();
+	const glm::vec3 *p = points.data();
+	ParallelFor(pool, 0, n, 16384, [keys, p, lo, scale](int first, int last) {
+		for (int k = first; k < last; k++) {
+			glm::uvec3 cell((p[k] - lo) * scale);
+			keys[k] = SpreadBits(cell.x) | (SpreadBits(cell.y) << 1) | (SpreadBits(cell.z) << 2);
+		}
+	});
+
+	// three passes of 10 bits, ping-ponging keys and points
+	uint32_t *keyIn = keys, *keyOut = sort->keyScratch.data();
+	glm::vec3 *pointIn = points.data(), *pointOut = sort->pointScratch.data();
+	for (int shift = 0; shift < 30; shift += 10) {
+		int offsets[1025] = { 0 };
+		for (int k = 0; k < n; k++) offsets[((keyIn[k] >> shift) & 1023) + 1]++;
+		for (int b = 0; b < 1024; b++) offsets[b + 1] += offsets[b];
+		for (int k = 0; k < n; k++) {
+			int to = offsets[(keyIn[k] >> shift) & 1023]++;
+			keyOut[to] = keyIn[k];
+			pointOut[to] = pointIn[k];
+		}
+		std::swap(keyIn, keyOut);
+		std::swap(pointIn, pointOut);
+	}
+
+	// an odd number of passes leaves the result in the scratch buffer
+	points.swap(sort->pointScratch);
+}
+
+// bounding sphere of every chunk of a point set
+inline void BuildPointChunks(MyJobPool *pool, const std::vector<glm::vec3> &points, std::vector<MyPointChunk> &chunks)
+{
+	int n = (int)points.size();
+	int count = (n + cullChunkSize - 1) / cullChunkSize;
+	chunks.resize(count);
+	const glm::vec3 *p = points.data();
+	MyPointChunk *c = chunks.data();
+	ParallelFor(pool, 0, count, 64, [p, c, n](int firstChunk, int lastChunk) {
+		for (int k = firstChunk; k < lastChunk; k++) {
+			int first = k * cullChunkSize, last = std::min(n, first + cullChunkSize);
+			glm::vec3 lo(1.0e30f), hi(-1.0e30f);
+			for (int i = first; i < last; i++) {
+				lo = glm::min(lo, p[i]);
+				hi = glm::max(hi, p[i]);
+			}
+			glm::vec3 centre = 0.5f * (lo + hi);
+			float r2 = 0.0f;
+			for (int i = first; i < last; i++) {
+				glm::vec3 d = p[i] - centre;
+				r2 = std::max(r2, glm::dot(d, d));
+			}
+			c[k].centre = centre;
+			c[k].radius = sqrt(r2);
+		}
+	});
+}
+
+// tests every chunk of a point set of the given size, whose chunks are in
+// model space, and returns the draw ranges of the visible ones, allocated
+// from the frame arena
+inline MyDrawRanges CullPointChunks(MyFrameArena *arena, const MyFrustum &frustum,
+	const MyOccluder *occluders, int occluderCount, const glm::vec3 &eye, const glm::mat4 &model,
+	const std::vector<MyPointChunk> &chunks, int points, MyCullStats *stats)
+{
+	MyDrawRanges draw;
+	int count = (int)chunks.size();
+	draw.first = ArenaArray<int>(arena, count);
+	draw.count = ArenaArray<int>(arena, count);
+	if (!draw.first || !draw.count) {
+		// out of frame memory: draw everything
+		draw.all = true;
+		stats->pointsDrawn += points;
+		return draw;
+	}
+
+	bool previous = false;
+	for (int k = 0; k < count; k++) {
+		glm::vec3 centre(model * glm::vec4(chunks[k].centre, 1.0f));
+		int first = k * cullChunkSize, n = std::min(points - first, cullChunkSize);
+		if (n <= 0) break;
+		bool visible = SphereVisible(frustum, centre, chunks[k].radius);
+		bool occluded = visible && SphereOccluded(occluders, occluderCount, eye, centre, chunks[k].radius);
+		visible = visible && !occluded;
+		if (visible) {
+			// extend the previous range when consecutive chunks are visible
+			if (previous) draw.count[draw.ranges - 1] += n;
+			else {
+				draw.first[draw.ranges] = first;
+				draw.count[draw.ranges] = n;
+				draw.ranges++;
+			}
+			stats->chunksDrawn++;
+			stats->pointsDrawn += n;
+		}
+		else if (occluded) {
+			stats->chunksOccluded++;
+			stats->pointsOccluded += n;
+			stats->verticesSaved += n;
+		}
+		else {
+			stats->chunksCulled++;
+			stats->pointsCulled += n;
+			stats->verticesSaved += n;
+		}
+		previous = visible;
+	}
+	return draw;
+}
+
+// tests a point set without chunks as a whole
+inline MyDrawRanges CullPointSet(const MyFrustum &frustum, const MyOccluder *occluders, int occluderCount,
+	const glm::vec3 &eye, const glm::vec3 &centre, float radius, int points, MyCullStats *stats)
+{
+	MyDrawRanges draw;
+	bool visible = SphereVisible(frustum, centre, radius);
+	bool occluded = visible && SphereOccluded(occluders, occluderCount, eye, centre, radius);
+	draw.all = visible && !occluded;
+	if (draw.all) stats->pointsDrawn += points;
+	else if (occluded) stats->pointsOccluded += points;
+	else stats->pointsCulled += points;
+	if (!draw.all) stats->verticesSaved += points;
+	return draw;
+}
+
+#endif
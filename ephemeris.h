@@ -0,0 +1,446 @@
+#ifndef EPHEMERIS_H
+#define EPHEMERIS_H
+
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define EPHEMERIS_SSE2
+#endif
+
+// --------------------------------------------------------------------------
+// Analytic ephemeris: truncated VSOP87D series for the Earth and the
+// ELP-2000/82 main problem for the Moon, as tabulated by Meeus (Astronomical
+// Algorithms, chapters 32 and 47).
+//
+// Series are stored as structures of arrays and their trigonometric sums are
+// evaluated two terms at a time with SSE2. Accuracy tiers drop every term
+// below an amplitude cutoff, and the last result is cached so that a frame
+// in which simulation time has not moved does not evaluate anything.
+
+enum EphemerisTier { EPHEMERIS_LOW, EPHEMERIS_MEDIUM, EPHEMERIS_HIGH, EPHEMERIS_TIERS };
+
+// VSOP87 term: A cos(B + C tau), A in 1e-8 rad or AU, tau in Julian millennia
+struct MyVsopTerm { double a, b, c; };
+
+// ELP term: coefficients of the arguments D, M, M', F and the amplitude of the
+// sine (longitude/latitude, 1e-6 degrees) or cosine (distance, 1e-3 km) term
+struct MyElpTerm { signed char d, m, mp, f; double l, r; };
+
+static const MyVsopTerm earthL0[] = {
+	{ 175347046, 0, 0 }, { 3341656, 4.6692568, 6283.07585 }, { 34894, 4.6261, 12566.1517 },
+	{ 3497, 2.7441, 5753.3849 }, { 3418, 2.8289, 3.5231 }, { 3136, 3.6277, 77713.7715 },
+	{ 2676, 4.4181, 7860.4194 }, { 2343, 6.1352, 3930.2097 }, { 1324, 0.7425, 11506.7698 },
+	{ 1273, 2.0371, 529.691 }, { 1199, 1.1096, 1577.3435 }, { 990, 5.233, 5884.927 },
+	{ 902, 2.045, 26.298 }, { 857, 3.508, 398.149 }, { 780, 1.179, 5223.694 },
+	{ 753, 2.533, 5507.553 }, { 505, 4.583, 18849.228 }, { 492, 4.205, 775.523 },
+	{ 357, 2.92, 0.067 }, { 317, 5.849, 11790.629 }, { 284, 1.899, 796.298 },
+	{ 271, 0.315, 10977.079 }, { 243, 0.345, 5486.778 }, { 206, 4.806, 2544.314 },
+	{ 205, 1.869, 5573.143 }, { 202, 2.458, 6069.777 }, { 156, 0.833, 213.299 },
+	{ 132, 3.411, 2942.463 }, { 126, 1.083, 20.775 }, { 115, 0.645, 0.98 },
+	{ 103, 0.636, 4694.003 }, { 102, 0.976, 15720.839 }, { 102, 4.267, 7.114 },
+	{ 99, 6.21, 2146.17 }, { 98, 0.68, 155.42 }, { 86, 5.98, 161000.69 },
+	{ 85, 1.3, 6275.96 }, { 85, 3.67, 71430.7 }, { 80, 1.81, 17260.15 },
+	{ 79, 3.04, 12036.46 }, { 75, 1.76, 5088.63 }, { 74, 3.5, 3154.69 },
+	{ 74, 4.68, 801.82 }, { 70, 0.83, 9437.76 }, { 62, 3.98, 8827.39 },
+	{ 61, 1.82, 7084.9 }, { 57, 2.78, 6286.6 }, { 56, 4.39, 14143.5 },
+	{ 56, 3.47, 6279.55 }, { 52, 0.19, 12139.55 }, { 52, 1.33, 1748.02 },
+	{ 51, 0.28, 5856.48 }, { 49, 0.49, 1194.45 }, { 41, 5.37, 8429.24 },
+	{ 41, 2.4, 19651.05 }, { 39, 6.17, 10447.39 }, { 37, 6.04, 10213.29 },
+	{ 37, 2.57, 1059.38 }, { 36, 1.71, 2352.87 }, { 36, 1.78, 6812.77 },
+	{ 33, 0.59, 17789.85 }, { 30, 0.44, 83996.85 }, { 30, 2.74, 1349.87 },
+	{ 25, 3.16, 4690.48 }
+};
+static const MyVsopTerm earthL1[] = {
+	{ 628331966747.0, 0, 0 }, { 206059, 2.678235, 6283.07585 }, { 4303, 2.6351, 12566.1517 },
+	{ 425, 1.59, 3.523 }, { 119, 5.796, 26.298 }, { 109, 2.966, 1577.344 },
+	{ 93, 2.59, 18849.23 }, { 72, 1.14, 529.69 }, { 68, 1.87, 398.15 },
+	{ 67, 4.41, 5507.55 }, { 59, 2.89, 5223.69 }, { 56, 2.17, 155.42 },
+	{ 45, 0.4, 796.3 }, { 36, 0.47, 775.52 }, { 29, 2.65, 7.11 },
+	{ 21, 5.34, 0.98 }, { 19, 1.85, 5486.78 }, { 19, 4.97, 213.3 },
+	{ 17, 2.99, 6275.96 }, { 16, 0.03, 2544.31 }, { 16, 1.43, 2146.17 },
+	{ 15, 1.21, 10977.08 }, { 12, 2.83, 1748.02 }, { 12, 3.26, 5088.63 },
+	{ 12, 5.27, 1194.45 }, { 12, 2.08, 4694 }, { 11, 0.77, 553.57 },
+	{ 10, 1.3, 6286.6 }, { 10, 4.24, 1349.87 }, { 9, 2.7, 242.73 },
+	{ 9, 5.64, 951.72 }, { 8, 5.3, 2352.87 }, { 6, 2.65, 9437.76 },
+	{ 6, 4.67, 4690.48 }
+};
+static const MyVsopTerm earthL2[] = {
+	{ 52919, 0, 0 }, { 8720, 1.0721, 6283.0758 }, { 309, 0.867, 12566.152 },
+	{ 27, 0.05, 3.52 }, { 16, 5.19, 26.3 }, { 16, 3.68, 155.42 },
+	{ 10, 0.76, 18849.23 }, { 9, 2.06, 77713.77 }, { 7, 0.83, 775.52 },
+	{ 5, 4.66, 1577.34 }, { 4, 1.03, 7.11 }, { 4, 3.44, 5573.14 },
+	{ 3, 5.14, 796.3 }, { 3, 6.05, 5507.55 }, { 3, 1.19, 242.73 },
+	{ 3, 6.12, 529.69 }, { 3, 0.31, 398.15 }, { 3, 2.28, 553.57 },
+	{ 2, 4.38, 5223.69 }, { 2, 3.75, 0.98 }
+};
+static const MyVsopTerm earthL3[] = {
+	{ 289, 5.844, 6283.076 }, { 35, 0, 0 }, { 17, 5.49, 12566.15 },
+	{ 3, 5.2, 155.42 }, { 1, 4.72, 3.52 }, { 1, 5.3, 18849.23 },
+	{ 1, 5.97, 242.73 }
+};
+static const MyVsopTerm earthL4[] = {
+	{ 114, 3.142, 0 }, { 8, 4.13, 6283.08 }, { 1, 3.84, 12566.15 }
+};
+static const MyVsopTerm earthL5[] = {
+	{ 1, 3.14, 0 }
+};
+static const MyVsopTerm earthB0[] = {
+	{ 280, 3.199, 84334.662 }, { 102, 5.422, 5507.553 }, { 80, 3.88, 5223.69 },
+	{ 44, 3.7, 2352.87 }, { 32, 4, 1577.34 }
+};
+static const MyVsopTerm earthB1[] = {
+	{ 9, 3.9, 5507.55 }, { 6, 1.73, 5223.69 }
+};
+static const MyVsopTerm earthR0[] = {
+	{ 100013989, 0, 0 }, { 1670700, 3.0984635, 6283.07585 }, { 13956, 3.05525, 12566.1517 },
+	{ 3084, 5.1985, 77713.7715 }, { 1628, 1.1739, 5753.3849 }, { 1576, 2.8469, 7860.4194 },
+	{ 925, 5.453, 11506.77 }, { 542, 4.564, 3930.21 }, { 472, 3.661, 5884.927 },
+	{ 346, 0.964, 5507.553 }, { 329, 5.9, 5223.694 }, { 307, 0.299, 5573.143 },
+	{ 243, 4.273, 11790.629 }, { 212, 5.847, 1577.344 }, { 186, 5.022, 10977.079 },
+	{ 175, 3.012, 18849.228 }, { 110, 5.055, 5486.778 }, { 98, 0.89, 6069.78 },
+	{ 86, 5.69, 15720.84 }, { 86, 1.27, 161000.69 }, { 65, 0.27, 17260.15 },
+	{ 63, 0.92, 529.69 }, { 57, 2.01, 83996.85 }, { 56, 5.24, 71430.7 },
+	{ 49, 3.25, 2544.31 }, { 47, 2.58, 775.52 }, { 45, 5.54, 9437.76 },
+	{ 43, 6.01, 6275.96 }, { 39, 5.36, 4694 }, { 38, 2.39, 8827.39 },
+	{ 37, 0.83, 19651.05 }, { 37, 4.9, 12139.55 }, { 36, 1.67, 12036.46 },
+	{ 35, 1.84, 2942.46 }, { 33, 0.24, 7084.9 }, { 32, 0.18, 5088.63 },
+	{ 32, 1.78, 398.15 }, { 28, 1.21, 6286.6 }, { 28, 1.9, 6279.55 },
+	{ 26, 4.59, 10447.39 }
+};
+static const MyVsopTerm earthR1[] = {
+	{ 103019, 1.10749, 6283.07585 }, { 1721, 1.0644, 12566.1517 }, { 702, 3.142, 0 },
+	{ 32, 1.02, 18849.23 }, { 31, 2.84, 5507.55 }, { 25, 1.32, 5223.69 },
+	{ 18, 1.42, 1577.34 }, { 10, 5.91, 10977.08 }, { 9, 1.42, 6275.96 },
+	{ 9, 0.27, 5486.78 }
+};
+static const MyVsopTerm earthR2[] = {
+	{ 4359, 5.7846, 6283.0758 }, { 124, 5.579, 12566.152 }, { 12, 3.14, 0 },
+	{ 9, 3.63, 77713.77 }, { 6, 1.87, 5573.14 }, { 3, 5.47, 18849.23 }
+};
+static const MyVsopTerm earthR3[] = {
+	{ 145, 4.273, 6283.076 }, { 7, 3.92, 12566.15 }
+};
+static const MyVsopTerm earthR4[] = {
+	{ 4, 2.56, 6283.08 }
+};
+
+// Moon longitude (l) and distance (r) terms
+static const MyElpTerm moonLR[] = {
+	{ 0, 0, 1, 0, 6288774, -20905355 }, { 2, 0, -1, 0, 1274027, -3699111 },
+	{ 2, 0, 0, 0, 658314, -2955968 }, { 0, 0, 2, 0, 213618, -569925 },
+	{ 0, 1, 0, 0, -185116, 48888 }, { 0, 0, 0, 2, -114332, -3149 },
+	{ 2, 0, -2, 0, 58793, 246158 }, { 2, -1, -1, 0, 57066, -152138 },
+	{ 2, 0, 1, 0, 53322, -170733 }, { 2, -1, 0, 0, 45758, -204586 },
+	{ 0, 1, -1, 0, -40923, -129620 }, { 1, 0, 0, 0, -34720, 108743 },
+	{ 0, 1, 1, 0, -30383, 104755 }, { 2, 0, 0, -2, 15327, 10321 },
+	{ 0, 0, 1, 2, -12528, 0 }, { 0, 0, 1, -2, 10980, 79661 },
+	{ 4, 0, -1, 0, 10675, -34782 }, { 0, 0, 3, 0, 10034, -23210 },
+	{ 4, 0, -2, 0, 8548, -21636 }, { 2, 1, -1, 0, -7888, 24208 },
+	{ 2, 1, 0, 0, -6766, 30824 }, { 1, 0, -1, 0, -5163, -8379 },
+	{ 1, 1, 0, 0, 4987, -16675 }, { 2, -1, 1, 0, 4036, -12831 },
+	{ 2, 0, 2, 0, 3994, -10445 }, { 4, 0, 0, 0, 3861, -11650 },
+	{ 2, 0, -3, 0, 3665, 14403 }, { 0, 1, -2, 0, -2689, -7003 },
+	{ 2, 0, -1, 2, -2602, 0 }, { 2, -1, -2, 0, 2390, 10056 },
+	{ 1, 0, 1, 0, -2348, 6322 }, { 2, -2, 0, 0, 2236, -9884 },
+	{ 0, 1, 2, 0, -2120, 5751 }, { 0, 2, 0, 0, -2069, 0 },
+	{ 2, -2, -1, 0, 2048, -4950 }, { 2, 0, 1, -2, -1773, 4130 },
+	{ 2, 0, 0, 2, -1595, 0 }, { 4, -1, -1, 0, 1215, -3958 },
+	{ 0, 0, 2, 2, -1110, 0 }, { 3, 0, -1, 0, -892, 3258 },
+	{ 2, 1, 1, 0, -810, 2616 }, { 4, -1, -2, 0, 759, -1897 },
+	{ 0, 2, -1, 0, -713, -2117 }, { 2, 2, -1, 0, -700, 2354 },
+	{ 2, 1, -2, 0, 691, 0 }, { 2, -1, 0, -2, 596, 0 },
+	{ 4, 0, 1, 0, 549, -1423 }, { 0, 0, 4, 0, 537, -1117 },
+	{ 4, -1, 0, 0, 520, -1571 }, { 1, 0, -2, 0, -487, -1739 },
+	{ 2, 1, 0, -2, -399, 0 }, { 0, 0, 2, -2, -381, -4421 },
+	{ 1, 1, 1, 0, 351, 0 }, { 3, 0, -2, 0, -340, 0 },
+	{ 4, 0, -3, 0, 330, 0 }, { 2, -1, 2, 0, 327, 0 },
+	{ 0, 2, 1, 0, -323, 1165 }, { 1, 1, -1, 0, 299, 0 },
+	{ 2, 0, 3, 0, 294, 0 }, { 2, 0, -1, -2, 0, 8752 }
+};
+
+// Moon latitude (b) terms, all 60 of Meeus' table 47.B, stored in the l field
+static const MyElpTerm moonB[] = {
+	{ 0, 0, 0, 1, 5128122, 0 }, { 0, 0, 1, 1, 280602, 0 }, { 0, 0, 1, -1, 277693, 0 },
+	{ 2, 0, 0, -1, 173237, 0 }, { 2, 0, -1, 1, 55413, 0 }, { 2, 0, -1, -1, 46271, 0 },
+	{ 2, 0, 0, 1, 32573, 0 }, { 0, 0, 2, 1, 17198, 0 }, { 2, 0, 1, -1, 9266, 0 },
+	{ 0, 0, 2, -1, 8822, 0 }, { 2, -1, 0, -1, 8216, 0 }, { 2, 0, -2, -1, 4324, 0 },
+	{ 2, 0, 1, 1, 4200, 0 }, { 2, 1, 0, -1, -3359, 0 }, { 2, -1, -1, 1, 2463, 0 },
+	{ 2, -1, 0, 1, 2211, 0 }, { 2, -1, -1, -1, 2065, 0 }, { 0, 1, -1, -1, -1870, 0 },
+	{ 4, 0, -1, -1, 1828, 0 }, { 0, 1, 0, 1, -1794, 0 }, { 0, 0, 0, 3, -1749, 0 },
+	{ 0, 1, -1, 1, -1565, 0 }, { 1, 0, 0, 1, -1491, 0 }, { 0, 1, 1, 1, -1475, 0 },
+	{ 0, 1, 1, -1, -1410, 0 }, { 0, 1, 0, -1, -1344, 0 }, { 1, 0, 0, -1, -1335, 0 },
+	{ 0, 0, 3, 1, 1107, 0 }, { 4, 0, 0, -1, 1021, 0 }, { 4, 0, -1, 1, 833, 0 },
+	{ 0, 0, 1, -3, 777, 0 }, { 4, 0, -2, 1, 671, 0 }, { 2, 0, 0, -3, 607, 0 },
+	{ 2, 0, 2, -1, 596, 0 }, { 2, -1, 1, -1, 491, 0 }, { 2, 0, -2, 1, -451, 0 },
+	{ 0, 0, 3, -1, 439, 0 }, { 2, 0, 2, 1, 422, 0 }, { 2, 0, -3, -1, 421, 0 },
+	{ 2, 1, -1, 1, -366, 0 }, { 2, 1, 0, 1, -351, 0 }, { 4, 0, 0, 1, 331, 0 },
+	{ 2, -1, 1, 1, 315, 0 }, { 2, -2, 0, -1, 302, 0 }, { 0, 0, 1, 3, -283, 0 },
+	{ 2, 1, 1, -1, -229, 0 }, { 1, 1, 0, -1, 223, 0 }, { 1, 1, 0, 1, 223, 0 },
+	{ 0, 1, -2, -1, -220, 0 }, { 2, 1, -1, -1, -220, 0 }, { 1, 0, 1, 1, -185, 0 },
+	{ 2, -1, -2, -1, 181, 0 }, { 0, 1, 2, 1, -177, 0 }, { 4, 0, -2, -1, 176, 0 },
+	{ 4, -1, -1, -1, 166, 0 }, { 1, 0, 1, -1, -164, 0 }, { 4, 0, 1, -1, 132, 0 },
+	{ 1, 0, -1, -1, -119, 0 }, { 4, -1, 0, -1, 115, 0 }, { 2, -2, 0, 1, 107, 0 }
+};
+
+// amplitude cutoffs per tier, in the units of each table
+static const double vsopCutoff[EPHEMERIS_TIERS] = { 1000.0, 100.0, 0.0 };
+static const double elpCutoff[EPHEMERIS_TIERS] = { 10000.0, 1000.0, 0.0 };
+
+// series as structure of arrays, padded with zero terms to a multiple of two
+struct MySeries
+{
+	std::vector<double> a, b, c;
+};
+
+// ELP series with the argument multipliers kept apart for the per-call phases
+struct MyElpSeries
+{
+	std::vector<double> amp, d, m, mp, f, eExp;
+	bool cosine;
+};
+
+struct MyEphemerisState
+{
+	glm::dvec3 earth;	// heliocentric ecliptic position of the Earth, AU
+	glm::dvec3 moon;	// geocentric ecliptic position of the Moon, km
+};
+
+struct MyEphemeris
+{
+	MySeries earthL[EPHEMERIS_TIERS][6];
+	MySeries earthB[EPHEMERIS_TIERS][2];
+	MySeries earthR[EPHEMERIS_TIERS][5];
+	MyElpSeries moonL[EPHEMERIS_TIERS], moonR[EPHEMERIS_TIERS], moonB[EPHEMERIS_TIERS];
+
+	// scratch space for the ELP phases and amplitudes, sized once at initialization
+	std::vector<double> phase, amplitude;
+
+	// result of the last evaluation
+	double cachedJD;
+	int cachedTier;
+	MyEphemerisState state;
+	int evaluations;
+
+	MyEphemeris() : cachedJD(0.0), cachedTier(-1), evaluations(0)
+	{}
+};
+
+// sum of a cos(b + c t) over the series
+inline double SumSeries(const double *a, const double *b, const double *c, int n, double t)
+{
+	int k = 0;
+	double sum = 0.0;
+
+#ifdef EPHEMERIS_SSE2
+	// range reduction by quadrant: x = j pi/2 + r, |r| <= pi/4, with pi/2
+	// split in two parts so that the reduction stays exact for large phases
+	const __m128d twoOverPi = _mm_set1_pd(0.63661977236758134);
+	const __m128d halfPi1 = _mm_set1_pd(1.5707963267341256);
+	const __m128d halfPi2 = _mm_set1_pd(6.077100506506192e-11);
+	const __m128d tt = _mm_set1_pd(t);
+	const __m128d one = _mm_set1_pd(1.0);
+	__m128d acc = _mm_setzero_pd();
+
+	for (; k + 2 <= n; k += 2) {
+		__m128d x = _mm_add_pd(_mm_loadu_pd(b + k), _mm_mul_pd(_mm_loadu_pd(c + k), tt));
+
+		// nearest quadrant, computed in 32-bit integers
+		__m128i j = _mm_cvtpd_epi32(_mm_mul_pd(x, twoOverPi));
+		__m128d jd = _mm_cvtepi32_pd(j);
+		__m128d r = _mm_sub_pd(_mm_sub_pd(x, _mm_mul_pd(jd, halfPi1)), _mm_mul_pd(jd, halfPi2));
+		__m128d r2 = _mm_mul_pd(r, r);
+
+		// Taylor polynomials of cos and sin, accurate to ~1e-16 on |r| <= pi/4
+		__m128d pc = _mm_set1_pd(1.0 / 20922789888000.0);
+		pc = _mm_sub_pd(_mm_mul_pd(pc, r2), _mm_set1_pd(1.0 / 87178291200.0));
+		pc = _mm_add_pd(_mm_mul_pd(pc, r2), _mm_set1_pd(1.0 / 479001600.0));
+		pc = _mm_sub_pd(_mm_mul_pd(pc, r2), _mm_set1_pd(1.0 / 3628800.0));
+		pc = _mm_add_pd(_mm_mul_pd(pc, r2), _mm_set1_pd(1.0 / 40320.0));
+		pc = _mm_sub_pd(_mm_mul_pd(pc, r2), _mm_set1_pd(1.0 / 720.0));
+		pc = _mm_add_pd(_mm_mul_pd(pc, r2), _mm_set1_pd(1.0 / 24.0));
+		pc = _mm_sub_pd(_mm_mul_pd(pc, r2), _mm_set1_pd(0.5));
+		pc = _mm_add_pd(_mm_mul_pd(pc, r2), one);
+
+		__m128d ps = _mm_set1_pd(-1.0 / 1307674368000.0);
+		ps = _mm_add_pd(_mm_mul_pd(ps, r2), _mm_set1_pd(1.0 / 6227020800.0));
+		ps = _mm_sub_pd(_mm_mul_pd(ps, r2), _mm_set1_pd(1.0 / 39916800.0));
+		ps = _mm_add_pd(_mm_mul_pd(ps, r2), _mm_set1_pd(1.0 / 362880.0));
+		ps = _mm_sub_pd(_mm_mul_pd(ps, r2), _mm_set1_pd(1.0 / 5040.0));
+		ps = _mm_add_pd(_mm_mul_pd(ps, r2), _mm_set1_pd(1.0 / 120.0));
+		ps = _mm_sub_pd(_mm_mul_pd(ps, r2), _mm_set1_pd(1.0 / 6.0));
+		ps = _mm_add_pd(_mm_mul_pd(ps, r2), one);
+		ps = _mm_mul_pd(ps, r);
+
+		// cos(x) by quadrant: cos r, -sin r, -cos r, sin r
+		__m128i q = _mm_shuffle_epi32(j, _MM_SHUFFLE(1, 1, 0, 0));
+		__m128d odd = _mm_castsi128_pd(_mm_cmpeq_epi32(_mm_and_si128(q, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+		__m128d neg = _mm_castsi128_pd(_mm_cmpeq_epi32(
+			_mm_and_si128(_mm_add_epi32(q, _mm_set1_epi32(1)), _mm_set1_epi32(2)), _mm_set1_epi32(2)));
+		__m128d v = _mm_or_pd(_mm_and_pd(odd, ps), _mm_andnot_pd(odd, pc));
+		v = _mm_xor_pd(v, _mm_and_pd(neg, _mm_set1_pd(-0.0)));
+
+		acc = _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(a + k), v));
+	}
+
+	double lanes[2];
+	_mm_storeu_pd(lanes, acc);
+	sum = lanes[0] + lanes[1];
+#endif
+
+	for (; k < n; k++)
+		sum += a[k] * cos(b[k] + c[k] * t);
+	return sum;
+}
+
+inline double SumSeries(const MySeries &s, double t)
+{
+	return SumSeries(s.a.data(), s.b.data(), s.c.data(), (int)s.a.size(), t);
+}
+
+// copies the terms above the cutoff into structure of arrays form
+inline void BuildSeries(MySeries *s, const MyVsopTerm *terms, int count, double cutoff)
+{
+	for (int k = 0; k < count; k++) {
+		if (fabs(terms[k].a) < cutoff) continue;
+		s->a.push_back(terms[k].a);
+		s->b.push_back(terms[k].b);
+		s->c.push_back(terms[k].c);
+	}
+	while (s->a.size() % 2) {
+		s->a.push_back(0.0);
+		s->b.push_back(0.0);
+		s->c.push_back(0.0);
+	}
+}
+
+inline void BuildSeries(MyElpSeries *s, const MyElpTerm *terms, int count, double cutoff, bool distance)
+{
+	s->cosine = distance;
+	for (int k = 0; k < count; k++) {
+		double amp = distance ? terms[k].r : terms[k].l;
+		if (amp == 0.0 || fabs(amp) < cutoff) continue;
+		s->amp.push_back(amp);
+		s->d.push_back(terms[k].d);
+		s->m.push_back(terms[k].m);
+		s->mp.push_back(terms[k].mp);
+		s->f.push_back(terms[k].f);
+		s->eExp.push_back(abs(terms[k].m));
+	}
+}
+
+#define EPHEMERIS_COUNT(table) int(sizeof(table) / sizeof(table[0]))
+
+inline void InitializeEphemeris(MyEphemeris *eph)
+{
+	const MyVsopTerm *tablesL[] = { earthL0, earthL1, earthL2, earthL3, earthL4, earthL5 };
+	const int countsL[] = { EPHEMERIS_COUNT(earthL0), EPHEMERIS_COUNT(earthL1), EPHEMERIS_COUNT(earthL2),
+		EPHEMERIS_COUNT(earthL3), EPHEMERIS_COUNT(earthL4), EPHEMERIS_COUNT(earthL5) };
+	const MyVsopTerm *tablesB[] = { earthB0, earthB1 };
+	const int countsB[] = { EPHEMERIS_COUNT(earthB0), EPHEMERIS_COUNT(earthB1) };
+	const MyVsopTerm *tablesR[] = { earthR0, earthR1, earthR2, earthR3, earthR4 };
+	const int countsR[] = { EPHEMERIS_COUNT(earthR0), EPHEMERIS_COUNT(earthR1), EPHEMERIS_COUNT(earthR2),
+		EPHEMERIS_COUNT(earthR3), EPHEMERIS_COUNT(earthR4) };
+
+	for (int tier = 0; tier < EPHEMERIS_TIERS; tier++) {
+		for (int k = 0; k < 6; k++)
+			BuildSeries(&eph->earthL[tier][k], tablesL[k], countsL[k], vsopCutoff[tier]);
+		for (int k = 0; k < 2; k++)
+			BuildSeries(&eph->earthB[tier][k], tablesB[k], countsB[k], vsopCutoff[tier]);
+		for (int k = 0; k < 5; k++)
+			BuildSeries(&eph->earthR[tier][k], tablesR[k], countsR[k], vsopCutoff[tier]);
+
+		BuildSeries(&eph->moonL[tier], moonLR, EPHEMERIS_COUNT(moonLR), elpCutoff[tier], false);
+		BuildSeries(&eph->moonR[tier], moonLR, EPHEMERIS_COUNT(moonLR), elpCutoff[tier], true);
+		BuildSeries(&eph->moonB[tier], moonB, EPHEMERIS_COUNT(moonB), elpCutoff[tier], false);
+	}
+
+	size_t n = EPHEMERIS_COUNT(moonLR);
+	eph->phase.resize(n);
+	eph->amplitude.resize(n);
+	eph->cachedJD = 0.0;
+	eph->cachedTier = -1;
+}
+
+// sum of amp sin(phase) (or cos for distance) of an ELP series with the
+// eccentricity factor E applied to terms in M
+inline double SumElpSeries(MyEphemeris *eph, const MyElpSeries &s,
+	double D, double M, double Mp, double F, double E)
+{
+	const double halfPi = 1.57079632679489662;
+	int n = (int)s.amp.size();
+	double *phase = eph->phase.data();
+	double *amplitude = eph->amplitude.data();
+	double shift = s.cosine ? 0.0 : -halfPi;	// sin x = cos(x - pi/2)
+
+	for (int k = 0; k < n; k++) {
+		phase[k] = s.d[k] * D + s.m[k] * M + s.mp[k] * Mp + s.f[k] * F + shift;
+		amplitude[k] = s.amp[k] * (s.eExp[k] == 0.0 ? 1.0 : s.eExp[k] == 1.0 ? E : E * E);
+	}
+	// zero rates: reuse the phase array as c, multiplied by t = 0
+	return SumSeries(amplitude, phase, phase, n, 0.0);
+}
+
+// evaluates the Earth and Moon positions at the given Julian date (TT), or
+// returns the cached result when neither the date nor the tier changed
+inline const MyEphemerisState &UpdateEphemeris(MyEphemeris *eph, double jd, int tier)
+{
+	if (jd == eph->cachedJD && tier == eph->cachedTier) return eph->state;
+	eph->cachedJD = jd;
+	eph->cachedTier = tier;
+	eph->evaluations++;
+
+	const double deg = 3.14159265358979323846 / 180.0;
+
+	// Earth, VSOP87D: heliocentric ecliptic longitude, latitude and radius
+	double tau = (jd - 2451545.0) / 365250.0;
+	double L = 0.0, B = 0.0, R = 0.0, p = 1.0;
+	for (int k = 0; k < 6; k++, p *= tau) L += SumSeries(eph->earthL[tier][k], tau) * p;
+	p = 1.0;
+	for (int k = 0; k < 2; k++, p *= tau) B += SumSeries(eph->earthB[tier][k], tau) * p;
+	p = 1.0;
+	for (int k = 0; k < 5; k++, p *= tau) R += SumSeries(eph->earthR[tier][k], tau) * p;
+	L *= 1.0e-8;
+	B *= 1.0e-8;
+	R *= 1.0e-8;
+	eph->state.earth = R * glm::dvec3(cos(B) * cos(L), cos(B) * sin(L), sin(B));
+
+	// Moon, ELP-2000/82: fundamental arguments in degrees, T in centuries
+	double T = (jd - 2451545.0) / 36525.0;
+	double T2 = T * T, T3 = T2 * T, T4 = T3 * T;
+	double Lp = 218.3164477 + 481267.88123421 * T - 0.0015786 * T2 + T3 / 538841.0 - T4 / 65194000.0;
+	double D = 297.8501921 + 445267.1114034 * T - 0.0018819 * T2 + T3 / 545868.0 - T4 / 113065000.0;
+	double M = 357.5291092 + 35999.0502909 * T - 0.0001536 * T2 + T3 / 24490000.0;
+	double Mp = 134.9633964 + 477198.8675055 * T + 0.0087414 * T2 + T3 / 69699.0 - T4 / 14712000.0;
+	double F = 93.2720950 + 483202.0175233 * T - 0.0036539 * T2 - T3 / 3526000.0 + T4 / 863310000.0;
+	double A1 = (119.75 + 131.849 * T) * deg;
+	double A2 = (53.09 + 479264.290 * T) * deg;
+	double A3 = (313.45 + 481266.484 * T) * deg;
+	double E = 1.0 - 0.002516 * T - 0.0000074 * T2;
+	Lp = fmod(Lp, 360.0) * deg;
+	D = fmod(D, 360.0) * deg;
+	M = fmod(M, 360.0) * deg;
+	Mp = fmod(Mp, 360.0) * deg;
+	F = fmod(F, 360.0) * deg;
+
+	double sl = SumElpSeries(eph, eph->moonL[tier], D, M, Mp, F, E);
+	double sr = SumElpSeries(eph, eph->moonR[tier], D, M, Mp, F, E);
+	double sb = SumElpSeries(eph, eph->moonB[tier], D, M, Mp, F, E);
+
+	// additive terms for Venus, Jupiter and the Earth's flattening
+	sl += 3958.0 * sin(A1) + 1962.0 * sin(Lp - F) + 318.0 * sin(A2);
+	sb += -2235.0 * sin(Lp) + 382.0 * sin(A3) + 175.0 * sin(A1 - F) + 175.0 * sin(A1 + F) +
+		127.0 * sin(Lp - Mp) - 115.0 * sin(Lp + Mp);
+
+	double lambda = Lp + sl * 1.0e-6 * deg;
+	double beta = sb * 1.0e-6 * deg;
+	double delta = 385000.56 + sr / 1000.0;
+	eph->state.moon = delta * glm::dvec3(cos(beta) * cos(lambda), cos(beta) * sin(lambda), sin(beta));
+
+	return eph->state;
+}
+
+#endif
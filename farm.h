@@ -0,0 +1,199 @@
+#ifndef FARM_H
+#define FARM_H
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#define FARM_AVAILABLE 1
+#endif
+
+// --------------------------------------------------------------------------
+// Render farm on local processes
+//
+// The coordinator splits a range of work into contiguous shares and runs
+// this program once per share. Each worker gets the coordinator's options
+// plus the range option for its share. Frames are split with --render-frames:
+// each worker renders headless and writes one file per frame, numbered in
+// the whole range. The animation time of a frame depends only on its number,
+// so the shares join into one sequence; the N-body simulation, which
+// integrates from the first frame rendered, is not split. A poster is split by image rows
+// with --poster-rows, each worker writing its band into the one file (see
+// poster.h). Each worker's console output goes to a log file next to the
+// output. Once all workers have exited, the coordinator checks that each
+// share's output is complete and reports the throughput of each worker and of the
+// whole farm.
+//
+// Mesa's software rasterizer starts a thread per core in every process. So
+// workers get LP_NUM_THREADS=1 unless it is already set, leaving the
+// parallelism to the processes.
+
+struct MyFarmWorker
+{
+	int     first;			// units (frames or rows) of its share
+	int     count;
+	long    pid;
+	double  seconds;		// from start to exit
+	int     status;			// exit code, or -1 if it did not exit normally
+
+	MyFarmWorker() : first(0), count(0), pid(-1), seconds(0.0), status(-1)
+	{}
+};
+
+// workers actually run for count units, at most one per unit
+inline int FarmWorkerCount(int workers, int count)
+{
+	return std::max(1, std::min(workers, count));
+}
+
+// share k of count units from first, split as evenly as possible
+inline void FarmShare(int first, int count, int workers, int k, int *shareFirst, int *shareCount)
+{
+	int base = count / workers, extra = count % workers;
+	*shareCount = base + (k < extra ? 1 : 0);
+	*shareFirst = first + k * base + std::min(k, extra);
+}
+
+inline double FarmSeconds()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#ifdef FARM_AVAILABLE
+
+// starts a worker for its share, with output to its log file
+inline bool SpawnFarmWorker(MyFarmWorker *w, const char *program, const std::vector<std::string> &args,
+	const char *rangeOption, const char *logFile)
+{
+	std::vector<std::string> all(1, program);
+	all.insert(all.end(), args.begin(), args.end());
+	all.push_back(rangeOption);
+	all.push_back(std::to_string(w->first));
+	all.push_back(std::to_string(w->count));
+	std::vector<char *> argv;
+	for (std::string &a : all) argv.push_back(&a[0]);
+	argv.push_back(0);
+
+	pid_t pid = fork();
+	if (pid < 0) return false;
+	if (pid == 0) {
+		int log = open(logFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (log >= 0) {
+			dup2(log, 1);
+			dup2(log, 2);
+			close(log);
+		}
+		// argv[0] may not be a path; Linux names the running binary
+		if (access("/proc/self/exe", X_OK) == 0) execv("/proc/self/exe", argv.data());
+		execvp(program, argv.data());
+		_exit(127);
+	}
+	w->pid = pid;
+	return true;
+}
+
+// frames named prefix_NNNNNN.extension in [first, first + count) that are
+// missing or empty
+inline int CountMissingFrames(const char *prefix, const char *extension, int first, int count)
+{
+	int missing = 0;
+	char name[512];
+	struct stat st;
+	for (int f = first; f < first + count; f++) {
+		snprintf(name, sizeof(name), "%s_%06d.%s", prefix, f, extension);
+		if (stat(name, &st) != 0 || st.st_size == 0) {
+			if (missing < 10) std::cout << "Missing " << name << std::endl;
+			missing++;
+		}
+	}
+	return missing;
+}
+
+// runs the workers over the units [first, first + count), each given its
+// share with rangeOption and logging to logPrefix_worker_K.log, and reports
+// on them; missing counts the units of a share whose output was not written.
+// Returns the process exit code
+inline int RunFarm(const char *program, const std::vector<std::string> &args, int workers,
+	int first, int count, const char *rangeOption, const char *units, const char *logPrefix,
+	const std::function<int(int first, int count)> &missing)
+{
+	workers = FarmWorkerCount(workers, count);
+	setenv("LP_NUM_THREADS", "1", 0);
+	std::cout << "Rendering " << units << " " << first << " to " << first + count - 1 << " on "
+		<< workers << " worker processes" << std::endl;
+
+	std::vector<MyFarmWorker> farm(workers);
+	std::vector<double> starts(workers);
+	char name[512];
+	double start = FarmSeconds();
+	int running = 0;
+	for (int k = 0; k < workers; k++) {
+		FarmShare(first, count, workers, k, &farm[k].first, &farm[k].count);
+		snprintf(name, sizeof(name), "%s_worker_%d.log", logPrefix, k);
+		starts[k] = FarmSeconds();
+		if (SpawnFarmWorker(&farm[k], program, args, rangeOption, name)) running++;
+		else std::cout << "ERROR: Could not start worker " << k << std::endl;
+	}
+
+	while (running > 0) {
+		int status = 0;
+		pid_t pid = waitpid(-1, &status, 0);
+		if (pid < 0) break;
+		for (int k = 0; k < workers; k++)
+			if (farm[k].pid == pid) {
+				farm[k].seconds = FarmSeconds() - starts[k];
+				farm[k].status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+				running--;
+			}
+	}
+	double seconds = FarmSeconds() - start;
+
+	// all of every share must have been written
+	int lost = 0;
+	bool ok = true;
+	std::cout << std::fixed << std::setprecision(2);
+	for (int k = 0; k < workers; k++) {
+		const MyFarmWorker &w = farm[k];
+		int missed = missing(w.first, w.count);
+		lost += missed;
+		ok = ok && missed == 0;
+		std::cout << "  worker " << k << "  " << units << " " << w.first << "-" << w.first + w.count - 1
+			<< "  " << w.seconds << " s  " << w.count / std::max(w.seconds, 1e-9) << " " << units << "/s";
+		if (missed > 0) std::cout << "  " << missed << " " << units << " missing";
+		if (w.status != 0) std::cout << "  FAILED (" << w.status << ", see " << logPrefix << "_worker_" << k << ".log)";
+		std::cout << std::endl;
+		ok = ok && w.status == 0;
+	}
+	std::cout << "FARM " << units << " " << count - lost << " of " << count << "  workers " << workers
+		<< "  " << seconds << " s  " << (count - lost) / seconds << " " << units << "/s aggregate" << std::endl;
+	return ok ? 0 : 1;
+}
+
+#else
+
+inline int CountMissingFrames(const char *, const char *, int, int count)
+{
+	return count;
+}
+
+inline int RunFarm(const char *, const std::vector<std::string> &, int, int, int, const char *, const char *,
+	const char *, const std::function<int(int, int)> &)
+{
+	std::cout << "The render farm needs POSIX processes (fork/exec) and is not available here" << std::endl;
+	return 1;
+}
+
+#endif
+
+#endif
@@ -8,6 +8,7 @@ in vec3 Colour;
 in vec3 texCoords;
 in vec3 point;
 in vec3 normal;
+in float logDepthW;
 
 // first output is mapped to the framebuffer's colour index by default
 out vec4 FragmentColour;
@@ -20,23 +21,29 @@ uniform sampler2D tex3;	// sun
 uniform sampler2D tex4;	// clouds1
 uniform sampler2D tex5;	// clouds2
 
-// animation progress
-uniform float animation;
-
-// camera location
-uniform vec3 camPoint;
-
-// light source
-uniform vec3 light;
-uniform vec3 specColour;
-uniform float ambient;
-uniform float diffRatio;
-uniform float intensity;
-uniform float glowInt;
-uniform float phong;
-uniform float waterPhong;
-
-uniform float cloudInt;
+// per-frame uniforms, laid out as MyFrameUniforms in uniforms.h
+layout(std140) uniform Frame
+{
+	mat4 view;
+	mat4 proj;
+	vec3 camPoint;
+	float animation;
+	vec3 light;
+	float logDepth;	// 2 / log2(zFar + 1), used when compiled with LOG_DEPTH
+};
+
+// lighting constants, laid out as MyLightingUniforms in uniforms.h
+layout(std140) uniform Lighting
+{
+	vec3 specColour;
+	float ambient;
+	float diffRatio;
+	float intensity;
+	float glowInt;
+	float phong;
+	float waterPhong;
+	float cloudInt;
+};
 
 
 // apply lighting model
@@ -155,4 +162,8 @@ void main(void)
 	}
 
 	FragmentColour = colour;
+	// only log depth writes depth, so the standard program keeps early depth tests
+#ifdef LOG_DEPTH
+	gl_FragDepth = 0.5 * log2(logDepthW) * logDepth;
+#endif
 }
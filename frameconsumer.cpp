@@ -0,0 +1,239 @@
+
+// Sample consumer of the shared-memory frame ring (see framering.h), and a
+// benchmark of the ring against a pipe.
+//
+// Build (Linux): g++ -std=c++11 -O2 frameconsumer.cpp -o frameconsumer -lrt
+//
+// frameconsumer NAME [--raw FILE]
+//     Reads the frames the renderer publishes with --shm-output NAME. Each
+//     frame is read in place in shared memory; with --raw the frames are
+//     written top-down as 8-bit RGBA to FILE, or to stdout for "-" (e.g.
+//     into ffmpeg -f rawvideo -pix_fmt rgba -s WxH -i -). Frames per second,
+//     throughput and the frames the renderer dropped are printed every
+//     second.
+//
+// frameconsumer --bench [WIDTH HEIGHT FRAMES SLOTS]
+//     Sends FRAMES synthetic frames from this process to a forked consumer,
+//     first through a ring, then through a pipe, and prints the throughput
+//     of each. The consumer reads every byte of every frame.
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+#include "framering.h"
+
+#ifdef FRAME_RING_AVAILABLE
+#include <sys/wait.h>
+#endif
+
+using namespace std;
+
+double Seconds()
+{
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// reads every byte, as an encoder would
+uint64_t Checksum(const unsigned char *data, size_t bytes)
+{
+	uint64_t sum = 0, word;
+	size_t k = 0;
+	for (; k + sizeof(word) <= bytes; k += sizeof(word)) {
+		memcpy(&word, data + k, sizeof(word));
+		sum += word;
+	}
+	for (; k < bytes; k++) sum += data[k];
+	return sum;
+}
+
+#ifdef FRAME_RING_AVAILABLE
+
+// --------------------------------------------------------------------------
+// Consumer of the renderer's frames
+
+int Consume(const char *name, const char *rawFile)
+{
+	// diagnostics go to stderr when frames go to stdout
+	bool rawStdout = rawFile && !strcmp(rawFile, "-");
+	ostream &log = rawStdout ? cerr : cout;
+	FILE *raw = 0;
+	if (rawFile) raw = rawStdout ? stdout : fopen(rawFile, "wb");
+	if (rawFile && !raw) {
+		log << "ERROR: Could not open " << rawFile << endl;
+		return -1;
+	}
+
+	MyFrameRing ring;
+	log << "Waiting for /" << name << endl;
+	while (!OpenFrameRing(&ring, name))
+		this_thread::sleep_for(chrono::milliseconds(100));
+	log << "Attached to /" << name << ": " << ring.header->slots << " slots of "
+		<< ring.header->slotBytes << " bytes" << endl;
+
+	long long frames = 0, bytes = 0, reported = 0;
+	uint32_t dropped = ring.header->dropped;
+	uint64_t sum = 0;
+	double start = Seconds(), last = start;
+	while (true) {
+		MyFrameSlotHeader *slot = AcquireFrameRingSlot(&ring, 100);
+		if (slot) {
+			const unsigned char *pixels = FrameRingPixels(slot);
+			size_t size = size_t(slot->stride) * slot->height;
+			if (raw) {
+				for (uint32_t y = slot->height; y-- > 0;)
+					fwrite(pixels + size_t(y) * slot->stride, 1, slot->width * 4, raw);
+			}
+			else sum += Checksum(pixels, size);
+			ReleaseFrameRingSlot(&ring);
+			frames++;
+			bytes += size;
+		}
+		else if (!ring.header->producerAlive) break;
+
+		double now = Seconds();
+		if (now - last >= 1.0) {
+			log << fixed << setprecision(1) << frames << " frames, " << (frames - reported) / (now - last)
+				<< " fps, " << bytes / (now - start) / 1.0e6 << " MB/s, "
+				<< ring.header->dropped - dropped << " dropped by the renderer" << endl;
+			reported = frames;
+			last = now;
+		}
+	}
+	log << "Renderer closed /" << name << " after " << frames << " frames (checksum " << sum << ")" << endl;
+	if (raw && raw != stdout) fclose(raw);
+	CloseFrameRing(&ring);
+	return 0;
+}
+
+// --------------------------------------------------------------------------
+// Throughput benchmark
+
+void PrintThroughput(const char *name, long long frames, size_t frameBytes, double seconds, long long stalls)
+{
+	cout << fixed << setprecision(1) << "BENCH " << left << setw(6) << name << right
+		<< " frames " << frames << "  " << frames / seconds << " fps  "
+		<< frames * double(frameBytes) / seconds / 1.0e9 << " GB/s  " << setprecision(3)
+		<< 1000.0 * seconds / frames << " ms/frame";
+	if (stalls >= 0) cout << "  (producer found the ring full " << stalls << " times)";
+	cout << endl;
+}
+
+// the producer copies a frame into each slot, as the renderer does from a
+// mapped pixel buffer, and waits for a free slot instead of dropping
+void BenchRing(int width, int height, int frames, int slots)
+{
+	size_t frameBytes = size_t(width) * height * 4;
+	char name[64];
+	snprintf(name, sizeof(name), "frameconsumer-bench-%d", int(getpid()));
+	MyFrameRing ring;
+	if (!CreateFrameRing(&ring, name, slots, uint32_t(frameBytes))) {
+		cout << "ERROR: Could not create the ring" << endl;
+		return;
+	}
+
+	pid_t child = fork();
+	if (child == 0) {
+		// the shared mapping is inherited; the parent owns and unlinks it
+		uint64_t sum = 0;
+		for (int k = 0; k < frames;) {
+			MyFrameSlotHeader *slot = AcquireFrameRingSlot(&ring, 100);
+			if (!slot) continue;
+			sum += Checksum(FrameRingPixels(slot), size_t(slot->stride) * slot->height);
+			ReleaseFrameRingSlot(&ring);
+			k++;
+		}
+		_exit(sum == 0);
+	}
+
+	vector<unsigned char> source(frameBytes);
+	for (size_t k = 0; k < frameBytes; k++) source[k] = (unsigned char)(k * 31);
+	long long stalls = 0;
+	double start = Seconds();
+	for (int k = 0; k < frames; k++) {
+		MyFrameSlotHeader *slot;
+		while (!(slot = BeginFrameRingWrite(&ring, uint32_t(frameBytes)))) {
+			stalls++;
+			this_thread::yield();
+		}
+		slot->frame = k;
+		slot->time = Seconds();
+		slot->width = width;
+		slot->height = height;
+		slot->stride = width * 4;
+		slot->format = FRAME_RING_RGBA8_BOTTOM_UP;
+		memcpy(FrameRingPixels(slot), source.data(), frameBytes);
+		EndFrameRingWrite(&ring);
+	}
+	waitpid(child, 0, 0);
+	PrintThroughput("shm", frames, frameBytes, Seconds() - start, stalls);
+	CloseFrameRing(&ring);
+}
+
+// the same frames written into a pipe and read out of it in full
+void BenchPipe(int width, int height, int frames)
+{
+	size_t frameBytes = size_t(width) * height * 4;
+	int fds[2];
+	if (pipe(fds) != 0) return;
+
+	pid_t child = fork();
+	if (child == 0) {
+		close(fds[1]);
+		vector<unsigned char> frame(frameBytes);
+		uint64_t sum = 0;
+		for (int k = 0; k < frames; k++) {
+			for (size_t got = 0; got < frameBytes;) {
+				ssize_t n = read(fds[0], frame.data() + got, frameBytes - got);
+				if (n <= 0) _exit(1);
+				got += n;
+			}
+			sum += Checksum(frame.data(), frameBytes);
+		}
+		_exit(sum == 0);
+	}
+
+	close(fds[0]);
+	vector<unsigned char> source(frameBytes);
+	for (size_t k = 0; k < frameBytes; k++) source[k] = (unsigned char)(k * 31);
+	double start = Seconds();
+	for (int k = 0; k < frames; k++)
+		for (size_t put = 0; put < frameBytes;) {
+			ssize_t n = write(fds[1], source.data() + put, frameBytes - put);
+			if (n <= 0) break;
+			put += n;
+		}
+	close(fds[1]);
+	waitpid(child, 0, 0);
+	PrintThroughput("pipe", frames, frameBytes, Seconds() - start, -1);
+}
+
+#endif
+
+int main(int argc, char *argv[])
+{
+#ifdef FRAME_RING_AVAILABLE
+	if (argc >= 2 && !strcmp(argv[1], "--bench")) {
+		int width = argc > 2 ? atoi(argv[2]) : 1920;
+		int height = argc > 3 ? atoi(argv[3]) : 1080;
+		int frames = argc > 4 ? atoi(argv[4]) : 600;
+		int slots = argc > 5 ? atoi(argv[5]) : 4;
+		cout << "Sending " << frames << " frames of " << width << "x" << height << " RGBA" << endl;
+		BenchRing(width, height, frames, slots);
+		BenchPipe(width, height, frames);
+		return 0;
+	}
+	if (argc >= 2) {
+		const char *rawFile = argc >= 4 && !strcmp(argv[2], "--raw") ? argv[3] : 0;
+		return Consume(argv[1], rawFile);
+	}
+	cout << "Usage: frameconsumer NAME [--raw FILE] | frameconsumer --bench [WIDTH HEIGHT FRAMES SLOTS]" << endl;
+	return 1;
+#else
+	cout << "POSIX shared memory is not available on this platform" << endl;
+	return 1;
+#endif
+}
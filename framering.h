@@ -0,0 +1,254 @@
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <atomic>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define FRAME_RING_AVAILABLE 1
+#endif
+#ifdef __linux__
+#include <climits>
+#include <ctime>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+// --------------------------------------------------------------------------
+// Shared-memory ring of video frames for external encoders
+//
+// The renderer publishes finished frames into a POSIX shared-memory object
+// that a local consumer process maps as well. The object holds a header and
+// a fixed number of slots, each a small frame header and the pixels. A
+// consumer reads a slot's pixels in place, with no copy or pipe between the
+// processes.
+//
+// There is one producer and one consumer. `published` counts the frames
+// written and `consumed` the frames the consumer has finished with. The
+// producer never waits: if every slot still holds an unconsumed frame, the
+// new frame is dropped and counted. The consumer sleeps on `published`
+// with a futex (on Linux, polling elsewhere) and the producer wakes it
+// after each frame. Both counters are 32 bits, as a futex word must be, and
+// wrap around, which the unsigned differences below tolerate.
+
+const uint32_t frameRingMagic = 0x474e5246;	// "FRNG"
+const uint32_t frameRingVersion = 1;
+
+// pixel layouts
+enum FrameRingFormat { FRAME_RING_RGBA8_BOTTOM_UP };
+
+struct MyFrameRingHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slots;
+	uint32_t slotBytes;			// pixel capacity of a slot
+	uint32_t headerBytes;		// offset of the first slot
+	uint32_t slotStride;		// bytes from one slot to the next
+	std::atomic<uint32_t> published;	// futex word, frames written
+	std::atomic<uint32_t> consumed;		// frames released by the consumer
+	std::atomic<uint32_t> dropped;		// frames the producer could not place
+	std::atomic<uint32_t> producerAlive;
+};
+
+struct MyFrameSlotHeader
+{
+	uint64_t frame;			// producer's frame number
+	double   time;			// producer's clock, seconds
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;		// bytes per row
+	uint32_t format;		// FrameRingFormat
+};
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex words must be plain 32-bit integers");
+
+const uint32_t frameRingAlignment = 4096;	// slots start on page boundaries
+
+// a mapping of the ring, on either side
+struct MyFrameRing
+{
+	MyFrameRingHeader *header;
+	size_t  bytes;
+	char    name[256];
+	bool    owner;			// created it, and unlinks it
+
+	MyFrameRing() : header(0), bytes(0), owner(false)
+	{
+		name[0] = 0;
+	}
+};
+
+inline size_t FrameRingBytes(uint32_t slots, uint32_t slotBytes)
+{
+	size_t headerBytes = (sizeof(MyFrameRingHeader) + frameRingAlignment - 1) / frameRingAlignment * frameRingAlignment;
+	size_t stride = (sizeof(MyFrameSlotHeader) + slotBytes + frameRingAlignment - 1) / frameRingAlignment * frameRingAlignment;
+	return headerBytes + slots * stride;
+}
+
+inline MyFrameSlotHeader *FrameRingSlot(const MyFrameRing *ring, uint32_t index)
+{
+	char *base = (char *)ring->header + ring->header->headerBytes;
+	return (MyFrameSlotHeader *)(base + size_t(index % ring->header->slots) * ring->header->slotStride);
+}
+
+inline unsigned char *FrameRingPixels(MyFrameSlotHeader *slot)
+{
+	return (unsigned char *)(slot + 1);
+}
+
+// sleeps while *word == value, or until the timeout
+inline void FrameRingWait(std::atomic<uint32_t> *word, uint32_t value, int timeoutMs)
+{
+#ifdef __linux__
+	timespec timeout = { timeoutMs / 1000, (timeoutMs % 1000) * 1000000L };
+	syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, value, &timeout, 0, 0);
+#else
+	(void)value;
+	std::this_thread::sleep_for(std::chrono::milliseconds(std::min(timeoutMs, 1)));
+#endif
+}
+
+inline void FrameRingWake(std::atomic<uint32_t> *word)
+{
+#ifdef __linux__
+	syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+#else
+	(void)word;
+#endif
+}
+
+#ifdef FRAME_RING_AVAILABLE
+
+inline void CloseFrameRing(MyFrameRing *ring)
+{
+	if (ring->header) {
+		if (ring->owner) {
+			ring->header->producerAlive.store(0);
+			FrameRingWake(&ring->header->published);
+		}
+		munmap(ring->header, ring->bytes);
+		if (ring->owner) shm_unlink(ring->name);
+	}
+	*ring = MyFrameRing();
+}
+
+// creates the shared-memory object "/name" for the producer, replacing a
+// stale one, returning true if successful
+inline bool CreateFrameRing(MyFrameRing *ring, const char *name, uint32_t slots, uint32_t slotBytes)
+{
+	snprintf(ring->name, sizeof(ring->name), "/%s", name);
+	ring->bytes = FrameRingBytes(slots, slotBytes);
+	shm_unlink(ring->name);
+	int fd = shm_open(ring->name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd < 0) return false;
+	void *p = MAP_FAILED;
+	if (ftruncate(fd, ring->bytes) == 0)
+		p = mmap(0, ring->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		shm_unlink(ring->name);
+		return false;
+	}
+	ring->header = (MyFrameRingHeader *)p;
+	ring->owner = true;
+
+	// the object starts zeroed; the magic is written last
+	MyFrameRingHeader *h = ring->header;
+	h->version = frameRingVersion;
+	h->slots = slots;
+	h->slotBytes = slotBytes;
+	h->headerBytes = uint32_t(FrameRingBytes(0, 0));
+	h->slotStride = uint32_t((ring->bytes - h->headerBytes) / slots);
+	h->producerAlive.store(1);
+	std::atomic_thread_fence(std::memory_order_release);
+	h->magic = frameRingMagic;
+	return true;
+}
+
+// maps an existing ring for the consumer, skipping frames published before
+// it attached, returning true if successful
+inline bool OpenFrameRing(MyFrameRing *ring, const char *name)
+{
+	snprintf(ring->name, sizeof(ring->name), "/%s", name);
+	int fd = shm_open(ring->name, O_RDWR, 0);
+	if (fd < 0) return false;
+	struct stat st;
+	void *p = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(MyFrameRingHeader))
+		p = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) return false;
+	ring->header = (MyFrameRingHeader *)p;
+	ring->bytes = st.st_size;
+	MyFrameRingHeader *h = ring->header;
+	if (h->magic != frameRingMagic || h->version != frameRingVersion ||
+		FrameRingBytes(h->slots, h->slotBytes) > ring->bytes) {
+		CloseFrameRing(ring);
+		return false;
+	}
+	h->consumed.store(h->published.load(std::memory_order_acquire), std::memory_order_release);
+	return true;
+}
+
+#else
+
+// no POSIX shared memory (Windows): the sink is unavailable
+inline void CloseFrameRing(MyFrameRing *ring) { *ring = MyFrameRing(); }
+inline bool CreateFrameRing(MyFrameRing *, const char *, uint32_t, uint32_t) { return false; }
+inline bool OpenFrameRing(MyFrameRing *, const char *) { return false; }
+
+#endif
+
+// producer: the slot for the next frame, or 0 if every slot is still
+// waiting for the consumer (the frame is then counted as dropped)
+inline MyFrameSlotHeader *BeginFrameRingWrite(MyFrameRing *ring, uint32_t bytes)
+{
+	MyFrameRingHeader *h = ring->header;
+	uint32_t published = h->published.load(std::memory_order_relaxed);
+	if (bytes > h->slotBytes || published - h->consumed.load(std::memory_order_acquire) >= h->slots) {
+		h->dropped.fetch_add(1, std::memory_order_relaxed);
+		return 0;
+	}
+	return FrameRingSlot(ring, published);
+}
+
+// producer: makes the written slot visible and wakes the consumer
+inline void EndFrameRingWrite(MyFrameRing *ring)
+{
+	MyFrameRingHeader *h = ring->header;
+	h->published.fetch_add(1, std::memory_order_release);
+	FrameRingWake(&h->published);
+}
+
+// consumer: the oldest unconsumed frame, waiting up to timeoutMs for one;
+// 0 on timeout
+inline MyFrameSlotHeader *AcquireFrameRingSlot(MyFrameRing *ring, int timeoutMs)
+{
+	MyFrameRingHeader *h = ring->header;
+	uint32_t consumed = h->consumed.load(std::memory_order_relaxed);
+	uint32_t published = h->published.load(std::memory_order_acquire);
+	if (published == consumed) {
+		FrameRingWait(&h->published, published, timeoutMs);
+		published = h->published.load(std::memory_order_acquire);
+		if (published == consumed) return 0;
+	}
+	return FrameRingSlot(ring, consumed);
+}
+
+// consumer: hands the slot from AcquireFrameRingSlot back to the producer
+inline void ReleaseFrameRingSlot(MyFrameRing *ring)
+{
+	ring->header->consumed.fetch_add(1, std::memory_order_release);
+}
+
+#endif
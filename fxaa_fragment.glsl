@@ -0,0 +1,45 @@
+#version 410
+
+// FXAA: blurs along the local edge direction found from the luma of the
+// four diagonal neighbours, with a fallback to a narrower blur when the wide
+// one leaves the local luma range
+
+out vec4 FragmentColour;
+
+uniform sampler2D source;	// resolved scene
+uniform vec2 texelSize;		// of the source texture
+uniform vec2 sourceMax;		// largest coordinate inside the drawn region
+
+const float REDUCE_MIN = 1.0 / 128.0;
+const float REDUCE_MUL = 1.0 / 8.0;
+const float SPAN_MAX = 8.0;
+const vec3 LUMA = vec3(0.299, 0.587, 0.114);
+
+vec3 fetch(vec2 uv)
+{
+	return texture(source, min(uv, sourceMax)).rgb;
+}
+
+void main(void)
+{
+	vec2 uv = gl_FragCoord.xy * texelSize;
+	vec3 rgbM = fetch(uv);
+	float lumaNW = dot(fetch(uv + vec2(-1.0, 1.0) * texelSize), LUMA);
+	float lumaNE = dot(fetch(uv + vec2(1.0, 1.0) * texelSize), LUMA);
+	float lumaSW = dot(fetch(uv + vec2(-1.0, -1.0) * texelSize), LUMA);
+	float lumaSE = dot(fetch(uv + vec2(1.0, -1.0) * texelSize), LUMA);
+	float lumaM = dot(rgbM, LUMA);
+	float lumaMin = min(lumaM, min(min(lumaNW, lumaNE), min(lumaSW, lumaSE)));
+	float lumaMax = max(lumaM, max(max(lumaNW, lumaNE), max(lumaSW, lumaSE)));
+
+	// direction across the edge
+	vec2 dir = vec2(-((lumaNW + lumaNE) - (lumaSW + lumaSE)), (lumaNW + lumaSW) - (lumaNE + lumaSE));
+	float reduce = max((lumaNW + lumaNE + lumaSW + lumaSE) * 0.25 * REDUCE_MUL, REDUCE_MIN);
+	float scale = 1.0 / (min(abs(dir.x), abs(dir.y)) + reduce);
+	dir = clamp(dir * scale, -SPAN_MAX, SPAN_MAX) * texelSize;
+
+	vec3 rgbA = 0.5 * (fetch(uv + dir * (1.0 / 3.0 - 0.5)) + fetch(uv + dir * (2.0 / 3.0 - 0.5)));
+	vec3 rgbB = 0.5 * rgbA + 0.25 * (fetch(uv - 0.5 * dir) + fetch(uv + 0.5 * dir));
+	float lumaB = dot(rgbB, LUMA);
+	FragmentColour = vec4(lumaB < lumaMin || lumaB > lumaMax ? rgbA : rgbB, 1.0);
+}
@@ -0,0 +1,357 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include "arena.h"
+
+// --------------------------------------------------------------------------
+// Work-stealing job pool
+//
+// Every worker owns a deque of jobs. A worker pops its own newest job first
+// (good cache locality for recursive splits) and steals the oldest job of
+// another worker when its own deque runs dry. The thread that starts the pool
+// owns queue 0, and further queues can be reserved for other long-lived
+// threads that queue jobs (the simulation thread); each such thread sets
+// JobQueueIndex to its queue and helps execute jobs while it waits for them.
+//
+// A job may depend on a counter: it is held back until every job of that
+// counter has finished, then queued by the thread that finished the last one.
+// Each queue also counts the jobs its thread ran, how many it stole and how
+// long it was busy, for utilization reports.
+//
+// Jobs are intrusive list nodes taken from a block pool, so once the pool
+// has grown to the working set, queueing jobs does not allocate. Job bodies
+// should capture at most two pointers' worth of trivially copyable data to
+// stay inside std::function's local storage.
+
+struct MyJobCounter;
+
+struct MyJob
+{
+	std::function<void()> run;
+	MyJobCounter *counter;
+	MyJob *prev, *next;		// queue or continuation list links
+
+	MyJob() : counter(0), prev(0), next(0)
+	{}
+};
+
+struct MyJobCounter
+{
+	std::atomic<int> pending;
+
+	// jobs waiting for this counter to reach zero
+	std::mutex lock;
+	MyJob *continuations;
+
+	MyJobCounter() : pending(0), continuations(0)
+	{}
+};
+
+struct MyJobQueue
+{
+	std::mutex lock;
+	MyJob *head;	// oldest
+	MyJob *tail;	// newest
+
+	// utilization counters of the thread owning the queue
+	std::atomic<long long> jobsRun;
+	std::atomic<long long> jobsStolen;
+	std::atomic<long long> busyNs;
+
+	MyJobQueue() : head(0), tail(0), jobsRun(0), jobsStolen(0), busyNs(0)
+	{}
+};
+
+struct MyJobPool
+{
+	std::vector<std::thread> threads;
+	std::vector<MyJobQueue *> queues;	// queue 0 belongs to the owning thread
+	int     owners;						// queues of threads other than the workers
+	std::atomic<int> queued;
+	std::atomic<bool> quit;
+	std::mutex sleepLock;
+	std::condition_variable wake;
+
+	// storage for jobs
+	std::mutex blockLock;
+	MyBlockPool blocks;
+
+	// jobs of the current frame, see PushFrameJob and WaitFrameJobs
+	MyJobCounter frame;
+
+	MyJobPool() : owners(0), queued(0), quit(false)
+	{}
+};
+
+// utilization of one thread over an interval
+struct MyJobStats
+{
+	long long jobsRun;
+	long long jobsStolen;
+	double busy;		// fraction of the interval spent running jobs
+};
+
+// index of the queue owned by the calling thread
+inline int &JobQueueIndex()
+{
+	thread_local int index = 0;
+	return index;
+}
+
+inline MyJob *NewJob(MyJobPool *pool)
+{
+	std::lock_guard<std::mutex> guard(pool->blockLock);
+	return PoolNew<MyJob>(&pool->blocks);
+}
+
+inline void DeleteJob(MyJobPool *pool, MyJob *job)
+{
+	std::lock_guard<std::mutex> guard(pool->blockLock);
+	PoolDelete(&pool->blocks, job);
+}
+
+// unlinks a job from its queue, which must be locked
+inline void UnlinkJob(MyJobQueue *q, MyJob *job)
+{
+	(job->prev ? job->prev->next : q->head) = job->next;
+	(job->next ? job->next->prev : q->tail) = job->prev;
+	job->prev = job->next = 0;
+}
+
+inline MyJob *PopJob(MyJobPool *pool, int index)
+{
+	// own queue first, newest job
+	{
+		MyJobQueue *q = pool->queues[index];
+		std::lock_guard<std::mutex> guard(q->lock);
+		if (MyJob *job = q->tail) {
+			UnlinkJob(q, job);
+			pool->queued--;
+			return job;
+		}
+	}
+
+	// steal the oldest job from the other queues
+	int n = (int)pool->queues.size();
+	for (int k = 1; k < n; k++) {
+		MyJobQueue *q = pool->queues[(index + k) % n];
+		std::lock_guard<std::mutex> guard(q->lock);
+		if (MyJob *job = q->head) {
+			UnlinkJob(q, job);
+			pool->queued--;
+			pool->queues[index]->jobsStolen++;
+			return job;
+		}
+	}
+	return 0;
+}
+
+inline void QueueJob(MyJobPool *pool, MyJob *job);
+
+// signals a finished job and queues the jobs held back by the counter once
+// it reaches zero. The counter is only touched under its lock, so a waiter
+// that saw zero can take the lock to know the counter is no longer in use.
+inline void FinishJob(MyJobPool *pool, MyJobCounter *counter)
+{
+	MyJob *ready = 0;
+	{
+		std::lock_guard<std::mutex> guard(counter->lock);
+		if (--counter->pending == 0) {
+			ready = counter->continuations;
+			counter->continuations = 0;
+		}
+	}
+	while (ready) {
+		MyJob *next = ready->next;
+		ready->next = 0;
+		QueueJob(pool, ready);
+		ready = next;
+	}
+}
+
+// runs a job and signals its counter; busy time is only measured for the
+// outermost job, as a job waiting on others runs them itself
+inline void RunJob(MyJobPool *pool, int index, MyJob *job)
+{
+	thread_local int depth = 0;
+	std::chrono::steady_clock::time_point start;
+	if (depth == 0) start = std::chrono::steady_clock::now();
+
+	depth++;
+	job->run();
+	depth--;
+
+	MyJobQueue *q = pool->queues[index];
+	q->jobsRun++;
+	if (depth == 0)
+		q->busyNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	if (job->counter) FinishJob(pool, job->counter);
+	DeleteJob(pool, job);
+}
+
+inline void WorkerLoop(MyJobPool *pool, int index)
+{
+	JobQueueIndex() = index;
+	while (!pool->quit) {
+		if (MyJob *job = PopJob(pool, index)) {
+			RunJob(pool, index, job);
+			continue;
+		}
+
+		// nothing to do, sleep until new jobs are queued
+		std::unique_lock<std::mutex> guard(pool->sleepLock);
+		pool->wake.wait(guard, [pool] { return pool->quit || pool->queued > 0; });
+	}
+}
+
+// starts the pool with the given number of worker threads (-1 = one per core,
+// leaving the calling thread as the extra worker), reserving queues 0 to
+// owners - 1 for the calling thread and other threads that queue jobs
+inline void StartJobs(MyJobPool *pool, int workers = -1, int owners = 1)
+{
+	if (workers < 0) workers = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+
+	pool->quit = false;
+	pool->owners = owners;
+	InitializePool(&pool->blocks, sizeof(MyJob));
+	for (int k = 0; k < owners + workers; k++)
+		pool->queues.push_back(new MyJobQueue);
+	for (int k = owners; k < owners + workers; k++)
+		pool->threads.push_back(std::thread(WorkerLoop, pool, k));
+}
+
+inline void StopJobs(MyJobPool *pool)
+{
+	{
+		std::lock_guard<std::mutex> guard(pool->sleepLock);
+		pool->quit = true;
+	}
+	pool->wake.notify_all();
+	for (std::thread &t : pool->threads) t.join();
+	for (MyJobQueue *q : pool->queues) delete q;
+	pool->threads.clear();
+	pool->queues.clear();
+	DestroyPool(&pool->blocks);
+}
+
+// places a runnable job on the calling thread's deque and wakes a worker
+inline void QueueJob(MyJobPool *pool, MyJob *job)
+{
+	MyJobQueue *q = pool->queues[JobQueueIndex()];
+	{
+		std::lock_guard<std::mutex> guard(q->lock);
+		job->prev = q->tail;
+		(q->tail ? q->tail->next : q->head) = job;
+		q->tail = job;
+		pool->queued++;
+	}
+	{
+		std::lock_guard<std::mutex> guard(pool->sleepLock);
+	}
+	pool->wake.notify_one();
+}
+
+// queues a job, signalling counter when it finishes; with after, the job only
+// becomes runnable once every job of that counter has finished
+inline void PushJob(MyJobPool *pool, std::function<void()> run, MyJobCounter *counter,
+	MyJobCounter *after = 0)
+{
+	MyJob *job = NewJob(pool);
+	job->run = std::move(run);
+	job->counter = counter;
+	if (counter) counter->pending++;
+
+	if (after) {
+		std::lock_guard<std::mutex> guard(after->lock);
+		if (after->pending > 0) {
+			job->next = after->continuations;
+			after->continuations = job;
+			return;
+		}
+	}
+	QueueJob(pool, job);
+}
+
+// executes queued jobs until the counter drops to zero
+inline void WaitJobs(MyJobPool *pool, MyJobCounter *counter)
+{
+	int index = JobQueueIndex();
+	while (counter->pending > 0) {
+		if (MyJob *job = PopJob(pool, index)) RunJob(pool, index, job);
+		else std::this_thread::yield();
+	}
+
+	// the thread that finished the last job may still hold the lock
+	std::lock_guard<std::mutex> guard(counter->lock);
+}
+
+// queues a job belonging to the current frame
+inline void PushFrameJob(MyJobPool *pool, std::function<void()> run, MyJobCounter *after = 0)
+{
+	PushJob(pool, std::move(run), &pool->frame, after);
+}
+
+// waits for every job of the current frame, including jobs still held back
+// by dependencies
+inline void WaitFrameJobs(MyJobPool *pool)
+{
+	WaitJobs(pool, &pool->frame);
+}
+
+// number of threads running jobs, including the threads owning the
+// reserved queues
+inline int JobThreads(const MyJobPool *pool)
+{
+	return (int)pool->queues.size();
+}
+
+// utilization counters of one thread since the last reset, over the given
+// wall time in seconds
+inline MyJobStats GetJobStats(const MyJobPool *pool, int index, double seconds)
+{
+	const MyJobQueue *q = pool->queues[index];
+	MyJobStats stats;
+	stats.jobsRun = q->jobsRun;
+	stats.jobsStolen = q->jobsStolen;
+	stats.busy = seconds > 0.0 ? q->busyNs * 1.0e-9 / seconds : 0.0;
+	return stats;
+}
+
+inline void ResetJobStats(MyJobPool *pool)
+{
+	for (MyJobQueue *q : pool->queues) {
+		q->jobsRun = 0;
+		q->jobsStolen = 0;
+		q->busyNs = 0;
+	}
+}
+
+// runs body(first, last) over [begin, end) in chunks of at most grain items,
+// returning when every chunk has finished; the body is taken by reference so
+// that its captures never need to fit a job
+template <typename Body>
+inline void ParallelFor(MyJobPool *pool, int begin, int end, int grain, const Body &body)
+{
+	if (end <= begin) return;
+	if (pool->queues.empty() || end - begin <= grain) {
+		body(begin, end);
+		return;
+	}
+
+	MyJobCounter counter;
+	for (int first = begin; first < end; first += grain) {
+		int last = std::min(end, first + grain);
+		PushJob(pool, [&body, first, last] { body(first, last); }, &counter);
+	}
+	WaitJobs(pool, &counter);
+}
+
+#endif
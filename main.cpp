@@ -3,11 +3,20 @@
 #include <fstream>
 #include <algorithm>
 #include <string>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
 #include <iterator>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/rotate_vector.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/quaternion.hpp>
 
 // Specify that we want the OpenGL core profile before including GLFW headers
 #ifndef LAB_LINUX
@@ -18,8 +27,37 @@
 #endif
 #include <GLFW/glfw3.h>
 
+// synchronous glGetError checks in per-frame code; they can stall the
+// pipeline, so release builds (NDEBUG) compile them out unless this is set
+#ifndef GL_FRAME_CHECKS
+#ifdef NDEBUG
+#define GL_FRAME_CHECKS 0
+#else
+#define GL_FRAME_CHECKS 1
+#endif
+#endif
+
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#include "minorbodies.h"
+#include "sgp4.h"
+#include "ephemeris.h"
+#include "chebyshev.h"
+#include "nbody.h"
+#include "jobs.h"
+#include "benchmark.h"
+#include "triplebuffer.h"
+#include "arena.h"
+#include "culling.h"
+#include "renderscale.h"
+#include "uniforms.h"
+#include "framering.h"
+#include "farm.h"
+#include "poster.h"
+#include "stars.h"
 
 using namespace std;
 using namespace glm;
@@ -29,14 +67,16 @@ using namespace glm;
 
 const float piVal = 3.14159265359;
 const int maxShapes = 65536;
-const int wWidth = 1920;
-const int wHeight = 1080;
+int wWidth = 1920;
+int wHeight = 1080;
+bool windowSizeGiven = false;	// by --window
 const bool showWireframe = true;
-const bool antialiasing = true;
 
 // field of view
 float fovDegrees = 38.0;
 float fov = fovDegrees * piVal / 180.0;
+float minFov = 0.1 * piVal / 180.0;
+float maxFov = 90.0 * piVal / 180.0;
 
 // camera
 int camFocus = 0;
@@ -50,22 +90,39 @@ float zoomSpeed = 2.0;
 float maxDistance = 500.0;
 float minDistance = 5.0;
 
-// animation
-bool animate = true;
-double animSpeed = 4.0;
+// animation, set by input and read by the simulation thread
+atomic<bool> animate(true);
+atomic<double> animSpeed(4.0);
 double minSpeed = 0.1;
 double maxSpeed = 500.0;
 double speedInterval = 1.2;
 double lastFrameTime;
+bool simulationThread = true;	// simulate on a separate thread, or inline once per frame
+int jobThreads = 0;				// job pool threads including the main thread, 0 = one per core
 
 // scaling values
 double unit = 1111.1; // km
 double factor = 0.5;
 double base = 2.0;
 
+// true-scale mode: linear distances instead of log-compressed ones, with a
+// logarithmic depth buffer so metres to AU fit in a single pass
+bool trueScale = false;
+bool logDepth = false;			// also usable on its own
+double trueScaleUnit = 1000.0;	// km per scene unit
+float trueZoomFactor = 1.25;	// altitude ratio per mouse wheel step
+
 // star values
 char starTexture[] = "stars.png";
 float starResolution = 40.0; // #of divisions per polar coordinate
+double starsR = maxDistance + 0.65;
+const char *starFile = 0;		// binary star catalog, the texture is shown without one
+float starLimit = 6.5;			// faintest magnitude at the default field of view and window size
+float starSize = 6.0;			// point size in pixels of the brightest stars
+float starMinSize = 1.5;		// point size in pixels of stars at the limit
+float starColour[] = { 1.0, 1.0, 1.0 };
+float obliquity = 23.4392911 * piVal / 180.0;	// of the ecliptic at J2000, degrees -> radians
+float backgroundGrey = 0.2;		// clear colour, black under a star catalog
 
 // earth values
 char earthTexture[] = "earth.png";
@@ -103,14 +160,215 @@ float phong = 2.0;			// normal phong exponent
 float waterPhong = 48.0;	// phong exponent for water
 float specColour[] = { 0.1, 0.1, 0.1 };	// specular colour
 
-// model rotation
+// minor body values
+int minorBodyCount = 0;			// size of the synthetic main belt, 0 disables it
+atomic<bool> gpuPropagation(true);	// propagate with transform feedback instead of the CPU
+float minorBodySize = 2.0;		// point size in pixels
+float minorBodyColour[] = { 0.8, 0.75, 0.65 };
+
+// satellite values
+const char *satelliteFile = 0;	// local TLE catalog, none by default
+float satelliteSize = 2.0;		// point size in pixels
+float satelliteColour[] = { 0.55, 0.8, 1.0 };
+
+// simulation time
+double epochJD = 2451545.0;		// Julian date at yangle = 0 (J2000)
+
+// ephemeris accuracy tier (EphemerisTier), -1 animates fixed circular orbits
+atomic<int> ephemerisTier(-1);
+const char *ephemerisTierNames[] = { "low", "medium", "high" };
+MyEphemeris ephemeris;
+
+// precomputed Chebyshev ephemeris, used instead of the series when loaded
+const char *ephemerisFile = 0;
+MyChebFile chebEphemeris;
+int chebEarth = -1, chebMoon = -1;
+
+// N-body simulation values
+atomic<bool> nbodyMode(false);	// integrate the Sun, Earth, Moon and particles under mutual gravity
+atomic<int> nbodyParticles(0);	// test particles injected when the simulation starts
+int nbodyIntegrator = NBODY_YOSHIDA;
+double nbodyMaxStep = 0.05;		// days per substep
+int nbodyMaxSubsteps = 64;		// per frame, longer jumps restart the simulation
+float particleSize = 2.0;		// point size in pixels
+float particleColour[] = { 1.0, 0.6, 0.35 };
+MyNBody nbody;
+
+// CPU job pool and benchmark mode; the main thread owns queue 0 and the
+// simulation thread queue 1
+MyJobPool jobs;
+const int simulationJobQueue = 1;
+MyBenchmark benchmark;
+
+// per-frame temporaries and heap allocation checks
+const size_t frameArenaBytes = 4 << 20;
+MyFrameArena frameArena;		// reset at the start of every frame
+bool allocationTrap = false;	// abort on heap use during steady-state frames
+int allocationWarmupFrames = 120;
+
+// frustum and occlusion culling of bodies and point set chunks
+bool frustumCulling = true;
+MyCullStats cullStats;			// counts of the last frame
+
+// model rotation, yangle is owned by the simulation and kept in double so
+// that it stays accurate however long the animation runs
 float xangle = piVal / 2.0;
-float yangle = 0.0;
+double yangle = 0.0;
+
+// requests from input to the simulation thread
+atomic<int> yearJumps(0);			// years to jump forward (negative: back)
+atomic<int> particleInjections(0);	// batches of test particles to inject
+atomic<bool> nbodyRestart(false);	// restart the N-body simulation
+atomic<bool> simulationRequest(false);	// step once even while paused
+mutex simulationWakeLock;
+condition_variable simulationWake;	// wakes a paused simulation thread
+
+// dynamic resolution, off unless a GPU time budget is given
+MyRenderScale renderScale;
+
+// on-demand rendering: frames are drawn only when something changed
+bool onDemand = false;
+double frameCap = 0.0;				// frames per second, 0 = uncapped
+atomic<bool> sceneDirty(true);		// set by input and new simulation states
+
+// offline rendering of numbered frames, headless, optionally split across
+// worker processes
+int renderFirst = 0;
+int renderCount = 0;			// frames for --render-frames, 0 = interactive
+int farmWorkers = 0;			// processes for --farm
+
+// tiled rendering of one still far larger than the window (--poster)
+MyPoster poster;
 
 // mouse
 double mousex, mousey;
 bool rotating = false;
 
+// --------------------------------------------------------------------------
+// Global allocation functions, counting heap use (see arena.h)
+//
+// Every replaceable form is defined (sized, nothrow and over-aligned), so
+// that no allocation bypasses the counters and the --alloc-trap check.
+
+void *operator new(size_t size)
+{
+	CountAllocation(size);
+	void *p = malloc(size ? size : 1);
+	if (!p) throw bad_alloc();
+	return p;
+}
+
+void operator delete(void *p) noexcept
+{
+	if (p) CountFree();
+	free(p);
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete[](void *p) noexcept
+{
+	operator delete(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	operator delete(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+	operator delete(p);
+}
+
+void *operator new(size_t size, const nothrow_t &) noexcept
+{
+	CountAllocation(size);
+	return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const nothrow_t &) noexcept
+{
+	return operator new(size, nothrow);
+}
+
+void operator delete(void *p, const nothrow_t &) noexcept
+{
+	operator delete(p);
+}
+
+void operator delete[](void *p, const nothrow_t &) noexcept
+{
+	operator delete(p);
+}
+
+#ifdef __cpp_aligned_new
+// over-aligned types: the block from malloc is padded to the alignment, and
+// its address is kept just below the aligned pointer for the delete
+void *operator new(size_t size, align_val_t alignment, const nothrow_t &) noexcept
+{
+	CountAllocation(size);
+	size_t align = std::max(size_t(alignment), sizeof(void *));
+	void *block = malloc(size + align + sizeof(void *));
+	if (!block) return 0;
+	uintptr_t p = (uintptr_t(block) + sizeof(void *) + align - 1) & ~uintptr_t(align - 1);
+	((void **)p)[-1] = block;
+	return (void *)p;
+}
+
+void *operator new(size_t size, align_val_t alignment)
+{
+	void *p = operator new(size, alignment, nothrow);
+	if (!p) throw bad_alloc();
+	return p;
+}
+
+void operator delete(void *p, align_val_t) noexcept
+{
+	if (!p) return;
+	CountFree();
+	free(((void **)p)[-1]);
+}
+
+void *operator new[](size_t size, align_val_t alignment)
+{
+	return operator new(size, alignment);
+}
+
+void *operator new[](size_t size, align_val_t alignment, const nothrow_t &) noexcept
+{
+	return operator new(size, alignment, nothrow);
+}
+
+void operator delete[](void *p, align_val_t alignment) noexcept
+{
+	operator delete(p, alignment);
+}
+
+void operator delete(void *p, size_t, align_val_t alignment) noexcept
+{
+	operator delete(p, alignment);
+}
+
+void operator delete[](void *p, size_t, align_val_t alignment) noexcept
+{
+	operator delete(p, alignment);
+}
+
+void operator delete(void *p, align_val_t alignment, const nothrow_t &) noexcept
+{
+	operator delete(p, alignment);
+}
+
+void operator delete[](void *p, align_val_t alignment, const nothrow_t &) noexcept
+{
+	operator delete(p, alignment);
+}
+#endif
+
 // --------------------------------------------------------------------------
 // OpenGL utility and support function prototypes
 
@@ -118,349 +376,2273 @@ void QueryGLVersion();
 bool CheckGLErrors();
 
 string LoadSource(const string &filename);
+string DefineInSource(const string &source, const char *name);
 GLuint CompileShader(GLenum shaderType, const string &source);
-GLuint LinkProgram(GLuint vertexShader, GLuint fragmentShader);
-
-// --------------------------------------------------------------------------
-// Functions to set up OpenGL shader programs for rendering
+GLuint LinkProgram(GLuint vertexShader, GLuint fragmentShader, const char *feedbackVarying = 0,
+	GLuint geometryShader = 0);
+void InvalidateGLState();
 
+// shader programs and textures, set up by the functions defined below; the
+// trace replay (trace.h) builds its objects with them too
 struct MyShader
 {
-	// OpenGL names for vertex and fragment shaders, shader program
+	// OpenGL names for vertex, geometry and fragment shaders, shader program
 	GLuint  vertex;
+	GLuint  geometry;
 	GLuint  fragment;
 	GLuint  program;
 
 	// initialize shader and program names to zero (OpenGL reserved value)
-	MyShader() : vertex(0), fragment(0), program(0)
+	MyShader() : vertex(0), geometry(0), fragment(0), program(0)
 	{}
 };
 
-// load, compile, and link shaders, returning true if successful
-bool InitializeShaders(MyShader *shader)
+bool InitializeShaders(MyShader *shader, const char *vertexFile = "vertex.glsl",
+	const char *fragmentFile = "fragment.glsl", const char *geometryFile = 0);
+void DestroyShaders(MyShader *shader);
+
+struct MyTexture
 {
-	// load shader source from files
-	string vertexSource = LoadSource("vertex.glsl");
-	string fragmentSource = LoadSource("fragment.glsl");
-	if (vertexSource.empty() || fragmentSource.empty()) return false;
+	GLuint textureID;
+	GLuint target;
+	int width;
+	int height;
 
-	// compile shader source into shader objects
-	shader->vertex = CompileShader(GL_VERTEX_SHADER, vertexSource);
-	shader->fragment = CompileShader(GL_FRAGMENT_SHADER, fragmentSource);
+	// initialize object names to zero (OpenGL reserved value)
+	MyTexture() : textureID(0), target(0), width(0), height(0)
+	{}
+};
 
-	// link shader program
-	shader->program = LinkProgram(shader->vertex, shader->fragment);
+bool InitializeTexture(MyTexture* texture, const char* filename, GLuint target = GL_TEXTURE_2D);
 
-	// check for OpenGL errors and return false if error occurred
+// --------------------------------------------------------------------------
+// OpenGL debug output
+//
+// Where the driver offers KHR_debug or ARB_debug_output, errors and warnings
+// arrive through a callback instead of being polled with glGetError, which
+// can stall the pipeline. The context is 4.1, so the entry points are loaded
+// at runtime. Messages below the chosen severity are filtered by the driver
+// and again in the callback. A message already seen (same source, type and
+// id) is counted instead of printed again. The table of seen messages has a
+// fixed size so the callback never allocates, and it is locked because the
+// driver may call from its own thread.
+
+// KHR_debug values, missing from the 4.0 loader
+const GLenum debugOutput = 0x92E0;
+const GLenum debugSeverityHigh = 0x9146;
+const GLenum debugSeverityMedium = 0x9147;
+const GLenum debugSeverityLow = 0x9148;
+const GLenum debugSeverityNotification = 0x826B;
+const GLenum debugTypeError = 0x824C;
+const GLenum debugTypeDeprecated = 0x824D;
+const GLenum debugTypeUndefined = 0x824E;
+const GLenum debugTypePortability = 0x824F;
+const GLenum debugTypePerformance = 0x8250;
+
+typedef void (APIENTRYP MyDebugMessageCallbackProc)(GLDEBUGPROC callback, const void *userParam);
+typedef void (APIENTRYP MyDebugMessageControlProc)(GLenum source, GLenum type, GLenum severity,
+	GLsizei count, const GLuint *ids, GLboolean enabled);
+
+const char *debugSeverityNames[4] = { "notification", "low", "medium", "high" };
+int debugSeverity = 2;			// lowest reported, index into debugSeverityNames, -1 for off
+bool debugContext = false;		// ask for a debug context (set by --gl-debug)
+bool debugOutputActive = false;
+
+// per-frame glGetError checks, compiled in with GL_FRAME_CHECKS; by default
+// only used when no debug callback is available
+bool frameErrorChecks = GL_FRAME_CHECKS;
+int frameErrorCheckMode = -1;	// forced on (1) or off (0), or -1 for the default
+
+const int debugMessageSlots = 64;
+
+struct MyDebugMessage
+{
+	GLenum  source, type;
+	GLuint  id;
+	long long count;
+};
+
+struct MyDebugLog
+{
+	MyDebugMessage messages[debugMessageSlots];
+	int     used;
+	long long total;		// messages received, repeats included
+	mutex   lock;
+
+	MyDebugLog() : used(0), total(0)
+	{}
+};
+
+MyDebugLog debugLog;
+
+int DebugSeverityRank(GLenum severity)
+{
+	if (severity == debugSeverityHigh) return 3;
+	if (severity == debugSeverityMedium) return 2;
+	if (severity == debugSeverityLow) return 1;
+	return 0;
+}
+
+const char *DebugTypeName(GLenum type)
+{
+	if (type == debugTypeError) return "error";
+	if (type == debugTypeDeprecated) return "deprecated";
+	if (type == debugTypeUndefined) return "undefined behaviour";
+	if (type == debugTypePortability) return "portability";
+	if (type == debugTypePerformance) return "performance";
+	return "other";
+}
+
+void APIENTRY DebugMessageCallback(GLenum source, GLenum type, GLuint id, GLenum severity,
+	GLsizei /*length*/, const GLchar *message, const void * /*userParam*/)
+{
+	int rank = DebugSeverityRank(severity);
+	if (rank < debugSeverity) return;
+
+	lock_guard<mutex> guard(debugLog.lock);
+	debugLog.total++;
+	for (int k = 0; k < debugLog.used; k++) {
+		MyDebugMessage &m = debugLog.messages[k];
+		if (m.source == source && m.type == type && m.id == id) {
+			m.count++;
+			return;
+		}
+	}
+	// once the table is full new messages are printed every time
+	if (debugLog.used < debugMessageSlots) {
+		MyDebugMessage &m = debugLog.messages[debugLog.used++];
+		m.source = source;
+		m.type = type;
+		m.id = id;
+		m.count = 1;
+	}
+	cout << "OpenGL " << debugSeverityNames[rank] << " " << DebugTypeName(type)
+		<< " [" << id << "]: " << message << endl;
+}
+
+// installs the debug callback if the driver has one, returning true if so
+bool InitializeDebugOutput()
+{
+	if (debugSeverity < 0) return false;
+
+	MyDebugMessageCallbackProc callback = 0;
+	MyDebugMessageControlProc control = 0;
+	bool khr = glfwExtensionSupported("GL_KHR_debug") != 0;
+	if (khr) {
+		callback = (MyDebugMessageCallbackProc)glfwGetProcAddress("glDebugMessageCallback");
+		control = (MyDebugMessageControlProc)glfwGetProcAddress("glDebugMessageControl");
+	}
+	else if (glfwExtensionSupported("GL_ARB_debug_output")) {
+		callback = (MyDebugMessageCallbackProc)glfwGetProcAddress("glDebugMessageCallbackARB");
+		control = (MyDebugMessageControlProc)glfwGetProcAddress("glDebugMessageControlARB");
+	}
+	if (!callback) {
+		cout << "OpenGL debug output is not available" << endl;
+		return false;
+	}
+
+	// debug output is off by default outside debug contexts with KHR_debug
+	if (khr) glEnable(debugOutput);
+	callback(DebugMessageCallback, 0);
+	if (control) {
+		const GLenum severities[4] = { debugSeverityNotification, debugSeverityLow, debugSeverityMedium, debugSeverityHigh };
+		for (int k = 0; k < 4; k++)
+			control(GL_DONT_CARE, GL_DONT_CARE, severities[k], 0, 0, k >= debugSeverity);
+	}
+	cout << "OpenGL debug output from " << debugSeverityNames[debugSeverity] << " severity ("
+		<< (khr ? "KHR_debug" : "ARB_debug_output") << (debugContext ? ", debug context" : "") << ")" << endl;
 	return !CheckGLErrors();
 }
 
-// deallocate shader-related objects
-void DestroyShaders(MyShader *shader)
+// prints the messages that repeated, and how often
+void ReportDebugMessages()
 {
-	// unbind any shader programs and destroy shader objects
-	glUseProgram(0);
-	glDeleteProgram(shader->program);
-	glDeleteShader(shader->vertex);
-	glDeleteShader(shader->fragment);
+	lock_guard<mutex> guard(debugLog.lock);
+	if (debugLog.total == 0) return;
+	cout << "OpenGL debug messages: " << debugLog.total << " received" << endl;
+	for (int k = 0; k < debugLog.used; k++)
+		if (debugLog.messages[k].count > 1)
+			cout << "  " << DebugTypeName(debugLog.messages[k].type) << " [" << debugLog.messages[k].id
+				<< "] repeated " << debugLog.messages[k].count << " times" << endl;
+}
+
+// synchronous error check for per-frame code, compiled out of release
+// builds and skipped while the debug callback reports errors
+inline bool CheckFrameGLErrors()
+{
+#if GL_FRAME_CHECKS
+	if (frameErrorChecks) return CheckGLErrors();
+#endif
+	return false;
 }
 
 // --------------------------------------------------------------------------
-// Functions to set up OpenGL buffers for storing textures
+// Command trace recording and replay (see trace.h), which recreates objects
+// with the shader and texture functions declared above
 
-struct MyTexture
+#include "trace.h"
+
+// --------------------------------------------------------------------------
+// Cached OpenGL state
+//
+// Per-frame code binds programs, vertex arrays, textures, framebuffers and
+// uniform ranges through these functions instead of the glad entry points.
+// Each remembers what is bound and drops calls that would not change it, so
+// render functions simply bind what they need and no longer reset it to
+// zero afterwards. Every call, issued or dropped, is counted by kind for the
+// frame; draws and uniform and buffer updates are counted without caching.
+// Code outside the frame (initialization, teardown, mode switches) still
+// calls OpenGL directly and must call InvalidateGLState() afterwards. Issued
+// calls are also what a trace capture records.
+
+enum GLCallKind { GLCALL_PROGRAM, GLCALL_VERTEX_ARRAY, GLCALL_TEXTURE, GLCALL_FRAMEBUFFER,
+	GLCALL_UNIFORM_RANGE, GLCALL_STATE, GLCALL_UNIFORM, GLCALL_BUFFER, GLCALL_DRAW, GLCALL_KINDS };
+const char *glCallKindNames[GLCALL_KINDS] = { "program", "vertex array", "texture", "framebuffer",
+	"uniform range", "state", "uniform", "buffer", "draw" };
+
+const GLuint glUnknown = ~0u;			// cached name that matches nothing
+const int cachedTextureUnits = 8;
+const int cachedUniformBindings = 4;
+enum CachedCapability { CAP_DEPTH_TEST, CAP_PROGRAM_POINT_SIZE, CAP_RASTERIZER_DISCARD, CAP_COUNT };
+const GLenum cachedCapabilities[CAP_COUNT] = { GL_DEPTH_TEST, GL_PROGRAM_POINT_SIZE, GL_RASTERIZER_DISCARD };
+
+struct MyGLCallCounts
 {
-	GLuint textureID;
-	GLuint target;
-	int width;
-	int height;
+	long long issued[GLCALL_KINDS];
+	long long filtered[GLCALL_KINDS];	// redundant, not passed to OpenGL
 
-	// initialize object names to zero (OpenGL reserved value)
-	MyTexture() : textureID(0), target(0), width(0), height(0)
-	{}
+	MyGLCallCounts()
+	{
+		for (int k = 0; k < GLCALL_KINDS; k++) issued[k] = filtered[k] = 0;
+	}
 };
 
-bool InitializeTexture(MyTexture* texture, const char* filename, GLuint target = GL_TEXTURE_2D)
+// what is bound, as far as the cache knows
+struct MyGLBindings
 {
-	int numComponents;
-	stbi_set_flip_vertically_on_load(true);
-	unsigned char *data = stbi_load(filename, &texture->width, &texture->height, &numComponents, 0);
-	if (data != nullptr)
+	GLuint  program;
+	GLuint  vertexArray;
+	GLuint  readFramebuffer, drawFramebuffer;
+	int     activeUnit;
+	GLenum  textureTargets[cachedTextureUnits];
+	GLuint  textures[cachedTextureUnits];
+	GLuint  uniformBuffers[cachedUniformBindings];
+	GLintptr uniformOffsets[cachedUniformBindings];
+	GLsizeiptr uniformSizes[cachedUniformBindings];
+	int     capabilities[CAP_COUNT];	// 0 off, 1 on, -1 unknown
+	GLenum  polygonMode;
+	GLint   viewport[4];
+
+	// initialize everything to unknown, so the first call always goes through
+	MyGLBindings() : program(glUnknown), vertexArray(glUnknown), readFramebuffer(glUnknown),
+		drawFramebuffer(glUnknown), activeUnit(-1), polygonMode(glUnknown)
 	{
-		texture->target = target;
-		glGenTextures(1, &texture->textureID);
-		glBindTexture(texture->target, texture->textureID);
-		GLuint format = numComponents == 3 ? GL_RGB : GL_RGBA;
-		glTexImage2D(texture->target, 0, format, texture->width, texture->height, 0, format, GL_UNSIGNED_BYTE, data);
+		for (int k = 0; k < cachedTextureUnits; k++) {
+			textureTargets[k] = glUnknown;
+			textures[k] = glUnknown;
+		}
+		for (int k = 0; k < cachedUniformBindings; k++) {
+			uniformBuffers[k] = glUnknown;
+			uniformOffsets[k] = uniformSizes[k] = -1;
+		}
+		for (int k = 0; k < CAP_COUNT; k++) capabilities[k] = -1;
+		for (int k = 0; k < 4; k++) viewport[k] = -1;
+	}
+};
+
+struct MyGLState
+{
+	MyGLBindings bound;
+	MyGLCallCounts frame;		// counts of the frame being drawn
+	MyGLCallCounts lastFrame;
+};
+
+MyGLState glState;
+
+void InvalidateGLState()
+{
+	glState.bound = MyGLBindings();
+}
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(texture->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(texture->target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+// counts an issued call of the given kind; returns false if it was redundant
+inline bool CountGLCall(GLCallKind kind, bool needed = true)
+{
+	if (needed) glState.frame.issued[kind]++;
+	else glState.frame.filtered[kind]++;
+	return needed;
+}
 
-		// Clean up
-		glBindTexture(texture->target, 0);
-		stbi_image_free(data);
-		return !CheckGLErrors();
+inline void UseProgram(GLuint program)
+{
+	if (CountGLCall(GLCALL_PROGRAM, glState.bound.program != program)) {
+		glUseProgram(program);
+		glState.bound.program = program;
+		TraceCall(TRACE_USE_PROGRAM, { TraceHandle(TRACE_OBJECT_PROGRAM, program) });
 	}
-	return true; //error
 }
 
-// deallocate texture-related objects
-void DestroyTexture(MyTexture *texture)
+inline void BindVertexArray(GLuint vertexArray)
 {
-	glBindTexture(texture->target, 0);
-	glDeleteTextures(1, &texture->textureID);
+	if (CountGLCall(GLCALL_VERTEX_ARRAY, glState.bound.vertexArray != vertexArray)) {
+		glBindVertexArray(vertexArray);
+		glState.bound.vertexArray = vertexArray;
+		TraceCall(TRACE_BIND_VERTEX_ARRAY, { TraceHandle(TRACE_OBJECT_VERTEX_ARRAY, vertexArray) });
+	}
 }
 
-// --------------------------------------------------------------------------
-// Functions to set up OpenGL buffers for storing geometry data
+// binds a texture to a unit, selecting the unit only when a bind is needed
+inline void BindTexture(int unit, GLenum target, GLuint texture)
+{
+	bool needed = unit >= cachedTextureUnits ||
+		glState.bound.textures[unit] != texture || glState.bound.textureTargets[unit] != target;
+	if (!CountGLCall(GLCALL_TEXTURE, needed)) return;
+	if (glState.bound.activeUnit != unit) {
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glState.bound.activeUnit = unit;
+		CountGLCall(GLCALL_TEXTURE);
+	}
+	glBindTexture(target, texture);
+	TraceCall(TRACE_BIND_TEXTURE, { unit, int32_t(target), TraceHandle(TRACE_OBJECT_TEXTURE, texture) });
+	if (unit < cachedTextureUnits) {
+		glState.bound.textureTargets[unit] = target;
+		glState.bound.textures[unit] = texture;
+	}
+}
 
-struct MyGeometry
+// GL_FRAMEBUFFER binds both the read and the draw framebuffer
+inline void BindFramebuffer(GLenum target, GLuint framebuffer)
 {
-	// OpenGL names for array buffer objects, vertex array object
-	GLuint  vertexBuffer;
-	GLuint  textureBuffer;
-	GLuint  colourBuffer;
-	GLuint  elementBuffer;
-	GLuint  vertexArray;
-	GLsizei elementCount;
+	bool read = target != GL_DRAW_FRAMEBUFFER, draw = target != GL_READ_FRAMEBUFFER;
+	bool needed = (read && glState.bound.readFramebuffer != framebuffer) ||
+		(draw && glState.bound.drawFramebuffer != framebuffer);
+	if (CountGLCall(GLCALL_FRAMEBUFFER, needed)) {
+		glBindFramebuffer(target, framebuffer);
+		TraceCall(TRACE_BIND_FRAMEBUFFER, { int32_t(target), TraceHandle(TRACE_OBJECT_FRAMEBUFFER, framebuffer) });
+		if (read) glState.bound.readFramebuffer = framebuffer;
+		if (draw) glState.bound.drawFramebuffer = framebuffer;
+	}
+}
 
-	// initialize object names to zero (OpenGL reserved value)
-	MyGeometry() : vertexBuffer(0), colourBuffer(0), vertexArray(0), elementCount(0)
-	{}
-};
+inline void BindUniformRange(GLuint binding, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+	bool needed = binding >= GLuint(cachedUniformBindings) || glState.bound.uniformBuffers[binding] != buffer ||
+		glState.bound.uniformOffsets[binding] != offset || glState.bound.uniformSizes[binding] != size;
+	if (!CountGLCall(GLCALL_UNIFORM_RANGE, needed)) return;
+	glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, offset, size);
+	TraceCall(TRACE_BIND_UNIFORM_RANGE, { int32_t(binding), TraceHandle(TRACE_OBJECT_BUFFER, buffer),
+		int32_t(offset), int32_t(size) });
+	if (binding < GLuint(cachedUniformBindings)) {
+		glState.bound.uniformBuffers[binding] = buffer;
+		glState.bound.uniformOffsets[binding] = offset;
+		glState.bound.uniformSizes[binding] = size;
+	}
+}
 
-struct MySphere {
-	int lastVertex;
-	int lastIndex;
-};
+inline void SetCapability(CachedCapability cap, bool enabled)
+{
+	if (CountGLCall(GLCALL_STATE, glState.bound.capabilities[cap] != int(enabled))) {
+		if (enabled) glEnable(cachedCapabilities[cap]);
+		else glDisable(cachedCapabilities[cap]);
+		glState.bound.capabilities[cap] = enabled;
+		TraceCall(TRACE_CAPABILITY, { int32_t(cachedCapabilities[cap]), enabled });
+	}
+}
 
-// arrays
-GLfloat vertices[maxShapes * 3][3];
-GLfloat colours[maxShapes * 3][3];
-GLfloat texCoords[maxShapes * 3][3];
-unsigned indices[maxShapes * 3];
-MyTexture textures[6];
-MySphere spheres[4];
+inline void SetPolygonMode(GLenum mode)
+{
+	if (CountGLCall(GLCALL_STATE, glState.bound.polygonMode != mode)) {
+		glPolygonMode(GL_FRONT_AND_BACK, mode);
+		glState.bound.polygonMode = mode;
+		TraceCall(TRACE_POLYGON_MODE, { int32_t(mode) });
+	}
+}
 
-// creates a sphere using triangles
-MySphere generateSphere(float div, float R, int i, int j, int texID) {
-	MySphere result;
+inline void SetViewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	GLint *v = glState.bound.viewport;
+	if (CountGLCall(GLCALL_STATE, v[0] != x || v[1] != y || v[2] != width || v[3] != height)) {
+		glViewport(x, y, width, height);
+		v[0] = x; v[1] = y; v[2] = width; v[3] = height;
+		TraceCall(TRACE_VIEWPORT, { x, y, width, height });
+	}
+}
 
-	float unit = piVal / div;
-	float x = 0.0, y = 0.0;
+// uncached commands, counted and traced
 
-	for (float it = 0.0; it < piVal; it += unit) {
-		x = 0.0;
+inline void Clear(GLbitfield mask, float r, float g, float b, float a)
+{
+	glClearColor(r, g, b, a);
+	glClear(mask);
+	glState.frame.issued[GLCALL_STATE]++;
+	glState.frame.issued[GLCALL_DRAW]++;
+	if (!tracer.recording) return;
+	MyTraceWriter *w = &tracer.writer;
+	TraceBegin(w, TRACE_CLEAR);
+	TracePutInt(w, mask);
+	TracePutFloat(w, r);
+	TracePutFloat(w, g);
+	TracePutFloat(w, b);
+	TracePutFloat(w, a);
+	TraceEnd(w);
+}
 
-		for (float ip = 0.0; ip < 2.0 * piVal; ip += unit) {
-			float nextp = ip + unit;
-			float nextt = it + unit;
-			float px, py, pz;
+inline void DrawArrays(GLenum mode, GLint first, GLsizei count)
+{
+	glDrawArrays(mode, first, count);
+	CountGLCall(GLCALL_DRAW);
+	TraceCall(TRACE_DRAW_ARRAYS, { int32_t(mode), first, count });
+}
 
-			// p1
-			px = R * cos(ip) * sin(it);
-			py = R * sin(ip) * sin(it);
-			pz = R * cos(it);
-			vertices[i][0] = px;
-			vertices[i][1] = py;
-			vertices[i][2] = pz;
-			texCoords[i][0] = 1.0 - x;
-			texCoords[i][1] = y;
-			texCoords[i][2] = texID;
-			i++;
-			x += 1.0 / (2.0 * div);
+inline void DrawElements(GLenum mode, GLsizei count, GLenum type, size_t offset)
+{
+	glDrawElements(mode, count, type, (void *)offset);
+	CountGLCall(GLCALL_DRAW);
+	TraceCall(TRACE_DRAW_ELEMENTS, { int32_t(mode), count, int32_t(type), int32_t(offset) });
+}
 
-			// p2
-			px = R * cos(nextp) * sin(it);
-			py = R * sin(nextp) * sin(it);
-			pz = R * cos(it);
-			vertices[i][0] = px;
-			vertices[i][1] = py;
-			vertices[i][2] = pz;
-			texCoords[i][0] = 1.0 - x;
-			texCoords[i][1] = y;
-			texCoords[i][2] = texID;
-			i++;
+inline void MultiDrawArrays(GLenum mode, const GLint *first, const GLsizei *count, GLsizei ranges)
+{
+	glMultiDrawArrays(mode, first, count, ranges);
+	CountGLCall(GLCALL_DRAW);
+	if (!tracer.recording) return;
+	MyTraceWriter *w = &tracer.writer;
+	TraceBegin(w, TRACE_MULTI_DRAW_ARRAYS);
+	TracePutInt(w, mode);
+	TracePutInt(w, ranges);
+	for (GLsizei k = 0; k < ranges; k++) {
+		TracePutInt(w, first[k]);
+		TracePutInt(w, count[k]);
+	}
+	TraceEnd(w);
+}
 
-			// p3
-			px = R * cos(ip) * sin(nextt);
-			py = R * sin(ip) * sin(nextt);
-			pz = R * cos(nextt);
-			vertices[i][0] = px;
-			vertices[i][1] = py;
-			vertices[i][2] = pz;
-			texCoords[i][0] = 1.0 - (x - 1.0 / (2.0 * div));
-			texCoords[i][1] = y + 1.0 / div;
-			texCoords[i][2] = texID;
-			i++;
+inline void BlitFramebuffer(GLint x0, GLint y0, GLint x1, GLint y1, GLint toX0, GLint toY0,
+	GLint toX1, GLint toY1, GLbitfield mask, GLenum filter)
+{
+	glBlitFramebuffer(x0, y0, x1, y1, toX0, toY0, toX1, toY1, mask, filter);
+	CountGLCall(GLCALL_DRAW);
+	TraceCall(TRACE_BLIT, { x0, y0, x1, y1, toX0, toY0, toX1, toY1, int32_t(mask), int32_t(filter) });
+}
 
-			int offset = 0;
-			if (ip > 2.0 * piVal - unit) {
-				// p4
-				px = R * cos(nextp) * sin(nextt);
-				py = R * sin(nextp) * sin(nextt);
-				pz = R * cos(nextt);
-				vertices[i][0] = px;
-				vertices[i][1] = py;
-				vertices[i][2] = pz;
-				texCoords[i][0] = 1.0 - x;
-				texCoords[i][1] = y + 1.0 / div;
-				texCoords[i][2] = texID;
-				i++;
-				offset = 1;
-			}
+// uniforms outside the blocks, by name so that a trace does not depend on
+// the locations one driver assigned
+inline void SetUniform1i(GLuint program, const char *name, GLint value)
+{
+	glUniform1i(glGetUniformLocation(program, name), value);
+	CountGLCall(GLCALL_UNIFORM);
+	if (!tracer.recording) return;
+	MyTraceWriter *w = &tracer.writer;
+	TraceBegin(w, TRACE_UNIFORM_1I);
+	TracePutInt(w, TraceHandle(TRACE_OBJECT_PROGRAM, program));
+	TracePutString(w, name);
+	TracePutInt(w, value);
+	TraceEnd(w);
+}
+
+inline void SetUniform2f(GLuint program, const char *name, const float *value)
+{
+	glUniform2fv(glGetUniformLocation(program, name), 1, value);
+	CountGLCall(GLCALL_UNIFORM);
+	if (!tracer.recording) return;
+	MyTraceWriter *w = &tracer.writer;
+	TraceBegin(w, TRACE_UNIFORM_2F);
+	TracePutInt(w, TraceHandle(TRACE_OBJECT_PROGRAM, program));
+	TracePutString(w, name);
+	TracePutFloat(w, value[0]);
+	TracePutFloat(w, value[1]);
+	TraceEnd(w);
+}
+
+// closes the frame's counts, recording them in benchmark mode
+void EndGLStateFrame(MyBenchmark *bench)
+{
+	MyGLCallCounts &c = glState.frame;
+	long long issued = 0, filtered = 0;
+	for (int k = 0; k < GLCALL_KINDS; k++) {
+		issued += c.issued[k];
+		filtered += c.filtered[k];
+	}
+	BenchmarkCount(bench, "gl calls issued", double(issued));
+	BenchmarkCount(bench, "gl calls filtered", double(filtered));
+	glState.lastFrame = c;
+	c = MyGLCallCounts();
+}
+
+// prints the calls of the last frame by kind
+void ReportGLCalls()
+{
+	const MyGLCallCounts &c = glState.lastFrame;
+	cout << "OpenGL calls in the last frame (issued / redundant and filtered):" << endl;
+	for (int k = 0; k < GLCALL_KINDS; k++)
+		cout << "  " << glCallKindNames[k] << ": " << c.issued[k] << " / " << c.filtered[k] << endl;
+}
+
+// --------------------------------------------------------------------------
+// Functions to set up OpenGL shader programs for rendering
+
+// load, compile, and link shaders, with a geometry stage if a file is given,
+// returning true if successful
+bool InitializeShaders(MyShader *shader, const char *vertexFile, const char *fragmentFile,
+	const char *geometryFile)
+{
+	// load shader source from files
+	string vertexSource = LoadSource(vertexFile);
+	string fragmentSource = LoadSource(fragmentFile);
+	string geometrySource = geometryFile ? LoadSource(geometryFile) : string();
+	if (vertexSource.empty() || fragmentSource.empty() || (geometryFile && geometrySource.empty())) return false;
+
+	// logarithmic depth is chosen when the program is built, so that the
+	// standard depth program never writes gl_FragDepth
+	if (logDepth) {
+		vertexSource = DefineInSource(vertexSource, "LOG_DEPTH");
+		fragmentSource = DefineInSource(fragmentSource, "LOG_DEPTH");
+		if (geometryFile) geometrySource = DefineInSource(geometrySource, "LOG_DEPTH");
+	}
+
+	// compile shader source into shader objects
+	shader->vertex = CompileShader(GL_VERTEX_SHADER, vertexSource);
+	shader->fragment = CompileShader(GL_FRAGMENT_SHADER, fragmentSource);
+	if (geometryFile) shader->geometry = CompileShader(GL_GEOMETRY_SHADER, geometrySource);
+
+	// link shader program; a trace has no geometry stage, so programs with
+	// one are left out of it and counted to keep captures from starting
+	shader->program = LinkProgram(shader->vertex, shader->fragment, 0, shader->geometry);
+	if (!geometryFile) TraceProgram(shader->program, vertexFile, fragmentFile, logDepth);
+	else if (shader->program) tracer.untracedPrograms++;
+
+	// check for OpenGL errors and return false if error occurred, or if the
+	// program did not link
+	GLint linked = GL_FALSE;
+	glGetProgramiv(shader->program, GL_LINK_STATUS, &linked);
+	return !CheckGLErrors() && linked == GL_TRUE;
+}
+
+// load, compile, and link a vertex-only program whose output is captured with
+// transform feedback, returning true if successful
+bool InitializeFeedbackShader(MyShader *shader, const char *vertexFile, const char *varying)
+{
+	string vertexSource = LoadSource(vertexFile);
+	if (vertexSource.empty()) return false;
+
+	shader->vertex = CompileShader(GL_VERTEX_SHADER, vertexSource);
+	shader->program = LinkProgram(shader->vertex, 0, varying);
+
+	return !CheckGLErrors();
+}
+
+// deallocate shader-related objects
+void DestroyShaders(MyShader *shader)
+{
+	// unbind any shader programs and destroy shader objects
+	glUseProgram(0);
+	glDeleteProgram(shader->program);
+	TraceForget(TRACE_OBJECT_PROGRAM, shader->program);
+	if (shader->geometry && shader->program) tracer.untracedPrograms--;
+	glDeleteShader(shader->vertex);
+	glDeleteShader(shader->geometry);
+	glDeleteShader(shader->fragment);
+}
+
+// --------------------------------------------------------------------------
+// Ring of uniform blocks for frame and draw data
+//
+// Per-frame and per-draw uniform blocks are written into one uniform buffer
+// with a region for each of three frames in flight, and each draw binds its
+// block as a range of the buffer. A region is fenced when its frame has been
+// submitted and the fence is waited on before the region is written again,
+// which with three regions rarely blocks. With GL_ARB_buffer_storage the
+// buffer is mapped once, persistently and coherently, and blocks are written
+// straight into it; without it (the context is 4.1) blocks are gathered in a
+// staging copy and written with one unsynchronized map of the region, which
+// the fences make safe. Storage buffers would need 4.3, so all data fits in
+// uniform blocks.
+
+enum UniformBinding { UNIFORM_FRAME, UNIFORM_DRAW, UNIFORM_LIGHTING, UNIFORM_CUBE, UNIFORM_BINDINGS };
+
+const int uniformRingFrames = 3;
+const GLsizeiptr uniformRingBytes = 16 * 1024;	// per frame
+
+// GL 4.4 entry point and flags, loaded at runtime
+typedef void (APIENTRYP MyBufferStorageProc)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+const GLbitfield mapPersistentBit = 0x0040;
+const GLbitfield mapCoherentBit = 0x0080;
+
+struct MyUniformRing
+{
+	GLuint  buffer;
+	GLsync  fences[uniformRingFrames];
+	unsigned char *mapped;		// whole buffer, when persistently mapped
+	std::vector<unsigned char> staging;	// one region, otherwise
+	unsigned char *write;		// blocks of the current frame
+	GLintptr alignment;			// of a bound range
+	GLintptr used;
+	int     frame;				// region being written
+	bool    persistent;
+	long long waits;			// frames that found their region still in use
+	bool    overflowed;
+
+	// initialize object names to zero (OpenGL reserved value)
+	MyUniformRing() : buffer(0), mapped(0), write(0), alignment(256), used(0), frame(0),
+		persistent(false), waits(0), overflowed(false)
+	{
+		for (int k = 0; k < uniformRingFrames; k++) fences[k] = 0;
+	}
+};
+
+MyUniformRing uniformRing;
+
+bool InitializeUniformRing(MyUniformRing *ring)
+{
+	GLint alignment = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	ring->alignment = std::max(alignment, 1);
+
+	GLsizeiptr bytes = uniformRingFrames * uniformRingBytes;
+	glGenBuffers(1, &ring->buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, ring->buffer);
+	MyBufferStorageProc bufferStorage = 0;
+	if (glfwExtensionSupported("GL_ARB_buffer_storage"))
+		bufferStorage = (MyBufferStorageProc)glfwGetProcAddress("glBufferStorage");
+	if (bufferStorage) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | mapPersistentBit | mapCoherentBit;
+		bufferStorage(GL_UNIFORM_BUFFER, bytes, 0, flags);
+		ring->mapped = (unsigned char *)glMapBufferRange(GL_UNIFORM_BUFFER, 0, bytes, flags);
+		ring->persistent = ring->mapped != 0;
+	}
+	if (!ring->persistent) {
+		if (bufferStorage) {
+			// immutable storage without a mapping is of no use
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+			glDeleteBuffers(1, &ring->buffer);
+			glGenBuffers(1, &ring->buffer);
+			glBindBuffer(GL_UNIFORM_BUFFER, ring->buffer);
+		}
+		glBufferData(GL_UNIFORM_BUFFER, bytes, 0, GL_STREAM_DRAW);
+		ring->staging.resize(uniformRingBytes);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	TraceBuffer(ring->buffer, TRACE_CONTENTS_NONE);	// the frame's blocks are traced as they are submitted
+
+	cout << "Uniform ring " << (ring->persistent ? "persistently mapped" : "mapped unsynchronized per frame") << endl;
+	return !CheckGLErrors();
+}
+
+// waits until the GPU has finished the frame that last used this region,
+// then starts writing blocks into it
+void BeginUniformFrame(MyUniformRing *ring)
+{
+	GLsync &fence = ring->fences[ring->frame];
+	if (fence) {
+		if (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED) {
+			ring->waits++;
+			glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+		}
+		glDeleteSync(fence);
+		fence = 0;
+	}
+	ring->write = ring->persistent ? ring->mapped + ring->frame * uniformRingBytes : ring->staging.data();
+	ring->used = 0;
+}
+
+// copies a block into the current frame's region and returns its offset in
+// the buffer, to bind with BindUniforms
+GLintptr PushUniforms(MyUniformRing *ring, const void *block, size_t size)
+{
+	GLintptr offset = AlignUp(ring->used, ring->alignment);
+	if (offset + GLintptr(size) > uniformRingBytes) {
+		// bind the frame's first block rather than write past the region
+		if (!ring->overflowed) cout << "ERROR: Uniform ring region is full" << endl;
+		ring->overflowed = true;
+		return ring->frame * uniformRingBytes;
+	}
+	memcpy(ring->write + offset, block, size);
+	ring->used = offset + size;
+	return ring->frame * uniformRingBytes + offset;
+}
+
+// makes the blocks written so far visible to the GPU; call before drawing
+void SubmitUniformFrame(MyUniformRing *ring)
+{
+	if (tracer.recording && ring->used > 0) {
+		MyTraceWriter *w = &tracer.writer;
+		TraceBegin(w, TRACE_BUFFER_DATA);
+		TracePutInt(w, TraceHandle(TRACE_OBJECT_BUFFER, ring->buffer));
+		TracePutInt(w, int32_t(ring->frame * uniformRingBytes));
+		TracePutBlock(w, ring->write, ring->used);
+		TraceEnd(w);
+	}
+	if (ring->persistent || ring->used == 0) return;
+	glBindBuffer(GL_UNIFORM_BUFFER, ring->buffer);
+	void *region = glMapBufferRange(GL_UNIFORM_BUFFER, ring->frame * uniformRingBytes, ring->used,
+		GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+	if (region) {
+		memcpy(region, ring->staging.data(), ring->used);
+		glUnmapBuffer(GL_UNIFORM_BUFFER);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glState.frame.issued[GLCALL_BUFFER] += 4;
+}
+
+inline void BindUniforms(MyUniformRing *ring, UniformBinding binding, GLintptr offset, GLsizeiptr size)
+{
+	BindUniformRange(binding, ring->buffer, offset, size);
+}
+
+// fences the region after the frame's last draw and moves to the next one
+void EndUniformFrame(MyUniformRing *ring)
+{
+	ring->fences[ring->frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	ring->frame = (ring->frame + 1) % uniformRingFrames;
+}
+
+// connects a program's blocks to the ring's binding points
+void BindUniformBlocks(MyShader *shader)
+{
+	const char *names[UNIFORM_BINDINGS] = { "Frame", "Draw", "Lighting", "Cube" };
+	for (int k = 0; k < UNIFORM_BINDINGS; k++) {
+		GLuint index = glGetUniformBlockIndex(shader->program, names[k]);
+		if (index != GL_INVALID_INDEX) glUniformBlockBinding(shader->program, index, k);
+	}
+}
+
+void DestroyUniformRing(MyUniformRing *ring)
+{
+	for (int k = 0; k < uniformRingFrames; k++)
+		if (ring->fences[k]) glDeleteSync(ring->fences[k]);
+	glBindBuffer(GL_UNIFORM_BUFFER, ring->buffer);
+	if (ring->persistent) glUnmapBuffer(GL_UNIFORM_BUFFER);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glDeleteBuffers(1, &ring->buffer);
+	*ring = MyUniformRing();
+}
+
+// --------------------------------------------------------------------------
+// Functions to set up OpenGL buffers for storing textures
+
+// image decoded on the CPU, waiting for upload
+struct MyImage
+{
+	unsigned char *data;
+	int width;
+	int height;
+	int components;
+
+	MyImage() : data(0), width(0), height(0), components(0)
+	{}
+};
+
+// decodes an image file, returning true if successful; safe to call from any
+// thread once stbi_set_flip_vertically_on_load has been set
+bool DecodeImage(MyImage *image, const char *filename)
+{
+	image->data = stbi_load(filename, &image->width, &image->height, &image->components, 0);
+	return image->data != nullptr;
+}
+
+// uploads a decoded image to a new texture and frees the image
+bool UploadTexture(MyTexture *texture, MyImage *image, GLuint target = GL_TEXTURE_2D)
+{
+	if (!image->data) return false;
+
+	texture->target = target;
+	texture->width = image->width;
+	texture->height = image->height;
+	glGenTextures(1, &texture->textureID);
+	glBindTexture(texture->target, texture->textureID);
+	GLuint format = image->components == 3 ? GL_RGB : GL_RGBA;
+	glTexImage2D(texture->target, 0, format, texture->width, texture->height, 0, format, GL_UNSIGNED_BYTE, image->data);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(texture->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(texture->target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	// Clean up
+	glBindTexture(texture->target, 0);
+	stbi_image_free(image->data);
+	image->data = 0;
+	return !CheckGLErrors();
+}
+
+bool InitializeTexture(MyTexture* texture, const char* filename, GLuint target)
+{
+	MyImage image;
+	stbi_set_flip_vertically_on_load(true);
+	if (!DecodeImage(&image, filename)) return false;
+	if (!UploadTexture(texture, &image, target)) return false;
+	TraceTextureFile(texture->textureID, target, filename);
+	return true;
+}
+
+// decodes the images in parallel on the job pool and uploads them in order
+// on this thread as each one becomes ready, returning true if all succeeded
+bool InitializeTextures(MyTexture *textures, const char *const *filenames, int count, GLuint target = GL_TEXTURE_2D)
+{
+	vector<MyImage> images(count);
+	vector<MyJobCounter> decoded(count);
+	stbi_set_flip_vertically_on_load(true);
+	for (int k = 0; k < count; k++)
+		PushJob(&jobs, [&images, filenames, k] { DecodeImage(&images[k], filenames[k]); }, &decoded[k]);
+
+	bool ok = true;
+	for (int k = 0; k < count; k++) {
+		WaitJobs(&jobs, &decoded[k]);
+		if (!UploadTexture(&textures[k], &images[k], target)) {
+			cout << "Program failed to intialize texture " << filenames[k] << "!" << endl;
+			ok = false;
+		}
+		else TraceTextureFile(textures[k].textureID, target, filenames[k]);
+	}
+	return ok;
+}
+
+// deallocate texture-related objects
+void DestroyTexture(MyTexture *texture)
+{
+	glBindTexture(texture->target, 0);
+	glDeleteTextures(1, &texture->textureID);
+}
+
+// --------------------------------------------------------------------------
+// Distance scales
+
+// scene distance of a length in km, log-compressed or true to scale
+double SceneDistance(double km)
+{
+	if (trueScale) return km / trueScaleUnit;
+	return log(km / unit) / log(base);
+}
+
+// scene radius of a body, log-compressed further by factor
+double SceneRadius(double km)
+{
+	if (trueScale) return km / trueScaleUnit;
+	return factor * log(km / unit) / log(base);
+}
+
+// sets the body distances and radii and the camera range for the chosen
+// scale, after the command line is parsed
+void SetDistanceScale()
+{
+	distEarthToSun = SceneDistance(149597890.0);
+	distMoonToEarth = SceneDistance(384403.08);
+	earthR = SceneRadius(6378.1);
+	moonR = SceneRadius(1737.1);
+	sunR = SceneRadius(695700.0);
+
+	// the camera distance becomes an altitude above the focused body, from
+	// a metre up to a few AU
+	if (trueScale) {
+		logDepth = true;
+		minDistance = float(0.001 / trueScaleUnit);
+		maxDistance = float(5.0 * auKm / trueScaleUnit);
+		cameraR = float(3.0 * SceneRadius(695700.0));
+		starsR = 4.0 * maxDistance;
+	}
+}
+
+// --------------------------------------------------------------------------
+// Functions to set up OpenGL buffers for storing geometry data
+
+struct MyGeometry
+{
+	// OpenGL names for array buffer objects, vertex array object
+	GLuint  vertexBuffer;
+	GLuint  textureBuffer;
+	GLuint  colourBuffer;
+	GLuint  elementBuffer;
+	GLuint  vertexArray;
+	GLsizei elementCount;
+
+	// initialize object names to zero (OpenGL reserved value)
+	MyGeometry() : vertexBuffer(0), colourBuffer(0), vertexArray(0), elementCount(0)
+	{}
+};
+
+struct MySphere {
+	int lastVertex;
+	int lastIndex;
+	int firstVertex;
+	int firstIndex;
+	float radius;	// bounding sphere about the model origin
+};
+
+// arrays
+GLfloat vertices[maxShapes * 3][3];
+GLfloat colours[maxShapes * 3][3];
+GLfloat texCoords[maxShapes * 3][3];
+unsigned indices[maxShapes * 3];
+MyTexture textures[6];
+MySphere spheres[4];
+
+// vertex data of one sphere, with indices relative to its first vertex
+struct MySphereMesh {
+	vector<vec3> vertices;
+	vector<vec3> texCoords;
+	vector<unsigned> indices;
+};
+
+// creates a sphere using triangles
+void generateSphere(MySphereMesh *mesh, float div, float R, int texID) {
+	float unit = piVal / div;
+	float x = 0.0, y = 0.0;
+
+	for (float it = 0.0; it < piVal; it += unit) {
+		x = 0.0;
+
+		for (float ip = 0.0; ip < 2.0 * piVal; ip += unit) {
+			float nextp = ip + unit;
+			float nextt = it + unit;
+			float px, py, pz;
+
+			// p1
+			px = R * cos(ip) * sin(it);
+			py = R * sin(ip) * sin(it);
+			pz = R * cos(it);
+			mesh->vertices.push_back(vec3(px, py, pz));
+			mesh->texCoords.push_back(vec3(1.0 - x, y, texID));
+			x += 1.0 / (2.0 * div);
+
+			// p2
+			px = R * cos(nextp) * sin(it);
+			py = R * sin(nextp) * sin(it);
+			pz = R * cos(it);
+			mesh->vertices.push_back(vec3(px, py, pz));
+			mesh->texCoords.push_back(vec3(1.0 - x, y, texID));
+
+			// p3
+			px = R * cos(ip) * sin(nextt);
+			py = R * sin(ip) * sin(nextt);
+			pz = R * cos(nextt);
+			mesh->vertices.push_back(vec3(px, py, pz));
+			mesh->texCoords.push_back(vec3(1.0 - (x - 1.0 / (2.0 * div)), y + 1.0 / div, texID));
+
+			int offset = 0;
+			if (ip > 2.0 * piVal - unit) {
+				// p4
+				px = R * cos(nextp) * sin(nextt);
+				py = R * sin(nextp) * sin(nextt);
+				pz = R * cos(nextt);
+				mesh->vertices.push_back(vec3(px, py, pz));
+				mesh->texCoords.push_back(vec3(1.0 - x, y + 1.0 / div, texID));
+				offset = 1;
+			}
+
+			// indices
+			int i = (int)mesh->vertices.size();
+			mesh->indices.push_back(i - 1 - offset);
+			mesh->indices.push_back(i - 2 - offset);
+			mesh->indices.push_back(i - 3 - offset);
+
+			if (it >= 0.0 && it < piVal - unit) {
+				mesh->indices.push_back(i - 1 - offset);
+				mesh->indices.push_back(i - 2 - offset);
+
+				if (ip < 2.0 * piVal - unit)
+					mesh->indices.push_back(i + 2 - offset);
+				else
+					mesh->indices.push_back(i - offset);
+			}
+		}
+
+		y += 1.0 / div;
+	}
+}
+
+// copies the sphere meshes into the vertex arrays one after another,
+// offsetting their indices, and records where each sphere ends
+void concatenateSpheres(const MySphereMesh *meshes, int count) {
+	int i = 0, j = 0;
+	for (int s = 0; s < count; s++) {
+		const MySphereMesh &mesh = meshes[s];
+		int n = (int)mesh.vertices.size(), m = (int)mesh.indices.size();
+		if (i + n > maxShapes * 3 || j + m > maxShapes * 3) {
+			cout << "ERROR: Sphere geometry exceeds the vertex arrays" << endl;
+			n = m = 0;
+		}
+
+		memcpy(vertices[i], mesh.vertices.data(), n * sizeof(vec3));
+		memcpy(texCoords[i], mesh.texCoords.data(), n * sizeof(vec3));
+		for (int k = 0; k < m; k++)
+			indices[j + k] = mesh.indices[k] + i;
+		i += n;
+		j += m;
+
+		spheres[s].firstVertex = i - n;
+		spheres[s].firstIndex = j - m;
+		spheres[s].lastVertex = i - 1;
+		spheres[s].lastIndex = j - 1;
+	}
+}
+
+// create buffers and fill with geometry data, returning true if successful
+bool InitializeGeometry(MyGeometry *geometry)
+{
+	// earth, stars, moon and sun are generated in parallel, and concatenated
+	// into the vertex arrays once all four are done
+	MySphereMesh meshes[4];
+	const float resolutions[4] = { earthResolution, starResolution, moonResolution, sunResolution };
+	const float radii[4] = { float(earthR), float(starsR), float(moonR), float(sunR) };
+	MyJobCounter generated, concatenated;
+	for (int s = 0; s < 4; s++)
+		PushJob(&jobs, [&meshes, &resolutions, &radii, s] { generateSphere(&meshes[s], resolutions[s], radii[s], s); }, &generated);
+	PushJob(&jobs, [&meshes] { concatenateSpheres(meshes, 4); }, &concatenated, &generated);
+	WaitJobs(&jobs, &concatenated);
+	for (int s = 0; s < 4; s++)
+		spheres[s].radius = radii[s];
+
+	geometry->elementCount = spheres[3].lastIndex;
+
+	// these vertex attribute indices correspond to those specified for the
+	// input variables in the vertex shader
+	const GLuint VERTEX_INDEX = 0;
+	const GLuint COLOUR_INDEX = 1;
+	const GLuint TEXTURE_INDEX = 2;
+
+	// create an array buffer object for storing our vertices
+	glGenBuffers(1, &geometry->vertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, geometry->vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+
+	// create another one for storing our colours
+	glGenBuffers(1, &geometry->colourBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, geometry->colourBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(colours), colours, GL_STATIC_DRAW);
+
+	// create another one for storing our texture data
+	glGenBuffers(1, &geometry->textureBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, geometry->textureBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(texCoords), texCoords, GL_STATIC_DRAW);
+
+	// create a vertex array object encapsulating all our vertex attributes
+	glGenVertexArrays(1, &geometry->vertexArray);
+	glBindVertexArray(geometry->vertexArray);
+
+	// element array -> buffer
+	glGenBuffers(1, &geometry->elementBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, geometry->elementBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+
+	// texture array -> buffer
+	glBindBuffer(GL_ARRAY_BUFFER, geometry->textureBuffer);
+	glVertexAttribPointer(TEXTURE_INDEX, 3	, GL_FLOAT, GL_FALSE, 0, 0);
+	glEnableVertexAttribArray(TEXTURE_INDEX);
+
+	// associate the position array with the vertex array object
+	glBindBuffer(GL_ARRAY_BUFFER, geometry->vertexBuffer);
+	glVertexAttribPointer(VERTEX_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	glEnableVertexAttribArray(VERTEX_INDEX);
+
+	// assocaite the colour array with the vertex array object
+	glBindBuffer(GL_ARRAY_BUFFER, geometry->colourBuffer);
+	glVertexAttribPointer(COLOUR_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	glEnableVertexAttribArray(COLOUR_INDEX);
+
+	GLuint buffers[4] = { geometry->vertexBuffer, geometry->colourBuffer, geometry->textureBuffer, geometry->elementBuffer };
+	for (int k = 0; k < 4; k++) TraceBuffer(buffers[k], TRACE_CONTENTS_ONCE);
+	const GLuint attributes[9] = { TEXTURE_INDEX, geometry->textureBuffer, 3, VERTEX_INDEX, geometry->vertexBuffer, 3,
+		COLOUR_INDEX, geometry->colourBuffer, 3 };
+	TraceVertexArray(geometry->vertexArray, geometry->elementBuffer, attributes, 3);
+
+	// unbind our buffers, resetting to default state
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	// check for OpenGL errors and return false if error occurred
+	return !CheckGLErrors();
+}
+
+// deallocate geometry-related objects
+void DestroyGeometry(MyGeometry *geometry)
+{
+	// unbind and destroy our vertex array object and associated buffers
+	glBindVertexArray(0);
+	glDeleteVertexArrays(1, &geometry->vertexArray);
+	glDeleteBuffers(1, &geometry->vertexBuffer);
+	glDeleteBuffers(1, &geometry->colourBuffer);
+	glDeleteBuffers(1, &geometry->elementBuffer);
+}
+
+// --------------------------------------------------------------------------
+// Functions to set up and propagate minor bodies (asteroids)
+
+// draws the visible ranges of a point set from the bound vertex array
+void DrawPointRanges(const MyDrawRanges &draw, GLsizei count)
+{
+	if (draw.all) DrawArrays(GL_POINTS, 0, count);
+	else if (draw.ranges > 0) MultiDrawArrays(GL_POINTS, draw.first, draw.count, draw.ranges);
+}
+
+// propagation is timed with a ring of queries, each read back this many
+// frames after it was issued so that the CPU never waits for the GPU
+const int propagateTimeQueries = 3;
+
+// uniforms of the feedback program, located once
+enum PropagateUniform { PROPAGATE_TIME, PROPAGATE_SCALE_OFFSET, PROPAGATE_SCALE_DIVISOR, PROPAGATE_LINEAR_SCALE,
+	PROPAGATE_UNIFORMS };
+const char *propagateUniformNames[PROPAGATE_UNIFORMS] = { "time", "scaleOffset", "scaleDivisor", "linearScale" };
+
+struct MyMinorBodies
+{
+	// OpenGL names for the orbit and position buffers and their vertex arrays
+	GLuint  orbitBuffer;
+	GLuint  positionBuffer;
+	GLuint  orbitArray;		// orbit attributes, input to the feedback pass
+	GLuint  positionArray;	// position attribute, input to the point pass
+	GLuint  timeQueries[propagateTimeQueries];
+	int     timeQuery;
+	GLuint  locatedProgram;	// feedback program the uniform locations are of
+	GLint   uniformLocations[PROPAGATE_UNIFORMS];
+	GLsizei count;
+	float   boundRadius;	// about the sun, over every orbit
+	double  epoch;			// time the uploaded orbits' mean anomalies are at
+
+	// CPU copy used by the CPU propagator
+	vector<MyOrbit> orbits;
+
+	// initialize object names to zero (OpenGL reserved value)
+	MyMinorBodies() : orbitBuffer(0), positionBuffer(0), orbitArray(0),
+		positionArray(0), timeQuery(0), locatedProgram(0), count(0), boundRadius(0.0f), epoch(0.0)
+	{
+		for (int k = 0; k < propagateTimeQueries; k++) timeQueries[k] = 0;
+		for (int k = 0; k < PROPAGATE_UNIFORMS; k++) uniformLocations[k] = -1;
+	}
+};
+
+// the GPU propagator works in float on the time since the orbits' epoch,
+// which is moved forward (or back) once it is this far away
+const double minorBodyRebase = 2.0 * piVal * 365.25 * 100.0;
+
+// distance scale used for minor bodies, matching distEarthToSun
+float MinorBodyScaleOffset() { return float(log(auKm / unit)); }
+float MinorBodyScaleDivisor() { return float(log(base)); }
+float MinorBodyLinearScale() { return trueScale ? float(auKm / trueScaleUnit) : 0.0f; }
+
+// scene distance of a minor body r AU from the sun
+float MinorBodyDistance(float r)
+{
+	if (trueScale) return r * MinorBodyLinearScale();
+	return (log(r) + MinorBodyScaleOffset()) / MinorBodyScaleDivisor();
+}
+
+// create orbit and position buffers, returning true if successful
+bool InitializeMinorBodies(MyMinorBodies *bodies, int count)
+{
+	GenerateMinorBodies(bodies->orbits, count);
+	bodies->count = count;
+
+	// GPU propagated positions never reach the CPU, so the belt is culled as
+	// a whole by the scene distances of its perihelia and aphelia
+	bodies->boundRadius = 0.0f;
+	for (const MyOrbit &o : bodies->orbits) {
+		float a = o.p.w, e = o.q.w;
+		for (float r : { a * (1.0f - e), a * (1.0f + e) })
+			bodies->boundRadius = std::max(bodies->boundRadius, fabs(MinorBodyDistance(r)));
+	}
+
+	// orbits stay resident on the GPU, the CPU copy only serves the CPU path
+	glGenBuffers(1, &bodies->orbitBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, bodies->orbitBuffer);
+	glBufferData(GL_ARRAY_BUFFER, count * sizeof(MyOrbit), bodies->orbits.data(), GL_STATIC_DRAW);
+
+	glGenVertexArrays(1, &bodies->orbitArray);
+	glBindVertexArray(bodies->orbitArray);
+	for (GLuint k = 0; k < 3; k++) {
+		glVertexAttribPointer(k, 4, GL_FLOAT, GL_FALSE, sizeof(MyOrbit), (void *)(k * sizeof(vec4)));
+		glEnableVertexAttribArray(k);
+	}
+
+	// positions are written by transform feedback or uploaded by the CPU path
+	glGenBuffers(1, &bodies->positionBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, bodies->positionBuffer);
+	glBufferData(GL_ARRAY_BUFFER, count * sizeof(vec3), 0, GL_DYNAMIC_DRAW);
+
+	glGenVertexArrays(1, &bodies->positionArray);
+	glBindVertexArray(bodies->positionArray);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	glEnableVertexAttribArray(0);
+	TracePointArray(bodies->positionArray, bodies->positionBuffer);
+
+	glGenQueries(propagateTimeQueries, bodies->timeQueries);
+
+	// unbind our buffers, resetting to default state
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+
+	return !CheckGLErrors();
+}
+
+// moves the uploaded orbits to a new epoch, rewriting the orbit buffer from
+// the CPU copy in parallel
+void RebaseMinorBodies(MyMinorBodies *bodies, double epoch)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, bodies->orbitBuffer);
+	MyOrbit *mapped = (MyOrbit *)glMapBufferRange(GL_ARRAY_BUFFER, 0, bodies->count * sizeof(MyOrbit),
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (mapped) {
+		const MyOrbit *orbits = bodies->orbits.data();
+		ParallelFor(&jobs, 0, bodies->count, 16384, [orbits, mapped, epoch](int first, int last) {
+			for (int k = first; k < last; k++) mapped[k] = RebaseOrbit(orbits[k], epoch);
+		});
+		if (glUnmapBuffer(GL_ARRAY_BUFFER)) bodies->epoch = epoch;
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// propagate all minor bodies to the given time on the GPU, or upload the
+// positions propagated by the simulation when they are a new state, into the
+// position buffer
+void UpdateMinorBodies(MyMinorBodies *bodies, MyShader *propagate, double time, const vector<vec3> &cpuPositions,
+	bool fresh)
+{
+	// GPU propagation time is only measured in benchmark mode, reporting the
+	// query of an earlier frame once its result is available
+	bool timed = BenchmarkActive(&benchmark);
+	GLuint query = bodies->timeQueries[bodies->timeQuery];
+	if (timed) {
+		GLint available = 0;
+		if (glIsQuery(query)) glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available) {
+			GLuint64 ns = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+			BenchmarkSection(&benchmark, "propagate (gpu)", ns / 1.0e6);
+		}
+		glBeginQuery(GL_TIME_ELAPSED, query);
+	}
+	double start = glfwGetTime();
+
+	if (gpuPropagation) {
+		if (fabs(time - bodies->epoch) > minorBodyRebase)
+			RebaseMinorBodies(bodies, minorBodyRebase * floor(time / minorBodyRebase));
+
+		// run the orbits through the feedback program without rasterizing
+		UseProgram(propagate->program);
+		if (bodies->locatedProgram != propagate->program) {
+			for (int k = 0; k < PROPAGATE_UNIFORMS; k++)
+				bodies->uniformLocations[k] = glGetUniformLocation(propagate->program, propagateUniformNames[k]);
+			bodies->locatedProgram = propagate->program;
+		}
+		const GLint *location = bodies->uniformLocations;
+		glUniform1f(location[PROPAGATE_TIME], float(time - bodies->epoch));
+		glUniform1f(location[PROPAGATE_SCALE_OFFSET], MinorBodyScaleOffset());
+		glUniform1f(location[PROPAGATE_SCALE_DIVISOR], MinorBodyScaleDivisor());
+		glUniform1f(location[PROPAGATE_LINEAR_SCALE], MinorBodyLinearScale());
+		glState.frame.issued[GLCALL_UNIFORM] += 4;
+
+		// the feedback buffer is unbound again so the point pass can read it
+		SetCapability(CAP_RASTERIZER_DISCARD, true);
+		BindVertexArray(bodies->orbitArray);
+		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, bodies->positionBuffer);
+		glBeginTransformFeedback(GL_POINTS);
+		glDrawArrays(GL_POINTS, 0, bodies->count);
+		glEndTransformFeedback();
+		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+		SetCapability(CAP_RASTERIZER_DISCARD, false);
+		glState.frame.issued[GLCALL_BUFFER] += 2;
+		CountGLCall(GLCALL_DRAW);
+	}
+	else if (fresh && (GLsizei)cpuPositions.size() == bodies->count) {
+		// upload every position propagated on the CPU
+		glBindBuffer(GL_ARRAY_BUFFER, bodies->positionBuffer);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, bodies->count * sizeof(vec3), cpuPositions.data());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glState.frame.issued[GLCALL_BUFFER] += 3;
+	}
+
+	if (timed) {
+		BenchmarkSection(&benchmark, "propagate (cpu)", 1000.0 * (glfwGetTime() - start));
+		glEndQuery(GL_TIME_ELAPSED);
+		bodies->timeQuery = (bodies->timeQuery + 1) % propagateTimeQueries;
+	}
+}
+
+// draw the visible propagated positions as point sprites
+void RenderMinorBodies(MyMinorBodies *bodies, MyShader *points, GLintptr uniforms, const MyDrawRanges &draw)
+{
+	UseProgram(points->program);
+	BindUniforms(&uniformRing, UNIFORM_DRAW, uniforms, sizeof(MyDrawUniforms));
+
+	SetCapability(CAP_PROGRAM_POINT_SIZE, true);
+	BindVertexArray(bodies->positionArray);
+	DrawPointRanges(draw, bodies->count);
+
+	CheckFrameGLErrors();
+}
+
+// deallocate minor body objects
+void DestroyMinorBodies(MyMinorBodies *bodies)
+{
+	glBindVertexArray(0);
+	glDeleteVertexArrays(1, &bodies->orbitArray);
+	glDeleteVertexArrays(1, &bodies->positionArray);
+	glDeleteBuffers(1, &bodies->orbitBuffer);
+	glDeleteBuffers(1, &bodies->positionBuffer);
+	glDeleteQueries(propagateTimeQueries, bodies->timeQueries);
+}
+
+// --------------------------------------------------------------------------
+// Functions to build and load Chebyshev ephemeris files
+
+// fits the high accuracy series with Chebyshev segments over [startJD, endJD)
+// and writes them to a file, reporting the fit error; returns 0 if successful
+int BuildEphemerisFile(const char *filename, double startJD, double endJD)
+{
+	vector<MyChebSource> sources(2);
+	sources[0].name = "earth";
+	sources[0].centre = -1;
+	sources[0].coefficients = 14;
+	sources[0].segmentDays = 32.0;
+	sources[0].position = [](double jd) { return UpdateEphemeris(&ephemeris, jd, EPHEMERIS_HIGH).earth * auKm; };
+	sources[1].name = "moon";
+	sources[1].centre = 0;
+	sources[1].coefficients = 13;
+	sources[1].segmentDays = 4.0;
+	sources[1].position = [](double jd) { return UpdateEphemeris(&ephemeris, jd, EPHEMERIS_HIGH).moon; };
+
+	if (endJD <= startJD || !WriteChebFile(filename, sources, startJD, endJD)) {
+		cout << "ERROR: Could not write ephemeris file " << filename << endl;
+		return -1;
+	}
+
+	// compare against the series between the fitting nodes
+	MyChebFile cheb;
+	if (!OpenChebFile(&cheb, filename)) {
+		cout << "ERROR: Could not read back ephemeris file " << filename << endl;
+		return -1;
+	}
+	for (size_t b = 0; b < sources.size(); b++) {
+		double maxError = 0.0;
+		for (double jd = startJD; jd < endJD; jd += 0.37)
+			maxError = std::max(maxError, length(EvaluateCheb(&cheb, (int)b, jd) - sources[b].position(jd)));
+		cout << "Ephemeris " << sources[b].name << ": " << cheb.bodies[b].segmentCount << " segments, max fit error "
+			<< maxError << " km" << endl;
+	}
+	cout << "Wrote " << cheb.size << " bytes to " << filename << endl;
+	CloseChebFile(&cheb);
+	return 0;
+}
+
+// maps an ephemeris file and times random access evaluation, returning true
+// if the file provides the earth and the moon
+bool InitializeEphemerisFile(const char *filename)
+{
+	if (!OpenChebFile(&chebEphemeris, filename)) {
+		cout << "ERROR: Could not load ephemeris file " << filename << endl;
+		return false;
+	}
+	chebEarth = FindChebBody(&chebEphemeris, "earth");
+	chebMoon = FindChebBody(&chebEphemeris, "moon");
+	if (chebEarth < 0 || chebMoon < 0) {
+		cout << "ERROR: Ephemeris file " << filename << " has no earth or moon" << endl;
+		CloseChebFile(&chebEphemeris);
+		return false;
+	}
+
+	// evaluate every body at scattered dates across the whole span
+	const int samples = 100000;
+	int bodies = (int)chebEphemeris.header->bodyCount;
+	double span = chebEphemeris.header->endJD - chebEphemeris.header->startJD;
+	double start = glfwGetTime();
+	dvec3 sum(0.0), velocity;
+	for (int k = 0; k < samples; k++) {
+		double jd = chebEphemeris.header->startJD + span * ((k * 7919) % samples) / samples;
+		for (int b = 0; b < bodies; b++)
+			sum += EvaluateCheb(&chebEphemeris, b, jd, &velocity);
+	}
+	double ns = 1.0e9 * (glfwGetTime() - start) / (double(samples) * bodies);
+
+	// keep the evaluations from being optimized away
+	volatile double checksum = sum.x + sum.y + sum.z;
+	(void)checksum;
+
+	cout << "Loaded ephemeris " << filename << " (" << bodies << " bodies, JD "
+		<< chebEphemeris.header->startJD << " to " << chebEphemeris.header->endJD << "), "
+		<< ns << " ns per body evaluation" << endl;
+	return true;
+}
+
+// --------------------------------------------------------------------------
+// Functions to set up and propagate artificial Earth satellites
+
+struct MySatellites
+{
+	// OpenGL names for the position buffer and its vertex array
+	GLuint  positionBuffer;
+	GLuint  pointArray;
+	GLsizei count;
+
+	MySatelliteCatalog catalog;
+
+	// initialize object names to zero (OpenGL reserved value)
+	MySatellites() : positionBuffer(0), pointArray(0), count(0)
+	{}
+};
+
+// converts yangle (2 pi per day) to a Julian date
+double SimulationJD(double time)
+{
+	return epochJD + time / (2.0 * piVal);
+}
+
+// converts an ecliptic position in km to the scene frame, keeping the
+// direction and scaling the distance like distEarthToSun
+dvec3 EclipticToScene(const dvec3 &km)
+{
+	double r = length(km);
+	double d = SceneDistance(r);
+	return d / r * dvec3(km.x, km.z, -km.y);
+}
+
+// load the TLE catalog and create the position buffer, returning true if successful
+bool InitializeSatellites(MySatellites *satellites, const char *filename)
+{
+	double start = glfwGetTime();
+	satellites->count = LoadTLECatalog(&satellites->catalog, filename);
+	double ms = 1000.0 * (glfwGetTime() - start);
+	if (satellites->count == 0) {
+		cout << "ERROR: Could not load satellites from file " << filename << endl;
+		return false;
+	}
+	cout << "Loaded " << satellites->count << " satellites (" << satellites->catalog.deepSpace.size()
+		<< " deep-space) from " << filename << " in " << ms << " ms" << endl;
+
+	// one point per satellite; the points are drawn in visible ranges, so
+	// they are plain vertices rather than instances
+	glGenBuffers(1, &satellites->positionBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, satellites->positionBuffer);
+	glBufferData(GL_ARRAY_BUFFER, satellites->count * sizeof(vec3), 0, GL_DYNAMIC_DRAW);
+
+	glGenVertexArrays(1, &satellites->pointArray);
+	glBindVertexArray(satellites->pointArray);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	glEnableVertexAttribArray(0);
+	TracePointArray(satellites->pointArray, satellites->positionBuffer);
+
+	// unbind our buffers, resetting to default state
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+
+	return !CheckGLErrors();
+}
+
+// propagate every satellite to the given date in parallel, scaled about
+// the Earth's centre in its equatorial frame
+void PropagateSatellitePositions(const MySatellites *satellites, double jd, vector<vec3> &positions)
+{
+	double start = glfwGetTime();
+	float scale = float(1.0 / log(base));
+	float logUnit = float(log(unit));
+	float linearScale = trueScale ? float(1.0 / trueScaleUnit) : 0.0f;
+
+	positions.resize(satellites->count);
+	vec3 *p = positions.data();
+	ParallelFor(&jobs, 0, satellites->count, 1024, [satellites, jd, scale, logUnit, linearScale, p](int first, int last) {
+		PropagateSatellites(&satellites->catalog, first, last, jd, p);
+		for (int k = first; k < last; k++) {
+			float r = length(p[k]);
+			if (linearScale > 0.0f) p[k] *= linearScale;
+			else if (r > 0.0f) p[k] *= (log(r) - logUnit) * scale / r;
+		}
+	});
+	double ms = 1000.0 * (glfwGetTime() - start);
+	BenchmarkSection(&benchmark, "satellites (propagate)", ms);
+	BenchmarkThroughput(&benchmark, "satellites propagated", satellites->count, ms);
+}
+
+// upload propagated satellite positions
+void UploadSatellites(MySatellites *satellites, const vector<vec3> &positions)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, satellites->positionBuffer);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, satellites->count * sizeof(vec3), positions.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glState.frame.issued[GLCALL_BUFFER] += 3;
+}
+
+// draw the visible satellites as point sprites in the Earth's frame
+void RenderSatellites(MySatellites *satellites, MyShader *points, GLintptr uniforms, const MyDrawRanges &draw)
+{
+	UseProgram(points->program);
+	BindUniforms(&uniformRing, UNIFORM_DRAW, uniforms, sizeof(MyDrawUniforms));
+
+	SetCapability(CAP_PROGRAM_POINT_SIZE, true);
+	BindVertexArray(satellites->pointArray);
+	DrawPointRanges(draw, satellites->count);
+
+	CheckFrameGLErrors();
+}
+
+// deallocate satellite objects
+void DestroySatellites(MySatellites *satellites)
+{
+	glBindVertexArray(0);
+	glDeleteVertexArrays(1, &satellites->pointArray);
+	glDeleteBuffers(1, &satellites->positionBuffer);
+}
+
+// --------------------------------------------------------------------------
+// Functions to load and draw a star catalog
+//
+// The stars of a catalog file (see stars.h) are uploaded once, in its order
+// of HEALPix cells and magnitudes. Each frame the cells outside the view or
+// behind a body are skipped and, of the others, only the stars brighter than
+// the magnitude limit are drawn, as one range per run of adjacent cells. The
+// limit follows the angular resolution: zooming in by a factor k shows stars
+// 5 log10 k magnitudes fainter, which keeps the number of stars per pixel
+// about the same, so the cost stays bounded at any zoom.
+
+struct MyStars
+{
+	// OpenGL names for the star buffer and its vertex array
+	GLuint  starBuffer;
+	GLuint  pointArray;
+	GLsizei count;
+
+	MyStarCatalog catalog;
+	MyShader shader, cubeShader;	// cubeShader draws all panorama faces in one pass
+
+	// initialize object names to zero (OpenGL reserved value)
+	MyStars() : starBuffer(0), pointArray(0), count(0)
+	{}
+};
+
+// reads a star table and writes it as a catalog file, returning the process
+// exit code
+int BuildStarFile(const char *table, const char *filename, int nside)
+{
+	vector<MyStarRecord> stars;
+	if (nside < 1 || nside > 1024 || (nside & (nside - 1))) {
+		cout << "ERROR: HEALPix nside must be a power of two up to 1024" << endl;
+		return -1;
+	}
+	if (ReadStarTable(table, &stars) == 0) {
+		cout << "ERROR: Could not read stars from " << table << endl;
+		return -1;
+	}
+	if (!WriteStarFile(filename, stars, nside)) {
+		cout << "ERROR: Could not write star catalog " << filename << endl;
+		return -1;
+	}
+	cout << "Wrote " << stars.size() << " stars in " << 12 * nside * nside << " cells to " << filename << endl;
+	return 0;
+}
+
+// load the catalog, create the star buffer and the programs drawing it,
+// returning true if successful
+bool InitializeStars(MyStars *stars, const char *filename, bool layered)
+{
+	double start = glfwGetTime();
+	if (!LoadStarCatalog(&stars->catalog, filename)) {
+		cout << "ERROR: Could not load star catalog " << filename << endl;
+		return false;
+	}
+	stars->count = GLsizei(stars->catalog.stars.size());
+	cout << "Loaded " << stars->count << " stars in " << stars->catalog.header.cellCount << " cells from "
+		<< filename << " in " << 1000.0 * (glfwGetTime() - start) << " ms" << endl;
+
+	if (!InitializeShaders(&stars->shader, "star_vertex.glsl", "star_fragment.glsl"))
+		return false;
+	BindUniformBlocks(&stars->shader);
+	if (layered) {
+		if (InitializeShaders(&stars->cubeShader, "star_vertex.glsl", "star_fragment.glsl", "cube_star_geometry.glsl"))
+			BindUniformBlocks(&stars->cubeShader);
+		else cout << "ERROR: Stars can not be drawn into the layered cubemap" << endl;
+	}
+
+	// the records are the vertices: the direction as normalized shorts, and
+	// magnitude and colour as shorts converted to float
+	glGenBuffers(1, &stars->starBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, stars->starBuffer);
+	glBufferData(GL_ARRAY_BUFFER, stars->count * sizeof(MyStarRecord), stars->catalog.stars.data(), GL_STATIC_DRAW);
+
+	glGenVertexArrays(1, &stars->pointArray);
+	glBindVertexArray(stars->pointArray);
+	glVertexAttribPointer(0, 3, GL_SHORT, GL_TRUE, sizeof(MyStarRecord), (void *)offsetof(MyStarRecord, direction));
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 2, GL_SHORT, GL_FALSE, sizeof(MyStarRecord), (void *)offsetof(MyStarRecord, magnitude));
+	glEnableVertexAttribArray(1);
+
+	// unbind our buffers, resetting to default state
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+
+	return !CheckGLErrors();
+}
+
+// takes catalog directions (J2000 equatorial) through the ecliptic to the
+// scene frame, as EclipticToScene, onto a sphere about the camera
+mat4 StarModel(float distance)
+{
+	float c = cos(obliquity), s = sin(obliquity);
+	mat4 model(1.0f);
+	model[0] = vec4(distance, 0.0f, 0.0f, 0.0f);
+	model[1] = vec4(0.0f, -s * distance, -c * distance, 0.0f);
+	model[2] = vec4(0.0f, c * distance, -s * distance, 0.0f);
+	return model;
+}
+
+// faintest magnitude drawn, for a view resolving k times as many pixels per
+// radian as the window at the default field of view
+float StarMagnitudeLimit(float k)
+{
+	return starLimit + 5.0f * log10(std::max(k, 1.0e-3f));
+}
+
+// draw the stars brighter than the limit in the visible cells as point
+// sprites, with the program for the target
+void RenderStars(MyStars *stars, MyShader *program, GLintptr uniforms, const MyDrawRanges &draw,
+	float magnitudeLimit, float minSize)
+{
+	UseProgram(program->program);
+	BindUniforms(&uniformRing, UNIFORM_DRAW, uniforms, sizeof(MyDrawUniforms));
+	float limits[2] = { magnitudeLimit, minSize };
+	SetUniform2f(program->program, "limits", limits);
+
+	SetCapability(CAP_PROGRAM_POINT_SIZE, true);
+	BindVertexArray(stars->pointArray);
+	DrawPointRanges(draw, stars->count);
+
+	CheckFrameGLErrors();
+}
+
+// deallocate star objects
+void DestroyStars(MyStars *stars)
+{
+	glBindVertexArray(0);
+	glDeleteVertexArrays(1, &stars->pointArray);
+	glDeleteBuffers(1, &stars->starBuffer);
+	if (stars->shader.program) DestroyShaders(&stars->shader);
+	if (stars->cubeShader.program) DestroyShaders(&stars->cubeShader);
+}
+
+// --------------------------------------------------------------------------
+// Functions to integrate and draw bodies under mutual gravity
+
+struct MyParticles
+{
+	// OpenGL names for the particle position buffer and its vertex array
+	GLuint  positionBuffer;
+	GLuint  pointArray;
+	GLsizei capacity;
+	GLsizei count;
+
+	// initialize object names to zero (OpenGL reserved value)
+	MyParticles() : positionBuffer(0), pointArray(0), capacity(0), count(0)
+	{}
+};
+
+// restarts the simulation at the given date with the Sun, the Earth and the
+// Moon from the high accuracy ephemeris, plus a number of test particles
+void SeedNBody(MyNBody *sim, double jd, int particles)
+{
+	const double sunMass = 1.0, earthMass = 3.003489e-6, moonMass = 3.694303e-8;
+	const double h = 0.01;	// days, for central difference velocities
+
+	MyEphemerisState now = UpdateEphemeris(&ephemeris, jd, EPHEMERIS_HIGH);
+	MyEphemerisState next = UpdateEphemeris(&ephemeris, jd + h, EPHEMERIS_HIGH);
+	MyEphemerisState prev = UpdateEphemeris(&ephemeris, jd - h, EPHEMERIS_HIGH);
+	dvec3 earthVel = (next.earth - prev.earth) / (2.0 * h);
+	dvec3 moonVel = earthVel + (next.moon - prev.moon) / (2.0 * h * auKm);
+
+	ClearNBody(sim);
+	sim->time = jd;
+	sim->integrator = nbodyIntegrator;
+	AddNBody(sim, dvec3(0.0), dvec3(0.0), sunMass, "sun");
+	AddNBody(sim, now.earth, earthVel, earthMass, "earth");
+	AddNBody(sim, now.earth + now.moon / auKm, moonVel, moonMass, "moon");
+
+	// the Sun absorbs the momentum of the Earth and Moon so the system does
+	// not drift away from the origin
+	sim->velocity[0] = -(earthMass * earthVel + moonMass * moonVel) / sunMass;
+
+	InjectParticles(sim, particles, sim->position[1], sim->velocity[1], 0);
+}
+
+// create the particle position buffer, returning true if successful
+bool InitializeParticles(MyParticles *particles)
+{
+	glGenBuffers(1, &particles->positionBuffer);
+	glGenVertexArrays(1, &particles->pointArray);
+	glBindVertexArray(particles->pointArray);
+	glBindBuffer(GL_ARRAY_BUFFER, particles->positionBuffer);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	glEnableVertexAttribArray(0);
+	TracePointArray(particles->pointArray, particles->positionBuffer);
+
+	// unbind our buffers, resetting to default state
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+
+	return !CheckGLErrors();
+}
+
+// brings the simulation to the given date, restarting it when requested or
+// after a jump in time, and writes the particle positions, log-scaled about
+// the Sun like the minor bodies
+void UpdateNBody(MyNBody *sim, double jd, vector<vec3> &positions)
+{
+	double days = jd - sim->time;
+	if (nbodyRestart.exchange(false) || sim->count == 0 || fabs(days) > nbodyMaxStep * nbodyMaxSubsteps)
+		SeedNBody(sim, jd, nbodyParticles);
+	else {
+		double start = glfwGetTime();
+		int steps = AdvanceNBody(sim, &jobs, days, nbodyMaxStep, nbodyMaxSubsteps);
+		double ms = 1000.0 * (glfwGetTime() - start);
+		BenchmarkSection(&benchmark, "nbody (integrate)", ms);
+		BenchmarkThroughput(&benchmark, "nbody steps", steps, ms);
+	}
+
+	// inject test particles near the Earth
+	int batches = particleInjections.exchange(0);
+	if (batches > 0) {
+		InjectParticles(sim, 1000 * batches, sim->position[1], sim->velocity[1], (unsigned)sim->count);
+		cout << "N-body simulation with " << sim->count << " bodies" << endl;
+	}
+
+	// particles follow the three massive bodies
+	const int first = 3;
+	positions.resize(std::max(0, sim->count - first));
+	vec3 *p = positions.data();
+	dvec3 sun = sim->position[0];
+	ParallelFor(&jobs, 0, (int)positions.size(), 4096, [sim, p, sun, first](int begin, int end) {
+		for (int k = begin; k < end; k++)
+			p[k] = vec3(EclipticToScene((sim->position[first + k] - sun) * auKm));
+	});
+}
+
+// upload particle positions, growing the buffer when particles were injected
+void UploadParticles(MyParticles *particles, const vector<vec3> &positions)
+{
+	particles->count = (GLsizei)positions.size();
+	glBindBuffer(GL_ARRAY_BUFFER, particles->positionBuffer);
+	if (particles->count > particles->capacity) {
+		particles->capacity = particles->count;
+		glBufferData(GL_ARRAY_BUFFER, particles->capacity * sizeof(vec3), 0, GL_DYNAMIC_DRAW);
+	}
+	glBufferSubData(GL_ARRAY_BUFFER, 0, particles->count * sizeof(vec3), positions.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glState.frame.issued[GLCALL_BUFFER] += 3;
+}
+
+// draw the visible particles as point sprites
+void RenderParticles(MyParticles *particles, MyShader *points, GLintptr uniforms, const MyDrawRanges &draw)
+{
+	UseProgram(points->program);
+	BindUniforms(&uniformRing, UNIFORM_DRAW, uniforms, sizeof(MyDrawUniforms));
+
+	SetCapability(CAP_PROGRAM_POINT_SIZE, true);
+	BindVertexArray(particles->pointArray);
+	DrawPointRanges(draw, particles->count);
+
+	CheckFrameGLErrors();
+}
+
+// deallocate particle objects
+void DestroyParticles(MyParticles *particles)
+{
+	glBindVertexArray(0);
+	glDeleteVertexArrays(1, &particles->pointArray);
+	glDeleteBuffers(1, &particles->positionBuffer);
+}
+
+// --------------------------------------------------------------------------
+// Job pool utilization
+
+double jobStatsStart = 0.0;
+
+// prints per-thread utilization since the last report and resets the counters
+void ReportJobStats()
+{
+	double now = glfwGetTime();
+	double seconds = now - jobStatsStart;
+	double total = 0.0;
+	int threads = 0;
+	cout << "Job threads over " << seconds << " s:" << endl;
+	for (int k = 0; k < JobThreads(&jobs); k++) {
+		// the simulation queue has no thread when stepping inline
+		if (k == simulationJobQueue && !simulationThread) continue;
+		MyJobStats stats = GetJobStats(&jobs, k, seconds);
+		const char *owner = k == 0 ? "main      " : k == simulationJobQueue ? "simulation" : "worker    ";
+		cout << "  " << owner << " " << k << ": " << int(100.0 * stats.busy + 0.5)
+			<< "% busy, " << stats.jobsRun << " jobs, " << stats.jobsStolen << " stolen" << endl;
+		total += stats.busy;
+		threads++;
+	}
+	cout << "  total " << total << " of " << threads << " threads busy" << endl;
+	ResetJobStats(&jobs);
+	jobStatsStart = now;
+}
+
+// --------------------------------------------------------------------------
+// Idle rendering
+
+double idleStatsStart = 0.0;
+double idleSeconds = 0.0;		// spent waiting for events or the frame cap
+long long framesDrawn = 0;
+int refreshRate = 60;			// of the primary monitor
+
+// prints the share of time spent idle and the frames drawn and skipped (the
+// refresh intervals spent idle) since the last report, and resets them
+void ReportIdleStats()
+{
+	double now = glfwGetTime();
+	double seconds = now - idleStatsStart;
+	cout << "Frames over " << seconds << " s: " << framesDrawn << " drawn, "
+		<< (long long)(idleSeconds * refreshRate) << " skipped, "
+		<< int(100.0 * idleSeconds / std::max(seconds, 1.0e-9) + 0.5) << "% idle" << endl;
+	if (renderScale.budgetMs > 0.0)
+		cout << "Render scale " << renderScale.scale << " for " << renderScale.smoothedMs
+			<< " ms of GPU time against a budget of " << renderScale.budgetMs << " ms" << endl;
+	idleSeconds = 0.0;
+	framesDrawn = 0;
+	idleStatsStart = now;
+}
+
+// marks the scene for redrawing and wakes the simulation thread for one
+// step, so that input takes effect while paused
+void RequestSimulationStep()
+{
+	sceneDirty = true;
+	{
+		lock_guard<mutex> lock(simulationWakeLock);
+		simulationRequest = true;
+	}
+	simulationWake.notify_one();
+}
+
+// --------------------------------------------------------------------------
+// Simulation thread
+//
+// Time, body poses and all CPU propagation advance at a fixed step on their
+// own thread. Every step is published through a triple buffer; the render
+// thread picks up the latest one and interpolates between the step's
+// previous and current poses, so neither thread ever waits for the other.
+
+const double simulationStep = 1.0 / 60.0;	// seconds of wall time per step
+
+enum SimulationBody { BODY_SUN, BODY_EARTH, BODY_MOON, BODY_COUNT };
+
+// positions, time and spin angles are double; the render thread converts
+// them to camera-relative floats once per frame
+struct MyBodyPose
+{
+	dvec3 position;		// scene frame
+	quat orientation;	// tilt and orbit facing
+	double spin;		// rotation about the body's own axis, unwrapped
+};
+
+struct MySimulationFrame
+{
+	double yangle;
+	MyBodyPose bodies[BODY_COUNT];
+};
+
+// everything the render thread needs from one step
+struct MySimulationState
+{
+	double wallTime;	// glfwGetTime() the step was due at
+	long long step;
+	double jd;			// simulated date
+	MySimulationFrame previous, current;
+
+	// propagated point sets, not interpolated, sorted for culling with the
+	// bounds of their chunks
+	vector<vec3> minorBodies;	// CPU propagation only
+	vector<vec3> satellites;
+	vector<vec3> particles;
+	vector<MyPointChunk> minorBodyChunks, satelliteChunks, particleChunks;
+
+	MySimulationState() : wallTime(0.0), step(0), jd(0.0)
+	{}
+};
+
+struct MySimulation
+{
+	MyTripleBuffer<MySimulationState> states;
+	MySimulationFrame last;
+	long long step;
+
+	// CPU data of the propagated point sets, and scratch space for sorting them
+	const MyMinorBodies *minorBodies;
+	const MySatellites *satellites;
+	MyPointSort minorBodySort, satelliteSort, particleSort;
+
+	thread worker;
+	atomic<bool> quit;
+
+	MySimulation() : step(0), minorBodies(0), satellites(0), quit(false)
+	{}
+};
+
+// poses of the Sun, Earth and Moon at the given time, from the N-body
+// simulation, the ephemeris or on circular orbits
+void ComputeBodyPoses(MySimulationFrame *frame, double time, double jd)
+{
+	vec3 xaxis(1, 0, 0), yaxis(0, 1, 0), zaxis(0, 0, 1);
+	frame->yangle = time;
+
+	MyBodyPose &sun = frame->bodies[BODY_SUN];
+	sun.position = dvec3(0.0);
+	sun.orientation = angleAxis(sunTilt, xaxis);
+	sun.spin = time / sunRotate;
+
+	MyBodyPose &earth = frame->bodies[BODY_EARTH];
+	MyBodyPose &moon = frame->bodies[BODY_MOON];
+	earth.orientation = angleAxis(earthTilt, xaxis);
+	earth.spin = time / earthRotate;
+	moon.spin = 0.0;
+
+	int tier = ephemerisTier;
+	if (nbody.count > 0 || chebEphemeris.data || tier >= 0) {
+		MyEphemerisState eph;
+		if (nbody.count > 0) {
+			eph.earth = nbody.position[1] - nbody.position[0];
+			eph.moon = (nbody.position[2] - nbody.position[1]) * auKm;
+		}
+		else if (chebEphemeris.data && ChebCovers(&chebEphemeris, chebEarth, jd) &&
+			ChebCovers(&chebEphemeris, chebMoon, jd)) {
+			eph.earth = EvaluateCheb(&chebEphemeris, chebEarth, jd) / auKm;
+			eph.moon = EvaluateCheb(&chebEphemeris, chebMoon, jd);
+		}
+		else {
+			// outside the file's span the series it was fitted to take over
+			eph = UpdateEphemeris(&ephemeris, jd, tier >= 0 ? tier : EPHEMERIS_HIGH);
+		}
+		dvec3 earthScene = EclipticToScene(eph.earth * auKm);
+		dvec3 moonScene = EclipticToScene(eph.moon);
+		earth.position = earthScene;								// heliocentric position
+		moon.position = earthScene + moonScene;						// geocentric position
+		moon.orientation = angleAxis(float(atan2(-moonScene.z, moonScene.x)), yaxis) *	// face the earth
+							angleAxis(moonTilt, xaxis);				// set tilt
+	}
+	else {
+		double earthAngleO = time / earthOrbit;
+		earth.position = rotate(dvec3(distEarthToSun, 0, 0), earthAngleO, dvec3(yaxis));
+
+		float moonAngleO = float(fmod(time / moonOrbit, 2.0 * piVal));
+		quat moonOrbitRotation = angleAxis(moonIncl, zaxis) *		// orbit inclination
+								angleAxis(moonAngleO, yaxis);		// orbit rotation
+		moon.position = earth.position + dvec3(earth.orientation * (moonOrbitRotation * vec3(distMoonToEarth, 0, 0)));
+		moon.orientation = earth.orientation * moonOrbitRotation *
+							angleAxis(moonTilt, xaxis);				// set tilt
+	}
+}
+
+// animation time of a numbered frame in offline rendering, as if the
+// animation had run one step per frame from the start
+double FrameYangle(long long frame)
+{
+	return double(frame) * animSpeed * simulationStep;
+}
 
-			if (i > maxShapes * 3) break;
+// advances the simulation by one step and publishes its state
+void StepSimulation(MySimulation *sim, double wallTime)
+{
+	// apply requests from input
+	int jumps = yearJumps.exchange(0);
+	if (animate) yangle += animSpeed * simulationStep;
+	yangle += jumps * 2.0 * piVal * 365.25;
+	double jd = SimulationJD(yangle);
+
+	MySimulationState *state = WriteSlot(&sim->states);
+	state->wallTime = wallTime;
+	state->step = ++sim->step;
+	state->jd = jd;
+	state->current.yangle = yangle;
+
+	// the N-body integration, the body poses (which depend on it) and the
+	// CPU propagation of the point sets run as jobs of this step
+	MyJobCounter integrated;
+	if (nbodyMode)
+		PushJob(&jobs, [sim, state] {
+			UpdateNBody(&nbody, state->jd, state->particles);
+			SortPoints(&jobs, state->particles, &sim->particleSort);
+			BuildPointChunks(&jobs, state->particles, state->particleChunks);
+		}, &integrated);
+	else {
+		if (nbody.count > 0) ClearNBody(&nbody);
+		state->particles.clear();
+		state->particleChunks.clear();
+	}
 
-			// indices
-			indices[j] = i - 1 - offset;
-			j++;
-			indices[j] = i - 2 - offset;
-			j++;
-			indices[j] = i - 3 - offset;
-			j++;
+	PushFrameJob(&jobs, [state] { ComputeBodyPoses(&state->current, state->current.yangle, state->jd); }, &integrated);
+
+	if (sim->minorBodies && !gpuPropagation) {
+		PushFrameJob(&jobs, [sim, state] {
+			double start = glfwGetTime();
+			const MyMinorBodies *bodies = sim->minorBodies;
+			double time = state->current.yangle;
+			state->minorBodies.resize(bodies->count);
+			vec3 *p = state->minorBodies.data();
+			ParallelFor(&jobs, 0, bodies->count, 4096, [bodies, p, time](int first, int last) {
+				PropagateMinorBodies(bodies->orbits.data(), p, first, last, time,
+					MinorBodyScaleOffset(), MinorBodyScaleDivisor(), MinorBodyLinearScale());
+			});
+			SortPoints(&jobs, state->minorBodies, &sim->minorBodySort);
+			BuildPointChunks(&jobs, state->minorBodies, state->minorBodyChunks);
+			BenchmarkSection(&benchmark, "propagate (simulation)", 1000.0 * (glfwGetTime() - start));
+		});
+	}
+	else {
+		state->minorBodies.clear();
+		state->minorBodyChunks.clear();
+	}
 
-			if (it >= 0.0 && it < piVal - unit) {
-				indices[j] = i - 1 - offset;
-				j++;
-				indices[j] = i - 2 - offset;
-				j++;
-
-				if (ip < 2.0 * piVal - unit) {
-					indices[j] = i + 2 - offset;
-					j++;
-				}
-				else {
-					indices[j] = i - offset;
-					j++;
-				}
-			}
-		}
+	if (sim->satellites)
+		PushFrameJob(&jobs, [sim, state] {
+			PropagateSatellitePositions(sim->satellites, state->jd, state->satellites);
+			SortPoints(&jobs, state->satellites, &sim->satelliteSort);
+			BuildPointChunks(&jobs, state->satellites, state->satelliteChunks);
+		});
 
-		y += 1.0 / div;
-	}
+	WaitFrameJobs(&jobs);
 
-	result.lastVertex = i - 1;
-	result.lastIndex = j - 1;
-	return result;
+	// interpolate from the last step's poses, except across the first step
+	// or a jump
+	state->previous = sim->step == 1 || jumps != 0 ? state->current : sim->last;
+	sim->last = state->current;
+
+	PublishSlot(&sim->states);
 }
 
-// create buffers and fill with geometry data, returning true if successful
-bool InitializeGeometry(MyGeometry *geometry)
+// steps at the fixed rate until told to quit, sleeping while ahead of the
+// clock and dropping time when too far behind to catch up; while paused it
+// sleeps until input requests a step
+void SimulationLoop(MySimulation *sim)
 {
-	// earth
-	spheres[0] = generateSphere(earthResolution, earthR, 0, 0, 0);
+	JobQueueIndex() = simulationJobQueue;
+	double next = glfwGetTime() + simulationStep;
+	while (!sim->quit) {
+		if (!animate && !simulationRequest) {
+			unique_lock<mutex> lock(simulationWakeLock);
+			simulationWake.wait(lock, [sim] { return animate || simulationRequest || sim->quit; });
+			next = glfwGetTime();
+			continue;
+		}
 
-	// stars
-	spheres[1] = generateSphere(starResolution, maxDistance + 0.65, spheres[0].lastVertex + 1, spheres[0].lastIndex + 1, 1);
+		double now = glfwGetTime();
+		if (now < next) {
+			this_thread::sleep_for(chrono::duration<double>(next - now));
+			continue;
+		}
+		simulationRequest = false;
+		StepSimulation(sim, next);
+		next += simulationStep;
+		if (now - next > 0.25) next = now;
+
+		// a waiting render thread draws the new state
+		sceneDirty = true;
+		if (!animate) glfwPostEmptyEvent();
+	}
+}
 
-	// moon
-	spheres[2] = generateSphere(moonResolution, moonR, spheres[1].lastVertex + 1, spheres[1].lastIndex + 1, 2);
+// publishes the first state, then starts the simulation thread if requested
+void StartSimulation(MySimulation *sim, bool threaded)
+{
+	StepSimulation(sim, glfwGetTime());
+	if (threaded) sim->worker = thread(SimulationLoop, sim);
+}
 
-	// sun
-	spheres[3] = generateSphere(sunResolution, sunR, spheres[2].lastVertex + 1, spheres[2].lastIndex + 1, 3);
+void StopSimulation(MySimulation *sim)
+{
+	{
+		lock_guard<mutex> lock(simulationWakeLock);
+		sim->quit = true;
+	}
+	simulationWake.notify_one();
+	if (sim->worker.joinable()) sim->worker.join();
+}
 
-	geometry->elementCount = spheres[3].lastIndex;
+// latest state and its poses interpolated to the given time, one step
+// behind the simulation
+const MySimulationState *ReadSimulation(MySimulation *sim, double now, MySimulationFrame *frame, bool *fresh)
+{
+	const MySimulationState *state = ReadSlot(&sim->states, fresh);
+	double alpha = glm::clamp((now - state->wallTime) / simulationStep, 0.0, 1.0);
+	frame->yangle = mix(state->previous.yangle, state->current.yangle, alpha);
+	for (int b = 0; b < BODY_COUNT; b++) {
+		const MyBodyPose &p = state->previous.bodies[b], &c = state->current.bodies[b];
+		frame->bodies[b].position = mix(p.position, c.position, alpha);
+		frame->bodies[b].orientation = slerp(p.orientation, c.orientation, float(alpha));
+		frame->bodies[b].spin = mix(p.spin, c.spin, alpha);
+	}
+	return state;
+}
 
-	// these vertex attribute indices correspond to those specified for the
-	// input variables in the vertex shader
-	const GLuint VERTEX_INDEX = 0;
-	const GLuint COLOUR_INDEX = 1;
-	const GLuint TEXTURE_INDEX = 2;
+// body pose as a model matrix relative to the camera, without the spin; the
+// subtraction is done in double so that nothing far from the origin jitters
+mat4 PoseMatrix(const MyBodyPose &pose, const dvec3 &camera)
+{
+	return translate(mat4(1), vec3(pose.position - camera)) * mat4_cast(pose.orientation);
+}
 
-	// create an array buffer object for storing our vertices
-	glGenBuffers(1, &geometry->vertexBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, geometry->vertexBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+// rotation about a body's own axis, wrapped before conversion to float
+mat4 SpinMatrix(const MyBodyPose &pose)
+{
+	return rotate(mat4(1), float(fmod(pose.spin, 2.0 * piVal)), vec3(0, 1, 0));
+}
 
-	// create another one for storing our colours
-	glGenBuffers(1, &geometry->colourBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, geometry->colourBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(colours), colours, GL_STATIC_DRAW);
+// --------------------------------------------------------------------------
+// Offscreen, cubemap and capture targets (see rendertarget.h, cubetarget.h
+// and capture.h), drawn through the state cache wrappers above
 
-	// create another one for storing our texture data
-	glGenBuffers(1, &geometry->textureBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, geometry->textureBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(texCoords), texCoords, GL_STATIC_DRAW);
+#include "rendertarget.h"
+#include "cubetarget.h"
+#include "capture.h"
 
-	// create a vertex array object encapsulating all our vertex attributes
-	glGenVertexArrays(1, &geometry->vertexArray);
-	glBindVertexArray(geometry->vertexArray);
+// --------------------------------------------------------------------------
+// Tiled poster rendering
+//
+// With --poster the main loop draws one tile of the poster per iteration
+// (see poster.h), hidden and at the window's framebuffer size, until every
+// tile is in the file. A tile is read back from the window into one of two
+// pixel pack buffers. The other buffer, holding the tile before, is mapped
+// and written to the file while the GPU draws this one.
+
+struct MyPosterReadback
+{
+	GLuint  buffers[2];		// pixel pack buffers of one tile each
+	int     tile;			// next tile to draw
+	int     failed;			// tiles that could not be written
+	double  start;
 
-	// element array -> buffer
-	glGenBuffers(1, &geometry->elementBuffer);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, geometry->elementBuffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+	// initialize object names to zero (OpenGL reserved value)
+	MyPosterReadback() : tile(0), failed(0), start(0.0)
+	{
+		buffers[0] = buffers[1] = 0;
+	}
+};
 
-	// texture array -> buffer
-	glBindBuffer(GL_ARRAY_BUFFER, geometry->textureBuffer);
-	glVertexAttribPointer(TEXTURE_INDEX, 3	, GL_FLOAT, GL_FALSE, 0, 0);
-	glEnableVertexAttribArray(TEXTURE_INDEX);
+MyPosterReadback posterReadback;
 
-	// associate the position array with the vertex array object
-	glBindBuffer(GL_ARRAY_BUFFER, geometry->vertexBuffer);
-	glVertexAttribPointer(VERTEX_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
-	glEnableVertexAttribArray(VERTEX_INDEX);
+// lays the tiles out at the framebuffer size and opens the file
+bool InitializePoster(MyPosterReadback *readback, MyPoster *p, int width, int height)
+{
+	SetPosterTiles(p, width, height);
+	if (!OpenPosterFile(p)) {
+		cout << "ERROR: Could not open " << p->filename << " as a " << p->width << "x" << p->height << " poster" << endl;
+		return false;
+	}
+	glGenBuffers(2, readback->buffers);
+	for (int k = 0; k < 2; k++) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback->buffers[k]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, GLsizeiptr(width) * height * 3, 0, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	readback->start = glfwGetTime();
+	cout << "Rendering a " << p->width << "x" << p->height << " poster, rows " << p->firstRow << " to "
+		<< p->firstRow + p->rowCount - 1 << ", as " << PosterTiles(p) << " tiles of " << width << "x" << height << endl;
+	return !CheckGLErrors();
+}
 
-	// assocaite the colour array with the vertex array object
-	glBindBuffer(GL_ARRAY_BUFFER, geometry->colourBuffer);
-	glVertexAttribPointer(COLOUR_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
-	glEnableVertexAttribArray(COLOUR_INDEX);
+// projection of the tile about to be drawn
+mat4 PosterProjection(const MyPosterReadback *readback, const MyPoster *p, float zNear, float zFar)
+{
+	int column, row;
+	float left, right, bottom, top;
+	PosterTile(p, readback->tile, &column, &row);
+	PosterTileFrustum(p, column, row, fov, zNear, &left, &right, &bottom, &top);
+	return frustum(left, right, bottom, top, zNear, zFar);
+}
 
-	// unbind our buffers, resetting to default state
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+// maps a tile's pixel buffer and writes the tile to the file
+void WritePosterBuffer(MyPosterReadback *readback, MyPoster *p, int tile)
+{
+	int column, row;
+	PosterTile(p, tile, &column, &row);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback->buffers[tile % 2]);
+	void *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, GLsizeiptr(p->tileWidth) * p->tileHeight * 3,
+		GL_MAP_READ_BIT);
+	if (!pixels || !WritePosterTile(p, column, row, (const unsigned char *)pixels)) readback->failed++;
+	if (pixels) glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
 
-	// check for OpenGL errors and return false if error occurred
-	return !CheckGLErrors();
+// reads back the tile just drawn and writes out the one before it,
+// returning false once every tile is done; call before the swap
+bool ReadPosterTile(MyPosterReadback *readback, MyPoster *p)
+{
+	int tile = readback->tile++;
+	BindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback->buffers[tile % 2]);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, p->tileWidth, p->tileHeight, GL_RGB, GL_UNSIGNED_BYTE, 0);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glState.frame.issued[GLCALL_BUFFER] += 2;
+
+	if (tile > 0) WritePosterBuffer(readback, p, tile - 1);
+	if (readback->tile < PosterTiles(p)) return true;
+	WritePosterBuffer(readback, p, tile);
+	return false;
 }
 
-// deallocate geometry-related objects
-void DestroyGeometry(MyGeometry *geometry)
+// closes the file and reports, returning true if every tile was written
+bool FinishPoster(MyPosterReadback *readback, MyPoster *p)
 {
-	// unbind and destroy our vertex array object and associated buffers
-	glBindVertexArray(0);
-	glDeleteVertexArrays(1, &geometry->vertexArray);
-	glDeleteBuffers(1, &geometry->vertexBuffer);
-	glDeleteBuffers(1, &geometry->colourBuffer);
-	glDeleteBuffers(1, &geometry->elementBuffer);
+	bool ok = ClosePosterFile(p) && readback->failed == 0 && readback->tile == PosterTiles(p);
+	if (ok && p->band && !WritePosterBandMarker(p)) {
+		cout << "ERROR: Could not mark rows " << p->firstRow << " to " << p->firstRow + p->rowCount - 1
+			<< " of " << p->filename << " as written" << endl;
+		ok = false;
+	}
+	glDeleteBuffers(2, readback->buffers);
+	double seconds = glfwGetTime() - readback->start;
+	if (ok)
+		cout << "Wrote rows " << p->firstRow << " to " << p->firstRow + p->rowCount - 1 << " of " << p->filename
+			<< ": " << readback->tile << " tiles in " << seconds << " s (" << readback->tile / seconds << " tiles/s)" << endl;
+	else
+		cout << "ERROR: Poster " << p->filename << " incomplete, " << readback->tile << " of " << PosterTiles(p)
+			<< " tiles drawn and " << readback->failed << " not written" << endl;
+	*readback = MyPosterReadback();
+	return ok;
 }
 
 // --------------------------------------------------------------------------
 // Rendering function that draws our scene to the frame buffer
 
-void RenderScene(MyGeometry *geometry, MyShader *shader, MyTexture *textures)
+void RenderScene(MyGeometry *geometry, MyShader *shader, MyTexture *textures, const bool *visible,
+	const GLintptr *bodyUniforms)
 {
-	// clear screen to a dark grey colour
-	glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
-	glEnable(GL_DEPTH_TEST);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	// clear screen to a dark grey colour, or black behind catalog stars
+	SetCapability(CAP_DEPTH_TEST, true);
+	SetPolygonMode(showWireframe ? GL_LINE : GL_FILL);
+	Clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, backgroundGrey, backgroundGrey, backgroundGrey, 1.0f);
 
 	// bind our shader program and the vertex array object containing our
-	// scene geometry, then tell OpenGL to draw our geometry
-	glUseProgram(shader->program);
-	glBindVertexArray(geometry->vertexArray);
+	// scene geometry, then tell OpenGL to draw our geometry; the bindings
+	// stay in place for the next frame, where the cache skips them
+	UseProgram(shader->program);
+	BindVertexArray(geometry->vertexArray);
 
 	// bind textures
-	for (int i = 0; i < 6; i++) {
-		glActiveTexture(GL_TEXTURE0 + i);
-		glBindTexture(textures[i].target, textures[i].textureID);
-	}
-
-	// glDrawElements instead of glDrawArrays
-	glDrawElements(GL_TRIANGLES, geometry->elementCount, GL_UNSIGNED_INT, 0);
-
-	// reset state to default (no shader or geometry bound)
-	glBindTexture(textures[0].target, 0);
-	glActiveTexture(GL_TEXTURE0 + 0);
-	glBindVertexArray(0);
-	glUseProgram(0);
+	for (int i = 0; i < 6; i++)
+		BindTexture(i, textures[i].target, textures[i].textureID);
+
+	// glDrawElements instead of glDrawArrays, one range per visible sphere
+	// with its own block of draw uniforms
+	for (int s = 0; s < 4; s++)
+		if (visible[s]) {
+			BindUniforms(&uniformRing, UNIFORM_DRAW, bodyUniforms[s], sizeof(MyDrawUniforms));
+			DrawElements(GL_TRIANGLES, spheres[s].lastIndex - spheres[s].firstIndex + 1, GL_UNSIGNED_INT,
+				spheres[s].firstIndex * sizeof(unsigned));
+		}
 
 	// check for an report any OpenGL errors
-	CheckGLErrors();
+	CheckFrameGLErrors();
+}
+
+// prints what the last frame drew, culled by the frustum and found
+// occluded, and the work that saved
+void ReportCullStats()
+{
+	const MyCullStats &c = cullStats;
+	cout << "Last frame drew " << c.bodiesDrawn << " bodies (" << c.bodiesCulled << " culled, "
+		<< c.bodiesOccluded << " occluded), " << c.chunksDrawn << " point chunks (" << c.chunksCulled
+		<< " culled, " << c.chunksOccluded << " occluded), " << c.pointsDrawn << " points ("
+		<< c.pointsCulled << " culled, " << c.pointsOccluded << " occluded)" << endl;
+	cout << "Saved " << c.verticesSaved << " vertices and about " << (long long)c.pixelsSaved
+		<< " pixels of fill" << endl;
 }
 
 // --------------------------------------------------------------------------
@@ -473,9 +2655,31 @@ void ErrorCallback(int error, const char* description)
 	cout << description << endl;
 }
 
+// true for the keys KeyCallback acts on
+bool IsHandledKey(int key)
+{
+	switch (key) {
+	case GLFW_KEY_ESCAPE: case GLFW_KEY_1: case GLFW_KEY_2: case GLFW_KEY_3:
+	case GLFW_KEY_SPACE: case GLFW_KEY_UP: case GLFW_KEY_DOWN:
+	case GLFW_KEY_PAGE_UP: case GLFW_KEY_PAGE_DOWN: case GLFW_KEY_E:
+	case GLFW_KEY_N: case GLFW_KEY_I: case GLFW_KEY_J: case GLFW_KEY_F:
+	case GLFW_KEY_L: case GLFW_KEY_P: case GLFW_KEY_V: case GLFW_KEY_T:
+	case GLFW_KEY_A: case GLFW_KEY_C: case GLFW_KEY_K:
+	case GLFW_KEY_LEFT_BRACKET: case GLFW_KEY_RIGHT_BRACKET: case GLFW_KEY_G:
+		return true;
+	default:
+		return false;
+	}
+}
+
 // handles keyboard input events
 void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
+	// a handled key may change the scene, including while paused
+	bool pressed = action == GLFW_PRESS || action == GLFW_REPEAT;
+	if (pressed && IsHandledKey(key))
+		RequestSimulationStep();
+
 	// close window
 	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
 		glfwSetWindowShouldClose(window, GL_TRUE);
@@ -497,17 +2701,91 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 		animate = !animate;
 
 	// increase speed
-	if (key == GLFW_KEY_UP)
-		if (animSpeed < maxSpeed) animSpeed *= speedInterval;
+	if (key == GLFW_KEY_UP && pressed)
+		if (animSpeed < maxSpeed) animSpeed = animSpeed * speedInterval;
 
 	// decrease speed
-	if (key == GLFW_KEY_DOWN)
-		if (animSpeed > minSpeed) animSpeed /= speedInterval;
+	if (key == GLFW_KEY_DOWN && pressed)
+		if (animSpeed > minSpeed) animSpeed = animSpeed / speedInterval;
+
+	// jump one year forward or back in time
+	if (key == GLFW_KEY_PAGE_UP && action == GLFW_PRESS)
+		yearJumps++;
+	if (key == GLFW_KEY_PAGE_DOWN && action == GLFW_PRESS)
+		yearJumps--;
+
+	// cycle between circular orbits and the ephemeris accuracy tiers
+	if (key == GLFW_KEY_E && action == GLFW_PRESS) {
+		ephemerisTier = ephemerisTier + 1 < EPHEMERIS_TIERS ? ephemerisTier + 1 : -1;
+		if (ephemerisTier < 0) cout << "Ephemeris off, circular orbits" << endl;
+		else cout << "Ephemeris accuracy " << ephemerisTierNames[ephemerisTier] << endl;
+	}
+
+	// toggle the N-body simulation, which restarts at the current date
+	if (key == GLFW_KEY_N && action == GLFW_PRESS) {
+		nbodyMode = !nbodyMode;
+		cout << "N-body simulation " << (nbodyMode ? "on" : "off") << endl;
+	}
+
+	// inject test particles near the Earth
+	if (key == GLFW_KEY_I && action == GLFW_PRESS && nbodyMode)
+		particleInjections++;
+
+	// report job pool utilization
+	if (key == GLFW_KEY_J && action == GLFW_PRESS)
+		ReportJobStats();
+
+	// report frames drawn and skipped and the time spent idle
+	if (key == GLFW_KEY_F && action == GLFW_PRESS)
+		ReportIdleStats();
+
+	// report OpenGL calls of the last frame, issued and filtered by the cache
+	if (key == GLFW_KEY_L && action == GLFW_PRESS)
+		ReportGLCalls();
+
+	// save a screenshot, or start and stop recording frames
+	if (key == GLFW_KEY_P && action == GLFW_PRESS)
+		frameCapture.screenshotRequested = true;
+	if (key == GLFW_KEY_V && action == GLFW_PRESS)
+		ToggleRecording(&frameCapture);
+
+	// capture the next frames' OpenGL commands into a trace file
+	if (key == GLFW_KEY_T && action == GLFW_PRESS)
+		StartTrace(tracer.filename, traceFrames);
+
+	// cycle anti-aliasing modes; the render loop recreates the target
+	if (key == GLFW_KEY_A && action == GLFW_PRESS) {
+		aaMode = (aaMode + 1) % AA_MODES;
+		cout << "Anti-aliasing " << aaModeNames[aaMode] << endl;
+	}
+
+	// toggle culling
+	if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+		frustumCulling = !frustumCulling;
+		cout << "Culling " << (frustumCulling ? "on" : "off") << endl;
+	}
+
+	// report what the last frame drew, culled and found occluded
+	if (key == GLFW_KEY_K && action == GLFW_PRESS)
+		ReportCullStats();
+
+	// show fainter or only brighter catalog stars
+	if ((key == GLFW_KEY_LEFT_BRACKET || key == GLFW_KEY_RIGHT_BRACKET) && action == GLFW_PRESS) {
+		starLimit += key == GLFW_KEY_RIGHT_BRACKET ? 0.5f : -0.5f;
+		cout << "Star magnitude limit " << starLimit << " at the default field of view" << endl;
+	}
+
+	// toggle GPU/CPU minor body propagation
+	if (key == GLFW_KEY_G && action == GLFW_PRESS) {
+		gpuPropagation = !gpuPropagation;
+		cout << "Minor body propagation on the " << (gpuPropagation ? "GPU" : "CPU") << endl;
+	}
 }
 
 // handles mouse button events
 void MouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 {
+	sceneDirty = true;
 	if (button == GLFW_MOUSE_BUTTON_1) {
 		// when pressed, store mouse location
 		if (action == GLFW_PRESS) {
@@ -523,6 +2801,8 @@ void MouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 // handles cursor moving events
 void CursorPosCallback(GLFWwindow* window, double xpos, double ypos) {
 	if (rotating) {
+		sceneDirty = true;
+
 		// adjust azimuth
 		cameraP += scrollSpeed * double(xpos - mousex) / double(wWidth);
 
@@ -535,17 +2815,278 @@ void CursorPosCallback(GLFWwindow* window, double xpos, double ypos) {
 
 // handles mousewheel events
 void ScrollCallback(GLFWwindow* window, double xOffset, double yOffset) {
-	// adjust zoom level
-	cameraR -= zoomSpeed * yOffset;
+	sceneDirty = true;
+
+	// with shift held, narrow or widen the field of view like a telescope
+	if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_RIGHT_SHIFT) == GLFW_PRESS) {
+		fov = std::min(std::max(fov * pow(trueZoomFactor, -float(yOffset)), minFov), maxFov);
+		return;
+	}
+
+	// adjust zoom level, by steps or in true scale by altitude ratios
+	if (trueScale) cameraR *= pow(trueZoomFactor, -float(yOffset));
+	else cameraR -= zoomSpeed * yOffset;
 	if (cameraR < minDistance) cameraR = minDistance;
 	if (cameraR > maxDistance) cameraR = maxDistance;
 }
 
+// redraws after the window was uncovered or resized
+void RefreshCallback(GLFWwindow*)
+{
+	sceneDirty = true;
+}
+
 // ==========================================================================
 // PROGRAM ENTRY POINT
 
 int main(int argc, char *argv[])
 {
+	// parse command line options
+	bool epochGiven = false;
+	bool aaCompare = false;
+	bool checkCompare = false;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--asteroids") && i + 1 < argc)
+			minorBodyCount = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--cpu-propagate"))
+			gpuPropagation = false;
+		else if (!strcmp(argv[i], "--satellites") && i + 1 < argc)
+			satelliteFile = argv[++i];
+		else if (!strcmp(argv[i], "--stars") && i + 1 < argc)
+			starFile = argv[++i];
+		else if (!strcmp(argv[i], "--star-limit") && i + 1 < argc)
+			starLimit = float(atof(argv[++i]));
+		else if (!strcmp(argv[i], "--build-stars") && i + 2 < argc) {
+			int nside = i + 3 < argc && argv[i + 3][0] != '-' ? atoi(argv[i + 3]) : 16;
+			return BuildStarFile(argv[i + 1], argv[i + 2], nside);
+		}
+		else if (!strcmp(argv[i], "--epoch") && i + 1 < argc) {
+			epochJD = atof(argv[++i]);
+			epochGiven = true;
+		}
+		else if (!strcmp(argv[i], "--ephemeris") && i + 1 < argc) {
+			i++;
+			for (int k = 0; k < EPHEMERIS_TIERS; k++)
+				if (!strcmp(argv[i], ephemerisTierNames[k])) ephemerisTier = k;
+		}
+		else if (!strcmp(argv[i], "--ephemeris-file") && i + 1 < argc)
+			ephemerisFile = argv[++i];
+		else if (!strcmp(argv[i], "--build-ephemeris") && i + 3 < argc) {
+			InitializeEphemeris(&ephemeris);
+			return BuildEphemerisFile(argv[i + 1], atof(argv[i + 2]), atof(argv[i + 3]));
+		}
+		else if (!strcmp(argv[i], "--nbody") && i + 1 < argc) {
+			nbodyMode = true;
+			nbodyParticles = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "--integrator") && i + 1 < argc) {
+			i++;
+			if (!strcmp(argv[i], "leapfrog")) nbodyIntegrator = NBODY_LEAPFROG;
+			else if (!strcmp(argv[i], "yoshida")) nbodyIntegrator = NBODY_YOSHIDA;
+			else cout << "Unknown integrator " << argv[i] << endl;
+		}
+		else if (!strcmp(argv[i], "--job-threads") && i + 1 < argc)
+			jobThreads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--alloc-trap"))
+			allocationTrap = true;
+		else if (!strcmp(argv[i], "--inline-simulation"))
+			simulationThread = false;
+		else if (!strcmp(argv[i], "--no-cull"))
+			frustumCulling = false;
+		else if (!strcmp(argv[i], "--resolution-budget") && i + 1 < argc)
+			renderScale.budgetMs = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--min-scale") && i + 1 < argc)
+			renderScale.minScale = std::min(std::max(float(atof(argv[++i])), 0.1f), 1.0f);
+		else if (!strcmp(argv[i], "--on-demand"))
+			onDemand = true;
+		else if (!strcmp(argv[i], "--frame-cap") && i + 1 < argc)
+			frameCap = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--true-scale"))
+			trueScale = true;
+		else if (!strcmp(argv[i], "--log-depth"))
+			logDepth = true;
+		else if (!strcmp(argv[i], "--aa") && i + 1 < argc) {
+			i++;
+			int mode = -1;
+			for (int k = 0; k < AA_MODES; k++)
+				if (!strcmp(argv[i], aaModeNames[k])) mode = k;
+			if (!strcmp(argv[i], "all")) aaCompare = true;
+			else if (mode >= 0) aaMode = mode;
+			else cout << "Unknown anti-aliasing mode " << argv[i] << endl;
+		}
+		else if (!strcmp(argv[i], "--gl-debug") && i + 1 < argc) {
+			i++;
+			debugSeverity = -1;
+			for (int k = 0; k < 4; k++)
+				if (!strcmp(argv[i], debugSeverityNames[k])) debugSeverity = k;
+			if (!strcmp(argv[i], "all")) debugSeverity = 0;
+			if (debugSeverity < 0 && strcmp(argv[i], "off")) cout << "Unknown severity " << argv[i] << endl;
+			debugContext = debugSeverity >= 0;
+		}
+		else if (!strcmp(argv[i], "--gl-checks") && i + 1 < argc) {
+			i++;
+			if (!strcmp(argv[i], "on")) frameErrorCheckMode = 1;
+			else if (!strcmp(argv[i], "off")) frameErrorCheckMode = 0;
+			else if (!strcmp(argv[i], "compare")) checkCompare = true;
+			else cout << "Unknown check mode " << argv[i] << endl;
+		}
+		else if (!strcmp(argv[i], "--record") && i + 1 < argc) {
+			frameCapture.prefix = argv[++i];
+			frameCapture.recording = true;
+		}
+		else if (!strcmp(argv[i], "--record-format") && i + 1 < argc) {
+			i++;
+			if (!strcmp(argv[i], "png")) frameCapture.format = CAPTURE_PNG;
+			else if (!strcmp(argv[i], "raw")) frameCapture.format = CAPTURE_RAW;
+			else cout << "Unknown capture format " << argv[i] << endl;
+		}
+		else if (!strcmp(argv[i], "--shm-output") && i + 1 < argc)
+			frameCapture.sinkName = argv[++i];
+		else if (!strcmp(argv[i], "--shm-slots") && i + 1 < argc)
+			frameCapture.sinkSlots = std::max(atoi(argv[++i]), 2);
+		else if (!strcmp(argv[i], "--render-frames") && i + 2 < argc) {
+			renderFirst = std::max(atoi(argv[i + 1]), 0);
+			renderCount = std::max(atoi(argv[i + 2]), 0);
+			i += 2;
+		}
+		else if (!strcmp(argv[i], "--window") && i + 2 < argc) {
+			wWidth = std::max(atoi(argv[i + 1]), 1);
+			wHeight = std::max(atoi(argv[i + 2]), 1);
+			windowSizeGiven = true;
+			i += 2;
+		}
+		else if (!strcmp(argv[i], "--panorama") && i + 1 < argc) {
+			i++;
+			int projection = -1;
+			for (int k = PANORAMA_EQUIRECT; k < PANORAMA_PROJECTIONS; k++)
+				if (!strcmp(argv[i], panoramaNames[k])) projection = k;
+			if (projection >= 0) panoramaProjection = projection;
+			else cout << "Unknown panorama projection " << argv[i] << endl;
+		}
+		else if (!strcmp(argv[i], "--panorama-face") && i + 1 < argc)
+			panoramaFaceSize = std::max(atoi(argv[++i]), 16);
+		else if (!strcmp(argv[i], "--panorama-passes") && i + 1 < argc)
+			panoramaLayered = atoi(argv[++i]) != 6;
+		else if (!strcmp(argv[i], "--fisheye-aperture") && i + 1 < argc)
+			fisheyeAperture = std::min(std::max(float(atof(argv[++i])), 10.0f), 360.0f);
+		else if (!strcmp(argv[i], "--poster") && i + 3 < argc) {
+			poster.width = std::max(atoi(argv[i + 1]), 0);
+			poster.height = std::max(atoi(argv[i + 2]), 0);
+			poster.filename = argv[i + 3];
+			if (poster.width == 0 || poster.height == 0) poster.width = poster.height = 0;
+			i += 3;
+		}
+		else if (!strcmp(argv[i], "--poster-frame") && i + 1 < argc)
+			poster.frame = std::max(atoll(argv[++i]), 0LL);
+		else if (!strcmp(argv[i], "--poster-rows") && i + 2 < argc) {
+			poster.firstRow = std::max(atoi(argv[i + 1]), 0);
+			poster.rowCount = std::max(atoi(argv[i + 2]), 1);
+			poster.band = true;
+			i += 2;
+		}
+		else if (!strcmp(argv[i], "--farm") && i + 1 < argc)
+			farmWorkers = std::max(atoi(argv[++i]), 1);
+		else if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+			traceFile = tracer.filename = argv[++i];
+		else if (!strcmp(argv[i], "--trace-frames") && i + 1 < argc)
+			traceFrames = std::max(atoi(argv[++i]), 1);
+		else if (!strcmp(argv[i], "--replay") && i + 1 < argc)
+			replayFile = argv[++i];
+		else if (!strcmp(argv[i], "--replay-iterations") && i + 1 < argc)
+			replayIterations = std::max(atoi(argv[++i]), 1);
+		else if (!strcmp(argv[i], "--bench") && i + 1 < argc)
+			benchmark.framesPerVariant = atoi(argv[++i]);
+		else
+			cout << "Unknown option " << argv[i] << endl;
+	}
+	SetDistanceScale();
+
+	if (poster.width > 0 && renderCount > 0) {
+		cout << "--poster renders a still, ignoring --render-frames" << endl;
+		renderCount = 0;
+	}
+	if (poster.width > 0 && panoramaProjection != PANORAMA_OFF) {
+		cout << "--poster renders a perspective view, ignoring --panorama" << endl;
+		panoramaProjection = PANORAMA_OFF;
+	}
+
+	// a panorama's window takes the shape of its projection unless given
+	if (panoramaProjection != PANORAMA_OFF && !windowSizeGiven) {
+		wWidth = panoramaProjection == PANORAMA_EQUIRECT ? 2048 : 1024;
+		wHeight = 1024;
+	}
+
+	// a poster's file is created at its full size before any tile is drawn;
+	// farm workers write their rows into the coordinator's
+	if (poster.width > 0 && poster.rowCount == 0 && !CreatePosterFile(poster.filename, poster.width, poster.height)) {
+		cout << "ERROR: Could not create " << poster.filename << endl;
+		return -1;
+	}
+
+	// the farm coordinator only runs workers, each with the same options
+	// and its own share of the frames or of the poster's rows
+	if (farmWorkers > 0) {
+		if (renderCount <= 0 && poster.width == 0) {
+			cout << "--farm needs a frame range from --render-frames or a --poster" << endl;
+			return -1;
+		}
+		if (poster.width == 0 && nbodyMode) {
+			// each worker would integrate from the first frame of its share,
+			// so the shares would not join into one sequence
+			cout << "--farm can not split the frames of an N-body simulation (--nbody)" << endl;
+			return -1;
+		}
+		vector<string> workerArgs;
+		for (int i = 1; i < argc; i++) {
+			if (!strcmp(argv[i], "--farm")) i++;
+			else if (!strcmp(argv[i], "--render-frames") || !strcmp(argv[i], "--poster-rows")) i += 2;
+			else workerArgs.push_back(argv[i]);
+		}
+		if (poster.width > 0) {
+			// the file is complete in size from the start, so only the
+			// workers' markers, cleared of any earlier run's, tell the rows written
+			int workers = FarmWorkerCount(farmWorkers, poster.height), first, count;
+			for (int k = 0; k < workers; k++) {
+				FarmShare(0, poster.height, workers, k, &first, &count);
+				RemovePosterBandMarker(poster.filename, first, count);
+			}
+			return RunFarm(argv[0], workerArgs, farmWorkers, 0, poster.height, "--poster-rows", "rows", poster.filename,
+				[](int first, int count) { return PosterBandWritten(poster.filename, first, count) ? 0 : count; });
+		}
+		const char *extension = frameCapture.format == CAPTURE_PNG ? "png" : "rgba";
+		return RunFarm(argv[0], workerArgs, farmWorkers, renderFirst, renderCount, "--render-frames", "frames",
+			frameCapture.prefix, [extension](int first, int count) {
+				return CountMissingFrames(frameCapture.prefix, extension, first, count);
+			});
+	}
+
+	// offline rendering steps inline, places each frame by its number and
+	// records every one of them
+	if (renderCount > 0) {
+		simulationThread = false;
+		animate = false;
+		frameCapture.recording = true;
+		frameCapture.lossless = true;
+		frameCapture.frames = renderFirst;
+	}
+
+	// a poster is one moment, drawn at full scale; post-process
+	// anti-aliasing would leave seams at the tile edges
+	if (poster.width > 0) {
+		simulationThread = false;
+		animate = false;
+		frameCapture.recording = false;
+		renderScale = MyRenderScale();
+		if (aaMode == AA_FXAA || aaMode == AA_SMAA) {
+			cout << "Anti-aliasing " << aaModeNames[aaMode] << " is per tile, using msaa4 for the poster" << endl;
+			aaMode = AA_MSAA4;
+		}
+	}
+
+	// start the CPU worker threads
+	StartJobs(&jobs, jobThreads > 0 ? jobThreads - 1 : -1, simulationJobQueue + 1);
+	InitializeEphemeris(&ephemeris);
+
 	// initialize the GLFW windowing system
 	if (!glfwInit()) {
 		cout << "ERROR: GLFW failed to initialize, TERMINATING" << endl;
@@ -559,9 +3100,8 @@ int main(int argc, char *argv[])
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-	// toggle antialiasing
-	if (antialiasing) glfwWindowHint(GLFW_SAMPLES, 4);
+	if (debugContext) glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
+	if (replayFile || renderCount > 0 || poster.width > 0) glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
 
 	// attempt to create a window with an OpenGL 4.1 core profile context
 	window = glfwCreateWindow(wWidth, wHeight, "CPSC 453 Assignment 5", 0, 0);
@@ -576,6 +3116,7 @@ int main(int argc, char *argv[])
 	glfwSetMouseButtonCallback(window, MouseButtonCallback);
 	glfwSetCursorPosCallback(window, CursorPosCallback);
 	glfwSetScrollCallback(window, ScrollCallback);
+	glfwSetWindowRefreshCallback(window, RefreshCallback);
 	glfwMakeContextCurrent(window);
 
 	//Intialize GLAD
@@ -587,12 +3128,38 @@ int main(int argc, char *argv[])
 	}
 #endif
 
+	// benchmark, replay and offline modes run unthrottled
+	if (benchmark.framesPerVariant > 0 || replayFile || renderCount > 0 || poster.width > 0) {
+		glfwSwapInterval(0);
+		onDemand = false;
+		frameCap = 0.0;
+	}
+	const GLFWvidmode *mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+	if (mode && mode->refreshRate > 0) refreshRate = mode->refreshRate;
+
 	// toggle wireframe only
 	if (showWireframe) glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
 	// query and print out information about our OpenGL environment
 	QueryGLVersion();
 
+	// errors are reported by the debug callback where there is one, and
+	// otherwise by synchronous checks after each pass
+	debugOutputActive = InitializeDebugOutput();
+	frameErrorChecks = frameErrorCheckMode >= 0 ? frameErrorCheckMode == 1 : !debugOutputActive;
+	if (!GL_FRAME_CHECKS) frameErrorChecks = false;
+	cout << "Per-frame glGetError checks " << (!GL_FRAME_CHECKS ? "compiled out" : frameErrorChecks ? "on" : "off") << endl;
+
+	// a trace replays in a hidden window, without the rest of the program
+	if (replayFile) {
+		int result = ReplayTrace(replayFile, replayIterations);
+		ReportDebugMessages();
+		glfwDestroyWindow(window);
+		glfwTerminate();
+		StopJobs(&jobs);
+		return result;
+	}
+
 	// call function to load and compile shader programs
 	MyShader shader;
 	if (!InitializeShaders(&shader)) {
@@ -600,49 +3167,134 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
-	// initialize textures
-	if (!InitializeTexture(&textures[0], earthTexture, GL_TEXTURE_2D))
-		cout << "Program failed to intialize texture!" << endl;
-	if (!InitializeTexture(&textures[1], starTexture, GL_TEXTURE_2D))
-		cout << "Program failed to intialize texture!" << endl;
-	if (!InitializeTexture(&textures[2], moonTexture, GL_TEXTURE_2D))
-		cout << "Program failed to intialize texture!" << endl;
-	if (!InitializeTexture(&textures[3], sunTexture, GL_TEXTURE_2D))
-		cout << "Program failed to intialize texture!" << endl;
-	if (!InitializeTexture(&textures[4], cloud1Texture, GL_TEXTURE_2D))
-		cout << "Program failed to intialize texture!" << endl;
-	if (!InitializeTexture(&textures[5], cloud2Texture, GL_TEXTURE_2D))
-		cout << "Program failed to intialize texture!" << endl;
+	// initialize textures, decoded in parallel
+	const char *textureFiles[] = { earthTexture, starTexture, moonTexture, sunTexture, cloud1Texture, cloud2Texture };
+	InitializeTextures(textures, textureFiles, 6, GL_TEXTURE_2D);
 
 	// call function to create and fill buffers with geometry data
 	MyGeometry geometry;
 	if (!InitializeGeometry(&geometry))
 		cout << "Program failed to intialize geometry!" << endl;
 
+	// minor bodies, their propagation and point sprite programs
+	MyMinorBodies minorBodies;
+	MyShader propagateShader, pointShader;
+	if (minorBodyCount > 0) {
+		if (!InitializeFeedbackShader(&propagateShader, "propagate.glsl", "Position") ||
+			!InitializeShaders(&pointShader, "point_vertex.glsl", "point_fragment.glsl") ||
+			!InitializeMinorBodies(&minorBodies, minorBodyCount)) {
+			cout << "Program failed to intialize minor bodies!" << endl;
+			minorBodyCount = 0;
+		}
+	}
+
+	// precomputed ephemeris
+	if (ephemerisFile) InitializeEphemerisFile(ephemerisFile);
+
+	// satellites share the point sprite program, and start the clock at the
+	// catalog's most recent epoch unless one was given
+	MySatellites satellites;
+	if (satelliteFile) {
+		if (!pointShader.program && !InitializeShaders(&pointShader, "point_vertex.glsl", "point_fragment.glsl"))
+			cout << "Program failed to intialize point shaders!" << endl;
+		if (!InitializeSatellites(&satellites, satelliteFile))
+			satellites.count = 0;
+		else if (!epochGiven)
+			epochJD = *max_element(satellites.catalog.epoch.begin(), satellites.catalog.epoch.end());
+	}
+
+	// N-body particles share the point sprite program
+	MyParticles particles;
+	if (!pointShader.program && !InitializeShaders(&pointShader, "point_vertex.glsl", "point_fragment.glsl"))
+		cout << "Program failed to intialize point shaders!" << endl;
+	if (!InitializeParticles(&particles))
+		cout << "Program failed to intialize particles!" << endl;
+
+	// benchmark variants, per-frame error checks or anti-aliasing modes when
+	// asked to compare them, minor bodies compare both propagators and the
+	// N-body simulation is restarted with a growing number of particles
+	if (checkCompare) {
+		if (!GL_FRAME_CHECKS) cout << "Per-frame checks are compiled out, nothing to compare" << endl;
+		AddBenchmarkVariant(&benchmark, "glcheck-off", [] { frameErrorChecks = false; });
+		if (GL_FRAME_CHECKS) AddBenchmarkVariant(&benchmark, "glcheck-on", [] { frameErrorChecks = true; });
+	}
+	else if (aaCompare) {
+		for (int k = 0; k < AA_MODES; k++)
+			AddBenchmarkVariant(&benchmark, string("aa-") + aaModeNames[k], [k] { aaMode = k; });
+	}
+	else if (minorBodyCount > 0) {
+		AddBenchmarkVariant(&benchmark, "cpu-propagate", [] { gpuPropagation = false; });
+		AddBenchmarkVariant(&benchmark, "gpu-propagate", [] { gpuPropagation = true; });
+	}
+	else if (nbodyMode && nbodyParticles > 0) {
+		for (int n = std::max(1, nbodyParticles / 8); n < nbodyParticles; n *= 2)
+			AddBenchmarkVariant(&benchmark, "nbody-" + to_string(n), [n] { nbodyParticles = n; nbodyRestart = true; });
+		int n = nbodyParticles;
+		AddBenchmarkVariant(&benchmark, "nbody-" + to_string(n), [n] { nbodyParticles = n; nbodyRestart = true; });
+	}
+	else AddBenchmarkVariant(&benchmark, "default", 0);
+
+	// the scene is drawn offscreen, anti-aliased and, with a GPU time budget,
+	// at a varying scale
+	MyRenderTarget renderTarget;
+	int framebufferWidth, framebufferHeight;
+	glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+	if (!InitializeRenderTarget(&renderTarget, framebufferWidth, framebufferHeight, aaMode)) {
+		cout << "Program failed to intialize the render target!" << endl;
+		glfwTerminate();
+		return -1;
+	}
+
+	// full-sphere panoramas draw into a cubemap instead
+	MyCubeTarget cubeTarget;
+	bool panorama = panoramaProjection != PANORAMA_OFF;
+	if (panorama) {
+		if (!InitializeCubeTarget(&cubeTarget, PanoramaFaceSize(framebufferWidth, framebufferHeight),
+			framebufferWidth, framebufferHeight)) {
+			cout << "Program failed to intialize the panorama cubemap!" << endl;
+			glfwTerminate();
+			return -1;
+		}
+		InvalidateGLState();
+	}
+
+	// a star catalog replaces the textured sky, on black
+	MyStars stars;
+	if (starFile) {
+		if (InitializeStars(&stars, starFile, panorama && cubeTarget.layered)) backgroundGrey = 0.0f;
+		else {
+			cout << "Program failed to intialize the star catalog!" << endl;
+			DestroyStars(&stars);
+			stars.count = 0;
+		}
+		InvalidateGLState();
+	}
+
+	// start simulating, on its own thread unless frames must be deterministic
+	MySimulation simulation;
+	if (minorBodyCount > 0) simulation.minorBodies = &minorBodies;
+	if (satellites.count > 0) simulation.satellites = &satellites;
+	if (benchmark.framesPerVariant > 0) simulationThread = false;
+	StartSimulation(&simulation, simulationThread);
+
 	lastFrameTime = glfwGetTime();
+	jobStatsStart = lastFrameTime;
+	idleStatsStart = lastFrameTime;
+	ResetJobStats(&jobs);
 	float aspectRatio = (float)wWidth / (float)wHeight;
 	float zNear = .1f, zFar = 1000.f;
+	if (trueScale) {
+		zNear = float(1.0e-4 / trueScaleUnit);	// 10 cm
+		zFar = float(2.0 * starsR);
+	}
 	mat4 I(1);
 
 	// axes and translation vectors
 	vec3 xaxis = vec3(1, 0, 0);
 	vec3 yaxis = vec3(0, 1, 0);
-	vec3 zaxis = vec3(0, 0, 1);
-	vec3 earthLoc(distEarthToSun, 0, 0);
-	vec3 moonLoc(distMoonToEarth, 0, 0);
-
-	// get uniform locations
-	glUseProgram(shader.program);
-	GLint starsUniform = glGetUniformLocation(shader.program, "starsModel");
-	GLint sunUniform = glGetUniformLocation(shader.program, "sunModel");
-	GLint earthUniform = glGetUniformLocation(shader.program, "earthModel");
-	GLint moonUniform = glGetUniformLocation(shader.program, "moonModel");
-	GLint viewUniform = glGetUniformLocation(shader.program, "view");
-	GLint projUniform = glGetUniformLocation(shader.program, "proj");
-	GLint animUniform = glGetUniformLocation(shader.program, "animation");
-	GLint camUniform = glGetUniformLocation(shader.program, "camPoint");
 
 	// set texture uniforms
+	glUseProgram(shader.program);
 	GLint texUniform;
 	texUniform = glGetUniformLocation(shader.program, "tex0");
 	glUniform1i(texUniform, 0);
@@ -656,103 +3308,394 @@ int main(int argc, char *argv[])
 	glUniform1i(texUniform, 4);
 	texUniform = glGetUniformLocation(shader.program, "tex5");
 	glUniform1i(texUniform, 5);
+	glUseProgram(0);
+
+	// frame and draw blocks come from the uniform ring, the lighting
+	// constants from a block of their own written once
+	if (!InitializeUniformRing(&uniformRing)) {
+		cout << "Program failed to intialize the uniform ring!" << endl;
+		glfwTerminate();
+		return -1;
+	}
+	BindUniformBlocks(&shader);
+	BindUniformBlocks(&pointShader);
+	if (!InitializeFrameCapture(&frameCapture, framebufferWidth, framebufferHeight))
+		cout << "Program failed to intialize frame capture!" << endl;
+	if (poster.width > 0 && !InitializePoster(&posterReadback, &poster, framebufferWidth, framebufferHeight)) {
+		glfwTerminate();
+		return -1;
+	}
 
-	// set lighting uniforms
-	GLint u;
-	u = glGetUniformLocation(shader.program, "light");
-	glUniform3fv(u, 1, light);
-	u = glGetUniformLocation(shader.program, "ambient");
-	glUniform1f(u, ambient);
-	u = glGetUniformLocation(shader.program, "diffRatio");
-	glUniform1f(u, diffRatio);
-	u = glGetUniformLocation(shader.program, "intensity");
-	glUniform1f(u, intensity);
-	u = glGetUniformLocation(shader.program, "glowInt");
-	glUniform1f(u, glowIntensity);
-	u = glGetUniformLocation(shader.program, "phong");
-	glUniform1f(u, phong);
-	u = glGetUniformLocation(shader.program, "waterPhong");
-	glUniform1f(u, waterPhong);
-	u = glGetUniformLocation(shader.program, "specColour");
-	glUniform3fv(u, 1, specColour);
-	u = glGetUniformLocation(shader.program, "cloudInt");
-	glUniform1f(u, cloudIntensity);
+	MyLightingUniforms lighting;
+	lighting.specColour = vec3(specColour[0], specColour[1], specColour[2]);
+	lighting.ambient = ambient;
+	lighting.diffRatio = diffRatio;
+	lighting.intensity = intensity;
+	lighting.glowInt = glowIntensity;
+	lighting.phong = phong;
+	lighting.waterPhong = waterPhong;
+	lighting.cloudInt = cloudIntensity;
+	GLuint lightingBuffer;
+	glGenBuffers(1, &lightingBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, lightingBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(lighting), &lighting, GL_STATIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_LIGHTING, lightingBuffer);
+	TraceBuffer(lightingBuffer, TRACE_CONTENTS_ONCE);
+
+	// logarithmic depth over [0, zFar] in both programs that rasterize
+	float logDepthCoef = logDepth ? 2.0f / log2(zFar + 1.0f) : 0.0f;
 
 	// run an event-triggered main loop
+	InitializeArena(&frameArena, frameArenaBytes);
+	long long frames = 0;
+	double frameStart = glfwGetTime();
+	double renderStart = frameStart;
 	while (!glfwWindowShouldClose(window))
 	{
+		// on demand, wait in the event queue while nothing changed, and with
+		// a frame cap wait out the rest of the frame interval
+		double waitStart = glfwGetTime();
+		if (onDemand)
+			while (!animate && !sceneDirty.exchange(false) && !glfwWindowShouldClose(window))
+				glfwWaitEvents();
+		if (frameCap > 0.0)
+			for (double t = glfwGetTime(); t < frameStart + 1.0 / frameCap; t = glfwGetTime())
+				glfwWaitEventsTimeout(frameStart + 1.0 / frameCap - t);
+		frameStart = glfwGetTime();
+		idleSeconds += frameStart - waitStart;
+		if (glfwWindowShouldClose(window)) break;
+
 		mat4 fixModel = rotate(I, xangle, xaxis);	// rotate model 90 degrees
 
+		// per-frame temporaries start afresh, and heap use is counted for
+		// the whole frame
+		ResetArena(&frameArena);
+		long long frameAllocations = AllocationCounters().allocations;
+		long long renderAllocations = ThreadAllocations();
+		long long ringWaits = uniformRing.waits;
+		long long capturesDropped = frameCapture.dropped;
+		uint32_t streamDropped = frameCapture.sink.header ? frameCapture.sink.header->dropped.load() : 0;
+
+		// take the latest state with the body poses interpolated to the
+		// present; in deterministic mode one step is taken inline per frame
+		// and shown as is
+		double now = glfwGetTime();
+		if (renderCount > 0) yangle = FrameYangle(renderFirst + frames);
+		if (poster.width > 0) yangle = FrameYangle(poster.frame);
+		if (!simulationThread) {
+			StepSimulation(&simulation, now);
+			now += simulationStep;
+		}
+
+		// once warmed up, this thread's own frame work must not allocate;
+		// a trace capture grows its buffer and is exempt
+		if (traceFile && frames == traceWarmupFrames) StartTrace(traceFile, traceFrames);
+		AllocationTrap() = allocationTrap && frames >= allocationWarmupFrames && tracer.framesLeft == 0;
+		MySimulationFrame frame;
+		bool fresh;
+		const MySimulationState *state = ReadSimulation(&simulation, now, &frame, &fresh);
+
+		// camera about the focused body (the sun, earth or moon), placed in
+		// double; in true scale its distance is an altitude above the body
+		const int focusSphere[3] = { 3, 0, 2 };
+		const MyBodyPose &focusBody = frame.bodies[camFocus];
+		float camDistance = cameraR + (trueScale ? spheres[focusSphere[camFocus]].radius : 0.0f);
+		float camX = camDistance * cos(cameraP) * sin(cameraT);
+		float camY = camDistance * cos(cameraT);
+		float camZ = camDistance * sin(cameraP) * sin(cameraT);
+		vec3 cameraOffset(camX, camY, camZ);
+		if (camFocus != 0) cameraOffset = focusBody.orientation * cameraOffset;
+		dvec3 camera = focusBody.position + dvec3(cameraOffset);
+
+		// everything is drawn relative to the camera: poses are converted to
+		// camera-relative floats in one pass, and the scene origin moves to
+		// -camera
+		mat4 bodyPos[BODY_COUNT];
+		for (int b = 0; b < BODY_COUNT; b++)
+			bodyPos[b] = PoseMatrix(frame.bodies[b], camera);
+		mat4 worldModel = translate(I, vec3(-camera));
+
 		// sun model matrix
-		float sunAngleR = yangle / sunRotate;
-		mat4 sunModel = rotate(I, sunTilt, xaxis) *		// set tilt
-						rotate(I, sunAngleR, yaxis) *	// self rotation
+		const MyBodyPose &sun = frame.bodies[BODY_SUN];
+		mat4 sunModel = bodyPos[BODY_SUN] *				// set tilt
+						SpinMatrix(sun) *					// self rotation
 						fixModel;
 
+		// earth and moon positions and orientations
+		const MyBodyPose &earth = frame.bodies[BODY_EARTH];
+		mat4 earthPos = bodyPos[BODY_EARTH];
+		mat4 moonPos = bodyPos[BODY_MOON];
+
 		// earth model matrix
-		float earthAngleR = yangle / earthRotate;
-		float earthAngleO = yangle / earthOrbit;
-		mat4 earthPos = rotate(I, earthAngleO, yaxis) *		// orbit rotation
-						translate(I, earthLoc) *			// set orbit distance
-						rotate(I, -earthAngleO, yaxis) *	// counter orbit rotation
-						rotate(I, earthTilt, xaxis);		// set tilt
 		mat4 earthModel = earthPos *
-						rotate(I, earthAngleR, yaxis) *		// self rotation
+						SpinMatrix(earth) *					// self rotation
 						fixModel;
 
 		// moon model matrix
-		float moonAngleO = yangle / moonOrbit;
-		mat4 moonPos = earthPos *
-						rotate(I, moonIncl, zaxis) *		// orbit inclination
-						rotate(I, moonAngleO, yaxis) *		// orbit rotation
-						translate(I, moonLoc) *				// set orbit distance
-						rotate(I, moonTilt, xaxis);			// set tilt
 		mat4 moonModel = moonPos * 
 						fixModel;
 
 		// stars model matrix
-		mat4 starsModel = fixModel;
-
-		// camera and view/projection matrices
-		float camX = cameraR * cos(cameraP) * sin(cameraT);
-		float camY = cameraR * cos(cameraT);
-		float camZ = cameraR * sin(cameraP) * sin(cameraT);
-		vec3 cameraLoc(camX, camY, camZ);
-		mat4 focus = I;
-		if (camFocus == 1) focus = earthPos;
-		else if (camFocus == 2) focus = moonPos;
-		cameraLoc = focus * vec4(cameraLoc, 1.0);
-		vec3 cameraDir = focus * vec4(0.0, 0.0, 0.0, 1.0) - vec4(cameraLoc, 1.0);
+		mat4 starsModel = worldModel * fixModel;
+
+		// view/projection matrices, with the camera at the origin
+		vec3 cameraLoc(0.0f);
+		vec3 cameraDir = -cameraOffset;
 		vec3 cx = cross(yaxis, cameraDir);
 		vec3 cameraUp = normalize(cross(cameraDir, cx));
-		GLfloat camPoint[3] = { cameraLoc.x, cameraLoc.y, cameraLoc.z };
+		vec3 lightPoint = vec3(dvec3(light[0], light[1], light[2]) - camera);
+
+		mat4 view = lookAt(cameraLoc, cameraDir, cameraUp);
+		mat4 proj = poster.width > 0 ? PosterProjection(&posterReadback, &poster, zNear, zFar) :
+			perspective(fov, aspectRatio, zNear, zFar);
+
+		// propagate minor bodies on the GPU every frame, and upload the point
+		// sets of a new simulation state before the scene is drawn
+		if (minorBodyCount > 0)
+			UpdateMinorBodies(&minorBodies, &propagateShader, frame.yangle, state->minorBodies, fresh);
+		if (fresh && satellites.count > 0)
+			UploadSatellites(&satellites, state->satellites);
+		if (fresh)
+			UploadParticles(&particles, state->particles);
+
+		// cull the bodies by their bounding spheres and the point sets by
+		// their chunks, against the frustum and then against the Earth, Moon
+		// and Sun as occluders, with the ranges to draw kept in the frame arena
+		MyFrustum frustum = panorama ? AllDirectionsFrustum() : ExtractFrustum(proj * view);
+		MyCullStats culled;
+		const mat4 *sphereModels[4] = { &earthModel, &starsModel, &moonModel, &sunModel };
+		MyOccluder occluders[3];
+		int occluderCount = 0;
+		for (int s = 0; s < 4; s++)
+			if (s != 1 && MakeOccluder(cameraLoc, vec3((*sphereModels[s])[3]), spheres[s].radius, &occluders[occluderCount]))
+				occluderCount++;
+
+		// fill is estimated in pixels of the render target at its current scale
+		int targetWidth = RenderWidth(&renderTarget), targetHeight = RenderHeight(&renderTarget);
+		float focal = targetHeight / (2.0f * tan(0.5f * fov));
+		bool visible[4];
+		for (int s = 0; s < 4; s++) {
+			vec3 centre((*sphereModels[s])[3]);
+			bool inside = !frustumCulling || SphereVisible(frustum, centre, spheres[s].radius);
+			bool occluded = frustumCulling && inside &&
+				SphereOccluded(occluders, occluderCount, cameraLoc, centre, spheres[s].radius);
+			visible[s] = inside && !occluded && !(s == 1 && stars.count > 0);
+			if (visible[s]) culled.bodiesDrawn++;
+			else {
+				if (occluded) {
+					culled.bodiesOccluded++;
+					culled.pixelsSaved += std::min(double(targetWidth) * targetHeight,
+						ProjectedArea(cameraLoc, centre, spheres[s].radius, focal));
+				}
+				else culled.bodiesCulled++;
+				culled.verticesSaved += spheres[s].lastVertex - spheres[s].firstVertex + 1;
+			}
+		}
 
-		mat4 view = lookAt(cameraLoc, cameraLoc + cameraDir, cameraUp);
-		mat4 proj = perspective(fov, aspectRatio, zNear, zFar);
+		mat4 satelliteModel = earthPos * fixModel;
+		MyDrawRanges minorBodyDraw, satelliteDraw, particleDraw;
+		minorBodyDraw.all = satelliteDraw.all = particleDraw.all = true;
+		if (frustumCulling) {
+			// occluded points would each have filled a sprite
+			long long occluded = culled.pointsOccluded;
+			if (minorBodyCount > 0) {
+				if (!gpuPropagation && (GLsizei)state->minorBodies.size() == minorBodies.count)
+					minorBodyDraw = CullPointChunks(&frameArena, frustum, occluders, occluderCount, cameraLoc, worldModel,
+						state->minorBodyChunks, minorBodies.count, &culled);
+				else
+					minorBodyDraw = CullPointSet(frustum, occluders, occluderCount, cameraLoc, vec3(worldModel[3]),
+						minorBodies.boundRadius, minorBodies.count, &culled);
+				culled.pixelsSaved += (culled.pointsOccluded - occluded) * minorBodySize * minorBodySize;
+				occluded = culled.pointsOccluded;
+			}
+			if (satellites.count > 0) {
+				satelliteDraw = CullPointChunks(&frameArena, frustum, occluders, occluderCount, cameraLoc, satelliteModel,
+					state->satelliteChunks, satellites.count, &culled);
+				culled.pixelsSaved += (culled.pointsOccluded - occluded) * satelliteSize * satelliteSize;
+				occluded = culled.pointsOccluded;
+			}
+			if (particles.count > 0) {
+				particleDraw = CullPointChunks(&frameArena, frustum, occluders, occluderCount, cameraLoc, worldModel,
+					state->particleChunks, particles.count, &culled);
+				culled.pixelsSaved += (culled.pointsOccluded - occluded) * particleSize * particleSize;
+			}
+		}
 
-		// set uniforms
-		glUseProgram(shader.program);
-		glUniformMatrix4fv(starsUniform, 1, false, value_ptr(starsModel));
-		glUniformMatrix4fv(sunUniform, 1, false, value_ptr(sunModel));
-		glUniformMatrix4fv(earthUniform, 1, false, value_ptr(earthModel));
-		glUniformMatrix4fv(moonUniform, 1, false, value_ptr(moonModel));
-		glUniformMatrix4fv(viewUniform, 1, false, value_ptr(view));
-		glUniformMatrix4fv(projUniform, 1, false, value_ptr(proj));
-		glUniform1f(animUniform, yangle);
-		glUniform3fv(camUniform, 1, camPoint);
+		// catalog stars on a sphere just inside the textured one, by cells,
+		// down to the limit for the view's angular resolution; a poster or
+		// panorama resolves more than the window by its point scale
+		float pointScale = renderScale.scale;
+		if (poster.width > 0) pointScale *= float(poster.height) / framebufferHeight;
+		if (panorama) pointScale *= cubeTarget.size * tan(0.5f * fov) / framebufferHeight;
+		float starDistance = float(starsR) * 0.99f;
+		mat4 starModel = StarModel(starDistance);
+		float starMagnitude = StarMagnitudeLimit(pointScale * tan(0.5f * fovDegrees * piVal / 180.0f) / tan(0.5f * fov));
+		MyDrawRanges starDraw;
+		if (stars.count > 0) {
+			long long occluded = culled.pointsOccluded, drawn = culled.pointsDrawn;
+			starDraw = CullStarCells(&frameArena, frustumCulling ? frustum : AllDirectionsFrustum(), occluders,
+				frustumCulling ? occluderCount : 0, cameraLoc, starModel, starDistance, &stars.catalog,
+				starMagnitude, &culled);
+			culled.pixelsSaved += (culled.pointsOccluded - occluded) * starMinSize * starMinSize;
+			BenchmarkCount(&benchmark, "stars drawn", double(culled.pointsDrawn - drawn));
+		}
 
-		// call function to draw our scene
-		RenderScene(&geometry, &shader, textures);
+		cullStats = culled;
+		BenchmarkCount(&benchmark, "bodies culled", culled.bodiesCulled);
+		BenchmarkCount(&benchmark, "bodies occluded", culled.bodiesOccluded);
+		BenchmarkCount(&benchmark, "points drawn", double(culled.pointsDrawn));
+		BenchmarkCount(&benchmark, "points culled", double(culled.pointsCulled));
+		BenchmarkCount(&benchmark, "points occluded", double(culled.pointsOccluded));
+		BenchmarkCount(&benchmark, "vertices saved", double(culled.verticesSaved));
+		BenchmarkCount(&benchmark, "pixels saved (estimate)", culled.pixelsSaved);
+
+		// a new anti-aliasing mode needs a target with its samples and passes
+		if (aaMode != renderTarget.mode) {
+			DestroyRenderTarget(&renderTarget);
+			if (!InitializeRenderTarget(&renderTarget, framebufferWidth, framebufferHeight, aaMode)) {
+				cout << "Anti-aliasing " << aaModeNames[aaMode] << " failed, falling back to none" << endl;
+				DestroyRenderTarget(&renderTarget);
+				aaMode = AA_NONE;
+				InitializeRenderTarget(&renderTarget, framebufferWidth, framebufferHeight, aaMode);
+			}
+			InvalidateGLState();
+		}
 
-		// update animation values
-		if (animate) yangle += animSpeed * (glfwGetTime() - lastFrameTime);
-		lastFrameTime = glfwGetTime();
+		// write this frame's uniform blocks, one for the frame and one per
+		// draw; on a poster the sprites keep their size relative to the whole
+		// image
+		BeginTraceFrame();
+		if (panorama) BeginCubeTarget(&cubeTarget);
+		else BeginRenderTarget(&renderTarget);
+		BeginUniformFrame(&uniformRing);
+		MyFrameUniforms frameBlock;
+		frameBlock.view = view;
+		frameBlock.proj = proj;
+		frameBlock.camPoint = cameraLoc;
+		frameBlock.animation = float(frame.yangle);
+		frameBlock.light = lightPoint;
+		frameBlock.logDepth = logDepthCoef;
+		GLintptr frameUniforms = PushUniforms(&uniformRing, &frameBlock, sizeof(frameBlock));
+		GLintptr bodyUniforms[4];
+		for (int s = 0; s < 4; s++) {
+			MyDrawUniforms bodyBlock = DrawUniforms(*sphereModels[s]);
+			bodyUniforms[s] = PushUniforms(&uniformRing, &bodyBlock, sizeof(bodyBlock));
+		}
+		MyDrawUniforms pointBlock = DrawUniforms(worldModel, minorBodyColour, minorBodySize * pointScale);
+		GLintptr minorBodyUniforms = PushUniforms(&uniformRing, &pointBlock, sizeof(pointBlock));
+		pointBlock = DrawUniforms(worldModel, particleColour, particleSize * pointScale);
+		GLintptr particleUniforms = PushUniforms(&uniformRing, &pointBlock, sizeof(pointBlock));
+		pointBlock = DrawUniforms(satelliteModel, satelliteColour, satelliteSize * pointScale);
+		GLintptr satelliteUniforms = PushUniforms(&uniformRing, &pointBlock, sizeof(pointBlock));
+		pointBlock = DrawUniforms(starModel, starColour, starSize * pointScale);
+		GLintptr starUniforms = PushUniforms(&uniformRing, &pointBlock, sizeof(pointBlock));
+
+		// a panorama's faces look along the axes of the camera's view space,
+		// each with a square 90 degree frustum; in one layered pass their
+		// projections share a block, in six passes each has a frame block
+		int passes = panorama && !cubeTarget.layered ? 6 : 1;
+		GLintptr passUniforms[6] = { frameUniforms };
+		if (panorama) {
+			mat4 faceProj = perspective(0.5f * piVal, 1.0f, zNear, zFar);
+			if (cubeTarget.layered) {
+				MyCubeUniforms cubeBlock;
+				for (int face = 0; face < 6; face++)
+					cubeBlock.faceViewProj[face] = faceProj * CubeFaceView(face) * view;
+				GLintptr cubeUniforms = PushUniforms(&uniformRing, &cubeBlock, sizeof(cubeBlock));
+				BindUniforms(&uniformRing, UNIFORM_CUBE, cubeUniforms, sizeof(MyCubeUniforms));
+			}
+			else
+				for (int face = 0; face < 6; face++) {
+					MyFrameUniforms faceBlock = frameBlock;
+					faceBlock.view = CubeFaceView(face) * view;
+					faceBlock.proj = faceProj;
+					passUniforms[face] = PushUniforms(&uniformRing, &faceBlock, sizeof(faceBlock));
+				}
+		}
+		SubmitUniformFrame(&uniformRing);
+
+		// call function to draw our scene, in each pass
+		MyShader *sceneProgram = panorama && cubeTarget.layered ? &cubeTarget.scene : &shader;
+		MyShader *pointProgram = panorama && cubeTarget.layered ? &cubeTarget.points : &pointShader;
+		for (int pass = 0; pass < passes; pass++) {
+			if (pass > 0) BindFramebuffer(GL_FRAMEBUFFER, cubeTarget.faceFramebuffers[pass]);
+			BindUniforms(&uniformRing, UNIFORM_FRAME, passUniforms[pass], sizeof(MyFrameUniforms));
+			RenderScene(&geometry, sceneProgram, textures, visible, bodyUniforms);
+			if (minorBodyCount > 0)
+				RenderMinorBodies(&minorBodies, pointProgram, minorBodyUniforms, minorBodyDraw);
+			if (particles.count > 0)
+				RenderParticles(&particles, pointProgram, particleUniforms, particleDraw);
+			if (satellites.count > 0)
+				RenderSatellites(&satellites, pointProgram, satelliteUniforms, satelliteDraw);
+			if (stars.count > 0 && (!panorama || !cubeTarget.layered || stars.cubeShader.program))
+				RenderStars(&stars, panorama && cubeTarget.layered ? &stars.cubeShader : &stars.shader, starUniforms,
+					starDraw, starMagnitude, starMinSize * pointScale);
+		}
+		if (panorama) EndCubeTarget(&cubeTarget, framebufferWidth, framebufferHeight);
+		else EndRenderTarget(&renderTarget, framebufferWidth, framebufferHeight);
+		EndTraceFrame();
+		CaptureFrame(&frameCapture, framebufferWidth, framebufferHeight);
+		if (poster.width > 0 && !ReadPosterTile(&posterReadback, &poster))
+			glfwSetWindowShouldClose(window, GL_TRUE);
+		EndUniformFrame(&uniformRing);
+		EndGLStateFrame(&benchmark);
+		BenchmarkCount(&benchmark, "uniform ring waits", double(uniformRing.waits - ringWaits));
+		if (frameCapture.recording || frameCapture.sink.header)
+			BenchmarkCount(&benchmark, "capture dropped frames", double(frameCapture.dropped - capturesDropped));
+		if (frameCapture.sink.header)
+			BenchmarkCount(&benchmark, "stream dropped frames", double(frameCapture.sink.header->dropped - streamDropped));
+		if (renderScale.budgetMs > 0.0) BenchmarkCount(&benchmark, "render scale", renderScale.scale);
+
+		// benchmark frames include all GPU work
+		if (benchmark.framesPerVariant > 0) glFinish();
+		AllocationTrap() = false;
+		BenchmarkCount(&benchmark, "heap allocations (render)", double(ThreadAllocations() - renderAllocations));
+		BenchmarkCount(&benchmark, "heap allocations (all)", double(AllocationCounters().allocations - frameAllocations));
+		frames++;
+		framesDrawn++;
+		if (renderCount > 0 && frames >= renderCount) glfwSetWindowShouldClose(window, GL_TRUE);
+
+		double frameTime = glfwGetTime();
+		if (!BenchmarkFrame(&benchmark, 1000.0 * (frameTime - lastFrameTime)))
+			glfwSetWindowShouldClose(window, GL_TRUE);
+
+		lastFrameTime = frameTime;
 
 		glfwSwapBuffers(window);
 		glfwPollEvents();
 	}
 
 	// clean up allocated resources before exit
+	StopSimulation(&simulation);
+	if (benchmark.framesPerVariant > 0) {
+		ReportJobStats();
+		ReportCullStats();
+	}
+	if (onDemand || frameCap > 0.0) ReportIdleStats();
+	if (debugOutputActive) ReportDebugMessages();
+	if (minorBodyCount > 0) {
+		DestroyMinorBodies(&minorBodies);
+		DestroyShaders(&propagateShader);
+	}
+	if (satellites.count > 0)
+		DestroySatellites(&satellites);
+	if (stars.count > 0)
+		DestroyStars(&stars);
+	DestroyParticles(&particles);
+	if (pointShader.program)
+		DestroyShaders(&pointShader);
+	CloseChebFile(&chebEphemeris);
+	DestroyArena(&frameArena);
+	DestroyFrameCapture(&frameCapture);
+	bool posterWritten = poster.width == 0 || FinishPoster(&posterReadback, &poster);
+	if (renderCount > 0)
+		cout << "Rendered frames " << renderFirst << " to " << renderFirst + frames - 1 << " in "
+			<< glfwGetTime() - renderStart << " s (" << frames / (glfwGetTime() - renderStart) << " fps)" << endl;
+	DestroyRenderTarget(&renderTarget);
+	if (panorama) DestroyCubeTarget(&cubeTarget);
+	DestroyUniformRing(&uniformRing);
+	glDeleteBuffers(1, &lightingBuffer);
 	DestroyGeometry(&geometry);
 	DestroyShaders(&shader);
 	for (int i = 0; i < 6; i++)
@@ -760,9 +3703,10 @@ int main(int argc, char *argv[])
 
 	glfwDestroyWindow(window);
 	glfwTerminate();
+	StopJobs(&jobs);
 
 	cout << "Goodbye!" << endl;
-	return 0;
+	return (renderCount > 0 && frameCapture.failed > 0) || !posterWritten ? 1 : 0;
 }
 
 // ==========================================================================
@@ -831,6 +3775,15 @@ string LoadSource(const string &filename)
 	return source;
 }
 
+// inserts a #define after the #version line of a shader's source, keeping
+// the line numbers of compiler messages
+string DefineInSource(const string &source, const char *name)
+{
+	size_t line = source.find('\n');
+	if (line == string::npos) return source;
+	return source.substr(0, line + 1) + "#define " + name + "\n#line 2\n" + source.substr(line + 1);
+}
+
 // creates and returns a shader object compiled from the given source
 GLuint CompileShader(GLenum shaderType, const string &source)
 {
@@ -860,15 +3813,21 @@ GLuint CompileShader(GLenum shaderType, const string &source)
 }
 
 // creates and returns a program object linked from vertex and fragment shaders
-GLuint LinkProgram(GLuint vertexShader, GLuint fragmentShader)
+GLuint LinkProgram(GLuint vertexShader, GLuint fragmentShader, const char *feedbackVarying,
+	GLuint geometryShader)
 {
 	// allocate program object name
 	GLuint programObject = glCreateProgram();
 
 	// attach provided shader objects to this program
 	if (vertexShader)   glAttachShader(programObject, vertexShader);
+	if (geometryShader) glAttachShader(programObject, geometryShader);
 	if (fragmentShader) glAttachShader(programObject, fragmentShader);
 
+	// capture the named vertex output instead of rasterizing, if given
+	if (feedbackVarying)
+		glTransformFeedbackVaryings(programObject, 1, &feedbackVarying, GL_INTERLEAVED_ATTRIBS);
+
 	// try linking the program with given attachments
 	glLinkProgram(programObject);
 
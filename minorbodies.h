@@ -0,0 +1,123 @@
+#ifndef MINORBODIES_H
+#define MINORBODIES_H
+
+#include <vector>
+#include <random>
+#include <cmath>
+#include <glm/glm.hpp>
+
+// --------------------------------------------------------------------------
+// Minor bodies (asteroids, comets) on fixed Keplerian orbits around the Sun
+//
+// Each orbit is stored with its perihelion (P) and semi-minor (Q) direction
+// vectors already rotated into the scene frame, so that propagating a body
+// only needs the solution of Kepler's equation and no per-frame rotations.
+// The same layout is uploaded as vertex attributes for the GPU propagator in
+// propagate.glsl, which must stay in sync with PropagateMinorBodies().
+
+const double auKm = 149597870.7; // km
+
+struct MyOrbit
+{
+	glm::vec4 p;		// perihelion direction (xyz), semi-major axis in AU (w)
+	glm::vec4 q;		// semi-minor direction (xyz), eccentricity (w)
+	glm::vec4 motion;	// mean anomaly at time 0, mean motion per time unit
+
+	MyOrbit() : p(0.0f), q(0.0f), motion(0.0f)
+	{}
+};
+
+// builds an orbit from classical elements (angles in radians, period in days)
+inline MyOrbit MakeOrbit(double a, double e, double incl, double node,
+	double peri, double meanAnomaly, double period)
+{
+	double cn = cos(node), sn = sin(node);
+	double cw = cos(peri), sw = sin(peri);
+	double ci = cos(incl), si = sin(incl);
+
+	// ecliptic P and Q vectors
+	double px = cn * cw - sn * sw * ci;
+	double py = sn * cw + cn * sw * ci;
+	double pz = sw * si;
+	double qx = -cn * sw - sn * cw * ci;
+	double qy = -sn * sw + cn * cw * ci;
+	double qz = cw * si;
+
+	// ecliptic (x, y, z) -> scene (x, z, -y), the scene orbits about +y
+	MyOrbit orbit;
+	orbit.p = glm::vec4(px, pz, -py, a);
+	orbit.q = glm::vec4(qx, qz, -qy, e);
+	orbit.motion = glm::vec4(meanAnomaly, 1.0 / period, 0.0, 0.0);
+	return orbit;
+}
+
+// fills the list with a synthetic main belt population (deterministic)
+inline void GenerateMinorBodies(std::vector<MyOrbit> &orbits, int count, unsigned seed = 453)
+{
+	const double pi = 3.14159265358979;
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<double> axis(2.1, 3.3);
+	std::uniform_real_distribution<double> ecc(0.0, 0.3);
+	std::uniform_real_distribution<double> angle(0.0, 2.0 * pi);
+	std::normal_distribution<double> incl(0.0, 8.0 * pi / 180.0);
+
+	orbits.resize(count);
+	for (int k = 0; k < count; k++) {
+		double a = axis(rng);
+		double e = ecc(rng);
+		double i = fabs(incl(rng));
+		double node = angle(rng);
+		double peri = angle(rng);
+		double m0 = angle(rng);
+		orbits[k] = MakeOrbit(a, e, i, node, peri, m0, 365.25 * a * sqrt(a));
+	}
+}
+
+// the same orbit with its mean anomaly moved to the given epoch, so that
+// propagators in float (the GPU) only see times relative to that epoch
+inline MyOrbit RebaseOrbit(const MyOrbit &orbit, double epoch)
+{
+	const double twoPi = 6.283185307179586;
+	MyOrbit o = orbit;
+	double m = orbit.motion.x + epoch * orbit.motion.y;
+	o.motion.x = float(m - twoPi * floor(m / twoPi));
+	return o;
+}
+
+// propagates orbits [first, last) to the given animation time, writing scene
+// positions with distances on the log scale defined by scaleOffset/scaleDivisor:
+//   d = (ln(r in AU) + scaleOffset) / scaleDivisor
+// or, when linearScale is positive, true to scale: d = r * linearScale
+inline void PropagateMinorBodies(const MyOrbit *orbits, glm::vec3 *positions,
+	int first, int last, double time, float scaleOffset, float scaleDivisor, float linearScale = 0.0f)
+{
+	const double twoPi = 6.283185307179586;
+
+	for (int k = first; k < last; k++) {
+		const MyOrbit &o = orbits[k];
+		float a = o.p.w;
+		float e = o.q.w;
+
+		// mean anomaly, wrapped to [0, 2pi) in double so that it stays
+		// accurate however long the animation runs
+		double wrapped = o.motion.x + time * o.motion.y;
+		float m = float(wrapped - twoPi * floor(wrapped / twoPi));
+
+		// solve Kepler's equation with a fixed number of Newton steps
+		float E = m + e * sin(m);
+		for (int it = 0; it < 4; it++)
+			E -= (E - e * sin(E) - m) / (1.0f - e * cos(E));
+
+		float cE = cos(E), sE = sin(E);
+		float x = a * (cE - e);
+		float y = a * sqrt(1.0f - e * e) * sE;
+		float r = a * (1.0f - e * cE);
+
+		// keep the direction, scale the distance from the sun
+		float d = linearScale > 0.0f ? r * linearScale : (log(r) + scaleOffset) / scaleDivisor;
+		glm::vec3 dir = (x * glm::vec3(o.p) + y * glm::vec3(o.q)) / r;
+		positions[k] = d * dir;
+	}
+}
+
+#endif
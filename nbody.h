@@ -0,0 +1,379 @@
+#ifndef NBODY_H
+#define NBODY_H
+
+#include <vector>
+#include <string>
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "jobs.h"
+
+// --------------------------------------------------------------------------
+// Gravitational N-body integration with a Barnes-Hut octree
+//
+// Units are AU, days and solar masses. Bodies are kept as a structure of
+// arrays. Every force evaluation rebuilds the octree top-down: the root
+// partitions the bodies into its eight octants and each octant's subtree is
+// built as a separate job, after which the subtrees are appended behind the
+// root. Bodies of a subtree stay contiguous in the index array, so leaves
+// refer to a range of up to nbodyLeafSize bodies.
+
+const double nbodyG = 2.959122082855911e-4;	// Gaussian constant squared, AU^3 / (Msun day^2)
+const double nbodySoftening = 1.0e-5;		// AU, ~1500 km
+const double nbodyTheta = 0.5;				// opening angle
+const int nbodyLeafSize = 8;
+const int nbodyMaxDepth = 40;
+
+enum NBodyIntegrator { NBODY_LEAPFROG, NBODY_YOSHIDA };
+
+struct MyOctreeNode
+{
+	glm::dvec3 com;		// centre of mass
+	double mass;
+	glm::dvec3 centre;	// cube centre
+	double half;		// cube half size
+	int child[8];		// node indices, -1 if empty
+	int first, count;	// range of the subtree's bodies in the index array
+	bool leaf;
+};
+
+struct MyNBody
+{
+	int count;
+	std::vector<glm::dvec3> position, velocity, acceleration;
+	std::vector<double> mass;
+	std::vector<std::string> names;	// named (massive) bodies, particles are unnamed
+
+	// octree, rebuilt for every force evaluation
+	std::vector<MyOctreeNode> nodes;
+	std::vector<int> index, scratch;
+	std::vector<MyOctreeNode> octantNodes[8];
+
+	int integrator;
+	bool accelerationValid;
+	double time;			// Julian date
+	long long steps;
+
+	MyNBody() : count(0), integrator(NBODY_YOSHIDA), accelerationValid(false), time(0.0), steps(0)
+	{}
+};
+
+// adds a body and returns its index
+inline int AddNBody(MyNBody *sim, const glm::dvec3 &p, const glm::dvec3 &v, double m, const std::string &name = "")
+{
+	sim->position.push_back(p);
+	sim->velocity.push_back(v);
+	sim->acceleration.push_back(glm::dvec3(0.0));
+	sim->mass.push_back(m);
+	sim->names.push_back(name);
+	sim->accelerationValid = false;
+	return sim->count++;
+}
+
+inline void ClearNBody(MyNBody *sim)
+{
+	sim->count = 0;
+	sim->position.clear();
+	sim->velocity.clear();
+	sim->acceleration.clear();
+	sim->mass.clear();
+	sim->names.clear();
+	sim->accelerationValid = false;
+	sim->steps = 0;
+}
+
+// heliocentric state of a Kepler orbit (angles in radians, a in AU)
+inline void KeplerState(double a, double e, double incl, double node, double peri, double meanAnomaly,
+	double mu, glm::dvec3 *p, glm::dvec3 *v)
+{
+	double E = meanAnomaly;
+	for (int it = 0; it < 30; it++)
+		E -= (E - e * sin(E) - meanAnomaly) / (1.0 - e * cos(E));
+
+	double b = a * sqrt(1.0 - e * e);
+	double n = sqrt(mu / (a * a * a));
+	double edot = n / (1.0 - e * cos(E));
+	glm::dvec2 po(a * (cos(E) - e), b * sin(E));
+	glm::dvec2 vo(-a * sin(E) * edot, b * cos(E) * edot);
+
+	double cn = cos(node), sn = sin(node), cw = cos(peri), sw = sin(peri), ci = cos(incl), si = sin(incl);
+	glm::dvec3 P(cn * cw - sn * sw * ci, sn * cw + cn * sw * ci, sw * si);
+	glm::dvec3 Q(-cn * sw - sn * cw * ci, -sn * sw + cn * cw * ci, cw * si);
+	*p = po.x * P + po.y * Q;
+	*v = vo.x * P + vo.y * Q;
+}
+
+// injects test particles: comets on eccentric heliocentric orbits and
+// spacecraft leaving the given planet with a few km/s of excess velocity
+inline void InjectParticles(MyNBody *sim, int count, const glm::dvec3 &planetPos, const glm::dvec3 &planetVel,
+	unsigned seed)
+{
+	const double pi = 3.14159265358979;
+	const double kmPerSecond = 86400.0 / 149597870.7;	// km/s -> AU/day
+	const double particleMass = 1.0e-13;
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+	for (int k = 0; k < count; k++) {
+		glm::dvec3 p, v;
+		if (k % 4 != 3) {
+			// comet: perihelion 0.5-3 AU, eccentricity 0.5-0.95
+			double e = 0.5 + 0.45 * uniform(rng);
+			double q = 0.5 + 2.5 * uniform(rng);
+			KeplerState(q / (1.0 - e), e, pi * uniform(rng), 2.0 * pi * uniform(rng),
+				2.0 * pi * uniform(rng), 2.0 * pi * uniform(rng), nbodyG, &p, &v);
+		}
+		else {
+			// spacecraft: 0.001-0.01 AU from the planet, 1-5 km/s relative
+			glm::dvec3 dir = glm::normalize(glm::dvec3(uniform(rng) - 0.5, uniform(rng) - 0.5, uniform(rng) - 0.5) + 1.0e-9);
+			p = planetPos + dir * (0.001 + 0.009 * uniform(rng));
+			v = planetVel + dir * (1.0 + 4.0 * uniform(rng)) * kmPerSecond;
+		}
+		AddNBody(sim, p, v, particleMass);
+	}
+}
+
+// builds the subtree over index[first, first + count) into nodes, returning
+// the index of its root node
+inline int BuildOctree(MyNBody *sim, std::vector<MyOctreeNode> &nodes, int first, int count,
+	const glm::dvec3 &centre, double half, int depth)
+{
+	int id = (int)nodes.size();
+	nodes.push_back(MyOctreeNode());
+	MyOctreeNode node;
+	node.centre = centre;
+	node.half = half;
+	node.first = first;
+	node.count = count;
+	node.leaf = count <= nbodyLeafSize || depth >= nbodyMaxDepth;
+	node.mass = 0.0;
+	node.com = glm::dvec3(0.0);
+	for (int c = 0; c < 8; c++) node.child[c] = -1;
+
+	int *idx = sim->index.data() + first;
+	if (node.leaf) {
+		for (int k = 0; k < count; k++) {
+			node.mass += sim->mass[idx[k]];
+			node.com += sim->mass[idx[k]] * sim->position[idx[k]];
+		}
+	}
+	else {
+		// counting sort of the range by octant, through the scratch array
+		int start[9] = { 0 };
+		int *tmp = sim->scratch.data() + first;
+		for (int k = 0; k < count; k++) {
+			const glm::dvec3 &p = sim->position[idx[k]];
+			start[1 + (p.x > centre.x) + 2 * (p.y > centre.y) + 4 * (p.z > centre.z)]++;
+		}
+		for (int c = 0; c < 8; c++) start[c + 1] += start[c];
+		int fill[8];
+		std::copy(start, start + 8, fill);
+		for (int k = 0; k < count; k++) {
+			const glm::dvec3 &p = sim->position[idx[k]];
+			tmp[fill[(p.x > centre.x) + 2 * (p.y > centre.y) + 4 * (p.z > centre.z)]++] = idx[k];
+		}
+		std::copy(tmp, tmp + count, idx);
+
+		for (int c = 0; c < 8; c++) {
+			int n = start[c + 1] - start[c];
+			if (n == 0) continue;
+			glm::dvec3 offset(c & 1 ? 0.5 : -0.5, c & 2 ? 0.5 : -0.5, c & 4 ? 0.5 : -0.5);
+			int child = BuildOctree(sim, nodes, first + start[c], n, centre + offset * half, 0.5 * half, depth + 1);
+			node.child[c] = child;
+			node.mass += nodes[child].mass;
+			node.com += nodes[child].mass * nodes[child].com;
+		}
+	}
+	node.com = node.mass > 0.0 ? node.com / node.mass : centre;
+	nodes[id] = node;
+	return id;
+}
+
+// rebuilds the octree, with the root's eight subtrees built in parallel
+inline void BuildNBodyTree(MyNBody *sim, MyJobPool *pool)
+{
+	int n = sim->count;
+	sim->index.resize(n);
+	sim->scratch.resize(n);
+	for (int k = 0; k < n; k++) sim->index[k] = k;
+
+	// bounding cube
+	glm::dvec3 lo(1.0e300), hi(-1.0e300);
+	for (int k = 0; k < n; k++) {
+		lo = glm::min(lo, sim->position[k]);
+		hi = glm::max(hi, sim->position[k]);
+	}
+	glm::dvec3 centre = 0.5 * (lo + hi);
+	double half = 0.5 * std::max(hi.x - lo.x, std::max(hi.y - lo.y, hi.z - lo.z)) * 1.0001 + 1.0e-12;
+
+	// small sets need no parallel build
+	sim->nodes.clear();
+	if (n <= nbodyLeafSize) {
+		BuildOctree(sim, sim->nodes, 0, n, centre, half, 0);
+		return;
+	}
+
+	// the root partitions the bodies into octants, then each octant's
+	// subtree is built concurrently into its own node list
+	MyOctreeNode root;
+	root.centre = centre;
+	root.half = half;
+	root.first = 0;
+	root.count = n;
+	root.leaf = false;
+	root.mass = 0.0;
+	root.com = glm::dvec3(0.0);
+	for (int c = 0; c < 8; c++) root.child[c] = -1;
+
+	int start[9] = { 0 };
+	for (int k = 0; k < n; k++) {
+		const glm::dvec3 &p = sim->position[k];
+		start[1 + (p.x > centre.x) + 2 * (p.y > centre.y) + 4 * (p.z > centre.z)]++;
+	}
+	for (int c = 0; c < 8; c++) start[c + 1] += start[c];
+	int fill[8];
+	std::copy(start, start + 8, fill);
+	for (int k = 0; k < n; k++) {
+		const glm::dvec3 &p = sim->position[k];
+		sim->index[fill[(p.x > centre.x) + 2 * (p.y > centre.y) + 4 * (p.z > centre.z)]++] = k;
+	}
+
+	ParallelFor(pool, 0, 8, 1, [sim, &start, centre, half](int first, int last) {
+		for (int c = first; c < last; c++) {
+			sim->octantNodes[c].clear();
+			int count = start[c + 1] - start[c];
+			if (count == 0) continue;
+			glm::dvec3 offset(c & 1 ? 0.5 : -0.5, c & 2 ? 0.5 : -0.5, c & 4 ? 0.5 : -0.5);
+			BuildOctree(sim, sim->octantNodes[c], start[c], count, centre + offset * half, 0.5 * half, 1);
+		}
+	});
+
+	// append the subtrees behind the root, shifting their child indices
+	sim->nodes.push_back(root);
+	for (int c = 0; c < 8; c++) {
+		std::vector<MyOctreeNode> &sub = sim->octantNodes[c];
+		if (sub.empty()) continue;
+		int base = (int)sim->nodes.size();
+		for (MyOctreeNode node : sub) {
+			for (int k = 0; k < 8; k++)
+				if (node.child[k] >= 0) node.child[k] += base;
+			sim->nodes.push_back(node);
+		}
+		MyOctreeNode &r = sim->nodes[0];
+		r.child[c] = base;
+		r.mass += sub[0].mass;
+		r.com += sub[0].mass * sub[0].com;
+	}
+	MyOctreeNode &r = sim->nodes[0];
+	r.com = r.mass > 0.0 ? r.com / r.mass : centre;
+}
+
+// acceleration of body i from the tree
+inline glm::dvec3 TreeAcceleration(const MyNBody *sim, int i)
+{
+	const double eps2 = nbodySoftening * nbodySoftening;
+	const double theta2 = nbodyTheta * nbodyTheta;
+	const glm::dvec3 p = sim->position[i];
+	glm::dvec3 a(0.0);
+
+	int stack[8 * nbodyMaxDepth + 8];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const MyOctreeNode &node = sim->nodes[stack[--top]];
+		if (node.leaf) {
+			for (int k = node.first; k < node.first + node.count; k++) {
+				int j = sim->index[k];
+				if (j == i) continue;
+				glm::dvec3 d = sim->position[j] - p;
+				double r2 = glm::dot(d, d) + eps2;
+				a += sim->mass[j] / (r2 * sqrt(r2)) * d;
+			}
+			continue;
+		}
+
+		glm::dvec3 d = node.com - p;
+		double r2 = glm::dot(d, d);
+		glm::dvec3 rel = glm::abs(p - node.centre);
+		bool inside = rel.x <= node.half && rel.y <= node.half && rel.z <= node.half;
+		double size = 2.0 * node.half;
+		if (!inside && size * size < theta2 * r2) {
+			// far enough: the whole cell acts as a point mass
+			r2 += eps2;
+			a += node.mass / (r2 * sqrt(r2)) * d;
+		}
+		else {
+			for (int c = 0; c < 8; c++)
+				if (node.child[c] >= 0) stack[top++] = node.child[c];
+		}
+	}
+	return nbodyG * a;
+}
+
+inline void ComputeNBodyAccelerations(MyNBody *sim, MyJobPool *pool)
+{
+	BuildNBodyTree(sim, pool);
+	ParallelFor(pool, 0, sim->count, 256, [sim](int first, int last) {
+		for (int i = first; i < last; i++)
+			sim->acceleration[i] = TreeAcceleration(sim, i);
+	});
+	sim->accelerationValid = true;
+}
+
+inline void DriftNBody(MyNBody *sim, MyJobPool *pool, double dt)
+{
+	ParallelFor(pool, 0, sim->count, 4096, [sim, dt](int first, int last) {
+		for (int i = first; i < last; i++) sim->position[i] += dt * sim->velocity[i];
+	});
+}
+
+inline void KickNBody(MyNBody *sim, MyJobPool *pool, double dt)
+{
+	ParallelFor(pool, 0, sim->count, 4096, [sim, dt](int first, int last) {
+		for (int i = first; i < last; i++) sim->velocity[i] += dt * sim->acceleration[i];
+	});
+}
+
+// one symplectic step of length dt: kick-drift-kick leapfrog (one force
+// evaluation) or Yoshida's fourth order composition (three)
+inline void StepNBody(MyNBody *sim, MyJobPool *pool, double dt)
+{
+	if (sim->integrator == NBODY_LEAPFROG) {
+		if (!sim->accelerationValid) ComputeNBodyAccelerations(sim, pool);
+		KickNBody(sim, pool, 0.5 * dt);
+		DriftNBody(sim, pool, dt);
+		ComputeNBodyAccelerations(sim, pool);
+		KickNBody(sim, pool, 0.5 * dt);
+	}
+	else {
+		const double cbrt2 = 1.2599210498948732;
+		const double w1 = 1.0 / (2.0 - cbrt2);
+		const double w0 = -cbrt2 * w1;
+		const double c[4] = { 0.5 * w1, 0.5 * (w0 + w1), 0.5 * (w0 + w1), 0.5 * w1 };
+		const double d[3] = { w1, w0, w1 };
+		for (int k = 0; k < 3; k++) {
+			DriftNBody(sim, pool, c[k] * dt);
+			ComputeNBodyAccelerations(sim, pool);
+			KickNBody(sim, pool, d[k] * dt);
+		}
+		DriftNBody(sim, pool, c[3] * dt);
+		sim->accelerationValid = false;
+	}
+	sim->time += dt;
+	sim->steps++;
+}
+
+// advances the simulation by the given number of days in equal substeps no
+// longer than maxStep (at most maxSubsteps), returning the substeps taken
+inline int AdvanceNBody(MyNBody *sim, MyJobPool *pool, double days, double maxStep, int maxSubsteps)
+{
+	if (days == 0.0 || sim->count == 0) return 0;
+	int substeps = std::min(maxSubsteps, std::max(1, (int)ceil(fabs(days) / maxStep)));
+	double dt = days / substeps;
+	for (int k = 0; k < substeps; k++)
+		StepNBody(sim, pool, dt);
+	return substeps;
+}
+
+#endif
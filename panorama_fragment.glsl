@@ -0,0 +1,39 @@
+#version 410
+
+// reprojects the cubemap drawn around the camera onto the window, either
+// as an equirectangular map of the whole sphere (longitude across, latitude
+// up, the view direction in the centre) or as an azimuthal equidistant
+// fisheye about the view direction, as projected onto a dome
+
+out vec4 FragmentColour;
+
+uniform samplerCube faces;	// in the camera's view space
+uniform vec2 outputSize;	// of the window, in pixels
+uniform int fisheye;		// 0 for the equirectangular map
+uniform float aperture;		// fisheye field of view, radians
+
+const float PI = 3.14159265358979;
+
+void main(void)
+{
+	vec3 direction;
+	if (fisheye == 0) {
+		vec2 uv = gl_FragCoord.xy / outputSize;
+		float longitude = (uv.x - 0.5) * 2.0 * PI;
+		float latitude = (uv.y - 0.5) * PI;
+		direction = vec3(cos(latitude) * sin(longitude), sin(latitude), -cos(latitude) * cos(longitude));
+	}
+	else {
+		// the circle of the aperture fills the shorter side
+		vec2 p = (2.0 * gl_FragCoord.xy - outputSize) / min(outputSize.x, outputSize.y);
+		float r = length(p);
+		if (r > 1.0) {
+			FragmentColour = vec4(0.0, 0.0, 0.0, 1.0);
+			return;
+		}
+		float theta = 0.5 * aperture * r;
+		float phi = atan(p.y, p.x);
+		direction = vec3(sin(theta) * cos(phi), sin(theta) * sin(phi), -cos(theta));
+	}
+	FragmentColour = vec4(texture(faces, direction).rgb, 1.0);
+}
@@ -0,0 +1,35 @@
+#version 410
+
+out vec4 FragmentColour;
+
+// per-frame uniforms, laid out as MyFrameUniforms in uniforms.h
+layout(std140) uniform Frame
+{
+	mat4 view;
+	mat4 proj;
+	vec3 camPoint;
+	float animation;
+	vec3 light;
+	float logDepth;	// 2 / log2(zFar + 1), used when compiled with LOG_DEPTH
+};
+
+// per-draw uniforms, laid out as MyDrawUniforms in uniforms.h
+layout(std140) uniform Draw
+{
+	mat4 model;
+	vec3 pointColour;
+	float pointSize;
+};
+
+in float logDepthW;
+
+void main(void)
+{
+	// round sprite with a soft edge
+	float r = length(gl_PointCoord - vec2(0.5));
+	if (r > 0.5) discard;
+	FragmentColour = vec4(pointColour * (1.0 - r), 1.0);
+#ifdef LOG_DEPTH
+	gl_FragDepth = 0.5 * log2(logDepthW) * logDepth;
+#endif
+}
@@ -0,0 +1,35 @@
+#version 410
+
+// point sprites for minor bodies and other point sets
+layout(location = 0) in vec3 VertexPosition;
+
+// per-frame uniforms, laid out as MyFrameUniforms in uniforms.h
+layout(std140) uniform Frame
+{
+	mat4 view;
+	mat4 proj;
+	vec3 camPoint;
+	float animation;
+	vec3 light;
+	float logDepth;	// 2 / log2(zFar + 1), used when compiled with LOG_DEPTH
+};
+
+// per-draw uniforms, laid out as MyDrawUniforms in uniforms.h
+layout(std140) uniform Draw
+{
+	mat4 model;
+	vec3 pointColour;
+	float pointSize;
+};
+
+out float logDepthW;
+
+void main()
+{
+	gl_Position = proj * view * model * vec4(VertexPosition, 1.0);
+	logDepthW = 1.0 + gl_Position.w;
+#ifdef LOG_DEPTH
+	gl_Position.z = (log2(max(1e-6, logDepthW)) * logDepth - 1.0) * gl_Position.w;
+#endif
+	gl_PointSize = pointSize;
+}
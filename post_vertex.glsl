@@ -0,0 +1,9 @@
+#version 410
+
+// full-screen triangle for post-processing passes, generated from the vertex
+// index so no vertex buffer is needed
+void main()
+{
+	vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	gl_Position = vec4(2.0 * p - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,211 @@
+#ifndef POSTER_H
+#define POSTER_H
+
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#endif
+
+// --------------------------------------------------------------------------
+// Tiled poster rendering
+//
+// A poster is far larger than any framebuffer. The view frustum of the whole
+// image is cut into a grid of tiles the size of the render target, and each
+// tile is drawn with an off-axis frustum over its own rectangle of the near
+// plane. Side by side the tiles make up exactly the image that a single
+// perspective projection at the poster's size would give.
+//
+// The image is a binary PPM (8-bit RGB, rows top down) created at its full
+// size before any tile is drawn. Each row of a tile is written straight to
+// its place in the file, so only one tile is ever held in memory. A render
+// farm worker writes only its own band of image rows into the shared file,
+// drawing just the tiles that cover the band. As the file has its full size
+// from the start, a worker records each band it wrote completely in a marker
+// file next to the image (FILE_rows_FIRST_COUNT.done), and the coordinator
+// counts the rows without one as missing.
+
+struct MyPoster
+{
+	int     width, height;		// of the whole image, 0 when not rendering one
+	const char *filename;
+	long long frame;			// animation frame shown
+	int     firstRow, rowCount;	// band of image rows this process writes, count 0 = all
+	bool    band;				// given a band by --poster-rows, and marks it when done
+	int     tileWidth, tileHeight;
+	int     columns, rows;		// of the tile grid
+	int     firstTileRow, tileRows;	// rows of tiles covering the band
+	long long headerBytes;
+	FILE   *file;
+
+	MyPoster() : width(0), height(0), filename(0), frame(0), firstRow(0), rowCount(0), band(false), tileWidth(0),
+		tileHeight(0), columns(0), rows(0), firstTileRow(0), tileRows(0), headerBytes(0), file(0)
+	{}
+};
+
+inline bool PosterSeek(FILE *file, long long offset)
+{
+#ifdef _WIN32
+	return _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+	return fseeko(file, off_t(offset), SEEK_SET) == 0;
+#endif
+}
+
+inline int PosterHeader(int width, int height, char *header, size_t size)
+{
+	return snprintf(header, size, "P6\n%d %d\n255\n", width, height);
+}
+
+inline long long PosterFileBytes(int width, int height)
+{
+	char header[64];
+	return PosterHeader(width, height, header, sizeof(header)) + 3LL * width * height;
+}
+
+// writes the header and extends the file to the full image, returning true
+// if successful; the pixels start out black (and on most file systems take
+// no space until written)
+inline bool CreatePosterFile(const char *filename, int width, int height)
+{
+	FILE *file = fopen(filename, "wb");
+	if (!file) return false;
+	char header[64];
+	int n = PosterHeader(width, height, header, sizeof(header));
+	unsigned char zero = 0;
+	bool ok = fwrite(header, 1, n, file) == size_t(n) &&
+		PosterSeek(file, PosterFileBytes(width, height) - 1) && fwrite(&zero, 1, 1, file) == 1;
+	return fclose(file) == 0 && ok;
+}
+
+// true if the file has the header and size of a width x height poster
+inline bool PosterFileComplete(const char *filename, int width, int height)
+{
+	FILE *file = fopen(filename, "rb");
+	if (!file) return false;
+	char expected[64], found[64];
+	int n = PosterHeader(width, height, expected, sizeof(expected));
+	bool ok = fread(found, 1, n, file) == size_t(n) && memcmp(found, expected, n) == 0 &&
+		PosterSeek(file, PosterFileBytes(width, height) - 1) && fgetc(file) != EOF && fgetc(file) == EOF;
+	fclose(file);
+	return ok;
+}
+
+// lays the tile grid over the image and finds the tiles of this process's
+// band of rows
+inline void SetPosterTiles(MyPoster *p, int tileWidth, int tileHeight)
+{
+	p->tileWidth = tileWidth;
+	p->tileHeight = tileHeight;
+	p->columns = (p->width + tileWidth - 1) / tileWidth;
+	p->rows = (p->height + tileHeight - 1) / tileHeight;
+	if (p->rowCount <= 0) {
+		p->firstRow = 0;
+		p->rowCount = p->height;
+	}
+	p->firstRow = std::min(std::max(p->firstRow, 0), p->height);
+	p->rowCount = std::min(p->rowCount, p->height - p->firstRow);
+	p->firstTileRow = p->firstRow / tileHeight;
+	p->tileRows = p->rowCount > 0 ? (p->firstRow + p->rowCount - 1) / tileHeight - p->firstTileRow + 1 : 0;
+}
+
+inline int PosterTiles(const MyPoster *p)
+{
+	return p->columns * p->tileRows;
+}
+
+// column and row in the grid of the index-th tile this process draws
+inline void PosterTile(const MyPoster *p, int index, int *column, int *row)
+{
+	*column = index % p->columns;
+	*row = p->firstTileRow + index / p->columns;
+}
+
+// near-plane rectangle of a tile, for glm::frustum; the tile grid starts at
+// the top left of the image, and tiles past its right or bottom edge keep
+// their full size with the excess cut off when written
+inline void PosterTileFrustum(const MyPoster *p, int column, int row, float fovY, float zNear,
+	float *left, float *right, float *bottom, float *top)
+{
+	double halfHeight = zNear * tan(0.5 * fovY);
+	double halfWidth = halfHeight * p->width / p->height;
+	double x = 2.0 * halfWidth / p->width, y = 2.0 * halfHeight / p->height;	// per pixel
+	*left = float(-halfWidth + x * column * p->tileWidth);
+	*right = float(-halfWidth + x * (column + 1) * p->tileWidth);
+	*top = float(halfHeight - y * row * p->tileHeight);
+	*bottom = float(halfHeight - y * (row + 1) * p->tileHeight);
+}
+
+// opens the file made by CreatePosterFile for writing tiles into, returning
+// true if it has the poster's header and size
+inline bool OpenPosterFile(MyPoster *p)
+{
+	if (!PosterFileComplete(p->filename, p->width, p->height)) return false;
+	char header[64];
+	p->headerBytes = PosterHeader(p->width, p->height, header, sizeof(header));
+	p->file = fopen(p->filename, "r+b");
+	return p->file != 0;
+}
+
+// writes a tile's RGB pixels, rows bottom up as OpenGL reads them, into the
+// image rows of this process's band, returning true if successful
+inline bool WritePosterTile(MyPoster *p, int column, int row, const unsigned char *pixels)
+{
+	int x = column * p->tileWidth;
+	int n = std::min(p->tileWidth, p->width - x);
+	int first = std::max(row * p->tileHeight, p->firstRow);
+	int last = std::min((row + 1) * p->tileHeight, p->firstRow + p->rowCount);
+	bool ok = true;
+	for (int y = first; y < last && ok; y++) {
+		const unsigned char *source = pixels + size_t(p->tileHeight - 1 - (y - row * p->tileHeight)) * p->tileWidth * 3;
+		ok = PosterSeek(p->file, p->headerBytes + 3 * ((long long)y * p->width + x)) &&
+			fwrite(source, 1, size_t(n) * 3, p->file) == size_t(n) * 3;
+	}
+	return ok;
+}
+
+inline void PosterBandMarker(const char *filename, int first, int count, char *name, size_t size)
+{
+	snprintf(name, size, "%s_rows_%d_%d.done", filename, first, count);
+}
+
+// records that the band of rows was written and the file closed, returning
+// true if successful
+inline bool WritePosterBandMarker(const MyPoster *p)
+{
+	char name[512];
+	PosterBandMarker(p->filename, p->firstRow, p->rowCount, name, sizeof(name));
+	FILE *file = fopen(name, "w");
+	if (!file) return false;
+	bool ok = fprintf(file, "%d %d\n", p->firstRow, p->rowCount) > 0;
+	return fclose(file) == 0 && ok;
+}
+
+inline bool PosterBandWritten(const char *filename, int first, int count)
+{
+	char name[512];
+	PosterBandMarker(filename, first, count, name, sizeof(name));
+	FILE *file = fopen(name, "r");
+	if (file) fclose(file);
+	return file != 0;
+}
+
+// removes the marker a previous run may have left
+inline void RemovePosterBandMarker(const char *filename, int first, int count)
+{
+	char name[512];
+	PosterBandMarker(filename, first, count, name, sizeof(name));
+	remove(name);
+}
+
+inline bool ClosePosterFile(MyPoster *p)
+{
+	bool ok = p->file && fclose(p->file) == 0;
+	p->file = 0;
+	return ok;
+}
+
+#endif
@@ -0,0 +1,42 @@
+#version 410
+
+// transform feedback pass propagating minor body orbits on the GPU, the
+// attribute layout matches MyOrbit and the maths PropagateMinorBodies()
+layout(location = 0) in vec4 OrbitP;		// perihelion direction, semi-major axis
+layout(location = 1) in vec4 OrbitQ;		// semi-minor direction, eccentricity
+layout(location = 2) in vec4 OrbitMotion;	// mean anomaly at time 0, mean motion
+
+// captured into the position buffer
+out vec3 Position;
+
+// animation time and distance scale, logarithmic unless linearScale > 0
+uniform float time;
+uniform float scaleOffset;
+uniform float scaleDivisor;
+uniform float linearScale;
+
+const float TWO_PI = 6.28318530718;
+
+void main()
+{
+	float a = OrbitP.w;
+	float e = OrbitQ.w;
+
+	// mean anomaly, wrapped to [0, 2pi)
+	float m = OrbitMotion.x + time * OrbitMotion.y;
+	m -= TWO_PI * floor(m / TWO_PI);
+
+	// solve Kepler's equation with a fixed number of Newton steps
+	float E = m + e * sin(m);
+	for (int it = 0; it < 4; it++)
+		E -= (E - e * sin(E) - m) / (1.0 - e * cos(E));
+
+	float cE = cos(E), sE = sin(E);
+	float x = a * (cE - e);
+	float y = a * sqrt(1.0 - e * e) * sE;
+	float r = a * (1.0 - e * cE);
+
+	// keep the direction, scale the distance from the sun
+	float d = linearScale > 0.0 ? r * linearScale : (log(r) + scaleOffset) / scaleDivisor;
+	Position = d * (x * OrbitP.xyz + y * OrbitQ.xyz) / r;
+}
@@ -0,0 +1,61 @@
+#ifndef RENDERSCALE_H
+#define RENDERSCALE_H
+
+#include <cmath>
+#include <algorithm>
+
+// --------------------------------------------------------------------------
+// Render scale controller for dynamic resolution
+//
+// The scene is drawn at a fraction of the window resolution and upscaled.
+// The controller smooths the measured GPU time per frame and, since fill
+// cost grows with the pixel count (the square of the scale), moves the scale
+// towards scale * sqrt(budget / time). Changes are limited per step, ignored
+// inside a dead band around the budget and spaced out by a settling period,
+// so the resolution does not oscillate from frame to frame.
+
+const double renderScaleSmoothing = 0.1;	// weight of a new sample
+const double renderScaleDeadBand = 0.1;		// relative distance from the budget to ignore
+const float renderScaleMaxStep = 0.1f;		// largest change per adjustment
+const float renderScaleQuantum = 1.0f / 64.0f;	// scales are multiples of this
+const int renderScaleSettleFrames = 8;		// frames between adjustments
+
+struct MyRenderScale
+{
+	float scale;		// fraction of the window resolution per axis
+	float minScale;
+	float maxScale;
+	double budgetMs;	// target GPU time per frame, 0 disables the controller
+	double smoothedMs;	// moving average of the GPU time
+	int frames;			// samples since the last adjustment
+
+	MyRenderScale() : scale(1.0f), minScale(0.5f), maxScale(1.0f), budgetMs(0.0),
+		smoothedMs(0.0), frames(0)
+	{}
+};
+
+// feeds one GPU frame time into the controller, returning true if the
+// scale changed
+inline bool UpdateRenderScale(MyRenderScale *rs, double gpuMs)
+{
+	if (rs->budgetMs <= 0.0 || gpuMs <= 0.0) return false;
+	rs->smoothedMs = rs->smoothedMs > 0.0 ?
+		rs->smoothedMs + renderScaleSmoothing * (gpuMs - rs->smoothedMs) : gpuMs;
+	if (++rs->frames < renderScaleSettleFrames) return false;
+	if (fabs(rs->smoothedMs - rs->budgetMs) < renderScaleDeadBand * rs->budgetMs) return false;
+
+	float ideal = rs->scale * float(sqrt(rs->budgetMs / rs->smoothedMs));
+	float next = std::min(std::max(ideal, rs->scale - renderScaleMaxStep), rs->scale + renderScaleMaxStep);
+	next = std::min(std::max(next, rs->minScale), rs->maxScale);
+	next = renderScaleQuantum * floor(next / renderScaleQuantum + 0.5f);
+	if (next == rs->scale) return false;
+
+	// the smoothed time is rescaled to the new pixel count so that the next
+	// adjustment does not overshoot while fresh samples arrive
+	rs->smoothedMs *= (next * next) / (rs->scale * rs->scale);
+	rs->scale = next;
+	rs->frames = 0;
+	return true;
+}
+
+#endif
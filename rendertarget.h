@@ -0,0 +1,266 @@
+#ifndef RENDERTARGET_H
+#define RENDERTARGET_H
+
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+// OpenGL core profile, as set up by main.cpp
+#ifndef LAB_LINUX
+#include <glad/glad.h>
+#else
+#define GLFW_INCLUDE_GLCOREARB
+#define GL_GLEXT_PROTOTYPES
+#endif
+#include <GLFW/glfw3.h>
+
+#include "renderscale.h"
+#include "benchmark.h"
+#include "trace.h"
+
+// --------------------------------------------------------------------------
+// Offscreen target, anti-aliasing and dynamic resolution
+//
+// The scene is always drawn offscreen. The target is allocated once at the
+// largest scale with the sample count of the anti-aliasing mode; smaller
+// scales draw into its lower left corner. That corner is resolved, run
+// through the post-process passes of FXAA or SMAA at the render resolution,
+// and upscaled to the window. GPU time of the scene and its anti-aliasing is
+// measured with a ring of timer queries so the result is read frames later
+// without stalling.
+//
+// main.cpp includes this file after its state cache wrappers (BindFramebuffer,
+// UseProgram, DrawArrays and the others) and shader functions, which the
+// passes draw through, and after the renderScale and benchmark globals.
+
+enum AAMode { AA_NONE, AA_MSAA2, AA_MSAA4, AA_MSAA8, AA_FXAA, AA_SMAA, AA_MODES };
+const char *aaModeNames[AA_MODES] = { "none", "msaa2", "msaa4", "msaa8", "fxaa", "smaa" };
+const int aaModeSamples[AA_MODES] = { 0, 2, 4, 8, 0, 0 };
+int aaMode = AA_MSAA4;
+
+const int renderTimeQueries = 3;
+const int postTextureUnit = 6;		// above the scene's six, so neither rebinds the other
+
+struct MyRenderTarget
+{
+	// OpenGL names for the scene framebuffer (multisampled or not) and the
+	// resolved and post-processed framebuffers with their textures
+	GLuint  framebuffer;
+	GLuint  colourBuffer;
+	GLuint  depthBuffer;
+	GLuint  resolveFramebuffer;
+	GLuint  resolveTexture;
+	GLuint  edgesFramebuffer;
+	GLuint  edgesTexture;
+	GLuint  weightsFramebuffer;
+	GLuint  weightsTexture;
+	GLuint  outputFramebuffer;
+	GLuint  outputTexture;
+	GLuint  emptyArray;		// for attribute-less full-screen passes
+	GLuint  queries[renderTimeQueries];
+	int     width, height;		// at scale 1
+	int     samples;
+	int     mode;				// AAMode the target was created for
+	int     query;
+
+	// post-process programs
+	MyShader fxaa, smaaEdges, smaaWeights, smaaBlend;
+
+	// initialize object names to zero (OpenGL reserved value)
+	MyRenderTarget() : framebuffer(0), colourBuffer(0), depthBuffer(0), resolveFramebuffer(0),
+		resolveTexture(0), edgesFramebuffer(0), edgesTexture(0), weightsFramebuffer(0),
+		weightsTexture(0), outputFramebuffer(0), outputTexture(0), emptyArray(0),
+		width(0), height(0), samples(0), mode(-1), query(0)
+	{
+		for (int k = 0; k < renderTimeQueries; k++) queries[k] = 0;
+	}
+};
+
+// a texture of the target size with a framebuffer drawing into it
+inline bool CreateTargetTexture(GLuint *framebuffer, GLuint *texture, GLenum format, int width, int height)
+{
+	glGenTextures(1, texture);
+	glBindTexture(GL_TEXTURE_2D, *texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, *framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *texture, 0);
+	TraceTexture(*texture, format, width, height);
+	TraceFramebuffer(*framebuffer, *texture, 0, 0);
+	return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+}
+
+// create the framebuffers for the window size and the anti-aliasing mode,
+// returning true if successful
+inline bool InitializeRenderTarget(MyRenderTarget *target, int width, int height, int mode)
+{
+	GLint maxSamples = 0;
+	glGetIntegerv(GL_MAX_SAMPLES, &maxSamples);
+	target->width = int(ceil(width * renderScale.maxScale));
+	target->height = int(ceil(height * renderScale.maxScale));
+	target->samples = std::min(aaModeSamples[mode], int(maxSamples));
+	target->mode = mode;
+
+	glGenRenderbuffers(1, &target->colourBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, target->colourBuffer);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, target->samples, GL_RGBA8, target->width, target->height);
+	glGenRenderbuffers(1, &target->depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, target->depthBuffer);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, target->samples, GL_DEPTH_COMPONENT24, target->width, target->height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glGenFramebuffers(1, &target->framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target->colourBuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target->depthBuffer);
+	TraceRenderbuffer(target->colourBuffer, target->samples, GL_RGBA8, target->width, target->height);
+	TraceRenderbuffer(target->depthBuffer, target->samples, GL_DEPTH_COMPONENT24, target->width, target->height);
+	TraceFramebuffer(target->framebuffer, 0, target->colourBuffer, target->depthBuffer);
+	bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+	// resolved pixels, input to the post-process passes and the upscale
+	complete = CreateTargetTexture(&target->resolveFramebuffer, &target->resolveTexture, GL_RGBA8,
+		target->width, target->height) && complete;
+
+	if (mode == AA_FXAA || mode == AA_SMAA) {
+		complete = CreateTargetTexture(&target->outputFramebuffer, &target->outputTexture, GL_RGBA8,
+			target->width, target->height) && complete;
+		glGenVertexArrays(1, &target->emptyArray);
+		TraceVertexArray(target->emptyArray, 0, 0, 0);
+	}
+	if (mode == AA_FXAA)
+		complete = InitializeShaders(&target->fxaa, "post_vertex.glsl", "fxaa_fragment.glsl") && complete;
+	if (mode == AA_SMAA) {
+		complete = CreateTargetTexture(&target->edgesFramebuffer, &target->edgesTexture, GL_RG8,
+			target->width, target->height) && complete;
+		complete = CreateTargetTexture(&target->weightsFramebuffer, &target->weightsTexture, GL_RG8,
+			target->width, target->height) && complete;
+		complete = InitializeShaders(&target->smaaEdges, "post_vertex.glsl", "smaa_edges.glsl") &&
+			InitializeShaders(&target->smaaWeights, "post_vertex.glsl", "smaa_weights.glsl") &&
+			InitializeShaders(&target->smaaBlend, "post_vertex.glsl", "smaa_blend.glsl") && complete;
+	}
+
+	glGenQueries(renderTimeQueries, target->queries);
+
+	// unbind our buffers, resetting to default state
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (!complete) std::cout << "ERROR: Offscreen render target is incomplete" << std::endl;
+
+	return complete && !CheckGLErrors();
+}
+
+// drawn region of the target at the current scale
+inline int RenderWidth(const MyRenderTarget *target) { return int(target->width * renderScale.scale / renderScale.maxScale); }
+inline int RenderHeight(const MyRenderTarget *target) { return int(target->height * renderScale.scale / renderScale.maxScale); }
+
+// feeds the GPU time of an earlier frame to the controller, then binds the
+// target at the current scale and starts timing this frame
+inline void BeginRenderTarget(MyRenderTarget *target)
+{
+	GLuint query = target->queries[target->query];
+	GLint available = 0;
+	if (glIsQuery(query)) glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+	if (available) {
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+		UpdateRenderScale(&renderScale, ns / 1.0e6);
+		BenchmarkSection(&benchmark, "scene and aa (gpu)", ns / 1.0e6);
+	}
+	glBeginQuery(GL_TIME_ELAPSED, query);
+
+	BindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+	SetViewport(0, 0, RenderWidth(target), RenderHeight(target));
+}
+
+// one full-screen pass over the drawn region into a framebuffer
+inline void PostProcessPass(MyRenderTarget *target, MyShader *shader, GLuint framebuffer,
+	GLuint source, const char *sourceName, GLuint second, const char *secondName)
+{
+	float texelSize[2] = { 1.0f / target->width, 1.0f / target->height };
+	float sourceMax[2] = { (RenderWidth(target) - 0.5f) * texelSize[0], (RenderHeight(target) - 0.5f) * texelSize[1] };
+
+	BindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	UseProgram(shader->program);
+	SetUniform2f(shader->program, "texelSize", texelSize);
+	SetUniform2f(shader->program, "sourceMax", sourceMax);
+	SetUniform1i(shader->program, sourceName, postTextureUnit);
+	BindTexture(postTextureUnit, GL_TEXTURE_2D, source);
+	if (second) {
+		SetUniform1i(shader->program, secondName, postTextureUnit + 1);
+		BindTexture(postTextureUnit + 1, GL_TEXTURE_2D, second);
+	}
+	DrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+// resolves the drawn region, anti-aliases it in post if the mode asks for
+// it, upscales it to the window and stops timing
+inline void EndRenderTarget(MyRenderTarget *target, int windowWidth, int windowHeight)
+{
+	int width = RenderWidth(target), height = RenderHeight(target);
+	BindFramebuffer(GL_READ_FRAMEBUFFER, target->framebuffer);
+	BindFramebuffer(GL_DRAW_FRAMEBUFFER, target->resolveFramebuffer);
+	BlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+	// post passes fill the region with a triangle, whatever the polygon mode
+	GLuint output = target->resolveFramebuffer;
+	if (target->mode == AA_FXAA || target->mode == AA_SMAA) {
+		SetCapability(CAP_DEPTH_TEST, false);
+		SetPolygonMode(GL_FILL);
+		BindVertexArray(target->emptyArray);
+		if (target->mode == AA_FXAA)
+			PostProcessPass(target, &target->fxaa, target->outputFramebuffer, target->resolveTexture, "source", 0, 0);
+		else {
+			// edges and weights outside the region must read as none
+			BindFramebuffer(GL_FRAMEBUFFER, target->edgesFramebuffer);
+			Clear(GL_COLOR_BUFFER_BIT, 0.0f, 0.0f, 0.0f, 0.0f);
+			BindFramebuffer(GL_FRAMEBUFFER, target->weightsFramebuffer);
+			Clear(GL_COLOR_BUFFER_BIT, 0.0f, 0.0f, 0.0f, 0.0f);
+			PostProcessPass(target, &target->smaaEdges, target->edgesFramebuffer,
+				target->resolveTexture, "source", 0, 0);
+			PostProcessPass(target, &target->smaaWeights, target->weightsFramebuffer,
+				target->edgesTexture, "edges", 0, 0);
+			PostProcessPass(target, &target->smaaBlend, target->outputFramebuffer,
+				target->resolveTexture, "source", target->weightsTexture, "weights");
+		}
+		output = target->outputFramebuffer;
+	}
+
+	BindFramebuffer(GL_READ_FRAMEBUFFER, output);
+	BindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	BlitFramebuffer(0, 0, width, height, 0, 0, windowWidth, windowHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+
+	glEndQuery(GL_TIME_ELAPSED);
+	target->query = (target->query + 1) % renderTimeQueries;
+	CheckFrameGLErrors();
+}
+
+// deallocate render target objects
+inline void DestroyRenderTarget(MyRenderTarget *target)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	GLuint framebuffers[5] = { target->framebuffer, target->resolveFramebuffer, target->edgesFramebuffer,
+		target->weightsFramebuffer, target->outputFramebuffer };
+	GLuint textures[4] = { target->resolveTexture, target->edgesTexture, target->weightsTexture, target->outputTexture };
+	glDeleteFramebuffers(5, framebuffers);
+	glDeleteTextures(4, textures);
+	glDeleteRenderbuffers(1, &target->colourBuffer);
+	glDeleteRenderbuffers(1, &target->depthBuffer);
+	glDeleteVertexArrays(1, &target->emptyArray);
+	glDeleteQueries(renderTimeQueries, target->queries);
+	for (int k = 0; k < 5; k++) TraceForget(TRACE_OBJECT_FRAMEBUFFER, framebuffers[k]);
+	for (int k = 0; k < 4; k++) TraceForget(TRACE_OBJECT_TEXTURE, textures[k]);
+	TraceForget(TRACE_OBJECT_RENDERBUFFER, target->colourBuffer);
+	TraceForget(TRACE_OBJECT_RENDERBUFFER, target->depthBuffer);
+	TraceForget(TRACE_OBJECT_VERTEX_ARRAY, target->emptyArray);
+	MyShader *shaders[4] = { &target->fxaa, &target->smaaEdges, &target->smaaWeights, &target->smaaBlend };
+	for (int k = 0; k < 4; k++)
+		if (shaders[k]->program) DestroyShaders(shaders[k]);
+	*target = MyRenderTarget();
+}
+
+#endif
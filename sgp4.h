@@ -0,0 +1,861 @@
+#ifndef SGP4_H
+#define SGP4_H
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <glm/glm.hpp>
+
+// --------------------------------------------------------------------------
+// Artificial satellite catalog: two-line element (TLE) parser and SGP4
+// propagator (Spacetrack Report #3 with the Vallado 2006 corrections, WGS-72)
+//
+// The catalog is kept as a structure of arrays: the elements and every
+// constant derived at initialization are stored in their own contiguous
+// array, so that a range of satellites can be propagated by one thread with
+// streaming reads. Deep-space objects (period >= 225 minutes) add the SDP4
+// lunar-solar periodics and the 12 and 24 hour geopotential resonances
+// (Vallado's dscom, dpper, dsinit and dspace); they are a small part of a
+// typical catalog, so their constants are kept in a separate array indexed
+// from the satellite rather than widening every satellite's arrays.
+
+const double sgpRe = 6378.135;			// km, WGS-72
+const double sgpMu = 398600.8;			// km^3/s^2
+const double sgpXke = 0.0743669161331734;	// 60 / sqrt(re^3 / mu)
+const double sgpJ2 = 0.001082616;
+const double sgpJ3 = -0.00000253881;
+const double sgpJ4 = -0.00000165597;
+const double sgpJ3oJ2 = sgpJ3 / sgpJ2;
+const double sgpTwoPi = 6.28318530717958648;
+const double sgpRptim = 4.37526908801129966e-3;	// Earth rotation, rad/min
+
+// SDP4 constants of a deep-space satellite
+struct MySatelliteDeepSpace
+{
+	// lunar-solar periodics (dscom)
+	double e3, ee2, se2, se3, sgh2, sgh3, sgh4, sh2, sh3, si2, si3, sl2, sl3, sl4;
+	double xgh2, xgh3, xgh4, xh2, xh3, xi2, xi3, xl2, xl3, xl4, zmol, zmos;
+
+	// lunar-solar secular rates and resonance terms (dsinit)
+	double dedt, didt, dmdt, dnodt, domdt;
+	int irez;		// 0 none, 1 synchronous, 2 half-day
+	double gsto, xfact, xlamo, del1, del2, del3;
+	double d2201, d2211, d3210, d3222, d4410, d4422, d5220, d5232, d5421, d5433;
+
+	// resonance integrator state (dspace), only touched by the thread
+	// propagating the satellite
+	double atime, xli, xni;
+};
+
+struct MySatelliteCatalog
+{
+	int count;
+	std::vector<std::string> names;
+
+	// elements: epoch (Julian date), mean motion (rad/min, un-Kozai'd after
+	// initialization), eccentricity, angles in radians, drag term
+	std::vector<double> epoch, no, ecco, inclo, nodeo, argpo, mo, bstar;
+
+	// derived constants
+	std::vector<double> mdot, argpdot, nodedot, nodecf, cc1, cc4, cc5;
+	std::vector<double> t2cof, t3cof, t4cof, t5cof, d2, d3, d4;
+	std::vector<double> omgcof, xmcof, eta, delmo, sinmao;
+	std::vector<double> xlcof, aycof, con41, x1mth2, x7thm1;
+	std::vector<unsigned char> isimp;
+
+	// index into deepSpace, or -1 for a near-Earth satellite; the deep-space
+	// integrator state advances as the satellites are propagated
+	std::vector<int> deep;
+	mutable std::vector<MySatelliteDeepSpace> deepSpace;
+
+	MySatelliteCatalog() : count(0)
+	{}
+};
+
+// parses a fixed-width numeric field without copying it
+inline double ParseTLEField(const char *s, int length, bool impliedDecimal = false)
+{
+	double value = 0.0, scale = 1.0;
+	bool negative = false, digits = false, fraction = impliedDecimal;
+	int exponentSign = 0, exponent = 0;
+	for (int k = 0; k < length && s[k] && s[k] != '\n' && s[k] != '\r'; k++) {
+		char c = s[k];
+		if (c == ' ') continue;
+		if (c == '-' || c == '+') {
+			// a sign after digits starts the exponent of the packed "12345-3" format
+			if (digits) exponentSign = c == '-' ? -1 : 1;
+			else negative = c == '-';
+		}
+		else if (c == '.') fraction = true;
+		else if (c >= '0' && c <= '9') {
+			digits = true;
+			if (exponentSign) exponent = exponent * 10 + (c - '0');
+			else if (fraction) value += (c - '0') * (scale *= 0.1);
+			else value = value * 10.0 + (c - '0');
+		}
+	}
+	if (exponentSign) value *= pow(10.0, exponentSign * exponent);
+	return negative ? -value : value;
+}
+
+// recovers the original (Brouwer) mean motion from the element set's
+// (Kozai) mean motion, in rad/min
+inline double UnKozaiMeanMotion(double no, double ecco, double inclo)
+{
+	double omeosq = 1.0 - ecco * ecco;
+	double cosio = cos(inclo);
+	double ak = pow(sgpXke / no, 2.0 / 3.0);
+	double d1 = 0.75 * sgpJ2 * (3.0 * cosio * cosio - 1.0) / (sqrt(omeosq) * omeosq);
+	double del = d1 / (ak * ak);
+	double adel = ak * (1.0 - del * del - del * (1.0 / 3.0 + 134.0 * del * del / 81.0));
+	del = d1 / (adel * adel);
+	return no / (1.0 + del);
+}
+
+// Greenwich mean sidereal time in radians at a Julian date (gstime)
+inline double SatelliteSiderealTime(double jd)
+{
+	double tut1 = (jd - 2451545.0) / 36525.0;
+	double seconds = -6.2e-6 * tut1 * tut1 * tut1 + 0.093104 * tut1 * tut1 +
+		(876600.0 * 3600.0 + 8640184.812866) * tut1 + 67310.54841;
+	double theta = fmod(seconds * sgpTwoPi / 86400.0, sgpTwoPi);
+	return theta < 0.0 ? theta + sgpTwoPi : theta;
+}
+
+// initializes the lunar-solar and resonance terms of a deep-space
+// satellite from its un-Kozai'd elements and secular rates (dscom, dsinit)
+inline void InitializeDeepSpace(MySatelliteDeepSpace *ds, double epoch, double ecco, double inclo,
+	double nodeo, double argpo, double mo, double no, double mdot, double argpdot, double nodedot)
+{
+	const double zes = 0.01675, zel = 0.05490;
+	const double zns = 1.19459e-5, znl = 1.5835218e-4;
+	const double c1ss = 2.9864797e-6, c1l = 4.7968065e-7;
+	const double zsinis = 0.39785416, zcosis = 0.91744867;
+	const double zcosgs = 0.1945905, zsings = -0.98088458;
+	const double pi = 0.5 * sgpTwoPi;
+
+	double snodm = sin(nodeo), cnodm = cos(nodeo);
+	double sinomm = sin(argpo), cosomm = cos(argpo);
+	double sinim = sin(inclo), cosim = cos(inclo);
+	double emsq = ecco * ecco;
+	double betasq = 1.0 - emsq;
+	double rtemsq = sqrt(betasq);
+
+	// lunar orbit from days since 1900 January 0.5
+	double day = epoch - 2415020.0;
+	double xnodce = fmod(4.5236020 - 9.2422029e-4 * day, sgpTwoPi);
+	double stem = sin(xnodce), ctem = cos(xnodce);
+	double zcosil = 0.91375164 - 0.03568096 * ctem;
+	double zsinil = sqrt(1.0 - zcosil * zcosil);
+	double zsinhl = 0.089683511 * stem / zsinil;
+	double zcoshl = sqrt(1.0 - zsinhl * zsinhl);
+	double gam = 5.8351514 + 0.0019443680 * day;
+	double zx = atan2(0.39785416 * stem / zsinil, zcoshl * ctem + 0.91744867 * zsinhl * stem);
+	zx = gam + zx - xnodce;
+	double zcosgl = cos(zx), zsingl = sin(zx);
+
+	// the same coefficients for the Sun (first pass) and the Moon (second)
+	double zcosg = zcosgs, zsing = zsings, zcosi = zcosis, zsini = zsinis;
+	double zcosh = cnodm, zsinh = snodm, cc = c1ss;
+	double s1, s2, s3, s4, s5, s6, s7, z1, z2, z3, z11, z12, z13, z21, z22, z23, z31, z32, z33;
+	double ss1 = 0.0, ss2 = 0.0, ss3 = 0.0, ss4 = 0.0, ss5 = 0.0, ss6 = 0.0, ss7 = 0.0;
+	double sz1 = 0.0, sz2 = 0.0, sz3 = 0.0, sz11 = 0.0, sz12 = 0.0, sz13 = 0.0;
+	double sz21 = 0.0, sz22 = 0.0, sz23 = 0.0, sz31 = 0.0, sz32 = 0.0, sz33 = 0.0;
+	for (int pass = 0; pass < 2; pass++) {
+		double a1 = zcosg * zcosh + zsing * zcosi * zsinh;
+		double a3 = -zsing * zcosh + zcosg * zcosi * zsinh;
+		double a7 = -zcosg * zsinh + zsing * zcosi * zcosh;
+		double a8 = zsing * zsini;
+		double a9 = zsing * zsinh + zcosg * zcosi * zcosh;
+		double a10 = zcosg * zsini;
+		double a2 = cosim * a7 + sinim * a8;
+		double a4 = cosim * a9 + sinim * a10;
+		double a5 = -sinim * a7 + cosim * a8;
+		double a6 = -sinim * a9 + cosim * a10;
+
+		double x1 = a1 * cosomm + a2 * sinomm;
+		double x2 = a3 * cosomm + a4 * sinomm;
+		double x3 = -a1 * sinomm + a2 * cosomm;
+		double x4 = -a3 * sinomm + a4 * cosomm;
+		double x5 = a5 * sinomm;
+		double x6 = a6 * sinomm;
+		double x7 = a5 * cosomm;
+		double x8 = a6 * cosomm;
+
+		z31 = 12.0 * x1 * x1 - 3.0 * x3 * x3;
+		z32 = 24.0 * x1 * x2 - 6.0 * x3 * x4;
+		z33 = 12.0 * x2 * x2 - 3.0 * x4 * x4;
+		z1 = 3.0 * (a1 * a1 + a2 * a2) + z31 * emsq;
+		z2 = 6.0 * (a1 * a3 + a2 * a4) + z32 * emsq;
+		z3 = 3.0 * (a3 * a3 + a4 * a4) + z33 * emsq;
+		z11 = -6.0 * a1 * a5 + emsq * (-24.0 * x1 * x7 - 6.0 * x3 * x5);
+		z12 = -6.0 * (a1 * a6 + a3 * a5) + emsq * (-24.0 * (x2 * x7 + x1 * x8) - 6.0 * (x3 * x6 + x4 * x5));
+		z13 = -6.0 * a3 * a6 + emsq * (-24.0 * x2 * x8 - 6.0 * x4 * x6);
+		z21 = 6.0 * a2 * a5 + emsq * (24.0 * x1 * x5 - 6.0 * x3 * x7);
+		z22 = 6.0 * (a4 * a5 + a2 * a6) + emsq * (24.0 * (x2 * x5 + x1 * x6) - 6.0 * (x4 * x7 + x3 * x8));
+		z23 = 6.0 * a4 * a6 + emsq * (24.0 * x2 * x6 - 6.0 * x4 * x8);
+		z1 = z1 + z1 + betasq * z31;
+		z2 = z2 + z2 + betasq * z32;
+		z3 = z3 + z3 + betasq * z33;
+		s3 = cc / no;
+		s2 = -0.5 * s3 / rtemsq;
+		s4 = s3 * rtemsq;
+		s1 = -15.0 * ecco * s4;
+		s5 = x1 * x3 + x2 * x4;
+		s6 = x2 * x3 + x1 * x4;
+		s7 = x2 * x4 - x1 * x3;
+
+		if (pass == 0) {
+			ss1 = s1; ss2 = s2; ss3 = s3; ss4 = s4; ss5 = s5; ss6 = s6; ss7 = s7;
+			sz1 = z1; sz2 = z2; sz3 = z3;
+			sz11 = z11; sz12 = z12; sz13 = z13;
+			sz21 = z21; sz22 = z22; sz23 = z23;
+			sz31 = z31; sz32 = z32; sz33 = z33;
+			zcosg = zcosgl;
+			zsing = zsingl;
+			zcosi = zcosil;
+			zsini = zsinil;
+			zcosh = zcoshl * cnodm + zsinhl * snodm;
+			zsinh = snodm * zcoshl - cnodm * zsinhl;
+			cc = c1l;
+		}
+	}
+	ds->zmol = fmod(4.7199672 + 0.22997150 * day - gam, sgpTwoPi);
+	ds->zmos = fmod(6.2565837 + 0.017201977 * day, sgpTwoPi);
+
+	// solar periodics
+	ds->se2 = 2.0 * ss1 * ss6;
+	ds->se3 = 2.0 * ss1 * ss7;
+	ds->si2 = 2.0 * ss2 * sz12;
+	ds->si3 = 2.0 * ss2 * (sz13 - sz11);
+	ds->sl2 = -2.0 * ss3 * sz2;
+	ds->sl3 = -2.0 * ss3 * (sz3 - sz1);
+	ds->sl4 = -2.0 * ss3 * (-21.0 - 9.0 * emsq) * zes;
+	ds->sgh2 = 2.0 * ss4 * sz32;
+	ds->sgh3 = 2.0 * ss4 * (sz33 - sz31);
+	ds->sgh4 = -18.0 * ss4 * zes;
+	ds->sh2 = -2.0 * ss2 * sz22;
+	ds->sh3 = -2.0 * ss2 * (sz23 - sz21);
+
+	// lunar periodics
+	ds->ee2 = 2.0 * s1 * s6;
+	ds->e3 = 2.0 * s1 * s7;
+	ds->xi2 = 2.0 * s2 * z12;
+	ds->xi3 = 2.0 * s2 * (z13 - z11);
+	ds->xl2 = -2.0 * s3 * z2;
+	ds->xl3 = -2.0 * s3 * (z3 - z1);
+	ds->xl4 = -2.0 * s3 * (-21.0 - 9.0 * emsq) * zel;
+	ds->xgh2 = 2.0 * s4 * z32;
+	ds->xgh3 = 2.0 * s4 * (z33 - z31);
+	ds->xgh4 = -18.0 * s4 * zel;
+	ds->xh2 = -2.0 * s2 * z22;
+	ds->xh3 = -2.0 * s2 * (z23 - z21);
+
+	// lunar-solar secular rates, with the node terms dropped near 0 and 180
+	// degrees inclination
+	bool equatorial = inclo < 5.2359877e-2 || inclo > pi - 5.2359877e-2;
+	double shs = equatorial ? 0.0 : -zns * ss2 * (sz21 + sz23);
+	if (sinim != 0.0) shs /= sinim;
+	double sgs = ss4 * zns * (sz31 + sz33 - 6.0) - cosim * shs;
+	ds->dedt = ss1 * zns * ss5 + s1 * znl * s5;
+	ds->didt = ss2 * zns * (sz11 + sz13) + s2 * znl * (z11 + z13);
+	ds->dmdt = -zns * ss3 * (sz1 + sz3 - 14.0 - 6.0 * emsq) - znl * s3 * (z1 + z3 - 14.0 - 6.0 * emsq);
+	double sghl = s4 * znl * (z31 + z33 - 6.0);
+	double shll = equatorial ? 0.0 : -znl * s2 * (z21 + z23);
+	ds->domdt = sgs + sghl;
+	ds->dnodt = shs;
+	if (sinim != 0.0) {
+		ds->domdt -= cosim / sinim * shll;
+		ds->dnodt += shll / sinim;
+	}
+
+	// geopotential resonance of synchronous (irez 1) and eccentric half-day
+	// (irez 2) orbits
+	ds->irez = 0;
+	if (no < 0.0052359877 && no > 0.0034906585) ds->irez = 1;
+	if (no >= 8.26e-3 && no <= 9.24e-3 && ecco >= 0.5) ds->irez = 2;
+	ds->gsto = SatelliteSiderealTime(epoch);
+	ds->xfact = ds->xlamo = ds->del1 = ds->del2 = ds->del3 = 0.0;
+	ds->d2201 = ds->d2211 = ds->d3210 = ds->d3222 = ds->d4410 = 0.0;
+	ds->d4422 = ds->d5220 = ds->d5232 = ds->d5421 = ds->d5433 = 0.0;
+	double theta = ds->gsto;
+	double aonv = pow(no / sgpXke, 2.0 / 3.0);
+	if (ds->irez == 2) {
+		double em = ecco;
+		double eoc = em * emsq;
+		double g201 = -0.306 - (em - 0.64) * 0.440;
+		double g211, g310, g322, g410, g422, g520, g521, g532, g533;
+		if (em <= 0.65) {
+			g211 = 3.616 - 13.2470 * em + 16.2900 * emsq;
+			g310 = -19.302 + 117.3900 * em - 228.4190 * emsq + 156.5910 * eoc;
+			g322 = -18.9068 + 109.7927 * em - 214.6334 * emsq + 146.5816 * eoc;
+			g410 = -41.122 + 242.6940 * em - 471.0940 * emsq + 313.9530 * eoc;
+			g422 = -146.407 + 841.8800 * em - 1629.014 * emsq + 1083.4350 * eoc;
+			g520 = -532.114 + 3017.977 * em - 5740.032 * emsq + 3708.2760 * eoc;
+		}
+		else {
+			g211 = -72.099 + 331.819 * em - 508.738 * emsq + 266.724 * eoc;
+			g310 = -346.844 + 1582.851 * em - 2415.925 * emsq + 1246.113 * eoc;
+			g322 = -342.585 + 1554.908 * em - 2366.899 * emsq + 1215.972 * eoc;
+			g410 = -1052.797 + 4758.686 * em - 7193.992 * emsq + 3651.957 * eoc;
+			g422 = -3581.690 + 16178.110 * em - 24462.770 * emsq + 12422.520 * eoc;
+			if (em > 0.715) g520 = -5149.66 + 29936.92 * em - 54087.36 * emsq + 31324.56 * eoc;
+			else g520 = 1464.74 - 4664.75 * em + 3763.64 * emsq;
+		}
+		if (em < 0.7) {
+			g533 = -919.22770 + 4988.6100 * em - 9064.7700 * emsq + 5542.21 * eoc;
+			g521 = -822.71072 + 4568.6173 * em - 8491.4146 * emsq + 5337.524 * eoc;
+			g532 = -853.66600 + 4690.2500 * em - 8624.7700 * emsq + 5341.4 * eoc;
+		}
+		else {
+			g533 = -37995.780 + 161616.52 * em - 229838.20 * emsq + 109377.94 * eoc;
+			g521 = -51752.104 + 218913.95 * em - 309468.16 * emsq + 146349.42 * eoc;
+			g532 = -40023.880 + 170470.89 * em - 242699.48 * emsq + 115605.82 * eoc;
+		}
+
+		double cosisq = cosim * cosim;
+		double sini2 = sinim * sinim;
+		double f220 = 0.75 * (1.0 + 2.0 * cosim + cosisq);
+		double f221 = 1.5 * sini2;
+		double f321 = 1.875 * sinim * (1.0 - 2.0 * cosim - 3.0 * cosisq);
+		double f322 = -1.875 * sinim * (1.0 + 2.0 * cosim - 3.0 * cosisq);
+		double f441 = 35.0 * sini2 * f220;
+		double f442 = 39.3750 * sini2 * sini2;
+		double f522 = 9.84375 * sinim * (sini2 * (1.0 - 2.0 * cosim - 5.0 * cosisq) +
+			0.33333333 * (-2.0 + 4.0 * cosim + 6.0 * cosisq));
+		double f523 = sinim * (4.92187512 * sini2 * (-2.0 - 4.0 * cosim + 10.0 * cosisq) +
+			6.56250012 * (1.0 + 2.0 * cosim - 3.0 * cosisq));
+		double f542 = 29.53125 * sinim * (2.0 - 8.0 * cosim + cosisq * (-12.0 + 8.0 * cosim + 10.0 * cosisq));
+		double f543 = 29.53125 * sinim * (-2.0 - 8.0 * cosim + cosisq * (12.0 + 8.0 * cosim - 10.0 * cosisq));
+		double temp1 = 3.0 * no * no * aonv * aonv;
+		double temp = temp1 * 1.7891679e-6;
+		ds->d2201 = temp * f220 * g201;
+		ds->d2211 = temp * f221 * g211;
+		temp1 *= aonv;
+		temp = temp1 * 3.7393792e-7;
+		ds->d3210 = temp * f321 * g310;
+		ds->d3222 = temp * f322 * g322;
+		temp1 *= aonv;
+		temp = 2.0 * temp1 * 7.3636953e-9;
+		ds->d4410 = temp * f441 * g410;
+		ds->d4422 = temp * f442 * g422;
+		temp1 *= aonv;
+		temp = temp1 * 1.1428639e-7;
+		ds->d5220 = temp * f522 * g520;
+		ds->d5232 = temp * f523 * g532;
+		temp = 2.0 * temp1 * 2.1765803e-9;
+		ds->d5421 = temp * f542 * g521;
+		ds->d5433 = temp * f543 * g533;
+		ds->xlamo = fmod(mo + nodeo + nodeo - theta - theta, sgpTwoPi);
+		ds->xfact = mdot + ds->dmdt + 2.0 * (nodedot + ds->dnodt - sgpRptim) - no;
+	}
+	else if (ds->irez == 1) {
+		double g200 = 1.0 + emsq * (-2.5 + 0.8125 * emsq);
+		double g310 = 1.0 + 2.0 * emsq;
+		double g300 = 1.0 + emsq * (-6.0 + 6.60937 * emsq);
+		double f220 = 0.75 * (1.0 + cosim) * (1.0 + cosim);
+		double f311 = 0.9375 * sinim * sinim * (1.0 + 3.0 * cosim) - 0.75 * (1.0 + cosim);
+		double f330 = 1.0 + cosim;
+		f330 = 1.875 * f330 * f330 * f330;
+		double del1 = 3.0 * no * no * aonv * aonv;
+		ds->del2 = 2.0 * del1 * f220 * g200 * 1.7891679e-6;
+		ds->del3 = 3.0 * del1 * f330 * g300 * 2.2123015e-7 * aonv;
+		ds->del1 = del1 * f311 * g310 * 2.1460748e-6 * aonv;
+		ds->xlamo = fmod(mo + nodeo + argpo - theta, sgpTwoPi);
+		ds->xfact = mdot + argpdot + nodedot - sgpRptim + ds->dmdt + ds->domdt + ds->dnodt - no;
+	}
+
+	// the resonance integrator starts at epoch
+	ds->atime = 0.0;
+	ds->xli = ds->xlamo;
+	ds->xni = no;
+}
+
+// applies the lunar-solar secular rates and integrates the resonance terms
+// t minutes from epoch, updating the mean elements (dspace)
+inline void DeepSpaceSecular(MySatelliteDeepSpace *ds, double argpo, double argpdot, double no, double t,
+	double *em, double *argpm, double *inclm, double *mm, double *nodem, double *nm)
+{
+	const double fasx2 = 0.13130908, fasx4 = 2.8843198, fasx6 = 0.37448087;
+	const double g22 = 5.7686396, g32 = 0.95240898, g44 = 1.8014998, g52 = 1.0508330, g54 = 4.4108898;
+	const double stepp = 720.0, step2 = 259200.0;
+
+	*em += ds->dedt * t;
+	*inclm += ds->didt * t;
+	*argpm += ds->domdt * t;
+	*nodem += ds->dnodt * t;
+	*mm += ds->dmdt * t;
+	if (ds->irez == 0) return;
+
+	// Euler-Maclaurin integration in 720 minute steps, continuing from the
+	// last time propagated unless the new time is behind it or across epoch
+	if (ds->atime == 0.0 || t * ds->atime <= 0.0 || fabs(t) < fabs(ds->atime)) {
+		ds->atime = 0.0;
+		ds->xni = no;
+		ds->xli = ds->xlamo;
+	}
+	double delt = t > 0.0 ? stepp : -stepp;
+	double xndt, xnddt, xldot, ft;
+	for (;;) {
+		double xli = ds->xli;
+		if (ds->irez != 2) {
+			// near-synchronous resonance terms
+			xndt = ds->del1 * sin(xli - fasx2) + ds->del2 * sin(2.0 * (xli - fasx4)) +
+				ds->del3 * sin(3.0 * (xli - fasx6));
+			xnddt = ds->del1 * cos(xli - fasx2) + 2.0 * ds->del2 * cos(2.0 * (xli - fasx4)) +
+				3.0 * ds->del3 * cos(3.0 * (xli - fasx6));
+		}
+		else {
+			// near half-day resonance terms
+			double xomi = argpo + argpdot * ds->atime;
+			double x2omi = xomi + xomi;
+			double x2li = xli + xli;
+			xndt = ds->d2201 * sin(x2omi + xli - g22) + ds->d2211 * sin(xli - g22) +
+				ds->d3210 * sin(xomi + xli - g32) + ds->d3222 * sin(-xomi + xli - g32) +
+				ds->d4410 * sin(x2omi + x2li - g44) + ds->d4422 * sin(x2li - g44) +
+				ds->d5220 * sin(xomi + xli - g52) + ds->d5232 * sin(-xomi + xli - g52) +
+				ds->d5421 * sin(xomi + x2li - g54) + ds->d5433 * sin(-xomi + x2li - g54);
+			xnddt = ds->d2201 * cos(x2omi + xli - g22) + ds->d2211 * cos(xli - g22) +
+				ds->d3210 * cos(xomi + xli - g32) + ds->d3222 * cos(-xomi + xli - g32) +
+				ds->d5220 * cos(xomi + xli - g52) + ds->d5232 * cos(-xomi + xli - g52) +
+				2.0 * (ds->d4410 * cos(x2omi + x2li - g44) + ds->d4422 * cos(x2li - g44) +
+				ds->d5421 * cos(xomi + x2li - g54) + ds->d5433 * cos(-xomi + x2li - g54));
+		}
+		xldot = ds->xni + ds->xfact;
+		xnddt *= xldot;
+		if (fabs(t - ds->atime) < stepp) {
+			ft = t - ds->atime;
+			break;
+		}
+		ds->xli += xldot * delt + xndt * step2;
+		ds->xni += xndt * delt + xnddt * step2;
+		ds->atime += delt;
+	}
+
+	*nm = ds->xni + xndt * ft + xnddt * ft * ft * 0.5;
+	double xl = ds->xli + xldot * ft + xndt * ft * ft * 0.5;
+	double theta = fmod(ds->gsto + t * sgpRptim, sgpTwoPi);
+	if (ds->irez != 1) *mm = xl - 2.0 * *nodem + 2.0 * theta;
+	else *mm = xl - *nodem - *argpm + theta;
+}
+
+// adds the lunar-solar periodics t minutes from epoch to the mean elements,
+// with Lyddane's modification below 0.2 radians inclination (dpper)
+inline void DeepSpacePeriodics(const MySatelliteDeepSpace *ds, double t,
+	double *ep, double *inclp, double *nodep, double *argpp, double *mp)
+{
+	const double zns = 1.19459e-5, zes = 0.01675;
+	const double znl = 1.5835218e-4, zel = 0.05490;
+	const double pi = 0.5 * sgpTwoPi;
+
+	// solar terms
+	double zm = ds->zmos + zns * t;
+	double zf = zm + 2.0 * zes * sin(zm);
+	double sinzf = sin(zf);
+	double f2 = 0.5 * sinzf * sinzf - 0.25;
+	double f3 = -0.5 * sinzf * cos(zf);
+	double ses = ds->se2 * f2 + ds->se3 * f3;
+	double sis = ds->si2 * f2 + ds->si3 * f3;
+	double sls = ds->sl2 * f2 + ds->sl3 * f3 + ds->sl4 * sinzf;
+	double sghs = ds->sgh2 * f2 + ds->sgh3 * f3 + ds->sgh4 * sinzf;
+	double shs = ds->sh2 * f2 + ds->sh3 * f3;
+
+	// lunar terms
+	zm = ds->zmol + znl * t;
+	zf = zm + 2.0 * zel * sin(zm);
+	sinzf = sin(zf);
+	f2 = 0.5 * sinzf * sinzf - 0.25;
+	f3 = -0.5 * sinzf * cos(zf);
+	double sel = ds->ee2 * f2 + ds->e3 * f3;
+	double sil = ds->xi2 * f2 + ds->xi3 * f3;
+	double sll = ds->xl2 * f2 + ds->xl3 * f3 + ds->xl4 * sinzf;
+	double sghl = ds->xgh2 * f2 + ds->xgh3 * f3 + ds->xgh4 * sinzf;
+	double shll = ds->xh2 * f2 + ds->xh3 * f3;
+
+	// the periodics at epoch are zero in Vallado's version, so nothing is
+	// subtracted here
+	double pe = ses + sel;
+	double pinc = sis + sil;
+	double pl = sls + sll;
+	double pgh = sghs + sghl;
+	double ph = shs + shll;
+	*inclp += pinc;
+	*ep += pe;
+	double sinip = sin(*inclp), cosip = cos(*inclp);
+	if (*inclp >= 0.2) {
+		ph /= sinip;
+		pgh -= cosip * ph;
+		*argpp += pgh;
+		*nodep += ph;
+		*mp += pl;
+	}
+	else {
+		double sinop = sin(*nodep), cosop = cos(*nodep);
+		double alfdp = sinip * sinop + ph * cosop + pinc * cosip * sinop;
+		double betdp = sinip * cosop - ph * sinop + pinc * cosip * cosop;
+		*nodep = fmod(*nodep, sgpTwoPi);
+		double xls = *mp + *argpp + cosip * *nodep + pl + pgh - pinc * *nodep * sinip;
+		double xnoh = *nodep;
+		*nodep = atan2(alfdp, betdp);
+		if (fabs(xnoh - *nodep) > pi) *nodep += *nodep < xnoh ? sgpTwoPi : -sgpTwoPi;
+		*mp += pl;
+		*argpp = xls - *mp - cosip * *nodep;
+	}
+}
+
+// initializes the derived constants of satellite k (sgp4init)
+inline void InitializeSatellite(MySatelliteCatalog *cat, int k)
+{
+	const double x2o3 = 2.0 / 3.0;
+	double ecco = cat->ecco[k], inclo = cat->inclo[k], no = cat->no[k];
+	double bstar = cat->bstar[k];
+
+	// recover the original mean motion and semi-major axis
+	double eccsq = ecco * ecco;
+	double omeosq = 1.0 - eccsq;
+	double rteosq = sqrt(omeosq);
+	double cosio = cos(inclo);
+	double cosio2 = cosio * cosio;
+	no = UnKozaiMeanMotion(no, ecco, inclo);
+	cat->no[k] = no;
+
+	double ao = pow(sgpXke / no, x2o3);
+	double sinio = sin(inclo);
+	double po = ao * omeosq;
+	double con42 = 1.0 - 5.0 * cosio2;
+	double con41 = -con42 - cosio2 - cosio2;
+	double posq = po * po;
+	double rp = ao * (1.0 - ecco);
+
+	// perigee below 220 km uses the simplified drag model
+	unsigned char isimp = rp < 220.0 / sgpRe + 1.0;
+
+	// atmospheric density parameter depends on perigee height
+	double sfour = 78.0 / sgpRe + 1.0;
+	double qzms24 = pow((120.0 - 78.0) / sgpRe, 4.0);
+	double perige = (rp - 1.0) * sgpRe;
+	if (perige < 156.0) {
+		sfour = perige - 78.0;
+		if (perige < 98.0) sfour = 20.0;
+		qzms24 = pow((120.0 - sfour) / sgpRe, 4.0);
+		sfour = sfour / sgpRe + 1.0;
+	}
+	double pinvsq = 1.0 / posq;
+
+	double tsi = 1.0 / (ao - sfour);
+	double eta = ao * ecco * tsi;
+	double etasq = eta * eta;
+	double eeta = ecco * eta;
+	double psisq = fabs(1.0 - etasq);
+	double coef = qzms24 * pow(tsi, 4.0);
+	double coef1 = coef / pow(psisq, 3.5);
+	double cc2 = coef1 * no * (ao * (1.0 + 1.5 * etasq + eeta * (4.0 + etasq)) +
+		0.375 * sgpJ2 * tsi / psisq * con41 * (8.0 + 3.0 * etasq * (8.0 + etasq)));
+	double cc1 = bstar * cc2;
+	double cc3 = 0.0;
+	if (ecco > 1.0e-4) cc3 = -2.0 * coef * tsi * sgpJ3oJ2 * no * sinio / ecco;
+	double x1mth2 = 1.0 - cosio2;
+	double cc4 = 2.0 * no * coef1 * ao * omeosq *
+		(eta * (2.0 + 0.5 * etasq) + ecco * (0.5 + 2.0 * etasq) -
+		sgpJ2 * tsi / (ao * psisq) *
+		(-3.0 * con41 * (1.0 - 2.0 * eeta + etasq * (1.5 - 0.5 * eeta)) +
+		0.75 * x1mth2 * (2.0 * etasq - eeta * (1.0 + etasq)) * cos(2.0 * cat->argpo[k])));
+	double cc5 = 2.0 * coef1 * ao * omeosq * (1.0 + 2.75 * (etasq + eeta) + eeta * etasq);
+
+	// secular rates
+	double cosio4 = cosio2 * cosio2;
+	double temp1 = 1.5 * sgpJ2 * pinvsq * no;
+	double temp2 = 0.5 * temp1 * sgpJ2 * pinvsq;
+	double temp3 = -0.46875 * sgpJ4 * pinvsq * pinvsq * no;
+	cat->mdot[k] = no + 0.5 * temp1 * rteosq * con41 +
+		0.0625 * temp2 * rteosq * (13.0 - 78.0 * cosio2 + 137.0 * cosio4);
+	cat->argpdot[k] = -0.5 * temp1 * con42 + 0.0625 * temp2 * (7.0 - 114.0 * cosio2 + 395.0 * cosio4) +
+		temp3 * (3.0 - 36.0 * cosio2 + 49.0 * cosio4);
+	double xhdot1 = -temp1 * cosio;
+	cat->nodedot[k] = xhdot1 + (0.5 * temp2 * (4.0 - 19.0 * cosio2) + 2.0 * temp3 * (3.0 - 7.0 * cosio2)) * cosio;
+
+	cat->omgcof[k] = bstar * cc3 * cos(cat->argpo[k]);
+	cat->xmcof[k] = ecco > 1.0e-4 ? -x2o3 * coef * bstar / eeta : 0.0;
+	cat->nodecf[k] = 3.5 * omeosq * xhdot1 * cc1;
+	cat->t2cof[k] = 1.5 * cc1;
+	double den = fabs(cosio + 1.0) > 1.5e-12 ? 1.0 + cosio : 1.5e-12;
+	cat->xlcof[k] = -0.25 * sgpJ3oJ2 * sinio * (3.0 + 5.0 * cosio) / den;
+	cat->aycof[k] = -0.5 * sgpJ3oJ2 * sinio;
+	cat->delmo[k] = pow(1.0 + eta * cos(cat->mo[k]), 3.0);
+	cat->sinmao[k] = sin(cat->mo[k]);
+	cat->x7thm1[k] = 7.0 * cosio2 - 1.0;
+	cat->con41[k] = con41;
+	cat->x1mth2[k] = x1mth2;
+	cat->eta[k] = eta;
+	cat->cc1[k] = cc1;
+	cat->cc4[k] = cc4;
+	cat->cc5[k] = cc5;
+
+	// deep-space satellites use the simplified drag model and add the SDP4 terms
+	cat->deep[k] = -1;
+	if (sgpTwoPi / no >= 225.0) {
+		isimp = 1;
+		cat->deep[k] = (int)cat->deepSpace.size();
+		cat->deepSpace.push_back(MySatelliteDeepSpace());
+		InitializeDeepSpace(&cat->deepSpace.back(), cat->epoch[k], ecco, inclo, cat->nodeo[k],
+			cat->argpo[k], cat->mo[k], no, cat->mdot[k], cat->argpdot[k], cat->nodedot[k]);
+	}
+	cat->isimp[k] = isimp;
+
+	// higher order drag terms
+	cat->d2[k] = cat->d3[k] = cat->d4[k] = 0.0;
+	cat->t3cof[k] = cat->t4cof[k] = cat->t5cof[k] = 0.0;
+	if (!isimp) {
+		double cc1sq = cc1 * cc1;
+		double d2 = 4.0 * ao * tsi * cc1sq;
+		double temp = d2 * tsi * cc1 / 3.0;
+		double d3 = (17.0 * ao + sfour) * temp;
+		double d4 = 0.5 * temp * ao * tsi * (221.0 * ao + 31.0 * sfour) * cc1;
+		cat->d2[k] = d2;
+		cat->d3[k] = d3;
+		cat->d4[k] = d4;
+		cat->t3cof[k] = d2 + 2.0 * cc1sq;
+		cat->t4cof[k] = 0.25 * (3.0 * d3 + cc1 * (12.0 * d2 + 10.0 * cc1sq));
+		cat->t5cof[k] = 0.2 * (3.0 * d4 + 12.0 * cc1 * d3 + 6.0 * d2 * d2 + 15.0 * cc1sq * (2.0 * d2 + cc1sq));
+	}
+}
+
+// parses a TLE catalog held in memory (with or without name lines),
+// returning the number of satellites read
+inline int ParseTLECatalog(MySatelliteCatalog *cat, const char *text, size_t length)
+{
+	const double deg = 3.14159265358979 / 180.0;
+	const char *end = text + length;
+	const char *line = text;
+	const char *name = 0;
+	int nameLength = 0;
+
+	while (line < end) {
+		const char *next = (const char *)memchr(line, '\n', end - line);
+		next = next ? next + 1 : end;
+
+		// element sets are a line 1 followed by a line 2, anything else is a name
+		if (line[0] == '1' && line[1] == ' ' && next < end && next[0] == '2' && next[1] == ' ' &&
+			next - line >= 69 && end - next >= 68) {
+			const char *l1 = line, *l2 = next;
+			double inclo = ParseTLEField(l2 + 8, 8) * deg;
+			double ecco = ParseTLEField(l2 + 26, 7, true);
+			double no = ParseTLEField(l2 + 52, 11) * sgpTwoPi / 1440.0;	// rev/day -> rad/min
+
+			// epoch: two digit year and fractional day of year
+			int year = (int)ParseTLEField(l1 + 18, 2);
+			year += year < 57 ? 2000 : 1900;
+			double day = ParseTLEField(l1 + 20, 12);
+			int y = year - 1;
+			double jan0 = 1721424.5 + 365.0 * y + y / 4 - y / 100 + y / 400;	// JD of Dec 31
+
+			// element sets without a mean motion are invalid
+			if (no > 0.0) {
+				cat->epoch.push_back(jan0 + day);
+				cat->bstar.push_back(ParseTLEField(l1 + 53, 8, true));
+				cat->inclo.push_back(inclo);
+				cat->nodeo.push_back(ParseTLEField(l2 + 17, 8) * deg);
+				cat->ecco.push_back(ecco);
+				cat->argpo.push_back(ParseTLEField(l2 + 34, 8) * deg);
+				cat->mo.push_back(ParseTLEField(l2 + 43, 8) * deg);
+				cat->no.push_back(no);
+				cat->names.push_back(name ? std::string(name, nameLength) : std::string(l2 + 2, 5));
+			}
+
+			// skip line 2 as well
+			name = 0;
+			next = (const char *)memchr(next, '\n', end - next);
+			next = next ? next + 1 : end;
+		}
+		else {
+			name = line[0] == '0' && line[1] == ' ' ? line + 2 : line;
+			nameLength = (int)(next - name);
+			while (nameLength > 0 && (unsigned char)name[nameLength - 1] <= ' ') nameLength--;
+		}
+		line = next;
+	}
+
+	// derived constants, all arrays sized like the elements
+	int n = cat->count = (int)cat->epoch.size();
+	std::vector<double> *derived[] = { &cat->mdot, &cat->argpdot, &cat->nodedot, &cat->nodecf,
+		&cat->cc1, &cat->cc4, &cat->cc5, &cat->t2cof, &cat->t3cof, &cat->t4cof, &cat->t5cof,
+		&cat->d2, &cat->d3, &cat->d4, &cat->omgcof, &cat->xmcof, &cat->eta, &cat->delmo,
+		&cat->sinmao, &cat->xlcof, &cat->aycof, &cat->con41, &cat->x1mth2, &cat->x7thm1 };
+	for (std::vector<double> *v : derived) v->resize(n);
+	cat->isimp.resize(n);
+	cat->deep.resize(n);
+	for (int k = 0; k < n; k++)
+		InitializeSatellite(cat, k);
+	return n;
+}
+
+// reads and parses a local TLE file, returning the number of satellites read
+inline int LoadTLECatalog(MySatelliteCatalog *cat, const char *filename)
+{
+	FILE *file = fopen(filename, "rb");
+	if (!file) return 0;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	std::vector<char> text(size > 0 ? size : 0);
+	size_t read = size > 0 ? fread(text.data(), 1, size, file) : 0;
+	fclose(file);
+	return ParseTLECatalog(cat, text.data(), read);
+}
+
+// propagates satellites [first, last) to the given Julian date, writing
+// TEME positions in km; decayed or invalid satellites are placed at the origin
+inline void PropagateSatellites(const MySatelliteCatalog *cat, int first, int last,
+	double jd, glm::vec3 *positions)
+{
+	for (int k = first; k < last; k++) {
+		double t = (jd - cat->epoch[k]) * 1440.0;	// minutes since epoch
+
+		// secular gravity and atmospheric drag
+		double xmdf = cat->mo[k] + cat->mdot[k] * t;
+		double argpdf = cat->argpo[k] + cat->argpdot[k] * t;
+		double nodedf = cat->nodeo[k] + cat->nodedot[k] * t;
+		double argpm = argpdf;
+		double mm = xmdf;
+		double t2 = t * t;
+		double nodem = nodedf + cat->nodecf[k] * t2;
+		double tempa = 1.0 - cat->cc1[k] * t;
+		double tempe = cat->bstar[k] * cat->cc4[k] * t;
+		double templ = cat->t2cof[k] * t2;
+
+		if (!cat->isimp[k]) {
+			double delomg = cat->omgcof[k] * t;
+			double delm = 1.0 + cat->eta[k] * cos(xmdf);
+			delm = cat->xmcof[k] * (delm * delm * delm - cat->delmo[k]);
+			double temp = delomg + delm;
+			mm = xmdf + temp;
+			argpm = argpdf - temp;
+			double t3 = t2 * t;
+			double t4 = t3 * t;
+			tempa = tempa - cat->d2[k] * t2 - cat->d3[k] * t3 - cat->d4[k] * t4;
+			tempe = tempe + cat->bstar[k] * cat->cc5[k] * (sin(mm) - cat->sinmao[k]);
+			templ = templ + cat->t3cof[k] * t3 + t4 * (cat->t4cof[k] + t * cat->t5cof[k]);
+		}
+
+		// lunar-solar secular rates and resonances of deep-space satellites
+		double no = cat->no[k];
+		double nm = no, em = cat->ecco[k], inclm = cat->inclo[k];
+		int deep = cat->deep[k];
+		if (deep >= 0) {
+			DeepSpaceSecular(&cat->deepSpace[deep], cat->argpo[k], cat->argpdot[k], no, t,
+				&em, &argpm, &inclm, &mm, &nodem, &nm);
+			if (nm <= 0.0) {
+				positions[k] = glm::vec3(0.0f);
+				continue;
+			}
+		}
+
+		double am = pow(sgpXke / nm, 2.0 / 3.0) * tempa * tempa;
+		em = em - tempe;
+		if (em >= 1.0 || em < -0.001 || am < 0.95) {
+			positions[k] = glm::vec3(0.0f);
+			continue;
+		}
+		if (em < 1.0e-6) em = 1.0e-6;
+		mm = mm + no * templ;
+		double xlm = mm + argpm + nodem;
+		nodem = fmod(nodem, sgpTwoPi);
+		argpm = fmod(argpm, sgpTwoPi);
+		xlm = fmod(xlm, sgpTwoPi);
+		mm = fmod(xlm - argpm - nodem, sgpTwoPi);
+
+		// lunar-solar periodics of deep-space satellites, which also change
+		// the inclination the long and short period terms depend on
+		double ep = em, xincp = inclm, argpp = argpm, nodep = nodem, mp = mm;
+		double aycof = cat->aycof[k], xlcof = cat->xlcof[k];
+		double con41 = cat->con41[k], x1mth2 = cat->x1mth2[k], x7thm1 = cat->x7thm1[k];
+		double sinip = sin(xincp);
+		double cosip = cos(xincp);
+		if (deep >= 0) {
+			DeepSpacePeriodics(&cat->deepSpace[deep], t, &ep, &xincp, &nodep, &argpp, &mp);
+			if (xincp < 0.0) {
+				xincp = -xincp;
+				nodep += 0.5 * sgpTwoPi;
+				argpp -= 0.5 * sgpTwoPi;
+			}
+			if (ep < 0.0 || ep > 1.0) {
+				positions[k] = glm::vec3(0.0f);
+				continue;
+			}
+			sinip = sin(xincp);
+			cosip = cos(xincp);
+			double den = fabs(cosip + 1.0) > 1.5e-12 ? 1.0 + cosip : 1.5e-12;
+			aycof = -0.5 * sgpJ3oJ2 * sinip;
+			xlcof = -0.25 * sgpJ3oJ2 * sinip * (3.0 + 5.0 * cosip) / den;
+			double cosisq = cosip * cosip;
+			con41 = 3.0 * cosisq - 1.0;
+			x1mth2 = 1.0 - cosisq;
+			x7thm1 = 7.0 * cosisq - 1.0;
+		}
+
+		// long period periodics
+		double axnl = ep * cos(argpp);
+		double temp = 1.0 / (am * (1.0 - ep * ep));
+		double aynl = ep * sin(argpp) + temp * aycof;
+		double xl = mp + argpp + nodep + temp * xlcof * axnl;
+
+		// solve Kepler's equation
+		double u = fmod(xl - nodep, sgpTwoPi);
+		double eo1 = u, sineo1 = 0.0, coseo1 = 1.0;
+		double tem5 = 9999.9;
+		for (int ktr = 0; fabs(tem5) >= 1.0e-12 && ktr < 10; ktr++) {
+			sineo1 = sin(eo1);
+			coseo1 = cos(eo1);
+			tem5 = 1.0 - coseo1 * axnl - sineo1 * aynl;
+			tem5 = (u - aynl * coseo1 + axnl * sineo1 - eo1) / tem5;
+			if (fabs(tem5) >= 0.95) tem5 = tem5 > 0.0 ? 0.95 : -0.95;
+			eo1 += tem5;
+		}
+
+		// short period preliminary quantities
+		double ecose = axnl * coseo1 + aynl * sineo1;
+		double esine = axnl * sineo1 - aynl * coseo1;
+		double el2 = axnl * axnl + aynl * aynl;
+		double pl = am * (1.0 - el2);
+		if (pl < 0.0) {
+			positions[k] = glm::vec3(0.0f);
+			continue;
+		}
+		double rl = am * (1.0 - ecose);
+		double betal = sqrt(1.0 - el2);
+		temp = esine / (1.0 + betal);
+		double sinu = am / rl * (sineo1 - aynl - axnl * temp);
+		double cosu = am / rl * (coseo1 - axnl + aynl * temp);
+		double su = atan2(sinu, cosu);
+		double sin2u = (cosu + cosu) * sinu;
+		double cos2u = 1.0 - 2.0 * sinu * sinu;
+		temp = 1.0 / pl;
+		double temp1 = 0.5 * sgpJ2 * temp;
+		double temp2 = temp1 * temp;
+
+		// update for short period periodics
+		double mrt = rl * (1.0 - 1.5 * temp2 * betal * con41) + 0.5 * temp1 * x1mth2 * cos2u;
+		su = su - 0.25 * temp2 * x7thm1 * sin2u;
+		double xnode = nodep + 1.5 * temp2 * cosip * sin2u;
+		double xinc = xincp + 1.5 * temp2 * cosip * sinip * cos2u;
+		if (mrt < 1.0) {
+			positions[k] = glm::vec3(0.0f);	// decayed
+			continue;
+		}
+
+		// orientation vectors
+		double sinsu = sin(su), cossu = cos(su);
+		double snod = sin(xnode), cnod = cos(xnode);
+		double sini = sin(xinc), cosi = cos(xinc);
+		double xmx = -snod * cosi;
+		double xmy = cnod * cosi;
+		double r = mrt * sgpRe;
+		positions[k] = glm::vec3(r * (xmx * sinsu + cnod * cossu),
+			r * (xmy * sinsu + snod * cossu),
+			r * (sini * sinsu));
+	}
+}
+
+#endif
@@ -0,0 +1,35 @@
+#version 410
+
+// SMAA pass 3: blends every pixel with its four neighbours by the weights of
+// the edges between them
+
+out vec4 FragmentColour;
+
+uniform sampler2D source;	// resolved scene
+uniform sampler2D weights;
+uniform vec2 texelSize;
+uniform vec2 sourceMax;		// largest coordinate inside the drawn region
+
+void main(void)
+{
+	vec2 uv = gl_FragCoord.xy * texelSize;
+	vec2 dx = vec2(texelSize.x, 0.0), dy = vec2(0.0, texelSize.y);
+
+	// edges below and left of this pixel, and below the pixel above and left
+	// of the pixel to the right
+	float below = texture(weights, uv).x;
+	float left = texture(weights, uv).y;
+	float above = texture(weights, uv + dy).x;
+	float right = texture(weights, uv + dx).y;
+
+	float total = below + left + above + right;
+	vec3 colour = texture(source, uv).rgb;
+	if (total > 0.0) {
+		float keep = max(0.0, 1.0 - total);
+		float norm = total > 1.0 ? 1.0 / total : 1.0;
+		colour = keep * colour + norm * (below * texture(source, uv - dy).rgb +
+			left * texture(source, uv - dx).rgb + above * texture(source, min(uv + dy, sourceMax)).rgb +
+			right * texture(source, min(uv + dx, sourceMax)).rgb);
+	}
+	FragmentColour = vec4(colour, 1.0);
+}
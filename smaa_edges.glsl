@@ -0,0 +1,23 @@
+#version 410
+
+// SMAA pass 1: luma edges, x against the left neighbour and y against the
+// neighbour below
+
+out vec4 FragmentColour;
+
+uniform sampler2D source;	// resolved scene
+uniform vec2 texelSize;
+
+const float THRESHOLD = 0.1;
+const vec3 LUMA = vec3(0.299, 0.587, 0.114);
+
+void main(void)
+{
+	vec2 uv = gl_FragCoord.xy * texelSize;
+	float luma = dot(texture(source, uv).rgb, LUMA);
+	float left = dot(texture(source, uv - vec2(texelSize.x, 0.0)).rgb, LUMA);
+	float below = dot(texture(source, uv - vec2(0.0, texelSize.y)).rgb, LUMA);
+	vec2 edges = step(vec2(THRESHOLD), abs(vec2(luma - left, luma - below)));
+	if (edges.x + edges.y == 0.0) discard;
+	FragmentColour = vec4(edges, 0.0, 1.0);
+}
@@ -0,0 +1,44 @@
+#version 410
+
+// SMAA pass 2, simplified: instead of the precomputed area texture, the
+// blending weight of an edge falls off linearly from its ends to its middle,
+// over a run found by searching along the edge in both directions
+
+out vec4 FragmentColour;
+
+uniform sampler2D edges;
+uniform vec2 texelSize;
+
+const int MAX_SEARCH = 8;
+
+// weight at a position dl texels from one end and dr from the other
+float coverage(float dl, float dr)
+{
+	float middle = 0.5 * (dl + dr + 1.0);
+	return 0.5 * max(0.0, 1.0 - (min(dl, dr) + 0.5) / middle);
+}
+
+void main(void)
+{
+	vec2 uv = gl_FragCoord.xy * texelSize;
+	vec2 e = texture(edges, uv).xy;
+	vec2 weights = vec2(0.0);
+
+	// horizontal edge below this pixel: run along x
+	if (e.y > 0.0) {
+		float dl = 0.0, dr = 0.0;
+		for (int i = 1; i <= MAX_SEARCH && texture(edges, uv - vec2(i * texelSize.x, 0.0)).y > 0.0; i++) dl++;
+		for (int i = 1; i <= MAX_SEARCH && texture(edges, uv + vec2(i * texelSize.x, 0.0)).y > 0.0; i++) dr++;
+		weights.x = coverage(dl, dr);
+	}
+
+	// vertical edge left of this pixel: run along y
+	if (e.x > 0.0) {
+		float dd = 0.0, du = 0.0;
+		for (int i = 1; i <= MAX_SEARCH && texture(edges, uv - vec2(0.0, i * texelSize.y)).x > 0.0; i++) dd++;
+		for (int i = 1; i <= MAX_SEARCH && texture(edges, uv + vec2(0.0, i * texelSize.y)).x > 0.0; i++) du++;
+		weights.y = coverage(dd, du);
+	}
+
+	FragmentColour = vec4(weights, 0.0, 1.0);
+}
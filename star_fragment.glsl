@@ -0,0 +1,34 @@
+#version 410
+
+out vec4 FragmentColour;
+
+// per-frame uniforms, laid out as MyFrameUniforms in uniforms.h
+layout(std140) uniform Frame
+{
+	mat4 view;
+	mat4 proj;
+	vec3 camPoint;
+	float animation;
+	vec3 light;
+	float logDepth;	// 2 / log2(zFar + 1), used when compiled with LOG_DEPTH
+};
+
+in Star
+{
+	vec3 point;
+	vec3 colour;
+	float size;
+	float logDepthW;
+} star;
+
+void main(void)
+{
+	// round sprite falling off like a blurred point of light
+	vec2 d = gl_PointCoord - vec2(0.5);
+	float r2 = 4.0 * dot(d, d);
+	if (r2 > 1.0) discard;
+	FragmentColour = vec4(star.colour * exp(-3.0 * r2), 1.0);
+#ifdef LOG_DEPTH
+	gl_FragDepth = 0.5 * log2(star.logDepthW) * logDepth;
+#endif
+}
@@ -0,0 +1,67 @@
+#version 410
+
+// catalog stars as point sprites, sized and shaded by their magnitude and
+// coloured by their B-V index; the layout of a star is MyStarRecord in
+// stars.h
+layout(location = 0) in vec3 StarDirection;		// unit vector, equatorial
+layout(location = 1) in vec2 StarMagnitude;		// visual magnitude and B-V, thousandths
+
+// per-frame uniforms, laid out as MyFrameUniforms in uniforms.h
+layout(std140) uniform Frame
+{
+	mat4 view;
+	mat4 proj;
+	vec3 camPoint;
+	float animation;
+	vec3 light;
+	float logDepth;	// 2 / log2(zFar + 1), used when compiled with LOG_DEPTH
+};
+
+// per-draw uniforms, laid out as MyDrawUniforms in uniforms.h; the model
+// places the sky sphere about the camera, and pointSize is the sprite of the
+// brightest stars
+layout(std140) uniform Draw
+{
+	mat4 model;
+	vec3 pointColour;
+	float pointSize;
+};
+
+uniform vec2 limits;	// faintest magnitude drawn, smallest sprite in pixels
+
+// cube_star_geometry.glsl reads the camera-relative point and the sprite
+out Star
+{
+	vec3 point;
+	vec3 colour;
+	float size;
+	float logDepthW;
+} star;
+
+// approximate colour of a black body with the given B-V index
+vec3 StarColour(float bv)
+{
+	vec3 blue = vec3(0.62, 0.72, 1.0), white = vec3(1.0, 0.96, 0.9), red = vec3(1.0, 0.68, 0.42);
+	return bv < 0.6 ? mix(blue, white, clamp((bv + 0.3) / 0.9, 0.0, 1.0)) :
+		mix(white, red, clamp((bv - 0.6) / 1.2, 0.0, 1.0));
+}
+
+void main()
+{
+	// flux relative to a star at the limit: a star at the limit is a dim
+	// sprite of the smallest size, and brighter ones first brighten, then grow
+	float magnitude = 0.001 * StarMagnitude.x;
+	float flux = exp2(1.3287712 * (limits.x - magnitude));	// 10^(0.4 dm)
+	float intensity = clamp(0.25 * flux, 0.0, 1.0);
+	star.colour = pointColour * StarColour(0.001 * StarMagnitude.y) * intensity;
+	star.size = clamp(limits.y * sqrt(0.25 * flux), limits.y, max(pointSize, limits.y));
+
+	vec4 newPos = model * vec4(StarDirection, 1.0);
+	star.point = newPos.xyz;
+	gl_Position = proj * view * newPos;
+	star.logDepthW = 1.0 + gl_Position.w;
+#ifdef LOG_DEPTH
+	gl_Position.z = (log2(max(1e-6, star.logDepthW)) * logDepth - 1.0) * gl_Position.w;
+#endif
+	gl_PointSize = star.size;
+}
@@ -0,0 +1,352 @@
+#ifndef STARS_H
+#define STARS_H
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "culling.h"
+
+// --------------------------------------------------------------------------
+// Star catalog binned by HEALPix cell and magnitude
+//
+// The sky is divided into the 12 * nside^2 equal-area cells of HEALPix in
+// its nested numbering, where cells that are close in number are close on
+// the sky. Stars are sorted by cell and, within a cell, from the brightest
+// to the faintest. For every cell the file keeps a bounding cone and, per
+// magnitude bin, how many of its stars are at least that bright. A magnitude
+// limit then selects a prefix of each cell's range without touching the
+// stars, and a cell outside the view is skipped as a whole.
+//
+// Layout, read in one piece:
+//
+//   MyStarHeader
+//   MyStarCell[cellCount]
+//   MyStarRecord[starCount]
+//
+// Directions are unit vectors in the J2000 equatorial frame stored as
+// normalized 16-bit integers; magnitudes and B-V colour indices are stored
+// in thousandths.
+
+const char starMagic[8] = { 'S', 'S', 'S', 'T', 'A', 'R', '0', '1' };
+const int starMagnitudeBins = 32;
+const float starMagnitudeMin = -2.0f;		// upper edge of the first bin is -1.5
+const float starMagnitudeStep = 0.5f;		// the last bin takes every fainter star
+
+struct MyStarHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t nside;
+	uint32_t cellCount;
+	uint32_t starCount;
+	uint32_t magnitudeBins;
+	float magnitudeMin;
+	float magnitudeStep;
+	uint32_t reserved;
+};
+
+struct MyStarCell
+{
+	float centre[3];		// unit direction of the cone's axis
+	float radius;			// angular radius of the cone, radians
+	uint32_t first;			// index of its brightest star
+	uint32_t brighter[starMagnitudeBins];	// stars brighter than the upper edge of each bin
+};
+
+struct MyStarRecord
+{
+	int16_t magnitude;		// visual, thousandths
+	int16_t colour;			// B-V, thousandths
+	int16_t direction[3];	// unit vector * 32767
+	int16_t reserved;
+};
+
+struct MyStarCatalog
+{
+	MyStarHeader header;
+	std::vector<MyStarCell> cells;
+	std::vector<MyStarRecord> stars;
+
+	MyStarCatalog()
+	{
+		memset(&header, 0, sizeof(header));
+	}
+};
+
+// --------------------------------------------------------------------------
+// HEALPix
+
+// spreads the low 16 bits of v to the even bits
+inline uint32_t HealpixSpread(uint32_t v)
+{
+	v &= 0xffff;
+	v = (v | (v << 8)) & 0x00ff00ff;
+	v = (v | (v << 4)) & 0x0f0f0f0f;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+// nested cell index of a unit direction, with z towards the pole and phi
+// from the x axis; nside is a power of two
+inline uint32_t HealpixNest(uint32_t nside, const glm::dvec3 &direction)
+{
+	const double pi = 3.14159265358979323846;
+	double z = std::min(std::max(direction.z, -1.0), 1.0), za = fabs(z);
+	double phi = atan2(direction.y, direction.x);
+	double tt = fmod(phi * 2.0 / pi + 4.0, 4.0);	// in [0, 4)
+	int n = int(nside), face, ix, iy;
+
+	if (za <= 2.0 / 3.0) {
+		// equatorial region
+		double t1 = n * (0.5 + tt), t2 = n * z * 0.75;
+		int jp = int(t1 - t2), jm = int(t1 + t2);
+		int ifp = jp / n, ifm = jm / n;
+		face = ifp == ifm ? (ifp | 4) : ifp < ifm ? ifp : ifm + 8;
+		ix = jm & (n - 1);
+		iy = n - (jp & (n - 1)) - 1;
+	}
+	else {
+		// polar caps
+		int ntt = std::min(3, int(tt));
+		double tp = tt - ntt, tmp = n * sqrt(3.0 * (1.0 - za));
+		int jp = std::min(int(tp * tmp), n - 1), jm = std::min(int((1.0 - tp) * tmp), n - 1);
+		if (z >= 0.0) {
+			face = ntt;
+			ix = n - jm - 1;
+			iy = n - jp - 1;
+		}
+		else {
+			face = ntt + 8;
+			ix = jp;
+			iy = jm;
+		}
+	}
+	return uint32_t(face) * nside * nside + (HealpixSpread(ix) | (HealpixSpread(iy) << 1));
+}
+
+// --------------------------------------------------------------------------
+// Building a catalog file
+
+inline glm::dvec3 EquatorialDirection(double raDegrees, double decDegrees)
+{
+	const double rad = 3.14159265358979323846 / 180.0;
+	double ra = raDegrees * rad, dec = decDegrees * rad;
+	return glm::dvec3(cos(dec) * cos(ra), cos(dec) * sin(ra), sin(dec));
+}
+
+inline int16_t StarThousandths(double value)
+{
+	return int16_t(std::min(std::max(floor(value * 1000.0 + 0.5), -32768.0), 32767.0));
+}
+
+inline glm::vec3 StarDirection(const MyStarRecord &star)
+{
+	return glm::normalize(glm::vec3(star.direction[0], star.direction[1], star.direction[2]));
+}
+
+// reads a text table of stars, RA and Dec in degrees (J2000), visual
+// magnitude and B-V in the first columns, separated by commas, semicolons,
+// bars or white space; lines that do not start with a number (headers,
+// comments) are skipped, and a missing colour is taken as solar. Returns the
+// number of stars read
+inline int ReadStarTable(const char *filename, std::vector<MyStarRecord> *stars)
+{
+	FILE *file = fopen(filename, "r");
+	if (!file) return 0;
+	char line[4096];
+	int count = 0;
+	while (fgets(line, sizeof(line), file)) {
+		double values[4] = { 0.0, 0.0, 0.0, 0.65 };
+		int n = 0;
+		char *p = line;
+		while (n < 4) {
+			while (*p == ' ' || *p == '\t') p++;
+			char *end;
+			double v = strtod(p, &end);
+			if (end == p) break;
+			values[n++] = v;
+			p = end;
+			while (*p == ' ' || *p == '\t') p++;
+			if (*p == ',' || *p == ';' || *p == '|') p++;
+		}
+		if (n < 3) continue;
+
+		glm::dvec3 d = EquatorialDirection(values[0], values[1]);
+		MyStarRecord star;
+		star.magnitude = StarThousandths(values[2]);
+		star.colour = StarThousandths(values[3]);
+		for (int k = 0; k < 3; k++)
+			star.direction[k] = int16_t(floor(d[k] * 32767.0 + 0.5));
+		star.reserved = 0;
+		stars->push_back(star);
+		count++;
+	}
+	fclose(file);
+	return count;
+}
+
+inline int StarMagnitudeBin(float magnitude)
+{
+	int bin = int(floor((magnitude - starMagnitudeMin) / starMagnitudeStep));
+	return std::min(std::max(bin, 0), starMagnitudeBins - 1);
+}
+
+// bins the stars, sorting them by cell and brightness, and writes the
+// catalog, returning true if successful
+inline bool WriteStarFile(const char *filename, std::vector<MyStarRecord> &stars, uint32_t nside)
+{
+	uint32_t cellCount = 12 * nside * nside;
+	std::vector<std::pair<uint64_t, uint32_t> > order(stars.size());
+	for (size_t k = 0; k < stars.size(); k++) {
+		uint32_t cell = HealpixNest(nside, glm::dvec3(StarDirection(stars[k])));
+		order[k] = std::make_pair((uint64_t(cell) << 32) | uint32_t(stars[k].magnitude + 32768), uint32_t(k));
+	}
+	std::sort(order.begin(), order.end());
+	std::vector<MyStarRecord> sorted(stars.size());
+	std::vector<uint32_t> cellOf(stars.size());
+	for (size_t k = 0; k < order.size(); k++) {
+		sorted[k] = stars[order[k].second];
+		cellOf[k] = uint32_t(order[k].first >> 32);
+	}
+	stars.swap(sorted);
+
+	// cones about the mean direction of each cell's stars
+	std::vector<MyStarCell> cells(cellCount);
+	memset(cells.data(), 0, cells.size() * sizeof(MyStarCell));
+	size_t k = 0;
+	for (uint32_t c = 0; c < cellCount; c++) {
+		MyStarCell &cell = cells[c];
+		cell.first = uint32_t(k);
+		size_t end = k;
+		glm::vec3 sum(0.0f);
+		while (end < stars.size() && cellOf[end] == c) sum += StarDirection(stars[end++]);
+		glm::vec3 centre = end > k ? glm::normalize(sum) : glm::vec3(0.0f, 0.0f, 1.0f);
+		float minCos = 1.0f;
+		int counts[starMagnitudeBins] = { 0 };
+		for (size_t s = k; s < end; s++) {
+			minCos = std::min(minCos, glm::dot(centre, StarDirection(stars[s])));
+			counts[StarMagnitudeBin(0.001f * stars[s].magnitude)]++;
+		}
+		for (int b = 0; b < 3; b++) cell.centre[b] = centre[b];
+		cell.radius = acos(std::max(-1.0f, minCos)) + 1.0e-4f;
+		uint32_t total = 0;
+		for (int b = 0; b < starMagnitudeBins; b++) {
+			total += counts[b];
+			cell.brighter[b] = total;
+		}
+		k = end;
+	}
+
+	MyStarHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, starMagic, sizeof(header.magic));
+	header.version = 1;
+	header.nside = nside;
+	header.cellCount = cellCount;
+	header.starCount = uint32_t(stars.size());
+	header.magnitudeBins = starMagnitudeBins;
+	header.magnitudeMin = starMagnitudeMin;
+	header.magnitudeStep = starMagnitudeStep;
+
+	FILE *file = fopen(filename, "wb");
+	if (!file) return false;
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(cells.data(), sizeof(MyStarCell), cells.size(), file) == cells.size() &&
+		fwrite(stars.data(), sizeof(MyStarRecord), stars.size(), file) == stars.size();
+	return fclose(file) == 0 && ok;
+}
+
+// --------------------------------------------------------------------------
+// Loading and culling
+
+// reads and validates a catalog file, returning true if successful
+inline bool LoadStarCatalog(MyStarCatalog *catalog, const char *filename)
+{
+	FILE *file = fopen(filename, "rb");
+	if (!file) return false;
+	MyStarHeader &h = catalog->header;
+	bool ok = fread(&h, sizeof(h), 1, file) == 1 && memcmp(h.magic, starMagic, sizeof(starMagic)) == 0 &&
+		h.version == 1 && h.magnitudeBins == starMagnitudeBins && h.magnitudeMin == starMagnitudeMin &&
+		h.magnitudeStep == starMagnitudeStep && h.nside > 0 && h.cellCount == 12 * h.nside * h.nside;
+	if (ok) {
+		catalog->cells.resize(h.cellCount);
+		catalog->stars.resize(h.starCount);
+		ok = fread(catalog->cells.data(), sizeof(MyStarCell), h.cellCount, file) == h.cellCount &&
+			fread(catalog->stars.data(), sizeof(MyStarRecord), h.starCount, file) == h.starCount;
+	}
+	for (uint32_t c = 0; ok && c < h.cellCount; c++)
+		ok = catalog->cells[c].first + catalog->cells[c].brighter[starMagnitudeBins - 1] <= h.starCount;
+	fclose(file);
+	if (!ok) *catalog = MyStarCatalog();
+	return ok;
+}
+
+// ranges of the stars brighter than the magnitude limit in the cells that
+// pass the frustum and occlusion tests. model takes catalog directions to
+// the camera-relative scene with the stars at the given distance, so a cell
+// is tested as the sphere about its patch of sky at that distance
+inline MyDrawRanges CullStarCells(MyFrameArena *arena, const MyFrustum &frustum, const MyOccluder *occluders,
+	int occluderCount, const glm::vec3 &eye, const glm::mat4 &model, float distance,
+	const MyStarCatalog *catalog, float magnitudeLimit, MyCullStats *stats)
+{
+	MyDrawRanges draw;
+	int count = int(catalog->cells.size());
+	draw.first = ArenaArray<int>(arena, count);
+	draw.count = ArenaArray<int>(arena, count);
+	if (!draw.first || !draw.count) {
+		// out of frame memory: draw everything
+		draw.all = true;
+		stats->pointsDrawn += catalog->stars.size();
+		return draw;
+	}
+
+	// the last bin whose upper edge is within the limit
+	int bin = int(ceil((magnitudeLimit - starMagnitudeMin) / starMagnitudeStep)) - 1;
+	if (bin < 0) return draw;
+	bin = std::min(bin, starMagnitudeBins - 1);
+	int previousEnd = -1;
+	for (int c = 0; c < count; c++) {
+		const MyStarCell &cell = catalog->cells[c];
+		int n = int(cell.brighter[bin]);
+		if (n == 0) continue;
+		glm::vec3 axis(cell.centre[0], cell.centre[1], cell.centre[2]);
+		glm::vec3 centre(model * glm::vec4(axis, 0.0f));
+		float radius = 2.0f * distance * sin(0.5f * std::min(cell.radius, 3.14159265f));
+		bool visible = SphereVisible(frustum, centre, radius);
+		bool occluded = visible && SphereOccluded(occluders, occluderCount, eye, centre, radius);
+		if (visible && !occluded) {
+			// a range continues where the previous cell's whole range ended
+			if (previousEnd == int(cell.first)) draw.count[draw.ranges - 1] += n;
+			else {
+				draw.first[draw.ranges] = cell.first;
+				draw.count[draw.ranges] = n;
+				draw.ranges++;
+			}
+			previousEnd = n == int(cell.brighter[starMagnitudeBins - 1]) ? int(cell.first) + n : -1;
+			stats->chunksDrawn++;
+			stats->pointsDrawn += n;
+		}
+		else {
+			previousEnd = -1;
+			if (occluded) {
+				stats->chunksOccluded++;
+				stats->pointsOccluded += n;
+			}
+			else {
+				stats->chunksCulled++;
+				stats->pointsCulled += n;
+			}
+			stats->verticesSaved += n;
+		}
+	}
+	return draw;
+}
+
+#endif
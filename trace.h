@@ -0,0 +1,949 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <initializer_list>
+
+// OpenGL core profile, as set up by main.cpp
+#ifndef LAB_LINUX
+#include <glad/glad.h>
+#else
+#define GLFW_INCLUDE_GLCOREARB
+#define GL_GLEXT_PROTOTYPES
+#endif
+#include <GLFW/glfw3.h>
+
+#include "benchmark.h"
+
+// --------------------------------------------------------------------------
+// Binary trace of OpenGL commands
+//
+// A trace is a header followed by records. Each record is an opcode, the
+// size of its payload and the payload itself. Payloads are 32-bit values,
+// length-prefixed strings and byte blocks, all little endian as written by
+// the recording machine. Objects are not named by their OpenGL names.
+// They are named by handles: indices into a list of definitions at the
+// start of the trace, which say how to recreate each object (a shader
+// program from its files, a texture of a given size, a buffer whose contents
+// follow). A replay can then run without the application that recorded it.
+//
+// Layout: setup records (definitions, static buffer contents, program and
+// binding state), then for every frame TRACE_FRAME_BEGIN, the contents of
+// dynamic buffers, the commands and TRACE_FRAME_END.
+
+const uint32_t traceMagic = 0x52544c47;	// "GLTR"
+const uint32_t traceVersion = 2;
+
+enum TraceOp
+{
+	// definitions, handles are assigned in order
+	TRACE_DEFINE_PROGRAM,		// vertex file, fragment file, LOG_DEPTH defined
+	TRACE_DEFINE_TEXTURE_FILE,	// target, file
+	TRACE_DEFINE_TEXTURE,		// internal format, width, height
+	TRACE_DEFINE_RENDERBUFFER,	// samples, internal format, width, height
+	TRACE_DEFINE_FRAMEBUFFER,	// colour texture, colour renderbuffer, depth renderbuffer
+	TRACE_DEFINE_BUFFER,		// size (contents follow as TRACE_BUFFER_DATA)
+	TRACE_DEFINE_VERTEX_ARRAY,	// element buffer, count, then (index, buffer, components) each
+
+	// state outside the frame
+	TRACE_BLOCK_BINDING,		// program, block name, binding
+	TRACE_UNIFORM_1I,			// program, name, value
+	TRACE_UNIFORM_2F,			// program, name, x, y
+
+	// frame commands
+	TRACE_FRAME_BEGIN,
+	TRACE_FRAME_END,
+	TRACE_BUFFER_DATA,			// buffer, offset, bytes (from offset 0, the whole buffer)
+	TRACE_USE_PROGRAM,			// program
+	TRACE_BIND_VERTEX_ARRAY,	// vertex array
+	TRACE_BIND_TEXTURE,			// unit, target, texture
+	TRACE_BIND_FRAMEBUFFER,		// target, framebuffer
+	TRACE_BIND_UNIFORM_RANGE,	// binding, buffer, offset, size
+	TRACE_CAPABILITY,			// capability, enabled
+	TRACE_POLYGON_MODE,			// mode
+	TRACE_VIEWPORT,				// x, y, width, height
+	TRACE_CLEAR,				// mask, r, g, b, a
+	TRACE_DRAW_ARRAYS,			// mode, first, count
+	TRACE_DRAW_ELEMENTS,		// mode, count, type, offset
+	TRACE_MULTI_DRAW_ARRAYS,	// mode, ranges, then (first, count) each
+	TRACE_BLIT,					// source rect, destination rect, mask, filter
+
+	TRACE_OPS
+};
+
+const int32_t traceNoHandle = -1;	// the default object (OpenGL name 0)
+
+struct MyTraceHeader
+{
+	uint32_t magic;
+	uint32_t version;
+};
+
+// --------------------------------------------------------------------------
+// Writing
+
+struct MyTraceWriter
+{
+	std::vector<unsigned char> bytes;
+	size_t record;		// start of the open record
+	int frames;
+
+	MyTraceWriter() : record(0), frames(0)
+	{}
+};
+
+inline void TracePut(MyTraceWriter *w, const void *data, size_t size)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	w->bytes.insert(w->bytes.end(), p, p + size);
+}
+
+inline void TracePutInt(MyTraceWriter *w, int32_t v) { TracePut(w, &v, sizeof(v)); }
+inline void TracePutFloat(MyTraceWriter *w, float v) { TracePut(w, &v, sizeof(v)); }
+
+inline void TracePutString(MyTraceWriter *w, const char *s)
+{
+	int32_t n = (int32_t)strlen(s);
+	TracePutInt(w, n);
+	TracePut(w, s, n);
+}
+
+inline void TracePutBlock(MyTraceWriter *w, const void *data, size_t size)
+{
+	TracePutInt(w, (int32_t)size);
+	TracePut(w, data, size);
+}
+
+// opens a record; its size is filled in by TraceEnd
+inline void TraceBegin(MyTraceWriter *w, TraceOp op)
+{
+	uint16_t code = (uint16_t)op;
+	TracePut(w, &code, sizeof(code));
+	w->record = w->bytes.size();
+	uint32_t size = 0;
+	TracePut(w, &size, sizeof(size));
+}
+
+inline void TraceEnd(MyTraceWriter *w)
+{
+	uint32_t size = uint32_t(w->bytes.size() - w->record - sizeof(uint32_t));
+	memcpy(&w->bytes[w->record], &size, sizeof(size));
+}
+
+// records an operation with integer arguments
+inline void TraceInts(MyTraceWriter *w, TraceOp op, int n, const int32_t *args)
+{
+	TraceBegin(w, op);
+	TracePut(w, args, n * sizeof(int32_t));
+	TraceEnd(w);
+}
+
+inline bool WriteTraceFile(const char *filename, const MyTraceWriter *w)
+{
+	FILE *file = fopen(filename, "wb");
+	if (!file) return false;
+	MyTraceHeader header = { traceMagic, traceVersion };
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(w->bytes.data(), 1, w->bytes.size(), file) == w->bytes.size();
+	return fclose(file) == 0 && ok;
+}
+
+// --------------------------------------------------------------------------
+// Reading
+
+struct MyTraceRecord
+{
+	TraceOp op;
+	const unsigned char *data;
+	uint32_t size;
+	uint32_t read;		// bytes consumed by the getters
+};
+
+inline bool ReadTraceFile(const char *filename, std::vector<unsigned char> *bytes)
+{
+	FILE *file = fopen(filename, "rb");
+	if (!file) return false;
+	MyTraceHeader header;
+	bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+		header.magic == traceMagic && header.version == traceVersion;
+	if (ok) {
+		unsigned char chunk[65536];
+		size_t n;
+		while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+			bytes->insert(bytes->end(), chunk, chunk + n);
+	}
+	fclose(file);
+	return ok;
+}
+
+// next record at *offset, advancing it; returns false at the end or on a
+// truncated record
+inline bool NextTraceRecord(const std::vector<unsigned char> &bytes, size_t *offset, MyTraceRecord *record)
+{
+	const size_t head = sizeof(uint16_t) + sizeof(uint32_t);
+	if (*offset + head > bytes.size()) return false;
+	uint16_t code;
+	memcpy(&code, &bytes[*offset], sizeof(code));
+	memcpy(&record->size, &bytes[*offset + sizeof(code)], sizeof(record->size));
+	if (code >= TRACE_OPS || *offset + head + record->size > bytes.size()) return false;
+	record->op = (TraceOp)code;
+	record->data = bytes.data() + *offset + head;
+	record->read = 0;
+	*offset += head + record->size;
+	return true;
+}
+
+inline int32_t TraceGetInt(MyTraceRecord *r)
+{
+	int32_t v = 0;
+	if (r->read + sizeof(v) <= r->size) memcpy(&v, r->data + r->read, sizeof(v));
+	r->read += sizeof(v);
+	return v;
+}
+
+inline float TraceGetFloat(MyTraceRecord *r)
+{
+	float v = 0.0f;
+	if (r->read + sizeof(v) <= r->size) memcpy(&v, r->data + r->read, sizeof(v));
+	r->read += sizeof(v);
+	return v;
+}
+
+// points at a length-prefixed block inside the record
+inline const unsigned char *TraceGetBlock(MyTraceRecord *r, int32_t *size)
+{
+	*size = TraceGetInt(r);
+	if (*size < 0 || r->read + *size > r->size) {
+		*size = 0;
+		return 0;
+	}
+	const unsigned char *p = r->data + r->read;
+	r->read += *size;
+	return p;
+}
+
+inline std::string TraceGetString(MyTraceRecord *r)
+{
+	int32_t n;
+	const unsigned char *p = TraceGetBlock(r, &n);
+	return p ? std::string((const char *)p, n) : std::string();
+}
+
+// --------------------------------------------------------------------------
+// Recording
+//
+// Objects the frame uses are registered as they are created. Registration
+// records how to recreate the object, and later lookups turn OpenGL names
+// into trace handles. A capture writes the definitions and the contents of
+// static buffers once. It also writes the uniform block bindings and sampler
+// uniforms of every program, since those are set outside the frame. Then for
+// each frame it writes the contents of the dynamic point buffers and every
+// command issued through the wrappers below, with the uniform blocks the
+// frame wrote into the ring. The state cache is invalidated when a frame
+// starts, so the frame's first binds are recorded even if they were already
+// in place. Work before the frame (GPU propagation, uploads) is captured
+// through the buffer contents rather than as commands.
+//
+// Handles are indices into the registered objects, so a deleted object's
+// slot is kept as forgotten rather than erased, and the slots are only
+// compacted when a capture writes its setup. Objects registered while a
+// capture is open (a render target recreated by the A key) are defined as
+// they are registered, and the state of such programs is written at the
+// next frame boundary. Programs with a geometry stage can not be defined in
+// a trace, so no capture starts while one exists.
+//
+// This part and the replay below use OpenGL. main.cpp includes this file
+// after its prototypes: the shader and texture types with their functions,
+// InvalidateGLState and CheckGLErrors, and the logDepth option.
+
+enum TraceObjectType { TRACE_OBJECT_PROGRAM, TRACE_OBJECT_TEXTURE, TRACE_OBJECT_RENDERBUFFER,
+	TRACE_OBJECT_FRAMEBUFFER, TRACE_OBJECT_BUFFER, TRACE_OBJECT_VERTEX_ARRAY, TRACE_OBJECT_FORGOTTEN };
+
+// what a capture saves of a buffer's contents
+enum TraceContents { TRACE_CONTENTS_NONE, TRACE_CONTENTS_ONCE, TRACE_CONTENTS_EVERY_FRAME };
+
+struct MyTraceObject
+{
+	TraceObjectType type;
+	TraceOp define;
+	GLuint  name;
+	std::string files[2];		// shader files, or a texture file
+	GLuint  args[4];			// sizes and formats, or attached object names
+	TraceContents contents;		// buffers
+	std::vector<GLuint> attributes;	// vertex arrays: (index, buffer, components) each
+
+	MyTraceObject() : type(TRACE_OBJECT_PROGRAM), define(TRACE_DEFINE_PROGRAM), name(0),
+		contents(TRACE_CONTENTS_NONE)
+	{
+		for (int k = 0; k < 4; k++) args[k] = 0;
+	}
+};
+
+struct MyTraceRecorder
+{
+	std::vector<MyTraceObject> objects;	// index is the handle
+	std::vector<int32_t> latePrograms;	// defined during the capture, state not yet written
+	MyTraceWriter writer;
+	const char *filename;
+	int     framesLeft;				// frames still to capture
+	int     untracedPrograms;		// live programs with a geometry stage
+	bool    open;					// setup written, the file not yet
+	bool    recording;				// inside a captured frame
+
+	MyTraceRecorder() : filename("frame.trace"), framesLeft(0), untracedPrograms(0), open(false),
+		recording(false)
+	{}
+};
+
+MyTraceRecorder tracer;
+int traceFrames = 1;		// frames per capture
+const char *traceFile = 0;	// captured once warmed up, set by --trace
+int traceWarmupFrames = 120;
+const char *replayFile = 0;	// replayed instead of running the application
+int replayIterations = 1000;
+
+// handle of an object, or traceNoHandle for name 0 and unregistered names
+inline int32_t TraceHandle(TraceObjectType type, GLuint name)
+{
+	if (name == 0) return traceNoHandle;
+	for (size_t k = 0; k < tracer.objects.size(); k++)
+		if (tracer.objects[k].type == type && tracer.objects[k].name == name) return int32_t(k);
+	return traceNoHandle;
+}
+
+// marks a deleted object's slot as forgotten, so that its name is not traced
+// as a live one while later handles keep their index
+inline void TraceForget(TraceObjectType type, GLuint name)
+{
+	int32_t handle = TraceHandle(type, name);
+	if (handle == traceNoHandle) return;
+	tracer.objects[handle] = MyTraceObject();
+	tracer.objects[handle].type = TRACE_OBJECT_FORGOTTEN;
+}
+
+// entry for an object, reset if its name was registered before (names of
+// deleted objects are reused); one already defined in the open capture keeps
+// its definition, so the name moves to a new handle
+inline MyTraceObject *TraceRegister(TraceObjectType type, TraceOp define, GLuint name)
+{
+	int32_t handle = TraceHandle(type, name);
+	if (handle != traceNoHandle && tracer.open) {
+		TraceForget(type, name);
+		handle = traceNoHandle;
+	}
+	if (handle == traceNoHandle) {
+		handle = int32_t(tracer.objects.size());
+		tracer.objects.push_back(MyTraceObject());
+	}
+	MyTraceObject &object = tracer.objects[handle];
+	object = MyTraceObject();
+	object.type = type;
+	object.define = define;
+	object.name = name;
+	return &object;
+}
+
+inline void TraceDefineLate(const MyTraceObject *o);
+
+// a program built from two files, with LOG_DEPTH defined or not
+inline void TraceProgram(GLuint program, const char *vertexFile, const char *fragmentFile, bool logDepthDefined)
+{
+	MyTraceObject *o = TraceRegister(TRACE_OBJECT_PROGRAM, TRACE_DEFINE_PROGRAM, program);
+	o->files[0] = vertexFile;
+	o->files[1] = fragmentFile;
+	o->args[0] = logDepthDefined;
+	TraceDefineLate(o);
+}
+
+inline void TraceTextureFile(GLuint texture, GLenum target, const char *file)
+{
+	MyTraceObject *o = TraceRegister(TRACE_OBJECT_TEXTURE, TRACE_DEFINE_TEXTURE_FILE, texture);
+	o->files[0] = file;
+	o->args[0] = target;
+	TraceDefineLate(o);
+}
+
+inline void TraceTexture(GLuint texture, GLenum format, int width, int height)
+{
+	MyTraceObject *o = TraceRegister(TRACE_OBJECT_TEXTURE, TRACE_DEFINE_TEXTURE, texture);
+	o->args[0] = format;
+	o->args[1] = width;
+	o->args[2] = height;
+	TraceDefineLate(o);
+}
+
+inline void TraceRenderbuffer(GLuint renderbuffer, int samples, GLenum format, int width, int height)
+{
+	MyTraceObject *o = TraceRegister(TRACE_OBJECT_RENDERBUFFER, TRACE_DEFINE_RENDERBUFFER, renderbuffer);
+	o->args[0] = samples;
+	o->args[1] = format;
+	o->args[2] = width;
+	o->args[3] = height;
+	TraceDefineLate(o);
+}
+
+// a framebuffer with a colour texture or renderbuffer and an optional depth
+// renderbuffer, all registered before it
+inline void TraceFramebuffer(GLuint framebuffer, GLuint colourTexture, GLuint colourRenderbuffer, GLuint depthRenderbuffer)
+{
+	MyTraceObject *o = TraceRegister(TRACE_OBJECT_FRAMEBUFFER, TRACE_DEFINE_FRAMEBUFFER, framebuffer);
+	o->args[0] = colourTexture;
+	o->args[1] = colourRenderbuffer;
+	o->args[2] = depthRenderbuffer;
+	TraceDefineLate(o);
+}
+
+inline void TraceBuffer(GLuint buffer, TraceContents contents)
+{
+	MyTraceObject *o = TraceRegister(TRACE_OBJECT_BUFFER, TRACE_DEFINE_BUFFER, buffer);
+	o->contents = contents;
+	TraceDefineLate(o);
+}
+
+// a vertex array of float attributes, tightly packed, one buffer each
+inline void TraceVertexArray(GLuint vertexArray, GLuint elementBuffer, const GLuint *attributes, int count)
+{
+	MyTraceObject *o = TraceRegister(TRACE_OBJECT_VERTEX_ARRAY, TRACE_DEFINE_VERTEX_ARRAY, vertexArray);
+	o->args[0] = elementBuffer;
+	o->attributes.assign(attributes, attributes + 3 * count);
+	TraceDefineLate(o);
+}
+
+// a point set: positions rewritten every frame, three floats per point
+inline void TracePointArray(GLuint vertexArray, GLuint positionBuffer)
+{
+	TraceBuffer(positionBuffer, TRACE_CONTENTS_EVERY_FRAME);
+	const GLuint attributes[3] = { 0, positionBuffer, 3 };
+	TraceVertexArray(vertexArray, 0, attributes, 1);
+}
+
+// records a command with integer arguments while a frame is captured
+inline void TraceCall(TraceOp op, std::initializer_list<int32_t> args)
+{
+	if (!tracer.recording) return;
+	TraceInts(&tracer.writer, op, int(args.size()), args.begin());
+}
+
+// records the contents of a buffer, read back from the GPU
+inline void TraceBufferContents(int32_t handle)
+{
+	MyTraceWriter *w = &tracer.writer;
+	glBindBuffer(GL_COPY_READ_BUFFER, tracer.objects[handle].name);
+	GLint size = 0;
+	glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &size);
+	TraceBegin(w, TRACE_BUFFER_DATA);
+	TracePutInt(w, handle);
+	TracePutInt(w, 0);
+	TracePutInt(w, size);
+	size_t at = w->bytes.size();
+	w->bytes.resize(at + size);
+	if (size > 0) glGetBufferSubData(GL_COPY_READ_BUFFER, 0, size, &w->bytes[at]);
+	TraceEnd(w);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+}
+
+// writes the definition of an object, and the contents of a static buffer
+inline void TraceDefinition(int32_t handle)
+{
+	MyTraceWriter *w = &tracer.writer;
+	const MyTraceObject &o = tracer.objects[handle];
+	TraceBegin(w, o.define);
+	switch (o.define) {
+	case TRACE_DEFINE_PROGRAM:
+		TracePutString(w, o.files[0].c_str());
+		TracePutString(w, o.files[1].c_str());
+		TracePutInt(w, o.args[0]);
+		break;
+	case TRACE_DEFINE_TEXTURE_FILE:
+		TracePutInt(w, o.args[0]);
+		TracePutString(w, o.files[0].c_str());
+		break;
+	case TRACE_DEFINE_TEXTURE:
+		for (int a = 0; a < 3; a++) TracePutInt(w, o.args[a]);
+		break;
+	case TRACE_DEFINE_RENDERBUFFER:
+		for (int a = 0; a < 4; a++) TracePutInt(w, o.args[a]);
+		break;
+	case TRACE_DEFINE_FRAMEBUFFER:
+		TracePutInt(w, TraceHandle(TRACE_OBJECT_TEXTURE, o.args[0]));
+		TracePutInt(w, TraceHandle(TRACE_OBJECT_RENDERBUFFER, o.args[1]));
+		TracePutInt(w, TraceHandle(TRACE_OBJECT_RENDERBUFFER, o.args[2]));
+		break;
+	case TRACE_DEFINE_BUFFER: {
+		GLint size = 0;
+		glBindBuffer(GL_COPY_READ_BUFFER, o.name);
+		glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &size);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		TracePutInt(w, size);
+		break;
+	}
+	case TRACE_DEFINE_VERTEX_ARRAY:
+		TracePutInt(w, TraceHandle(TRACE_OBJECT_BUFFER, o.args[0]));
+		TracePutInt(w, int32_t(o.attributes.size() / 3));
+		for (size_t a = 0; a < o.attributes.size(); a += 3) {
+			TracePutInt(w, o.attributes[a]);
+			TracePutInt(w, TraceHandle(TRACE_OBJECT_BUFFER, o.attributes[a + 1]));
+			TracePutInt(w, o.attributes[a + 2]);
+		}
+		break;
+	default:
+		break;
+	}
+	TraceEnd(w);
+	if (o.type == TRACE_OBJECT_BUFFER && o.contents == TRACE_CONTENTS_ONCE)
+		TraceBufferContents(handle);
+}
+
+// writes the uniform block bindings and sampler units of a program
+inline void TraceProgramState(int32_t handle)
+{
+	MyTraceWriter *w = &tracer.writer;
+	GLuint program = tracer.objects[handle].name;
+	GLint blocks = 0, uniforms = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &blocks);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &uniforms);
+	char name[256];
+	for (GLint b = 0; b < blocks; b++) {
+		GLint binding = 0;
+		glGetActiveUniformBlockName(program, b, sizeof(name), 0, name);
+		glGetActiveUniformBlockiv(program, b, GL_UNIFORM_BLOCK_BINDING, &binding);
+		TraceBegin(w, TRACE_BLOCK_BINDING);
+		TracePutInt(w, handle);
+		TracePutString(w, name);
+		TracePutInt(w, binding);
+		TraceEnd(w);
+	}
+	for (GLint u = 0; u < uniforms; u++) {
+		GLint size = 0, unit = 0;
+		GLenum type = 0;
+		glGetActiveUniform(program, u, sizeof(name), 0, &size, &type, name);
+		if (type != GL_SAMPLER_2D && type != GL_SAMPLER_CUBE) continue;
+		glGetUniformiv(program, glGetUniformLocation(program, name), &unit);
+		TraceBegin(w, TRACE_UNIFORM_1I);
+		TracePutInt(w, handle);
+		TracePutString(w, name);
+		TracePutInt(w, unit);
+		TraceEnd(w);
+	}
+}
+
+// defines an object registered while a capture is open; a program's state
+// is set after it is registered, so it waits for the next frame boundary
+inline void TraceDefineLate(const MyTraceObject *o)
+{
+	if (!tracer.open) return;
+	int32_t handle = int32_t(o - tracer.objects.data());
+	TraceDefinition(handle);
+	if (o->type == TRACE_OBJECT_PROGRAM) tracer.latePrograms.push_back(handle);
+}
+
+// writes the state of the programs defined since the last frame boundary
+// that are still alive
+inline void TraceLateProgramState()
+{
+	for (int32_t handle : tracer.latePrograms)
+		if (tracer.objects[handle].type == TRACE_OBJECT_PROGRAM) TraceProgramState(handle);
+	tracer.latePrograms.clear();
+}
+
+// definitions, static contents and the state set up outside the frame; the
+// slots of deleted objects are dropped first, as no handle is written yet
+inline void TraceSetup()
+{
+	std::vector<MyTraceObject> &objects = tracer.objects;
+	objects.erase(std::remove_if(objects.begin(), objects.end(),
+		[](const MyTraceObject &o) { return o.type == TRACE_OBJECT_FORGOTTEN; }), objects.end());
+	for (size_t k = 0; k < objects.size(); k++)
+		TraceDefinition(int32_t(k));
+	for (size_t k = 0; k < objects.size(); k++)
+		if (objects[k].type == TRACE_OBJECT_PROGRAM) TraceProgramState(int32_t(k));
+
+	// uniform buffers bound outside the frame, whole (size 0) or as ranges
+	MyTraceWriter *w = &tracer.writer;
+	GLint bindings = 0;
+	glGetIntegerv(GL_MAX_UNIFORM_BUFFER_BINDINGS, &bindings);
+	for (GLuint b = 0; b < GLuint(bindings); b++) {
+		GLint buffer = 0;
+		GLint64 offset = 0, size = 0;
+		glGetIntegeri_v(GL_UNIFORM_BUFFER_BINDING, b, &buffer);
+		glGetInteger64i_v(GL_UNIFORM_BUFFER_START, b, &offset);
+		glGetInteger64i_v(GL_UNIFORM_BUFFER_SIZE, b, &size);
+		int32_t args[4] = { int32_t(b), TraceHandle(TRACE_OBJECT_BUFFER, buffer), int32_t(offset), int32_t(size) };
+		if (args[1] != traceNoHandle) TraceInts(w, TRACE_BIND_UNIFORM_RANGE, 4, args);
+	}
+}
+
+// starts capturing the next frames into a file
+inline void StartTrace(const char *filename, int frames)
+{
+	if (tracer.framesLeft > 0) return;
+	if (tracer.untracedPrograms > 0) {
+		std::cout << "ERROR: Layered panorama programs can not be traced, use --panorama-passes 6 to capture "
+			<< "a panorama" << std::endl;
+		return;
+	}
+	tracer.filename = filename;
+	tracer.framesLeft = frames;
+	tracer.writer = MyTraceWriter();
+	std::cout << "Capturing " << frames << " frame(s) into " << filename << std::endl;
+}
+
+// opens a captured frame, writing the setup before the first one
+inline void BeginTraceFrame()
+{
+	if (tracer.framesLeft <= 0) return;
+	if (!tracer.open) {
+		TraceSetup();
+		tracer.open = true;
+	}
+	TraceLateProgramState();
+	TraceInts(&tracer.writer, TRACE_FRAME_BEGIN, 0, 0);
+	for (size_t k = 0; k < tracer.objects.size(); k++)
+		if (tracer.objects[k].type == TRACE_OBJECT_BUFFER && tracer.objects[k].contents == TRACE_CONTENTS_EVERY_FRAME)
+			TraceBufferContents(int32_t(k));
+	InvalidateGLState();
+	tracer.recording = true;
+}
+
+// closes a captured frame, writing the file after the last one
+inline void EndTraceFrame()
+{
+	if (!tracer.recording) return;
+	tracer.recording = false;
+	TraceLateProgramState();
+	TraceInts(&tracer.writer, TRACE_FRAME_END, 0, 0);
+	tracer.writer.frames++;
+	if (--tracer.framesLeft > 0) return;
+	tracer.open = false;
+	if (WriteTraceFile(tracer.filename, &tracer.writer))
+		std::cout << "Wrote " << tracer.writer.frames << " frame(s), " << tracer.writer.bytes.size()
+			<< " bytes, to " << tracer.filename << std::endl;
+	else std::cout << "ERROR: Could not write trace " << tracer.filename << std::endl;
+	tracer.writer = MyTraceWriter();
+}
+
+// --------------------------------------------------------------------------
+// Replay
+//
+// Recreates the objects a trace defines, applies its setup and then runs
+// its frames over and over with nothing else on the GPU. This times the
+// frame's commands apart from the simulation, culling and input that
+// produced them. Replayed commands go straight to the driver, bypassing the
+// state cache, so every recorded call is issued again. Ring offsets were
+// aligned for the recording driver, so a trace should be replayed on the
+// machine that recorded it.
+
+struct MyReplayObject
+{
+	GLuint  name;
+	GLsizeiptr size;		// buffers
+	MyShader shader;		// programs
+	MyTexture texture;		// textures loaded from files
+
+	// initialize object names to zero (OpenGL reserved value)
+	MyReplayObject() : name(0), size(0)
+	{}
+};
+
+// OpenGL name of a handle, 0 for traceNoHandle and unknown handles
+inline GLuint ReplayName(const std::vector<MyReplayObject> &objects, int32_t handle)
+{
+	return handle >= 0 && handle < int32_t(objects.size()) ? objects[handle].name : 0;
+}
+
+// creates the object a definition record describes
+inline void ReplayDefinition(MyTraceRecord *r, std::vector<MyReplayObject> &objects)
+{
+	objects.push_back(MyReplayObject());
+	MyReplayObject &o = objects.back();
+	switch (r->op) {
+	case TRACE_DEFINE_PROGRAM: {
+		std::string vertexFile = TraceGetString(r);
+		std::string fragmentFile = TraceGetString(r);
+		logDepth = TraceGetInt(r) != 0;
+		if (!InitializeShaders(&o.shader, vertexFile.c_str(), fragmentFile.c_str()))
+			std::cout << "ERROR: Replay could not build " << vertexFile << " and " << fragmentFile << std::endl;
+		o.name = o.shader.program;
+		break;
+	}
+	case TRACE_DEFINE_TEXTURE_FILE: {
+		GLenum target = TraceGetInt(r);
+		std::string file = TraceGetString(r);
+		if (!InitializeTexture(&o.texture, file.c_str(), target))
+			std::cout << "ERROR: Replay could not load texture " << file << std::endl;
+		o.name = o.texture.textureID;
+		break;
+	}
+	case TRACE_DEFINE_TEXTURE: {
+		GLenum format = TraceGetInt(r);
+		GLsizei width = TraceGetInt(r), height = TraceGetInt(r);
+		glGenTextures(1, &o.name);
+		glBindTexture(GL_TEXTURE_2D, o.name);
+		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		break;
+	}
+	case TRACE_DEFINE_RENDERBUFFER: {
+		GLsizei samples = TraceGetInt(r);
+		GLenum format = TraceGetInt(r);
+		GLsizei width = TraceGetInt(r), height = TraceGetInt(r);
+		glGenRenderbuffers(1, &o.name);
+		glBindRenderbuffer(GL_RENDERBUFFER, o.name);
+		glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, format, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		break;
+	}
+	case TRACE_DEFINE_FRAMEBUFFER: {
+		GLuint colourTexture = ReplayName(objects, TraceGetInt(r));
+		GLuint colourBuffer = ReplayName(objects, TraceGetInt(r));
+		GLuint depthBuffer = ReplayName(objects, TraceGetInt(r));
+		glGenFramebuffers(1, &o.name);
+		glBindFramebuffer(GL_FRAMEBUFFER, o.name);
+		if (colourTexture) glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colourTexture, 0);
+		if (colourBuffer) glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colourBuffer);
+		if (depthBuffer) glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		break;
+	}
+	case TRACE_DEFINE_BUFFER:
+		o.size = TraceGetInt(r);
+		glGenBuffers(1, &o.name);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, o.name);
+		glBufferData(GL_COPY_WRITE_BUFFER, o.size, 0, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		break;
+	case TRACE_DEFINE_VERTEX_ARRAY: {
+		GLuint elementBuffer = ReplayName(objects, TraceGetInt(r));
+		int count = TraceGetInt(r);
+		glGenVertexArrays(1, &o.name);
+		glBindVertexArray(o.name);
+		if (elementBuffer) glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBuffer);
+		for (int k = 0; k < count; k++) {
+			GLuint index = TraceGetInt(r);
+			GLuint buffer = ReplayName(objects, TraceGetInt(r));
+			GLint components = TraceGetInt(r);
+			glBindBuffer(GL_ARRAY_BUFFER, buffer);
+			glVertexAttribPointer(index, components, GL_FLOAT, GL_FALSE, 0, 0);
+			glEnableVertexAttribArray(index);
+		}
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+// issues the command in a setup or frame record
+inline void ReplayCommand(MyTraceRecord *r, std::vector<MyReplayObject> &objects)
+{
+	switch (r->op) {
+	case TRACE_BLOCK_BINDING: {
+		GLuint program = ReplayName(objects, TraceGetInt(r));
+		std::string name = TraceGetString(r);
+		GLuint binding = TraceGetInt(r);
+		GLuint index = glGetUniformBlockIndex(program, name.c_str());
+		if (index != GL_INVALID_INDEX) glUniformBlockBinding(program, index, binding);
+		break;
+	}
+	case TRACE_UNIFORM_1I: {
+		GLuint program = ReplayName(objects, TraceGetInt(r));
+		std::string name = TraceGetString(r);
+		GLint value = TraceGetInt(r);
+		glUseProgram(program);
+		glUniform1i(glGetUniformLocation(program, name.c_str()), value);
+		break;
+	}
+	case TRACE_UNIFORM_2F: {
+		GLuint program = ReplayName(objects, TraceGetInt(r));
+		std::string name = TraceGetString(r);
+		float x = TraceGetFloat(r), y = TraceGetFloat(r);
+		glUseProgram(program);
+		glUniform2f(glGetUniformLocation(program, name.c_str()), x, y);
+		break;
+	}
+	case TRACE_BUFFER_DATA: {
+		int32_t handle = TraceGetInt(r);
+		GLintptr offset = TraceGetInt(r);
+		int32_t size;
+		const unsigned char *data = TraceGetBlock(r, &size);
+		if (handle < 0 || handle >= int32_t(objects.size())) break;
+		MyReplayObject &o = objects[handle];
+		glBindBuffer(GL_COPY_WRITE_BUFFER, o.name);
+		if (offset + size > o.size || (offset == 0 && size != o.size)) {
+			// point sets grow and shrink with their contents
+			glBufferData(GL_COPY_WRITE_BUFFER, size, data, GL_DYNAMIC_DRAW);
+			o.size = size;
+		}
+		else if (size > 0) glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		break;
+	}
+	case TRACE_USE_PROGRAM:
+		glUseProgram(ReplayName(objects, TraceGetInt(r)));
+		break;
+	case TRACE_BIND_VERTEX_ARRAY:
+		glBindVertexArray(ReplayName(objects, TraceGetInt(r)));
+		break;
+	case TRACE_BIND_TEXTURE: {
+		GLuint unit = TraceGetInt(r);
+		GLenum target = TraceGetInt(r);
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(target, ReplayName(objects, TraceGetInt(r)));
+		break;
+	}
+	case TRACE_BIND_FRAMEBUFFER: {
+		GLenum target = TraceGetInt(r);
+		glBindFramebuffer(target, ReplayName(objects, TraceGetInt(r)));
+		break;
+	}
+	case TRACE_BIND_UNIFORM_RANGE: {
+		GLuint binding = TraceGetInt(r);
+		GLuint buffer = ReplayName(objects, TraceGetInt(r));
+		GLintptr offset = TraceGetInt(r);
+		GLsizeiptr size = TraceGetInt(r);
+		if (size > 0) glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, offset, size);
+		else glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+		break;
+	}
+	case TRACE_CAPABILITY: {
+		GLenum capability = TraceGetInt(r);
+		if (TraceGetInt(r)) glEnable(capability);
+		else glDisable(capability);
+		break;
+	}
+	case TRACE_POLYGON_MODE:
+		glPolygonMode(GL_FRONT_AND_BACK, TraceGetInt(r));
+		break;
+	case TRACE_VIEWPORT: {
+		GLint x = TraceGetInt(r), y = TraceGetInt(r);
+		GLsizei width = TraceGetInt(r), height = TraceGetInt(r);
+		glViewport(x, y, width, height);
+		break;
+	}
+	case TRACE_CLEAR: {
+		GLbitfield mask = TraceGetInt(r);
+		float red = TraceGetFloat(r), green = TraceGetFloat(r), blue = TraceGetFloat(r), alpha = TraceGetFloat(r);
+		glClearColor(red, green, blue, alpha);
+		glClear(mask);
+		break;
+	}
+	case TRACE_DRAW_ARRAYS: {
+		GLenum mode = TraceGetInt(r);
+		GLint first = TraceGetInt(r);
+		glDrawArrays(mode, first, TraceGetInt(r));
+		break;
+	}
+	case TRACE_DRAW_ELEMENTS: {
+		GLenum mode = TraceGetInt(r);
+		GLsizei count = TraceGetInt(r);
+		GLenum type = TraceGetInt(r);
+		glDrawElements(mode, count, type, (void *)size_t(TraceGetInt(r)));
+		break;
+	}
+	case TRACE_MULTI_DRAW_ARRAYS: {
+		GLenum mode = TraceGetInt(r);
+		GLsizei ranges = std::max(TraceGetInt(r), 0);
+		std::vector<GLint> first(ranges);
+		std::vector<GLsizei> count(ranges);
+		for (GLsizei k = 0; k < ranges; k++) {
+			first[k] = TraceGetInt(r);
+			count[k] = TraceGetInt(r);
+		}
+		if (ranges > 0) glMultiDrawArrays(mode, first.data(), count.data(), ranges);
+		break;
+	}
+	case TRACE_BLIT: {
+		GLint v[8];
+		for (int k = 0; k < 8; k++) v[k] = TraceGetInt(r);
+		GLbitfield mask = TraceGetInt(r);
+		GLenum filter = TraceGetInt(r);
+		glBlitFramebuffer(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], mask, filter);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+// replays a trace for a number of iterations of all its frames and prints
+// the time per frame, returning the process exit code
+inline int ReplayTrace(const char *filename, int iterations)
+{
+	std::vector<unsigned char> bytes;
+	if (!ReadTraceFile(filename, &bytes)) {
+		std::cout << "ERROR: Could not read trace " << filename << std::endl;
+		return -1;
+	}
+
+	// definitions and setup, up to the first frame
+	std::vector<MyReplayObject> objects;
+	MyTraceRecord record;
+	size_t offset = 0, framesStart = 0;
+	while (NextTraceRecord(bytes, &offset, &record) && record.op != TRACE_FRAME_BEGIN) {
+		if (record.op <= TRACE_DEFINE_VERTEX_ARRAY) ReplayDefinition(&record, objects);
+		else ReplayCommand(&record, objects);
+		framesStart = offset;
+	}
+	// objects defined during the capture are created up front, in order, and
+	// their definitions are skipped when the frames run
+	int frames = 0;
+	long long commands = 0;
+	for (size_t at = framesStart; NextTraceRecord(bytes, &at, &record);) {
+		if (record.op <= TRACE_DEFINE_VERTEX_ARRAY) ReplayDefinition(&record, objects);
+		else if (record.op == TRACE_FRAME_END) frames++;
+		else if (record.op != TRACE_FRAME_BEGIN && record.op != TRACE_BUFFER_DATA) commands++;
+	}
+	if (frames == 0) {
+		std::cout << "ERROR: Trace " << filename << " has no frames" << std::endl;
+		return -1;
+	}
+	std::cout << "Replaying " << frames << " frame(s) of " << filename << ": " << objects.size()
+		<< " objects, " << commands / frames << " commands per frame, " << iterations << " iterations" << std::endl;
+	bool ok = !CheckGLErrors();
+
+	// every iteration submits all the frames and waits for them, timed on
+	// the CPU and with a GPU timer query; times are per trace frame
+	GLuint query;
+	glGenQueries(1, &query);
+	MyBenchmark replay;
+	replay.framesPerVariant = iterations;
+	replay.warmupFrames = std::min(iterations, 10);
+	AddBenchmarkVariant(&replay, "replay", 0);
+	double ms = 0.0;
+	for (bool more = BenchmarkFrame(&replay, 0.0); more; more = BenchmarkFrame(&replay, ms)) {
+		double start = glfwGetTime();
+		glBeginQuery(GL_TIME_ELAPSED, query);
+		for (size_t at = framesStart; NextTraceRecord(bytes, &at, &record);)
+			ReplayCommand(&record, objects);
+		glEndQuery(GL_TIME_ELAPSED);
+		double submitted = glfwGetTime();
+		glFinish();
+		double finished = glfwGetTime();
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+		BenchmarkSection(&replay, "submission (cpu)", (submitted - start) * 1000.0 / frames);
+		BenchmarkSection(&replay, "frame (gpu)", ns / 1.0e6 / frames);
+		ms = (finished - start) * 1000.0 / frames;
+	}
+	ok = !CheckGLErrors() && ok;
+
+	glDeleteQueries(1, &query);
+	for (MyReplayObject &o : objects)
+		if (o.shader.program) DestroyShaders(&o.shader);
+	return ok ? 0 : -1;
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+// --------------------------------------------------------------------------
+// Lock-free triple buffer for handing states from one producer thread to one
+// consumer thread
+//
+// The producer always owns one slot to write into and the consumer one slot
+// to read from; the third slot is shared. Publishing swaps the written slot
+// with the shared one and marks it fresh, and reading swaps the shared slot
+// in only if it is fresh. Neither side ever waits for the other: the
+// producer may publish several times between reads (older states are
+// dropped) and the consumer keeps reading its slot until a new one arrives.
+
+const int tripleFresh = 4;	// flag on the shared index, set by a publish
+
+template <typename T>
+struct MyTripleBuffer
+{
+	T slots[3];
+	std::atomic<int> shared;	// slot index, plus tripleFresh if unread
+	int write;					// producer's slot
+	int read;					// consumer's slot
+
+	MyTripleBuffer() : shared(1), write(0), read(2)
+	{}
+};
+
+// slot the producer fills before publishing; it may hold an old state
+template <typename T>
+inline T *WriteSlot(MyTripleBuffer<T> *buffer)
+{
+	return &buffer->slots[buffer->write];
+}
+
+// hands the written slot to the consumer
+template <typename T>
+inline void PublishSlot(MyTripleBuffer<T> *buffer)
+{
+	buffer->write = buffer->shared.exchange(buffer->write | tripleFresh, std::memory_order_acq_rel) & 3;
+}
+
+// latest published slot, setting fresh if it was not read before; only valid
+// after the first publish
+template <typename T>
+inline const T *ReadSlot(MyTripleBuffer<T> *buffer, bool *fresh = 0)
+{
+	bool available = (buffer->shared.load(std::memory_order_relaxed) & tripleFresh) != 0;
+	if (available)
+		buffer->read = buffer->shared.exchange(buffer->read, std::memory_order_acq_rel) & 3;
+	if (fresh) *fresh = available;
+	return &buffer->slots[buffer->read];
+}
+
+#endif
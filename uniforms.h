@@ -0,0 +1,77 @@
+#ifndef UNIFORMS_H
+#define UNIFORMS_H
+
+#include <cstddef>
+#include <glm/glm.hpp>
+
+// --------------------------------------------------------------------------
+// Uniform block layouts shared with the shaders
+//
+// Each struct mirrors a std140 uniform block declared in the shaders. In
+// std140 a vec3 is aligned to 16 bytes and a following float fills its last
+// four, so vec3 members are paired with a float; blocks are padded to a
+// multiple of 16 bytes. A change on either side must be made on both.
+
+// per frame, in vertex.glsl, fragment.glsl, point_vertex.glsl and
+// point_fragment.glsl
+struct MyFrameUniforms
+{
+	glm::mat4 view;
+	glm::mat4 proj;
+	glm::vec3 camPoint;		// camera relative, always the origin
+	float animation;
+	glm::vec3 light;		// camera relative
+	float logDepth;			// 2 / log2(zFar + 1), read by programs built with LOG_DEPTH
+};
+
+// per draw, one block for every body and point set
+struct MyDrawUniforms
+{
+	glm::mat4 model;
+	glm::vec3 pointColour;	// point sets only
+	float pointSize;		// point sets only
+};
+
+// lighting constants, written once at startup, in fragment.glsl
+struct MyLightingUniforms
+{
+	glm::vec3 specColour;
+	float ambient;
+	float diffRatio;
+	float intensity;
+	float glowInt;
+	float phong;
+	float waterPhong;
+	float cloudInt;
+	float pad[2];
+};
+
+// per frame in panorama mode, in cube_geometry.glsl and
+// cube_point_geometry.glsl: the view and projection of each cubemap face
+struct MyCubeUniforms
+{
+	glm::mat4 faceViewProj[6];
+};
+
+static_assert(sizeof(MyFrameUniforms) == 160, "MyFrameUniforms must match the std140 Frame block");
+static_assert(sizeof(MyDrawUniforms) == 80, "MyDrawUniforms must match the std140 Draw block");
+static_assert(sizeof(MyLightingUniforms) == 48, "MyLightingUniforms must match the std140 Lighting block");
+static_assert(sizeof(MyCubeUniforms) == 384, "MyCubeUniforms must match the std140 Cube block");
+
+// draw block for a body (no colour or size) or a point set
+inline MyDrawUniforms DrawUniforms(const glm::mat4 &model, const float *pointColour = 0, float pointSize = 0.0f)
+{
+	MyDrawUniforms block;
+	block.model = model;
+	block.pointColour = pointColour ? glm::vec3(pointColour[0], pointColour[1], pointColour[2]) : glm::vec3(0.0f);
+	block.pointSize = pointSize;
+	return block;
+}
+
+// rounds an offset up to a multiple of a (power of two or not) alignment
+inline size_t AlignUp(size_t offset, size_t alignment)
+{
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+#endif
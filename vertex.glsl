@@ -12,31 +12,42 @@ out vec3 Colour;
 out vec3 texCoords;
 out vec3 normal;
 out vec3 point;
+out float logDepthW;
 
-// uniforms
-uniform mat4 starsModel;
-uniform mat4 sunModel;
-uniform mat4 earthModel;
-uniform mat4 moonModel;
-uniform mat4 view;
-uniform mat4 proj;
+// per-frame uniforms, laid out as MyFrameUniforms in uniforms.h
+layout(std140) uniform Frame
+{
+	mat4 view;
+	mat4 proj;
+	vec3 camPoint;
+	float animation;
+	vec3 light;
+	float logDepth;	// 2 / log2(zFar + 1), used when compiled with LOG_DEPTH
+};
+
+// per-draw uniforms, laid out as MyDrawUniforms in uniforms.h
+layout(std140) uniform Draw
+{
+	mat4 model;
+	vec3 pointColour;
+	float pointSize;
+};
 
 void main()
 {
-	mat4 mod = mat4(1.0);
-
-	// set appropriate model matrix
-	if (VertexTexture.z == 0) mod = earthModel;
-	else if (VertexTexture.z == 1) mod = starsModel;
-	else if (VertexTexture.z == 2) mod = moonModel;
-	else if (VertexTexture.z == 3) mod = sunModel;
-
-	// determine new position
-	vec4 newPos = mod * vec4(VertexPosition, 1.0);
+	// determine new position, each body is drawn with its own model matrix
+	vec4 newPos = model * vec4(VertexPosition, 1.0);
     gl_Position = proj * view * newPos;
 
+	// logarithmic depth, rewritten per fragment to avoid interpolation errors
+	// on large triangles close to the camera
+	logDepthW = 1.0 + gl_Position.w;
+#ifdef LOG_DEPTH
+	gl_Position.z = (log2(max(1e-6, logDepthW)) * logDepth - 1.0) * gl_Position.w;
+#endif
+
 	// determine surface normal
-	vec4 c = mod * vec4(0.0, 0.0, 0.0, 1.0);
+	vec4 c = model * vec4(0.0, 0.0, 0.0, 1.0);
 	normal = normalize(newPos.xyz - c.xyz);
 	point = newPos.xyz;
 